@@ -0,0 +1,766 @@
+/**********************************************************************
+
+   File          : cse543-aead.c
+
+   Description   : This is the session cipher.  The negotiated suite
+                   (AES-256-GCM, AES-128-GCM or ChaCha20-Poly1305) is
+                   keyed once per session; each block only resets the
+                   nonce, which is the session nonce base mixed with
+                   the direction and a block counter, so no random
+                   bytes or allocations are needed per block and the
+                   counter doubles as replay protection.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-ssl.h"
+#include "cse543-proto.h"
+#include "cse543-aead.h"
+
+/* Defines */
+#define AEAD_IV_LABEL "cse543 block nonce"
+#define AEAD_TEST_BATCH 32   /* blocks per batch call in test_aead */
+#define AEAD_RANK_BYTES (1024*1024)  /* sealed and opened per suite to rank by time */
+#define AEAD_RANK_BLOCK (64*1024)    /* in blocks of this size */
+
+/* This is one suite of the registry */
+typedef struct {
+	int               suite;     /* wire number (SUITE_*) */
+	const char       *name;
+	const EVP_CIPHER *(*cipher)( void );  /* keyed with the leading bytes of the session key */
+} AeadCipher;
+
+/* The registry, in suite number order */
+static const AeadCipher aead_ciphers[SUITE_MAX] = {
+	{ SUITE_AES_256_GCM,       "AES-256-GCM",       EVP_aes_256_gcm },
+	{ SUITE_AES_128_GCM,       "AES-128-GCM",       EVP_aes_128_gcm },
+	{ SUITE_CHACHA20_POLY1305, "ChaCha20-Poly1305", EVP_chacha20_poly1305 },
+};
+
+/* Our suites fastest first, ranked once per process */
+static pthread_once_t aead_ranked = PTHREAD_ONCE_INIT;
+static unsigned char aead_ranking[SUITE_MAX];
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : aead_nonce
+    Description : make the nonce for one block: the session nonce base
+                  with the direction in the first four bytes and the
+                  sequence number in the last eight
+    Inputs      : a - the session cipher
+                  role - the direction the block goes
+                  seq - its sequence number
+                  nonce - (out) the nonce
+    Outputs     : none
+
+***********************************************************************/
+
+static void aead_nonce( AeadSession *a, AeadRole role, uint64_t seq, 
+			unsigned char *nonce )
+{
+	int i;
+
+	memcpy( nonce, a->iv, AEAD_NONCESIZE );
+	nonce[3] ^= (unsigned char)role;
+	for ( i=0; i<8; i++ )
+		nonce[AEAD_NONCESIZE-1-i] ^= (unsigned char)(seq >> (8*i));
+}
+
+/**********************************************************************
+
+    Function    : aead_cipher
+    Description : find a suite in the registry
+    Inputs      : suite - the suite number
+    Outputs     : the suite, NULL if it is not one we know
+
+***********************************************************************/
+
+static const AeadCipher *aead_cipher( int suite )
+{
+	return( ((suite < 1) || (suite > SUITE_MAX)) ? NULL : &aead_ciphers[suite-1] );
+}
+
+/**********************************************************************
+
+    Function    : aead_context
+    Description : make a cipher context keyed for one direction
+    Inputs      : key - the session key
+                  c - the suite
+                  encrypt - 1 to seal, 0 to open
+    Outputs     : the context, NULL if failure
+
+***********************************************************************/
+
+static EVP_CIPHER_CTX *aead_context( unsigned char *key, const AeadCipher *c, int encrypt )
+{
+	EVP_CIPHER_CTX *ctx;
+
+	if ( (ctx = EVP_CIPHER_CTX_new()) == NULL )
+		return( NULL );
+	if ( EVP_CipherInit_ex(ctx, c->cipher(), NULL, NULL, NULL, encrypt) != 1 ||
+	     EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, AEAD_NONCESIZE, NULL) != 1 ||
+	     EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, encrypt) != 1 )
+	{
+		EVP_CIPHER_CTX_free( ctx );
+		return( NULL );
+	}
+	return( ctx );
+}
+
+/**********************************************************************
+
+    Function    : aead_hardware
+    Description : check the CPU for the instructions AES-GCM is fast
+                  with: AES rounds and carry-less multiply (AES-NI and
+                  PCLMULQDQ, or the ARMv8 AES and PMULL extensions)
+    Inputs      : none
+    Outputs     : 1 if it has them, 0 if not, -1 if we cannot tell
+
+***********************************************************************/
+
+static int aead_hardware( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	return( __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") );
+#elif defined(__aarch64__) && defined(__linux__)
+	unsigned long caps = getauxval( AT_HWCAP );
+
+	return( ((caps & HWCAP_AES) != 0) && ((caps & HWCAP_PMULL) != 0) );
+#else
+	return( -1 );
+#endif
+}
+
+/**********************************************************************
+
+    Function    : aead_time
+    Description : time sealing and opening through the session cipher
+                  with one suite
+    Inputs      : suite - the suite
+                  bytes - how much to seal and open
+                  size - in blocks of this size
+    Outputs     : seconds, a negative number if failure
+
+***********************************************************************/
+
+static double aead_time( int suite, unsigned long bytes, unsigned int size )
+{
+	unsigned char key[KEYSIZE], *data, *sealed;
+	AeadSession client, server;
+	struct timespec start, end;
+	unsigned int outlen, plainlen;
+	unsigned long off;
+	int ret = 0;
+
+	data = (unsigned char *)malloc( size );
+	sealed = (unsigned char *)malloc( size+AEAD_OVERHEAD );
+	if ( (data == NULL) || (sealed == NULL) ||
+	     (generate_pseudorandom_bytes(key, KEYSIZE) != 0) ||
+	     (generate_pseudorandom_bytes(data, size) != 0) ||
+	     (aead_init(&client, key, suite, AEAD_CLIENT) != 0) )
+	{
+		free( data );
+		free( sealed );
+		return( -1 );
+	}
+	if ( aead_init(&server, key, suite, AEAD_SERVER) != 0 )
+		ret = -1;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	for ( off=0; (off<bytes) && (ret == 0); off+=size )
+		if ( (aead_seal(&client, data, size, sealed, &outlen) != 0) ||
+		     (aead_open(&server, sealed, outlen, sealed+AEAD_OVERHEAD, &plainlen) != 0) )
+			ret = -1;
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	aead_free( &client );
+	if ( server.open != NULL )
+		aead_free( &server );
+	free( data );
+	free( sealed );
+	OPENSSL_cleanse( key, KEYSIZE );
+	return( (ret == 0) ? (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9 : -1 );
+}
+
+/**********************************************************************
+
+    Function    : aead_rank_suites
+    Description : rank our suites, once: by the CPU's instructions
+                  where we can read them, by timing each where not
+    Inputs      : none
+    Outputs     : none
+
+***********************************************************************/
+
+static void aead_rank_suites( void )
+{
+	static const unsigned char aes[SUITE_MAX] = 
+		{ SUITE_AES_128_GCM, SUITE_AES_256_GCM, SUITE_CHACHA20_POLY1305 };
+	static const unsigned char noaes[SUITE_MAX] = 
+		{ SUITE_CHACHA20_POLY1305, SUITE_AES_128_GCM, SUITE_AES_256_GCM };
+	double secs[SUITE_MAX], t;
+	int hw, i, j, k;
+
+	if ( (hw = aead_hardware()) >= 0 )
+	{
+		memcpy( aead_ranking, hw ? aes : noaes, SUITE_MAX );
+		return;
+	}
+
+	/* Insert each suite behind the faster ones, by the better of two
+	   runs since the first pays for loading the cipher; a suite that
+	   fails to run goes last */
+	for ( i=0; i<SUITE_MAX; i++ )
+	{
+		secs[i] = 1e9;
+		for ( k=0; k<2; k++ )
+			if ( ((t = aead_time(aead_ciphers[i].suite, AEAD_RANK_BYTES, AEAD_RANK_BLOCK)) >= 0) &&
+			     (t < secs[i]) )
+				secs[i] = t;
+		for ( j=0; (j<i) && (secs[aead_ranking[j]-1] <= secs[i]); j++ );
+		for ( k=i; k>j; k-- )
+			aead_ranking[k] = aead_ranking[k-1];
+		aead_ranking[j] = aead_ciphers[i].suite;
+	}
+}
+
+/**********************************************************************
+
+    Function    : aead_rank
+    Description : get our cipher suites, fastest first: the AES-GCM
+                  suites ahead of ChaCha20-Poly1305 where the CPU has
+                  AES and carry-less multiply instructions, behind it
+                  where it does not, timed where we cannot tell
+    Inputs      : suites - (out) SUITE_MAX suite numbers
+    Outputs     : the number of suites
+
+***********************************************************************/
+
+int aead_rank( unsigned char *suites )
+{
+	pthread_once( &aead_ranked, aead_rank_suites );
+	memcpy( suites, aead_ranking, SUITE_MAX );
+	return( SUITE_MAX );
+}
+
+/**********************************************************************
+
+    Function    : aead_choose
+    Description : pick the suite for a session from those a client
+                  offers: our fastest that it offers, unless its own
+                  first choice is ChaCha20-Poly1305, which it puts
+                  first only when it has no AES instructions
+    Inputs      : offered - the client's suites, fastest first
+                  n - how many, 0 for a client that names none
+    Outputs     : the suite, 0 if we have none in common
+
+***********************************************************************/
+
+int aead_choose( const unsigned char *offered, unsigned int n )
+{
+	unsigned char ours[SUITE_MAX];
+	unsigned int i, j;
+
+	/* Without AES instructions AES-GCM costs the client several times
+	   what ChaCha20 costs us */
+	if ( n == 0 )
+		return( SUITE_DEFAULT );
+	if ( offered[0] == SUITE_CHACHA20_POLY1305 )
+		return( SUITE_CHACHA20_POLY1305 );
+	for ( i=0, aead_rank(ours); i<SUITE_MAX; i++ )
+		for ( j=0; j<n; j++ )
+			if ( offered[j] == ours[i] )
+				return( ours[i] );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : aead_suite_name
+    Description : get the name of a cipher suite
+    Inputs      : suite - the suite number
+    Outputs     : the name, NULL if it is not one we know
+
+***********************************************************************/
+
+const char *aead_suite_name( int suite )
+{
+	const AeadCipher *c = aead_cipher( suite );
+
+	return( (c != NULL) ? c->name : NULL );
+}
+
+/**********************************************************************
+
+    Function    : aead_init
+    Description : key the session cipher once the handshake is done
+    Inputs      : a - the session cipher
+                  key - the session key (KEYSIZE bytes)
+                  suite - the cipher suite (SUITE_*)
+                  role - which end we are
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int aead_init( AeadSession *a, unsigned char *key, int suite, AeadRole role )
+{
+	unsigned char mac[EVP_MAX_MD_SIZE], *val = mac;
+	const AeadCipher *c = aead_cipher( suite );
+	size_t vlen = 0;
+
+	/* Both ends derive the same nonce base from the key */
+	memset( a, 0, sizeof(AeadSession) );
+	if ( c == NULL )
+	{
+		errorMessage( "unknown session cipher suite\n" );
+		return( -1 );
+	}
+	a->role = role;
+	a->suite = suite;
+	if ( hmac_message((unsigned char *)AEAD_IV_LABEL, strlen(AEAD_IV_LABEL), 
+			  &val, &vlen, key, KEYSIZE) != 0 || (vlen < AEAD_NONCESIZE) )
+		return( -1 );
+	memcpy( a->iv, mac, AEAD_NONCESIZE );
+	OPENSSL_cleanse( mac, sizeof(mac) );
+
+	/* The key schedule is done here, once */
+	if ( ((a->seal = aead_context(key, c, 1)) == NULL) ||
+	     ((a->open = aead_context(key, c, 0)) == NULL) )
+	{
+		errorMessage( "unable to key the session cipher\n" );
+		aead_free( a );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : aead_free
+    Description : release the cipher contexts and forget the key
+    Inputs      : a - the session cipher
+    Outputs     : none
+
+***********************************************************************/
+
+void aead_free( AeadSession *a )
+{
+	EVP_CIPHER_CTX_free( a->seal );
+	EVP_CIPHER_CTX_free( a->open );
+	OPENSSL_cleanse( a, sizeof(AeadSession) );
+}
+
+/**********************************************************************
+
+    Function    : aead_clone
+    Description : copy a keyed session cipher without redoing the key
+                  schedule, so several threads can each have their own
+    Inputs      : to - the new session cipher
+                  from - the keyed one, only read
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int aead_clone( AeadSession *to, AeadSession *from )
+{
+	*to = *from;
+	to->seal = EVP_CIPHER_CTX_new();
+	to->open = EVP_CIPHER_CTX_new();
+	if ( (to->seal == NULL) || (to->open == NULL) ||
+	     (EVP_CIPHER_CTX_copy(to->seal, from->seal) != 1) ||
+	     (EVP_CIPHER_CTX_copy(to->open, from->open) != 1) )
+	{
+		errorMessage( "unable to copy the session cipher\n" );
+		aead_free( to );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : aead_seal
+    Description : encrypt one block under the next sequence number
+    Inputs      : a - the session cipher
+                  in - the plaintext
+                  inlen - its length
+                  out - the sealed block (inlen+AEAD_OVERHEAD bytes); in
+                   may be out+AEAD_OVERHEAD to seal in place
+                  outlen - (out) length of the sealed block
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int aead_seal( AeadSession *a, unsigned char *in, unsigned int inlen, 
+	       unsigned char *out, unsigned int *outlen )
+{
+	if ( aead_seal_at(a, a->sent, in, inlen, out, outlen) != 0 )
+		return( -1 );
+	a->sent++;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : aead_seal_at
+    Description : encrypt one block under a given sequence number, for
+                  blocks sealed out of order by several threads (each
+                  with its own AeadSession); every number must be
+                  used once
+    Inputs      : a - the session cipher
+                  seq - the block's sequence number
+                  in - the plaintext
+                  inlen - its length
+                  out - the sealed block (inlen+AEAD_OVERHEAD bytes); in
+                   may be out+AEAD_OVERHEAD to seal in place
+                  outlen - (out) length of the sealed block
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int aead_seal_at( AeadSession *a, uint64_t seq, unsigned char *in, unsigned int inlen, 
+		  unsigned char *out, unsigned int *outlen )
+{
+	unsigned char nonce[AEAD_NONCESIZE];
+	int len = 0, fin = 0, i;
+
+	/* Sequence number, tag, then the ciphertext */
+	aead_nonce( a, a->role, seq, nonce );
+	if ( (EVP_EncryptInit_ex(a->seal, NULL, NULL, NULL, nonce) != 1) ||
+	     (EVP_EncryptUpdate(a->seal, out+AEAD_OVERHEAD, &len, in, inlen) != 1) ||
+	     (EVP_EncryptFinal_ex(a->seal, out+AEAD_OVERHEAD+len, &fin) != 1) ||
+	     (EVP_CIPHER_CTX_ctrl(a->seal, EVP_CTRL_AEAD_GET_TAG, TAGSIZE, 
+				  out+AEAD_SEQSIZE) != 1) )
+		return( -1 );
+	for ( i=0; i<AEAD_SEQSIZE; i++ )
+		out[i] = (unsigned char)(seq >> (8*(AEAD_SEQSIZE-1-i)));
+	*outlen = AEAD_OVERHEAD + len + fin;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : aead_open
+    Description : authenticate and decrypt the next block in sequence
+    Inputs      : a - the session cipher
+                  in - the sealed block
+                  inlen - its length
+                  out - the plaintext (inlen-AEAD_OVERHEAD bytes); may be
+                   in+AEAD_OVERHEAD to open in place
+                  outlen - (out) length of the plaintext
+    Outputs     : 0 if successful, -1 if the block is forged, replayed
+                  or out of order
+
+***********************************************************************/
+
+int aead_open( AeadSession *a, unsigned char *in, unsigned int inlen, 
+	       unsigned char *out, unsigned int *outlen )
+{
+	if ( aead_open_at(a, a->received, in, inlen, out, outlen) != 0 )
+		return( -1 );
+	a->received++;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : aead_open_at
+    Description : authenticate and decrypt the block that must have a
+                  given sequence number, for blocks numbered as they
+                  arrive and opened out of order by several threads
+                  (each with its own AeadSession)
+    Inputs      : a - the session cipher
+                  seq - the sequence number the block must carry
+                  in - the sealed block
+                  inlen - its length
+                  out - the plaintext (inlen-AEAD_OVERHEAD bytes); may be
+                   in+AEAD_OVERHEAD to open in place
+                  outlen - (out) length of the plaintext
+    Outputs     : 0 if successful, -1 if the block is forged, replayed
+                  or out of order
+
+***********************************************************************/
+
+int aead_open_at( AeadSession *a, uint64_t seq, unsigned char *in, unsigned int inlen, 
+		  unsigned char *out, unsigned int *outlen )
+{
+	unsigned char nonce[AEAD_NONCESIZE];
+	uint64_t got = 0;
+	int len = 0, fin = 0, i;
+
+	/* Only the block numbered where it arrived will do */
+	if ( inlen < AEAD_OVERHEAD )
+		return( -1 );
+	for ( i=0; i<AEAD_SEQSIZE; i++ )
+		got = (got << 8) | in[i];
+	if ( got != seq )
+		return( -1 );
+
+	/* The peer's direction, so our own blocks cannot be reflected */
+	aead_nonce( a, (a->role == AEAD_CLIENT) ? AEAD_SERVER : AEAD_CLIENT, seq, nonce );
+	if ( (EVP_DecryptInit_ex(a->open, NULL, NULL, NULL, nonce) != 1) ||
+	     (EVP_DecryptUpdate(a->open, out, &len, in+AEAD_OVERHEAD, 
+				inlen-AEAD_OVERHEAD) != 1) ||
+	     (EVP_CIPHER_CTX_ctrl(a->open, EVP_CTRL_AEAD_SET_TAG, TAGSIZE, 
+				  in+AEAD_SEQSIZE) != 1) ||
+	     (EVP_DecryptFinal_ex(a->open, out+len, &fin) != 1) )
+		return( -1 );
+	*outlen = len + fin;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : aead_seal_batch
+    Description : seal an array of blocks in order
+    Inputs      : a - the session cipher
+                  blocks - the blocks
+                  n - number of blocks
+    Outputs     : number of blocks sealed (less than n on failure)
+
+***********************************************************************/
+
+int aead_seal_batch( AeadSession *a, AeadBlock *blocks, int n )
+{
+	int i;
+
+	for ( i=0; i<n; i++ )
+		if ( aead_seal(a, blocks[i].in, blocks[i].inlen, 
+			       blocks[i].out, &blocks[i].outlen) != 0 )
+			break;
+	return( i );
+}
+
+/**********************************************************************
+
+    Function    : aead_open_batch
+    Description : open an array of blocks in order
+    Inputs      : a - the session cipher
+                  blocks - the blocks
+                  n - number of blocks
+    Outputs     : number of blocks opened (less than n on failure)
+
+***********************************************************************/
+
+int aead_open_batch( AeadSession *a, AeadBlock *blocks, int n )
+{
+	int i;
+
+	for ( i=0; i<n; i++ )
+		if ( aead_open(a, blocks[i].in, blocks[i].inlen, 
+			       blocks[i].out, &blocks[i].outlen) != 0 )
+			break;
+	return( i );
+}
+
+/**********************************************************************
+
+    Function    : test_elapsed
+    Description : get the seconds since a start time
+    Inputs      : start - the start time
+    Outputs     : seconds
+
+***********************************************************************/
+
+static double test_elapsed( struct timespec *start )
+{
+	struct timespec end;
+
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	return( (end.tv_sec-start->tv_sec) + (end.tv_nsec-start->tv_nsec)/1e9 );
+}
+
+/**********************************************************************
+
+    Function    : test_aead
+    Description : compare the per-block cost of the one-shot message
+                  cipher, the session cipher and bulk AES-GCM
+    Inputs      : count - MiB per block size, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_aead( int count )
+{
+	static const unsigned int sizes[] = { BLOCKSIZE, 1024, 4*1024, 64*1024 };
+	unsigned long total = (unsigned long)((count > 0) ? count : AEAD_TEST_COUNT) * 1024 * 1024;
+	unsigned char key[KEYSIZE], nonce[AEAD_NONCESIZE] = { 0 }, *data, *sealed, *plain;
+	AeadBlock blocks[AEAD_TEST_BATCH];
+	AeadSession client, server;
+	EVP_CIPHER_CTX *bulk = NULL, *unbulk = NULL;
+	unsigned int i, size, outlen, plainlen, stride;
+	unsigned long off, nblocks;
+	struct timespec start;
+	double legacy, session, raw;
+	int j, n, len, ret = 0;
+
+	printf( "*** Test session cipher, %lu MiB each. ***\n", total/(1024*1024) );
+	data = (unsigned char *)malloc( total );
+	sealed = (unsigned char *)malloc( total + (total/BLOCKSIZE+1)*(IVSIZE+TAGSIZE) );
+	plain = (unsigned char *)malloc( total );
+	if ( (data == NULL) || (sealed == NULL) || (plain == NULL) ||
+	     (generate_pseudorandom_bytes(key, KEYSIZE) != 0) ||
+	     (generate_pseudorandom_bytes(data, total) != 0) ||
+	     ((bulk = aead_context(key, aead_cipher(SUITE_DEFAULT), 1)) == NULL) ||
+	     ((unbulk = aead_context(key, aead_cipher(SUITE_DEFAULT), 0)) == NULL) )
+	{
+		errorMessage( "session cipher test unable to set up\n" );
+		ret = -1;
+	}
+
+	else
+		memset( sealed, 0, total );
+	for ( i=0; (i<sizeof(sizes)/sizeof(sizes[0])) && (ret == 0); i++ )
+	{
+		size = sizes[i];
+		nblocks = (total+size-1)/size;
+
+		/* One-shot: fresh context, random IV, per block */
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		for ( off=0; (off<total) && (ret == 0); off+=size )
+			if ( (encrypt_message(data+off, size, key, sealed, &outlen) != 0) ||
+			     (decrypt_message(sealed, outlen, key, plain+off, &plainlen) != 0) )
+				ret = -1;
+		legacy = test_elapsed( &start );
+
+		/* Session: keyed once, sealed then opened in batches */
+		stride = size + AEAD_OVERHEAD;
+		if ( (ret != 0) || (aead_init(&client, key, SUITE_DEFAULT, AEAD_CLIENT) != 0) )
+			break;
+		if ( aead_init(&server, key, SUITE_DEFAULT, AEAD_SERVER) != 0 )
+		{
+			aead_free( &client );
+			ret = -1;
+			break;
+		}
+		memset( plain, 0, total );
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		for ( off=0; (off<total) && (ret == 0); off+=(unsigned long)n*size )
+		{
+			for ( n=0; (n<AEAD_TEST_BATCH) && (off+(unsigned long)n*size<total); n++ )
+			{
+				blocks[n].in = data + off + (unsigned long)n*size;
+				blocks[n].inlen = size;
+				blocks[n].out = sealed + (unsigned long)n*stride;
+			}
+			if ( aead_seal_batch(&client, blocks, n) != n )
+				ret = -1;
+			for ( j=0; j<n; j++ )
+			{
+				blocks[j].in = blocks[j].out;
+				blocks[j].inlen = blocks[j].outlen;
+				blocks[j].out = plain + off + (unsigned long)j*size;
+			}
+			if ( (ret == 0) && (aead_open_batch(&server, blocks, n) != n) )
+				ret = -1;
+		}
+		session = test_elapsed( &start );
+		aead_free( &client );
+		aead_free( &server );
+		if ( (ret == 0) && (memcmp(plain, data, total) != 0) )
+			ret = -1;
+
+		/* Bulk: the same bytes through one nonce, the floor */
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		if ( (EVP_EncryptInit_ex(bulk, NULL, NULL, NULL, nonce) != 1) ||
+		     (EVP_EncryptUpdate(bulk, sealed, &len, data, total) != 1) ||
+		     (EVP_DecryptInit_ex(unbulk, NULL, NULL, NULL, nonce) != 1) ||
+		     (EVP_DecryptUpdate(unbulk, plain, &len, sealed, total) != 1) )
+			ret = -1;
+		raw = test_elapsed( &start );
+
+		printf( "Block %6u bytes: one-shot %7.1f MiB/s (+%5.0f ns/block), "
+			"session %7.1f MiB/s (+%5.0f ns/block), bulk %7.1f MiB/s\n", 
+			size, total/legacy/(1024*1024), (legacy-raw)*1e9/nblocks, 
+			total/session/(1024*1024), (session-raw)*1e9/nblocks, 
+			total/raw/(1024*1024) );
+	}
+	if ( ret != 0 )
+		errorMessage( "session cipher test failed\n" );
+
+	EVP_CIPHER_CTX_free( bulk );
+	EVP_CIPHER_CTX_free( unbulk );
+	free( data );
+	free( sealed );
+	free( plain );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_suites
+    Description : time the session cipher with each suite, and check
+                  the ranking against the times
+    Inputs      : count - MiB per suite, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_suites( int count )
+{
+	unsigned long total = (unsigned long)((count > 0) ? count : AEAD_TEST_COUNT) * 1024 * 1024;
+	unsigned char ranking[SUITE_MAX];
+	double secs[SUITE_MAX];
+	int i, fastest = 0, hw = aead_hardware();
+
+	printf( "*** Test cipher suites, %lu MiB each in %u byte blocks. ***\n", 
+		total/(1024*1024), AEAD_RANK_BLOCK );
+	printf( "AES and carry-less multiply instructions: %s\n", 
+		(hw > 0) ? "yes" : (hw == 0) ? "no" : "unknown, ranked by time" );
+	aead_rank( ranking );
+	for ( i=0; i<SUITE_MAX; i++ )
+	{
+		if ( (secs[i] = aead_time(ranking[i], total, AEAD_RANK_BLOCK)) <= 0 )
+		{
+			errorMessage( "cipher suite test failed\n" );
+			return( -1 );
+		}
+		if ( secs[i] < secs[fastest] )
+			fastest = i;
+		printf( "%d. %-18s %8.1f MiB/s sealed and opened\n", i+1, 
+			aead_suite_name(ranking[i]), total/secs[i]/(1024*1024) );
+	}
+
+	/* A suite within a tenth of the fastest is as good */
+	printf( "Ranked first: %s, fastest measured: %s%s\n", aead_suite_name(ranking[0]), 
+		aead_suite_name(ranking[fastest]), 
+		(secs[0] <= 1.1*secs[fastest]) ? "" : " (ranking disagrees)" );
+	return( 0 );
+}
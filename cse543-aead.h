@@ -0,0 +1,267 @@
+#ifndef CSE543_AEAD_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-aead.h
+
+   Description   : This is the session cipher: the negotiated suite
+                   keyed once after the handshake, with counter nonces
+                   and reusable contexts, for the file blocks.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdint.h>
+#include <openssl/evp.h>
+
+/* Defines */
+#define AEAD_NONCESIZE 12    /* 96-bit GCM and ChaCha20-Poly1305 nonce */
+#define AEAD_SEQSIZE 8       /* block sequence number sent with each block */
+#define AEAD_OVERHEAD (AEAD_SEQSIZE+TAGSIZE)  /* sequence and tag per block */
+#define AEAD_TEST_COUNT 64   /* MiB sealed and opened per size by test_aead */
+
+/* Data Structures */
+
+/* Which way the blocks go; each direction has its own nonces */
+typedef enum {
+	AEAD_CLIENT,         /* client to server */
+	AEAD_SERVER,         /* server to client */
+} AeadRole;
+
+/* This is the cipher state for one session */
+typedef struct {
+	AeadRole          role;      /* our end */
+	int               suite;     /* the cipher suite (SUITE_*) */
+	EVP_CIPHER_CTX   *seal;      /* keyed context for what we send */
+	EVP_CIPHER_CTX   *open;      /* keyed context for what we receive */
+	unsigned char     iv[AEAD_NONCESIZE];  /* per-session nonce base */
+	uint64_t          sent;      /* sequence number of the next sealed block */
+	uint64_t          received;  /* sequence number of the next opened block */
+} AeadSession;
+
+/* This is one block of a batch; out has room for inlen+AEAD_OVERHEAD */
+typedef struct {
+	unsigned char    *in;        /* plaintext to seal, or block to open */
+	unsigned int      inlen;
+	unsigned char    *out;       /* sealed block, or plaintext */
+	unsigned int      outlen;    /* (out) bytes placed in out */
+} AeadBlock;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : aead_rank
+    Description : get our cipher suites, fastest first: the AES-GCM
+                  suites ahead of ChaCha20-Poly1305 where the CPU has
+                  AES and carry-less multiply instructions, behind it
+                  where it does not, timed where we cannot tell
+    Inputs      : suites - (out) SUITE_MAX suite numbers
+    Outputs     : the number of suites
+
+***********************************************************************/
+extern int aead_rank( unsigned char *suites );
+
+/**********************************************************************
+
+    Function    : aead_choose
+    Description : pick the suite for a session from those a client
+                  offers: our fastest that it offers, unless its own
+                  first choice is ChaCha20-Poly1305, which it puts
+                  first only when it has no AES instructions
+    Inputs      : offered - the client's suites, fastest first
+                  n - how many, 0 for a client that names none
+    Outputs     : the suite, 0 if we have none in common
+
+***********************************************************************/
+extern int aead_choose( const unsigned char *offered, unsigned int n );
+
+/**********************************************************************
+
+    Function    : aead_suite_name
+    Description : get the name of a cipher suite
+    Inputs      : suite - the suite number
+    Outputs     : the name, NULL if it is not one we know
+
+***********************************************************************/
+extern const char *aead_suite_name( int suite );
+
+/**********************************************************************
+
+    Function    : aead_init
+    Description : key the session cipher once the handshake is done
+    Inputs      : a - the session cipher
+                  key - the session key (KEYSIZE bytes)
+                  suite - the cipher suite (SUITE_*)
+                  role - which end we are
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int aead_init( AeadSession *a, unsigned char *key, int suite, AeadRole role );
+
+/**********************************************************************
+
+    Function    : aead_free
+    Description : release the cipher contexts and forget the key
+    Inputs      : a - the session cipher
+    Outputs     : none
+
+***********************************************************************/
+extern void aead_free( AeadSession *a );
+
+/**********************************************************************
+
+    Function    : aead_clone
+    Description : copy a keyed session cipher without redoing the key
+                  schedule, so several threads can each have their own
+    Inputs      : to - the new session cipher
+                  from - the keyed one, only read
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int aead_clone( AeadSession *to, AeadSession *from );
+
+/**********************************************************************
+
+    Function    : aead_seal
+    Description : encrypt one block under the next sequence number
+    Inputs      : a - the session cipher
+                  in - the plaintext
+                  inlen - its length
+                  out - the sealed block (inlen+AEAD_OVERHEAD bytes); in
+                   may be out+AEAD_OVERHEAD to seal in place
+                  outlen - (out) length of the sealed block
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int aead_seal( AeadSession *a, unsigned char *in, unsigned int inlen, 
+		      unsigned char *out, unsigned int *outlen );
+
+/**********************************************************************
+
+    Function    : aead_seal_at
+    Description : encrypt one block under a given sequence number, for
+                  blocks sealed out of order by several threads (each
+                  with its own AeadSession); every number must be
+                  used once
+    Inputs      : a - the session cipher
+                  seq - the block's sequence number
+                  in - the plaintext
+                  inlen - its length
+                  out - the sealed block (inlen+AEAD_OVERHEAD bytes); in
+                   may be out+AEAD_OVERHEAD to seal in place
+                  outlen - (out) length of the sealed block
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int aead_seal_at( AeadSession *a, uint64_t seq, unsigned char *in, 
+			 unsigned int inlen, unsigned char *out, unsigned int *outlen );
+
+/**********************************************************************
+
+    Function    : aead_open
+    Description : authenticate and decrypt the next block in sequence
+    Inputs      : a - the session cipher
+                  in - the sealed block
+                  inlen - its length
+                  out - the plaintext (inlen-AEAD_OVERHEAD bytes); may be
+                   in+AEAD_OVERHEAD to open in place
+                  outlen - (out) length of the plaintext
+    Outputs     : 0 if successful, -1 if the block is forged, replayed
+                  or out of order
+
+***********************************************************************/
+extern int aead_open( AeadSession *a, unsigned char *in, unsigned int inlen, 
+		      unsigned char *out, unsigned int *outlen );
+
+/**********************************************************************
+
+    Function    : aead_open_at
+    Description : authenticate and decrypt the block that must have a
+                  given sequence number, for blocks numbered as they
+                  arrive and opened out of order by several threads
+                  (each with its own AeadSession)
+    Inputs      : a - the session cipher
+                  seq - the sequence number the block must carry
+                  in - the sealed block
+                  inlen - its length
+                  out - the plaintext (inlen-AEAD_OVERHEAD bytes); may be
+                   in+AEAD_OVERHEAD to open in place
+                  outlen - (out) length of the plaintext
+    Outputs     : 0 if successful, -1 if the block is forged, replayed
+                  or out of order
+
+***********************************************************************/
+extern int aead_open_at( AeadSession *a, uint64_t seq, unsigned char *in, 
+			 unsigned int inlen, unsigned char *out, unsigned int *outlen );
+
+/**********************************************************************
+
+    Function    : aead_seal_batch
+    Description : seal an array of blocks in order
+    Inputs      : a - the session cipher
+                  blocks - the blocks
+                  n - number of blocks
+    Outputs     : number of blocks sealed (less than n on failure)
+
+***********************************************************************/
+extern int aead_seal_batch( AeadSession *a, AeadBlock *blocks, int n );
+
+/**********************************************************************
+
+    Function    : aead_open_batch
+    Description : open an array of blocks in order
+    Inputs      : a - the session cipher
+                  blocks - the blocks
+                  n - number of blocks
+    Outputs     : number of blocks opened (less than n on failure)
+
+***********************************************************************/
+extern int aead_open_batch( AeadSession *a, AeadBlock *blocks, int n );
+
+/**********************************************************************
+
+    Function    : test_aead
+    Description : compare the per-block cost of the one-shot message
+                  cipher, the session cipher and bulk AES-GCM
+    Inputs      : count - MiB per block size, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_aead( int count );
+
+/**********************************************************************
+
+    Function    : test_suites
+    Description : time the session cipher with each suite, and check
+                  the ranking against the times
+    Inputs      : count - MiB per suite, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_suites( int count );
+
+#define CSE543_AEAD_INCLUDED
+#endif
@@ -0,0 +1,572 @@
+/**********************************************************************
+
+   File          : cse543-core.c
+
+   Description   : This is the sans-I/O protocol core.  It never touches
+                   a socket: the caller pushes in whatever bytes its
+                   transport produced, pulls out complete messages, and
+                   sends the frames the core has queued.  The message
+                   order of the exchange is checked here, in one table,
+                   for both directions.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-proto.h"
+#include "cse543-core.h"
+#include "cse543-slab.h"
+
+/* Data Structures */
+
+/* This is one legal step of the exchange */
+typedef struct {
+	CoreState         state;    /* where the exchange is */
+	ProtoMessageType  msgtype;  /* the message */
+	CoreRole          sender;   /* who may send it */
+	CoreState         next;     /* where the exchange goes */
+} CoreTransition;
+
+/* The exchange, in order */
+static const CoreTransition core_transitions[] = {
+	{ CORE_INIT_EXCHANGE, CLIENT_INIT_EXCHANGE, CORE_CLIENT, CORE_INIT_RESPONSE },
+	{ CORE_INIT_RESPONSE, SERVER_INIT_RESPONSE, CORE_SERVER, CORE_INIT_ACK },
+	{ CORE_INIT_RESPONSE, SERVER_COOKIE,        CORE_SERVER, CORE_DONE },
+	{ CORE_INIT_RESPONSE, SERVER_BUSY,          CORE_SERVER, CORE_DONE },
+	{ CORE_INIT_ACK,      CLIENT_INIT_ACK,      CORE_CLIENT, CORE_SERVER_ACK },
+	{ CORE_SERVER_ACK,    SERVER_INIT_ACK,      CORE_SERVER, CORE_XFER_INIT },
+	{ CORE_XFER_INIT,     FILE_XFER_INIT,       CORE_CLIENT, CORE_XFER },
+	{ CORE_XFER,          FILE_XFER_BLOCK,      CORE_CLIENT, CORE_XFER },
+	{ CORE_XFER,          EXIT,                 CORE_CLIENT, CORE_EXIT },
+	{ CORE_EXIT,          EXIT,                 CORE_SERVER, CORE_DONE },
+
+	/* The one round trip exchange: the key and command go first, the
+	   blocks after them without waiting for the server's ack */
+	{ CORE_INIT_EXCHANGE, CLIENT_FAST_INIT,     CORE_CLIENT, CORE_FAST_XFER },
+	{ CORE_FAST_XFER,     SERVER_COOKIE,        CORE_SERVER, CORE_DONE },
+	{ CORE_FAST_XFER,     SERVER_BUSY,          CORE_SERVER, CORE_DONE },
+	{ CORE_FAST_XFER,     SERVER_INIT_ACK,      CORE_SERVER, CORE_XFER },
+	{ CORE_FAST_XFER,     FILE_XFER_BLOCK,      CORE_CLIENT, CORE_FAST_XFER },
+	{ CORE_FAST_XFER,     EXIT,                 CORE_CLIENT, CORE_FAST_EXIT },
+	{ CORE_FAST_EXIT,     SERVER_INIT_ACK,      CORE_SERVER, CORE_EXIT },
+
+	/* Resumption: a ticket in place of the RSA exchange, the full
+	   exchange if the server will not take it; a new ticket before
+	   the server's EXIT */
+	{ CORE_INIT_EXCHANGE, CLIENT_RESUME,        CORE_CLIENT, CORE_RESUME },
+	{ CORE_RESUME,        SERVER_INIT_ACK,      CORE_SERVER, CORE_XFER_INIT },
+	{ CORE_RESUME,        SERVER_INIT_RESPONSE, CORE_SERVER, CORE_INIT_ACK },
+	{ CORE_RESUME,        SERVER_COOKIE,        CORE_SERVER, CORE_DONE },
+	{ CORE_RESUME,        SERVER_BUSY,          CORE_SERVER, CORE_DONE },
+	{ CORE_EXIT,          SERVER_TICKET,        CORE_SERVER, CORE_EXIT },
+
+	/* X25519: the key is agreed from the two shares, so the server
+	   acks straight after its response */
+	{ CORE_INIT_ACK,      SERVER_INIT_ACK,      CORE_SERVER, CORE_XFER_INIT },
+};
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : core_advance
+    Description : move the exchange past one message, if it is legal
+    Inputs      : c - the core
+                  msgtype - the message type
+                  sender - who sent (or is sending) it
+    Outputs     : 0 if successful, -1 if the message is out of turn
+
+***********************************************************************/
+
+static int core_advance( ProtoCore *c, ProtoMessageType msgtype, CoreRole sender )
+{
+	unsigned int i;
+
+	for ( i=0; i<sizeof(core_transitions)/sizeof(CoreTransition); i++ )
+	{
+		if ( (core_transitions[i].state == c->state) &&
+		     (core_transitions[i].msgtype == msgtype) &&
+		     (core_transitions[i].sender == sender) )
+		{
+			c->state = core_transitions[i].next;
+			return( 0 );
+		}
+	}
+
+	/* Complain, explain, and return */
+	char msg[128];
+	sprintf( msg, "Unable to process message type [%d] in protocol state [%d]\n", 
+		 msgtype, c->state );
+	errorMessage( msg );
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : core_init
+    Description : set up the protocol state for a new connection
+    Inputs      : c - the core
+                  role - which end we are
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int core_init( ProtoCore *c, CoreRole role )
+{
+	/* Buffers are attached when bytes arrive */
+	memset( c, 0, sizeof(ProtoCore) );
+	c->role = role;
+	c->state = CORE_INIT_EXCHANGE;
+	c->limit = MAX_BLOCK_SIZE;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : core_set_limit
+    Description : set the largest message body the core will take or
+                  frame (MAX_BLOCK_SIZE until the block size is agreed)
+    Inputs      : c - the core
+                  limit - the largest body
+    Outputs     : none
+
+***********************************************************************/
+
+void core_set_limit( ProtoCore *c, unsigned int limit )
+{
+	c->limit = limit;
+}
+
+/**********************************************************************
+
+    Function    : core_free
+    Description : release the buffers held by a core
+    Inputs      : c - the core
+    Outputs     : none
+
+***********************************************************************/
+
+void core_free( ProtoCore *c )
+{
+	if ( c->inbuf != NULL )
+		slab_free( c->inbuf );
+	slab_free( c->outbuf );
+	c->inbuf = c->outbuf = NULL;
+	c->inoff = c->inlen = c->insz = c->inneed = 0;
+	c->outoff = c->outlen = c->outsz = 0;
+	c->frame = NULL;
+}
+
+/**********************************************************************
+
+    Function    : core_idle
+    Description : give back the buffers of a core with no partial frame
+                  and nothing left to send, so an idle connection holds
+                  only its state
+    Inputs      : c - the core
+    Outputs     : none
+
+***********************************************************************/
+
+void core_idle( ProtoCore *c )
+{
+	if ( (c->inbuf != NULL) && (c->inoff == c->inlen) )
+	{
+		slab_free( c->inbuf );
+		c->inbuf = NULL;
+		c->inoff = c->inlen = c->insz = c->inneed = 0;
+	}
+	if ( (c->outbuf != NULL) && (c->outoff == c->outlen) )
+	{
+		slab_free( c->outbuf );
+		c->outbuf = NULL;
+		c->outoff = c->outlen = c->outsz = 0;
+	}
+}
+
+/**********************************************************************
+
+    Function    : core_held
+    Description : get the buffer memory a core holds right now
+    Inputs      : c - the core
+    Outputs     : bytes held
+
+***********************************************************************/
+
+unsigned int core_held( ProtoCore *c )
+{
+	return( c->insz + c->outsz );
+}
+
+/**********************************************************************
+
+    Function    : core_recv_space
+    Description : get the space the next received bytes go into, so
+                  the caller can read straight into the core
+    Inputs      : c - the core
+                  avail - (out) bytes of space
+    Outputs     : the space (avail is 0 if the core is full)
+
+***********************************************************************/
+
+char *core_recv_space( ProtoCore *c, unsigned int *avail )
+{
+	char *nbuf;
+
+	*avail = 0;
+	if ( c->inbuf == NULL )
+	{
+		/* Expect another large frame after one was detached */
+		c->insz = (c->inlast > CORE_FRAME_SIZE) ? c->inlast : CORE_FRAME_SIZE;
+		c->inbuf = (char *)slab_alloc( c->insz );
+		if ( c->inbuf == NULL )
+		{
+			c->insz = 0;
+			return( NULL );
+		}
+	}
+
+	/* Keep the partial frame at the front of the buffer */
+	if ( c->inoff > 0 )
+	{
+		memmove( c->inbuf, c->inbuf+c->inoff, c->inlen-c->inoff );
+		c->inlen -= c->inoff;
+		c->inoff = 0;
+	}
+
+	/* A large block grows the buffer to hold the whole frame */
+	if ( c->inneed > c->insz )
+	{
+		if ( (nbuf = (char *)slab_realloc(c->inbuf, c->inneed)) == NULL )
+			return( NULL );
+		c->inbuf = nbuf;
+		c->insz = c->inneed;
+	}
+	*avail = c->insz - c->inlen;
+	return( c->inbuf + c->inlen );
+}
+
+/**********************************************************************
+
+    Function    : core_received
+    Description : account for bytes placed in the core_recv_space
+    Inputs      : c - the core
+                  len - bytes received
+    Outputs     : none
+
+***********************************************************************/
+
+void core_received( ProtoCore *c, unsigned int len )
+{
+	c->inlen += len;
+}
+
+/**********************************************************************
+
+    Function    : core_push
+    Description : hand received bytes (any amount) to the core
+    Inputs      : c - the core
+                  data - the bytes
+                  len - number of bytes
+    Outputs     : bytes taken (less than len when the core is full and
+                  the caller needs to pull events first)
+
+***********************************************************************/
+
+unsigned int core_push( ProtoCore *c, char *data, unsigned int len )
+{
+	unsigned int avail;
+	char *space = core_recv_space( c, &avail );
+
+	if ( space == NULL )
+		return( 0 );
+	if ( len > avail )
+		len = avail;
+	memcpy( space, data, len );
+	core_received( c, len );
+	return( len );
+}
+
+/**********************************************************************
+
+    Function    : core_next_event
+    Description : return the next complete message from the peer
+    Inputs      : c - the core
+                  ev - (out) the message
+    Outputs     : 1 if a message was returned, 0 if more bytes are
+                  needed, -1 if the peer broke the protocol
+
+***********************************************************************/
+
+int core_next_event( ProtoCore *c, ProtoEvent *ev )
+{
+	ProtoMessageHdr hdr;
+
+	if ( c->state == CORE_FAILED )
+		return( -1 );
+
+	/* Wait for the whole header, then the whole body */
+	if ( c->inlen-c->inoff < sizeof(hdr) )
+		return( 0 );
+	memcpy( &hdr, c->inbuf+c->inoff, sizeof(hdr) );
+	hdr.msgtype = ntohl( hdr.msgtype );
+	hdr.length = ntohl( hdr.length );
+	if ( hdr.length > c->limit )
+	{
+		errorMessage( "Received oversized protocol frame\n" );
+		c->state = CORE_FAILED;
+		return( -1 );
+	}
+	if ( c->inlen-c->inoff < sizeof(hdr)+hdr.length )
+	{
+		c->inneed = sizeof(hdr) + hdr.length;
+		return( 0 );
+	}
+	c->inneed = 0;
+
+	/* The peer has to be the one whose turn it is */
+	if ( core_advance(c, hdr.msgtype, 
+			  (c->role == CORE_CLIENT) ? CORE_SERVER : CORE_CLIENT) != 0 )
+	{
+		c->state = CORE_FAILED;
+		return( -1 );
+	}
+
+	ev->msgtype = hdr.msgtype;
+	ev->length = hdr.length;
+	ev->block = c->inbuf + c->inoff + sizeof(hdr);
+	c->inoff += sizeof(hdr) + hdr.length;
+	return( 1 );
+}
+
+/**********************************************************************
+
+    Function    : core_queue
+    Description : frame a message for the peer
+    Inputs      : c - the core
+                  msgtype - the message type
+                  block - the message body (or NULL)
+                  len - the length of the body
+    Outputs     : 0 if successful, -1 if failure or out of turn
+
+***********************************************************************/
+
+int core_queue( ProtoCore *c, ProtoMessageType msgtype, 
+		char *block, unsigned int len )
+{
+	ProtoMessageHdr hdr;
+	unsigned int need = c->outlen + sizeof(hdr) + len;
+	char *nbuf;
+
+	if ( (c->state == CORE_FAILED) || (len > c->limit) )
+		return( -1 );
+
+	/* Grow the output buffer to hold the frame */
+	if ( need > c->outsz )
+	{
+		if ( (nbuf = (char *)slab_realloc(c->outbuf, need)) == NULL )
+			return( -1 );
+		c->outbuf = nbuf;
+		c->outsz = need;
+	}
+	if ( core_advance(c, msgtype, c->role) != 0 )
+		return( -1 );
+
+	/* Append the header in network format, then the body */
+	hdr.msgtype = htonl( msgtype );
+	hdr.length = htonl( len );
+	memcpy( c->outbuf+c->outlen, &hdr, sizeof(hdr) );
+	if ( len > 0 )
+		memcpy( c->outbuf+c->outlen+sizeof(hdr), block, len );
+	c->outlen += sizeof(hdr) + len;
+	c->copied += len;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : core_detach
+    Description : take the receive buffer holding the message just
+                  returned, so it can be used without copying; bytes
+                  after it move to a new buffer
+    Inputs      : c - the core
+                  ev - the message core_next_event just returned
+    Outputs     : the buffer (ev->block points into it, the caller
+                  gives it back with slab_free), NULL if the message
+                  is cheaper to copy
+
+***********************************************************************/
+
+char *core_detach( ProtoCore *c, ProtoEvent *ev )
+{
+	unsigned int tail = c->inlen - c->inoff;
+	char *buf, *nbuf = NULL;
+
+	/* Only the last message returned, and only if less follows it */
+	if ( (c->inbuf == NULL) || (ev->block+ev->length != c->inbuf+c->inoff) ||
+	     (tail >= ev->length) )
+		return( NULL );
+	if ( tail > 0 )
+	{
+		nbuf = (char *)slab_alloc( c->insz );
+		if ( nbuf == NULL )
+			return( NULL );
+		memcpy( nbuf, c->inbuf+c->inoff, tail );
+		c->copied += tail;
+	}
+
+	/* The caller owns the old buffer now */
+	buf = c->inbuf;
+	c->inlast = c->insz;
+	c->inbuf = nbuf;
+	c->inoff = 0;
+	c->inlen = tail;
+	if ( nbuf == NULL )
+		c->insz = 0;
+	return( buf );
+}
+
+/**********************************************************************
+
+    Function    : core_frame_init
+    Description : allocate a frame buffer
+    Inputs      : f - the frame
+                  headroom - body bytes to reserve ahead of the payload
+                  size - payload bytes
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int core_frame_init( ProtoFrame *f, unsigned int headroom, unsigned int size )
+{
+	f->headroom = headroom;
+	f->size = size;
+	f->len = 0;
+	f->buf = (char *)slab_alloc( sizeof(ProtoMessageHdr) + headroom + size );
+	return( (f->buf != NULL) ? 0 : -1 );
+}
+
+/**********************************************************************
+
+    Function    : core_frame_free
+    Description : release a frame buffer
+    Inputs      : f - the frame
+    Outputs     : none
+
+***********************************************************************/
+
+void core_frame_free( ProtoFrame *f )
+{
+	slab_free( f->buf );
+	f->buf = NULL;
+}
+
+/**********************************************************************
+
+    Function    : core_queue_frame
+    Description : frame a message built in a frame buffer, sending it
+                  from there when nothing else is waiting; the frame
+                  must stay put until core_pending has drained it
+    Inputs      : c - the core
+                  msgtype - the message type
+                  f - the frame (len bytes of body filled in)
+    Outputs     : 0 if successful, -1 if failure or out of turn
+
+***********************************************************************/
+
+int core_queue_frame( ProtoCore *c, ProtoMessageType msgtype, ProtoFrame *f )
+{
+	ProtoMessageHdr hdr;
+
+	/* Behind other output it has to wait its turn in outbuf */
+	if ( (c->frame != NULL) || (c->outoff != c->outlen) )
+		return( core_queue(c, msgtype, CORE_FRAME_BODY(f), f->len) );
+
+	if ( (c->state == CORE_FAILED) || (f->len > c->limit) ||
+	     (core_advance(c, msgtype, c->role) != 0) )
+		return( -1 );
+
+	/* The header goes in the slot ahead of the body */
+	hdr.msgtype = htonl( msgtype );
+	hdr.length = htonl( f->len );
+	memcpy( f->buf, &hdr, sizeof(hdr) );
+	c->frame = f->buf;
+	c->frameoff = 0;
+	c->framelen = sizeof(hdr) + f->len;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : core_pending
+    Description : get the framed bytes waiting to be sent
+    Inputs      : c - the core
+                  len - (out) number of bytes
+    Outputs     : the bytes (len is 0 if there is nothing to send)
+
+***********************************************************************/
+
+char *core_pending( ProtoCore *c, unsigned int *len )
+{
+	/* A frame sent in place goes first, it was queued first */
+	if ( c->frame != NULL )
+	{
+		*len = c->framelen - c->frameoff;
+		return( c->frame + c->frameoff );
+	}
+	*len = c->outlen - c->outoff;
+	return( c->outbuf + c->outoff );
+}
+
+/**********************************************************************
+
+    Function    : core_sent
+    Description : account for bytes from core_pending that went out
+    Inputs      : c - the core
+                  len - bytes sent
+    Outputs     : none
+
+***********************************************************************/
+
+void core_sent( ProtoCore *c, unsigned int len )
+{
+	if ( c->frame != NULL )
+	{
+		if ( (c->frameoff += len) == c->framelen )
+			c->frame = NULL;
+		return;
+	}
+
+	/* Everything went out, reuse the buffer from the start */
+	c->outoff += len;
+	if ( c->outoff == c->outlen )
+		c->outoff = c->outlen = 0;
+}
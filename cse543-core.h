@@ -0,0 +1,303 @@
+#ifndef CSE543_CORE_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-core.h
+
+   Description   : This is the sans-I/O protocol core: it takes bytes
+                   from whatever transport the caller uses, returns
+                   the protocol messages in them, and frames outgoing
+                   messages for the caller to send.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+
+/* Defines */
+#define CORE_FRAME_SIZE (sizeof(ProtoMessageHdr)+MAX_BLOCK_SIZE)
+#define CORE_FRAME_BODY(f) ((f)->buf + sizeof(ProtoMessageHdr))
+#define CORE_FRAME_PAYLOAD(f) (CORE_FRAME_BODY(f) + (f)->headroom)
+
+/* Data Structures */
+
+/* Which end of the exchange this core speaks for */
+typedef enum {
+     CORE_CLIENT,
+     CORE_SERVER,
+} CoreRole;
+
+/* This is where the exchange is (both directions, in order) */
+typedef enum {
+     CORE_INIT_EXCHANGE,     /* client sends CLIENT_INIT_EXCHANGE */
+     CORE_INIT_RESPONSE,     /* server sends SERVER_INIT_RESPONSE */
+     CORE_INIT_ACK,          /* client sends CLIENT_INIT_ACK */
+     CORE_SERVER_ACK,        /* server sends SERVER_INIT_ACK */
+     CORE_XFER_INIT,         /* client sends FILE_XFER_INIT */
+     CORE_XFER,              /* client sends FILE_XFER_BLOCKs, then EXIT */
+     CORE_EXIT,              /* server acks with EXIT */
+     CORE_FAST_XFER,         /* client sent CLIENT_FAST_INIT, sends blocks while
+                                the server unseals and sends SERVER_INIT_ACK */
+     CORE_FAST_EXIT,         /* client sent EXIT before SERVER_INIT_ACK came */
+     CORE_RESUME,            /* client sent CLIENT_RESUME, server acks or
+                                falls back to SERVER_INIT_RESPONSE */
+     CORE_DONE,              /* exchange complete */
+     CORE_FAILED,            /* protocol violation, nothing more accepted */
+} CoreState;
+
+/* This is one received message; block points into the core and is
+   valid until the next call on it */
+typedef struct {
+     ProtoMessageType  msgtype;  /* message type */
+     unsigned int      length;   /* body length */
+     char             *block;    /* message body */
+} ProtoEvent;
+
+/* This is a message built where it is sent from: a slot for the
+   header, headroom in the body (e.g., for the cipher's sequence number
+   and tag), then the payload */
+typedef struct {
+     char          *buf;       /* header slot, body */
+     unsigned int   headroom;  /* body bytes ahead of the payload */
+     unsigned int   size;      /* payload bytes the buffer holds */
+     unsigned int   len;       /* body bytes filled in */
+} ProtoFrame;
+
+/* This is the protocol state for one connection */
+typedef struct {
+     CoreRole      role;      /* our end */
+     CoreState     state;     /* where the exchange is */
+     unsigned int  limit;     /* largest message body either way */
+     char         *inbuf;     /* received bytes not yet returned (attached
+                                 only while a frame is arriving) */
+     unsigned int  inoff;     /* start of the unparsed bytes */
+     unsigned int  inlen;     /* end of the received bytes */
+     unsigned int  insz;      /* allocated size of inbuf */
+     unsigned int  inneed;    /* size of the frame now arriving */
+     unsigned int  inlast;    /* size of the last buffer detached */
+     char         *outbuf;    /* framed messages not yet sent */
+     unsigned int  outoff;    /* bytes of outbuf already sent */
+     unsigned int  outlen;    /* bytes held in outbuf */
+     unsigned int  outsz;     /* allocated size of outbuf */
+     char         *frame;     /* caller's frame being sent, ahead of outbuf */
+     unsigned int  frameoff;  /* bytes of it already sent */
+     unsigned int  framelen;  /* its framed length */
+     unsigned long copied;    /* message bytes the core has copied */
+} ProtoCore;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : core_init
+    Description : set up the protocol state for a new connection
+    Inputs      : c - the core
+                  role - which end we are
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int core_init( ProtoCore *c, CoreRole role );
+
+/**********************************************************************
+
+    Function    : core_set_limit
+    Description : set the largest message body the core will take or
+                  frame (MAX_BLOCK_SIZE until the block size is agreed)
+    Inputs      : c - the core
+                  limit - the largest body
+    Outputs     : none
+
+***********************************************************************/
+extern void core_set_limit( ProtoCore *c, unsigned int limit );
+
+/**********************************************************************
+
+    Function    : core_free
+    Description : release the buffers held by a core
+    Inputs      : c - the core
+    Outputs     : none
+
+***********************************************************************/
+extern void core_free( ProtoCore *c );
+
+/**********************************************************************
+
+    Function    : core_idle
+    Description : give back the buffers of a core with no partial frame
+                  and nothing left to send, so an idle connection holds
+                  only its state
+    Inputs      : c - the core
+    Outputs     : none
+
+***********************************************************************/
+extern void core_idle( ProtoCore *c );
+
+/**********************************************************************
+
+    Function    : core_held
+    Description : get the buffer memory a core holds right now
+    Inputs      : c - the core
+    Outputs     : bytes held
+
+***********************************************************************/
+extern unsigned int core_held( ProtoCore *c );
+
+/**********************************************************************
+
+    Function    : core_recv_space
+    Description : get the space the next received bytes go into, so
+                  the caller can read straight into the core
+    Inputs      : c - the core
+                  avail - (out) bytes of space
+    Outputs     : the space (avail is 0 if the core is full), NULL if
+                  no buffer could be attached
+
+***********************************************************************/
+extern char *core_recv_space( ProtoCore *c, unsigned int *avail );
+
+/**********************************************************************
+
+    Function    : core_received
+    Description : account for bytes placed in the core_recv_space
+    Inputs      : c - the core
+                  len - bytes received
+    Outputs     : none
+
+***********************************************************************/
+extern void core_received( ProtoCore *c, unsigned int len );
+
+/**********************************************************************
+
+    Function    : core_push
+    Description : hand received bytes (any amount) to the core
+    Inputs      : c - the core
+                  data - the bytes
+                  len - number of bytes
+    Outputs     : bytes taken (less than len when the core is full and
+                  the caller needs to pull events first)
+
+***********************************************************************/
+extern unsigned int core_push( ProtoCore *c, char *data, unsigned int len );
+
+/**********************************************************************
+
+    Function    : core_next_event
+    Description : return the next complete message from the peer
+    Inputs      : c - the core
+                  ev - (out) the message
+    Outputs     : 1 if a message was returned, 0 if more bytes are
+                  needed, -1 if the peer broke the protocol
+
+***********************************************************************/
+extern int core_next_event( ProtoCore *c, ProtoEvent *ev );
+
+/**********************************************************************
+
+    Function    : core_queue
+    Description : frame a message for the peer
+    Inputs      : c - the core
+                  msgtype - the message type
+                  block - the message body (or NULL)
+                  len - the length of the body
+    Outputs     : 0 if successful, -1 if failure or out of turn
+
+***********************************************************************/
+extern int core_queue( ProtoCore *c, ProtoMessageType msgtype, 
+		       char *block, unsigned int len );
+
+/**********************************************************************
+
+    Function    : core_detach
+    Description : take the receive buffer holding the message just
+                  returned, so it can be used without copying; bytes
+                  after it move to a new buffer
+    Inputs      : c - the core
+                  ev - the message core_next_event just returned
+    Outputs     : the buffer (ev->block points into it, the caller
+                  gives it back with slab_free), NULL if the message
+                  is cheaper to copy
+
+***********************************************************************/
+extern char *core_detach( ProtoCore *c, ProtoEvent *ev );
+
+/**********************************************************************
+
+    Function    : core_frame_init
+    Description : allocate a frame buffer
+    Inputs      : f - the frame
+                  headroom - body bytes to reserve ahead of the payload
+                  size - payload bytes
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int core_frame_init( ProtoFrame *f, unsigned int headroom, unsigned int size );
+
+/**********************************************************************
+
+    Function    : core_frame_free
+    Description : release a frame buffer
+    Inputs      : f - the frame
+    Outputs     : none
+
+***********************************************************************/
+extern void core_frame_free( ProtoFrame *f );
+
+/**********************************************************************
+
+    Function    : core_queue_frame
+    Description : frame a message built in a frame buffer, sending it
+                  from there when nothing else is waiting; the frame
+                  must stay put until core_pending has drained it
+    Inputs      : c - the core
+                  msgtype - the message type
+                  f - the frame (len bytes of body filled in)
+    Outputs     : 0 if successful, -1 if failure or out of turn
+
+***********************************************************************/
+extern int core_queue_frame( ProtoCore *c, ProtoMessageType msgtype, ProtoFrame *f );
+
+/**********************************************************************
+
+    Function    : core_pending
+    Description : get the framed bytes waiting to be sent
+    Inputs      : c - the core
+                  len - (out) number of bytes
+    Outputs     : the bytes (len is 0 if there is nothing to send)
+
+***********************************************************************/
+extern char *core_pending( ProtoCore *c, unsigned int *len );
+
+/**********************************************************************
+
+    Function    : core_sent
+    Description : account for bytes from core_pending that went out
+    Inputs      : c - the core
+                  len - bytes sent
+    Outputs     : none
+
+***********************************************************************/
+extern void core_sent( ProtoCore *c, unsigned int len );
+
+#define CSE543_CORE_INCLUDED
+#endif
@@ -0,0 +1,352 @@
+/**********************************************************************
+
+   File          : cse543-kex.c
+
+   Description   : This is the X25519 key exchange.  The client sends
+                   an ephemeral share in its hello; the server answers
+                   with a share it keeps for KEX_SHARE_LIFETIME seconds,
+                   signed with its RSA key when it is made, so each
+                   handshake costs the server one X25519 operation and
+                   an HKDF instead of an RSA private key operation.
+                   The share is semi-static, not ephemeral: whoever
+                   reads it from the server's memory while it is
+                   offered can work out every session key agreed with
+                   it.  Forward secrecy is per share, not per session;
+                   once a share is replaced and freed, the sessions it
+                   keyed stay safe even if the RSA key is later lost.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/crypto.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-ssl.h"
+#include "cse543-proto.h"
+#include "cse543-kex.h"
+
+/* Defines */
+#define KEX_SIGN_LABEL "cse543 x25519 share"
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : kex_keypair
+    Description : make an X25519 key and get its public value
+    Inputs      : key - (out) the private key
+                  pub - (out) the public value (KEX_SHARE_SIZE bytes)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int kex_keypair( EVP_PKEY **key, unsigned char *pub )
+{
+	EVP_PKEY_CTX *ctx;
+	size_t len = KEX_SHARE_SIZE;
+	int ret = -1;
+
+	*key = NULL;
+	if ( (ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL)) == NULL )
+		return( -1 );
+	if ( (EVP_PKEY_keygen_init(ctx) == 1) && (EVP_PKEY_keygen(ctx, key) == 1) &&
+	     (EVP_PKEY_get_raw_public_key(*key, pub, &len) == 1) && (len == KEX_SHARE_SIZE) )
+		ret = 0;
+	EVP_PKEY_CTX_free( ctx );
+	if ( ret != 0 )
+	{
+		EVP_PKEY_free( *key );
+		*key = NULL;
+	}
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : kex_derive
+    Description : agree the session key: X25519 with the peer's share,
+                  then HKDF-SHA256 salted with both shares
+    Inputs      : key - our private key
+                  peer - the peer's public value
+                  cshare - the client's public value
+                  sshare - the server's public value
+                  session_key - (out) KEYSIZE bytes
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int kex_derive( EVP_PKEY *key, const unsigned char *peer, const unsigned char *cshare, 
+		const unsigned char *sshare, unsigned char *session_key )
+{
+	unsigned char secret[KEX_SHARE_SIZE], salt[2*KEX_SHARE_SIZE];
+	size_t len = sizeof(secret), keylen = KEYSIZE;
+	EVP_PKEY *them;
+	EVP_PKEY_CTX *ctx = NULL, *kdf = NULL;
+	int ret = -1;
+
+	/* The shared secret; a low order share gives all zeros, which
+	   OpenSSL refuses */
+	if ( (them = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peer, KEX_SHARE_SIZE)) == NULL )
+		return( -1 );
+	if ( ((ctx = EVP_PKEY_CTX_new(key, NULL)) == NULL) ||
+	     (EVP_PKEY_derive_init(ctx) != 1) || (EVP_PKEY_derive_set_peer(ctx, them) != 1) ||
+	     (EVP_PKEY_derive(ctx, secret, &len) != 1) || (len != sizeof(secret)) )
+		goto done;
+
+	/* Bound to both shares, so the key is this exchange's alone */
+	memcpy( salt, cshare, KEX_SHARE_SIZE );
+	memcpy( salt+KEX_SHARE_SIZE, sshare, KEX_SHARE_SIZE );
+	if ( ((kdf = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) != NULL) &&
+	     (EVP_PKEY_derive_init(kdf) == 1) &&
+	     (EVP_PKEY_CTX_set_hkdf_md(kdf, EVP_sha256()) == 1) &&
+	     (EVP_PKEY_CTX_set1_hkdf_salt(kdf, salt, sizeof(salt)) == 1) &&
+	     (EVP_PKEY_CTX_set1_hkdf_key(kdf, secret, sizeof(secret)) == 1) &&
+	     (EVP_PKEY_CTX_add1_hkdf_info(kdf, (unsigned char *)KEX_LABEL, strlen(KEX_LABEL)) == 1) &&
+	     (EVP_PKEY_derive(kdf, session_key, &keylen) == 1) && (keylen == KEYSIZE) )
+		ret = 0;
+
+done:
+	OPENSSL_cleanse( secret, sizeof(secret) );
+	EVP_PKEY_CTX_free( kdf );
+	EVP_PKEY_CTX_free( ctx );
+	EVP_PKEY_free( them );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : kex_signed
+    Description : lay out what a share signature covers: the label, the
+                  share and its expiry
+    Inputs      : share - the share's public value
+                  expiry - the time it is offered until
+                  msg - (out) sizeof(KEX_SIGN_LABEL)-1+KEX_SHARE_SIZE+4 bytes
+    Outputs     : the length of msg
+
+***********************************************************************/
+
+static size_t kex_signed( const unsigned char *share, uint32_t expiry, unsigned char *msg )
+{
+	size_t len = sizeof(KEX_SIGN_LABEL)-1;
+
+	memcpy( msg, KEX_SIGN_LABEL, len );
+	memcpy( msg+len, share, KEX_SHARE_SIZE );
+	len += KEX_SHARE_SIZE;
+	expiry = htonl( expiry );
+	memcpy( msg+len, &expiry, sizeof(expiry) );
+	return( len+sizeof(expiry) );
+}
+
+/**********************************************************************
+
+    Function    : kex_share_refresh
+    Description : make and sign a new server share when the current
+                  one is missing or near its expiry
+    Inputs      : s - the share
+                  signer - the server's private key
+                  now - the time
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int kex_share_refresh( KexShare *s, EVP_PKEY *signer, uint32_t now )
+{
+	unsigned char msg[sizeof(KEX_SIGN_LABEL)-1+KEX_SHARE_SIZE+sizeof(uint32_t)];
+	EVP_MD_CTX *md;
+	EVP_PKEY *key;
+	size_t siglen = KEX_SIG_MAX;
+	int ret = -1;
+
+	/* Offered until half its life is left, so a client that takes a
+	   while to check it still finds it good */
+	if ( (s->key != NULL) && (now+KEX_SHARE_LIFETIME/2 < s->expiry) )
+		return( 0 );
+	if ( (EVP_PKEY_get_size(signer) > KEX_SIG_MAX) || (kex_keypair(&key, msg) != 0) )
+		return( -1 );
+	kex_share_free( s );
+	s->key = key;
+	memcpy( s->pub, msg, KEX_SHARE_SIZE );
+	s->expiry = now + KEX_SHARE_LIFETIME;
+	if ( ((md = EVP_MD_CTX_new()) != NULL) &&
+	     (EVP_DigestSignInit(md, NULL, EVP_sha256(), NULL, signer) == 1) &&
+	     (EVP_DigestSign(md, s->sig, &siglen, msg, kex_signed(s->pub, s->expiry, msg)) == 1) )
+	{
+		s->siglen = siglen;
+		ret = 0;
+	}
+	EVP_MD_CTX_free( md );
+	if ( ret != 0 )
+		kex_share_free( s );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : kex_share_free
+    Description : release a server share
+    Inputs      : s - the share
+    Outputs     : none
+
+***********************************************************************/
+
+void kex_share_free( KexShare *s )
+{
+	EVP_PKEY_free( s->key );
+	memset( s, 0, sizeof(KexShare) );
+}
+
+/**********************************************************************
+
+    Function    : kex_verify
+    Description : check a server share was signed with the server's key
+                  and has not expired
+    Inputs      : pubkey - the server's public key
+                  share - the share's public value
+                  expiry - the time it is offered until
+                  sig - the signature
+                  siglen - its length
+                  now - the time
+    Outputs     : 0 if valid, -1 if not
+
+***********************************************************************/
+
+int kex_verify( EVP_PKEY *pubkey, const unsigned char *share, uint32_t expiry, 
+		const unsigned char *sig, unsigned int siglen, uint32_t now )
+{
+	unsigned char msg[sizeof(KEX_SIGN_LABEL)-1+KEX_SHARE_SIZE+sizeof(uint32_t)];
+	EVP_MD_CTX *md;
+	int ret = -1;
+
+	/* A share's lifetime of slack for clocks that disagree */
+	if ( expiry+KEX_SHARE_LIFETIME < now )
+		return( -1 );
+	if ( ((md = EVP_MD_CTX_new()) != NULL) &&
+	     (EVP_DigestVerifyInit(md, NULL, EVP_sha256(), NULL, pubkey) == 1) &&
+	     (EVP_DigestVerify(md, sig, siglen, msg, kex_signed(share, expiry, msg)) == 1) )
+		ret = 0;
+	EVP_MD_CTX_free( md );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_kex
+    Description : measure handshakes per second per core with RSA key
+                  sealing and with the X25519 exchange; the key work on
+                  each side is timed on this thread's CPU clock, the
+                  server's share signed as often as it would be
+    Inputs      : count - handshakes of each kind, 0 for the default
+                  privkey - the server private key
+                  pubkey - the server public key
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_kex( int count, EVP_PKEY *privkey, EVP_PKEY *pubkey )
+{
+	static const char *kinds[] = { "RSA", "X25519" };
+	unsigned char ckey[KEYSIZE], skey[KEYSIZE], cpub[KEX_SHARE_SIZE], *key;
+	char sealed[MAX_BLOCK_SIZE];
+	double cpu[2][2], t[3];
+	struct timespec ts;
+	KexShare share;
+	EVP_PKEY *eph;
+	uint32_t now;
+	int i, k, len, failed = 0;
+
+	count = (count > 0) ? count : KEX_TEST_COUNT;
+	printf( "*** Test %d RSA and %d X25519 handshakes. ***\n", count, count );
+	memset( &share, 0, sizeof(share) );
+	now = (uint32_t)time( NULL );
+	for ( k=0; k<2; k++ )
+	{
+		cpu[k][0] = cpu[k][1] = 0;
+		for ( i=0; i<count; i++ )
+		{
+			/* Client, server, then client again for X25519 */
+			clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+			t[0] = ts.tv_sec + ts.tv_nsec/1e9;
+			key = NULL;
+			eph = NULL;
+			if ( k == 0 )
+			{
+				if ( (generate_pseudorandom_bytes(ckey, KEYSIZE) != 0) ||
+				     ((len = seal_symmetric_key(ckey, KEYSIZE, pubkey, sealed)) <= 0) )
+					failed++;
+				clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+				t[1] = ts.tv_sec + ts.tv_nsec/1e9;
+				if ( (len <= 0) || (unseal_symmetric_key(sealed, len, privkey, &key) != 0) ||
+				     (memcmp(key, ckey, KEYSIZE) != 0) )
+					failed++;
+				clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+				t[2] = ts.tv_sec + ts.tv_nsec/1e9;
+			}
+			else
+			{
+				/* A new share every KEX_SHARE_LIFETIME/2 seconds of
+				   handshakes, at one handshake per microsecond of
+				   CPU this costs the server next to nothing */
+				if ( kex_keypair(&eph, cpub) != 0 )
+					failed++;
+				clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+				t[1] = ts.tv_sec + ts.tv_nsec/1e9;
+				if ( (kex_share_refresh(&share, privkey, now + (i/10000)*KEX_SHARE_LIFETIME) != 0) ||
+				     (kex_derive(share.key, cpub, cpub, share.pub, skey) != 0) )
+					failed++;
+				clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+				t[2] = ts.tv_sec + ts.tv_nsec/1e9;
+				if ( (kex_verify(pubkey, share.pub, share.expiry, share.sig, share.siglen, now) != 0) ||
+				     (kex_derive(eph, share.pub, cpub, share.pub, ckey) != 0) ||
+				     (memcmp(ckey, skey, KEYSIZE) != 0) )
+					failed++;
+				EVP_PKEY_free( eph );
+			}
+			clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+			cpu[k][0] += (t[1]-t[0]) + (ts.tv_sec + ts.tv_nsec/1e9 - t[2]);
+			cpu[k][1] += t[2]-t[1];
+			free( key );
+		}
+		printf( "%-7s server %8.0f handshakes/s per core (%7.1f us), client %7.1f us\n", 
+			kinds[k], (cpu[k][1] > 0) ? count/cpu[k][1] : 0.0, 
+			cpu[k][1]*1e6/count, cpu[k][0]*1e6/count );
+	}
+	kex_share_free( &share );
+	printf( "X25519: %.1fx the server handshakes per core\n", 
+		(cpu[1][1] > 0) ? cpu[0][1]/cpu[1][1] : 0.0 );
+	if ( failed > 0 )
+	{
+		errorMessage( "key exchange test failed\n" );
+		return( -1 );
+	}
+	return( 0 );
+}
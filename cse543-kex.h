@@ -0,0 +1,139 @@
+#ifndef CSE543_KEX_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-kex.h
+
+   Description   : This is the X25519 key exchange: the client's
+                   ephemeral share against a server share signed with
+                   the server's RSA key, HKDF for the session key.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdint.h>
+#include <openssl/evp.h>
+
+/* Defines */
+#define KEX_SHARE_LIFETIME 60    /* seconds one signed server share answers handshakes */
+#define KEX_LABEL "cse543 x25519"  /* HKDF info for the session key */
+#define KEX_TEST_COUNT 500       /* handshakes of each kind timed by test_kex */
+
+/* Data Structures */
+
+/* This is the server's share: an X25519 key kept for a while, signed
+   once with the long-term key so a handshake costs no RSA work */
+typedef struct {
+	EVP_PKEY         *key;       /* the X25519 private key */
+	unsigned char     pub[KEX_SHARE_SIZE];  /* its public value */
+	uint32_t          expiry;    /* time the share is offered until */
+	unsigned char     sig[KEX_SIG_MAX];     /* RSA-SHA256 over label, share, expiry */
+	unsigned int      siglen;
+} KexShare;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : kex_keypair
+    Description : make an X25519 key and get its public value
+    Inputs      : key - (out) the private key
+                  pub - (out) the public value (KEX_SHARE_SIZE bytes)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int kex_keypair( EVP_PKEY **key, unsigned char *pub );
+
+/**********************************************************************
+
+    Function    : kex_derive
+    Description : agree the session key: X25519 with the peer's share,
+                  then HKDF-SHA256 salted with both shares
+    Inputs      : key - our private key
+                  peer - the peer's public value
+                  cshare - the client's public value
+                  sshare - the server's public value
+                  session_key - (out) KEYSIZE bytes
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int kex_derive( EVP_PKEY *key, const unsigned char *peer, const unsigned char *cshare, 
+		       const unsigned char *sshare, unsigned char *session_key );
+
+/**********************************************************************
+
+    Function    : kex_share_refresh
+    Description : make and sign a new server share when the current
+                  one is missing or near its expiry
+    Inputs      : s - the share
+                  signer - the server's private key
+                  now - the time
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int kex_share_refresh( KexShare *s, EVP_PKEY *signer, uint32_t now );
+
+/**********************************************************************
+
+    Function    : kex_share_free
+    Description : release a server share
+    Inputs      : s - the share
+    Outputs     : none
+
+***********************************************************************/
+extern void kex_share_free( KexShare *s );
+
+/**********************************************************************
+
+    Function    : kex_verify
+    Description : check a server share was signed with the server's key
+                  and has not expired
+    Inputs      : pubkey - the server's public key
+                  share - the share's public value
+                  expiry - the time it is offered until
+                  sig - the signature
+                  siglen - its length
+                  now - the time
+    Outputs     : 0 if valid, -1 if not
+
+***********************************************************************/
+extern int kex_verify( EVP_PKEY *pubkey, const unsigned char *share, uint32_t expiry, 
+		       const unsigned char *sig, unsigned int siglen, uint32_t now );
+
+/**********************************************************************
+
+    Function    : test_kex
+    Description : measure handshakes per second per core with RSA key
+                  sealing and with the X25519 exchange
+    Inputs      : count - handshakes of each kind, 0 for the default
+                  privkey - the server private key
+                  pubkey - the server public key
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_kex( int count, EVP_PKEY *privkey, EVP_PKEY *pubkey );
+
+#define CSE543_KEX_INCLUDED
+#endif
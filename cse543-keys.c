@@ -0,0 +1,172 @@
+/**********************************************************************
+
+   File          : cse543-keys.c
+
+   Description   : This is the server key cache.  The key files are
+                   read once and parsed from memory, and the public key
+                   is kept in the form it is sent to clients, so a
+                   handshake touches neither the disk nor the PEM
+                   parser.  A reload builds a whole new set before it
+                   replaces the old one.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/bio.h>
+#include <openssl/crypto.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-proto.h"
+#include "cse543-keys.h"
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : keys_private
+    Description : read and parse the private key file
+    Inputs      : privfile - the private key file (PEM)
+                  privkey - (out) the key
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int keys_private( char *privfile, EVP_PKEY **privkey )
+{
+	unsigned char *pem = NULL;
+	unsigned int len;
+	BIO *bio;
+
+	*privkey = NULL;
+	if ( (len = buffer_from_file(privfile, &pem)) == 0 )
+		return( -1 );
+	if ( (bio = BIO_new_mem_buf(pem, len)) != NULL )
+	{
+		*privkey = PEM_read_bio_PrivateKey( bio, NULL, NULL, NULL );
+		BIO_free( bio );
+	}
+	OPENSSL_cleanse( pem, len );
+	free( pem );
+	if ( (*privkey != NULL) && (EVP_PKEY_base_id(*privkey) != EVP_PKEY_RSA) )
+	{
+		EVP_PKEY_free( *privkey );
+		*privkey = NULL;
+	}
+	return( (*privkey != NULL) ? 0 : -1 );
+}
+
+/**********************************************************************
+
+    Function    : keys_load
+    Description : read and parse the key files, checking the public
+                  key is the private key's
+    Inputs      : k - (out) the keys
+                  privfile - the private key file (PEM)
+                  pubfile - the public key file (PEM)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int keys_load( KeySet *k, char *privfile, char *pubfile )
+{
+	memset( k, 0, sizeof(KeySet) );
+	k->privfile = privfile;
+	k->pubfile = pubfile;
+	if ( keys_private(privfile, &k->privkey) != 0 )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "Error loading RSA private key file [%.64s]\n", privfile );
+		errorMessage( msg );
+		keys_free( k );
+		return( -1 );
+	}
+	if ( ((k->pemlen = buffer_from_file(pubfile, &k->pem)) == 0) ||
+	     (extract_public_key((char *)k->pem, k->pemlen, &k->pubkey) != 0) )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "Error loading RSA public key file [%.64s]\n", pubfile );
+		errorMessage( msg );
+		keys_free( k );
+		return( -1 );
+	}
+
+	/* A client sealing to the wrong key would never get an answer */
+	if ( EVP_PKEY_eq(k->privkey, k->pubkey) != 1 )
+	{
+		errorMessage( "server public key does not match the private key\n" );
+		keys_free( k );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : keys_reload
+    Description : load the key files again, replacing the keys only if
+                  both load and match; anyone holding a reference to a
+                  replaced key keeps it
+    Inputs      : k - the keys
+    Outputs     : 0 if replaced, -1 if failure (the keys are unchanged)
+
+***********************************************************************/
+
+int keys_reload( KeySet *k )
+{
+	KeySet fresh;
+
+	if ( keys_load(&fresh, k->privfile, k->pubfile) != 0 )
+		return( -1 );
+	keys_free( k );
+	*k = fresh;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : keys_free
+    Description : release the keys
+    Inputs      : k - the keys
+    Outputs     : none
+
+***********************************************************************/
+
+void keys_free( KeySet *k )
+{
+	EVP_PKEY_free( k->privkey );
+	EVP_PKEY_free( k->pubkey );
+	free( k->pem );
+	k->privkey = k->pubkey = NULL;
+	k->pem = NULL;
+	k->pemlen = 0;
+}
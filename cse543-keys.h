@@ -0,0 +1,88 @@
+#ifndef CSE543_KEYS_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-keys.h
+
+   Description   : This is the server key cache: the key files parsed
+                   once in memory with the public key kept as sent to
+                   clients, and reloaded whole on request.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <openssl/evp.h>
+
+/* Data Structures */
+
+/* This is the server's key pair, as loaded from its files */
+typedef struct {
+	char             *privfile;  /* where the keys are loaded from */
+	char             *pubfile;
+	EVP_PKEY         *privkey;   /* the server private key */
+	EVP_PKEY         *pubkey;    /* the server public key */
+	unsigned char    *pem;       /* the public key as sent to clients */
+	unsigned int      pemlen;
+} KeySet;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : keys_load
+    Description : read and parse the key files, checking the public
+                  key is the private key's
+    Inputs      : k - (out) the keys
+                  privfile - the private key file (PEM)
+                  pubfile - the public key file (PEM)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int keys_load( KeySet *k, char *privfile, char *pubfile );
+
+/**********************************************************************
+
+    Function    : keys_reload
+    Description : load the key files again, replacing the keys only if
+                  both load and match; anyone holding a reference to a
+                  replaced key keeps it
+    Inputs      : k - the keys
+    Outputs     : 0 if replaced, -1 if failure (the keys are unchanged)
+
+***********************************************************************/
+extern int keys_reload( KeySet *k );
+
+/**********************************************************************
+
+    Function    : keys_free
+    Description : release the keys
+    Inputs      : k - the keys
+    Outputs     : none
+
+***********************************************************************/
+extern void keys_free( KeySet *k );
+
+#define CSE543_KEYS_INCLUDED
+#endif
@@ -34,15 +34,32 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 /* Project Include Files */
 #include "cse543-util.h"
+#include "cse543-uring.h"
 #include "cse543-network.h"
 
+/* Defines */
+#define URING_RECV_TAG 0xffffffffULL
+
+/* Sends queued on this thread's ring, waiting for the next flush */
+typedef struct {
+	int          bufidx;   /* registered buffer holding the data */
+	int          len;      /* length of the send */
+	int          res;      /* what the ring did with it */
+} NetSend;
+static __thread NetSend net_sends[URING_NBUFS];
+static __thread int net_nsends = 0;
+static __thread int net_send_sock = -1;
+
 /* Functional Prototypes */
+static int uring_flush( IoRing *r, char *blk, int sz );
 
 /**********************************************************************
 
@@ -96,12 +113,15 @@ int connect_client( char *address )
 
     Function    : server_connect
     Description : connnect a server socket to listen for
-    Inputs      : none
+    Inputs      : backlog - length of the pending connection queue
+                  reuseport - share the port with other listeners
+                              (SO_REUSEPORT), so the kernel spreads
+                              connections across them
     Outputs     : file handle if successful, -1 if failure
 
 ***********************************************************************/
 
-int server_connect( void )
+int server_connect( int backlog, int reuseport )
 {
 	/* Local variables */
 	int sock;
@@ -127,6 +147,16 @@ int server_connect( void )
 	/* Setup the socket option to reuse */
 	int on = 1;
 	setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if ( reuseport && 
+	     (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "failed server socket reuseport [%.64s]\n", 
+			 strerror(errno) );
+		errorMessage( msg );
+		exit( -1 );
+	}
 
 	// Call the connect
 	if ( bind(sock, (struct sockaddr *)&inet, sizeof(inet)) != 0 )
@@ -140,7 +170,7 @@ int server_connect( void )
 	}
 
 	// Do the listen
-	if ( listen(sock, 5) != 0 )
+	if ( listen(sock, backlog) != 0 )
 	{
 		/* Complain, explain, and return */
 		char msg[128];
@@ -170,23 +200,246 @@ int server_connect( void )
 int server_accept( int sock )
 {
 	struct sockaddr_in inet;
-	unsigned int inet_len = sizeof(inet), nsock;
+	socklen_t inet_len = sizeof(inet);
+	int nsock;
 
 	// Do the accept
-	if ( (nsock = accept(sock, (struct sockaddr *)&inet, &inet_len)) == 0 )
+	if ( (nsock = accept(sock, (struct sockaddr *)&inet, &inet_len)) == -1 )
 	{
+		/* Nothing pending on a non-blocking listener is not an error */
+		if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+			return( -1 );
+
 		/* Complain, explain, and return */
 		char msg[128];
 		sprintf( msg, "failed server socket accept [%.64s]\n", 
 			 strerror(errno) );
 		errorMessage( msg );
-		exit( -1 );
+		return( -1 );
 	}
 
+	/* Replies are whole frames, so do not hold them for Nagle */
+	int on = 1;
+	setsockopt( nsock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+
 	/* Return the new socket */
 	return( nsock );
 }
 
+/**********************************************************************
+
+    Function    : set_nonblocking
+    Description : put the socket into non-blocking mode
+    Inputs      : sock - the socket
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int set_nonblocking( int sock )
+{
+	int flags;
+
+	/* Get the flags, add O_NONBLOCK */
+	if ( ((flags = fcntl(sock, F_GETFL, 0)) == -1) ||
+	     (fcntl(sock, F_SETFL, flags|O_NONBLOCK) == -1) )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "failed setting non-blocking socket [%.64s]\n", 
+			 strerror(errno) );
+		errorMessage( msg );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : recv_avail
+    Description : receive whatever data a non-blocking socket has ready
+    Inputs      : sock - the socket
+                  blk - block to put data in
+                  sz - maxmimum size of buffer
+    Outputs     : bytes read (0 if the read would block), -1 on error
+                  or when the peer closed the connection
+
+***********************************************************************/
+
+int recv_avail( int sock, char *blk, int sz )
+{
+	int ret;
+
+	/* Retry interrupted reads, report would-block as no data */
+	do
+	{
+		ret = recv( sock, blk, sz, 0 );
+	}
+	while ( (ret == -1) && (errno == EINTR) );
+
+	if ( ret > 0 )
+		return( ret );
+	if ( (ret == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) )
+		return( 0 );
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : send_avail
+    Description : send as much data as a non-blocking socket will take
+    Inputs      : sock - the socket
+                  blk - block to send
+                  len - length of data to send
+    Outputs     : bytes sent (0 if the send would block), -1 on error
+
+***********************************************************************/
+
+int send_avail( int sock, char *blk, int len )
+{
+	int ret;
+
+	/* Retry interrupted sends, report would-block as nothing sent */
+	do
+	{
+		ret = send( sock, blk, len, MSG_NOSIGNAL );
+	}
+	while ( (ret == -1) && (errno == EINTR) );
+
+	if ( ret >= 0 )
+		return( ret );
+	if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+		return( 0 );
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : send_all
+    Description : send a whole block on a blocking socket
+    Inputs      : sock - the socket
+                  blk - block to send
+                  len - length of data to send
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int send_all( int sock, char *blk, int len )
+{
+	int ret, sb = 0;
+
+	while ( sb < len )
+	{
+		if ( (ret = send(sock, blk+sb, len-sb, MSG_NOSIGNAL)) == -1 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return( -1 );
+		}
+		sb += ret;
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : uring_send_queue
+    Description : queue a send from a registered buffer, linked behind
+                  the other sends in the batch so they stay in order
+    Inputs      : r - the ring
+                  sock - the socket
+                  buf - the registered buffer
+                  idx - its index
+                  blk - the data to send
+                  len - length of the data
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int uring_send_queue( IoRing *r, int sock, char *buf, int idx, char *blk, int len )
+{
+	int slot;
+
+	/* Register the socket at the start of each batch, the descriptor
+	   number may belong to a new socket since the last one */
+	if ( (slot = uring_file(r, sock, net_nsends == 0)) == -1 )
+		return( -1 );
+	memcpy( buf, blk, len );
+	if ( uring_queue(r, IORING_OP_WRITE_FIXED, slot, buf, len, 0, idx, 
+			 IOSQE_IO_LINK, net_nsends) != 0 )
+		return( -1 );
+	net_sends[net_nsends].bufidx = idx;
+	net_sends[net_nsends].len = len;
+	net_sends[net_nsends].res = -ECANCELED;
+	net_nsends++;
+	net_send_sock = sock;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : uring_flush
+    Description : submit the queued sends (and optionally a receive on
+                  the same socket) in one call, then finish any send the
+                  ring could not complete with plain system calls
+    Inputs      : r - the ring
+                  blk - receive buffer, NULL for no receive
+                  sz - size of the receive buffer
+    Outputs     : bytes received, 0 if there was no receive (or it
+                  did not complete), -1 if a send failed
+
+***********************************************************************/
+
+static int uring_flush( IoRing *r, char *blk, int sz )
+{
+	unsigned long long tag;
+	int i, res, wait = net_nsends, rres = 0, slot;
+
+	/* The receive goes last, after the linked sends */
+	if ( (blk != NULL) && ((slot = uring_file(r, net_send_sock, 0)) != -1) &&
+	     (uring_queue(r, IORING_OP_RECV, slot, blk, sz, 0, 0, 0, URING_RECV_TAG) == 0) )
+		wait++;
+	else
+		blk = NULL;
+
+	/* One system call for the whole batch; should it fail, nothing
+	   went and the sends below go by plain system calls */
+	if ( uring_submit(r, wait) != 0 )
+	{
+		uring_discard( r );
+		wait = 0;
+	}
+	while ( (wait > 0) && uring_reap(r, &tag, &res) )
+	{
+		if ( tag == URING_RECV_TAG )
+			rres = (res > 0) ? res : 0;
+		else if ( tag < URING_NBUFS )
+			net_sends[tag].res = res;
+		wait--;
+	}
+
+	/* A failed or short send breaks the chain, send the rest in order;
+	   once one fails the rest are dropped, the connection is done */
+	for ( i=0; i<net_nsends; i++ )
+	{
+		res = net_sends[i].res;
+		if ( (rres != -1) && (res < net_sends[i].len) &&
+		     (send_all(net_send_sock, r->bufs + net_sends[i].bufidx*URING_BUFSIZE + 
+			       ((res > 0) ? res : 0), 
+			       net_sends[i].len - ((res > 0) ? res : 0)) != 0) )
+		{
+			/* Complain, explain, and carry on releasing */
+			char msg[128];
+			sprintf( msg, "failed socket send [%.64s]\n", strerror(errno) );
+			errorMessage( msg );
+			rres = -1;
+		}
+		uring_release( r, net_sends[i].bufidx );
+	}
+	net_nsends = 0;
+	return( rres );
+}
+
 /**********************************************************************
 
     Function    : recv_data
@@ -203,33 +456,51 @@ int recv_data( int sock, char *blk, int sz, int minsz )
 {
 	/* Keep reading until you have enough bytes */
 	int rb = 0, ret;
-	do 
+	IoRing *r = uring_thread();
+
+	/* With sends queued on the ring, submit the receive with them */
+	if ( (r != NULL) && (net_nsends > 0) )
+	{
+		if ( (ret = uring_flush(r, (net_send_sock == sock) ? blk : NULL, sz)) == -1 )
+			return( -1 );
+		rb = ret;
+	}
+
+	while ( rb < minsz )
 	{
 		/* Receive data from the socket */
 		if ( (ret=recv(sock, &blk[rb], sz-rb, 0)) == -1 )
 		{
+			if ( errno == EINTR )
+				continue;
+
 			/* Complain, explain, and return */
 			char msg[128];
 			sprintf( msg, "failed read error [%.64s]\n", 
 				 strerror(errno) );
 			errorMessage( msg );
-			exit( -1 );
+			return( -1 );
+		}
+		if ( ret == 0 )
+		{
+			errorMessage( "connection closed by peer\n" );
+			return( -1 );
 		}
 
 		/* Increment read bytes */
 		rb += ret;
 	}
-	while ( rb < minsz );
 
-	/* Return the new socket */
+	/* Return the bytes read */
 	/* printBuffer( "recv data : ", blk, sz ); */
-	return( 0 );
+	return( rb );
 }
 
 /**********************************************************************
 
     Function    : send_data
-    Description : send  data to the socket
+    Description : send  data to the socket (with io_uring enabled the
+                  send may be queued until the next recv_data/net_flush)
     Inputs      : sock - server socket
                   blk - block to send
                   len - length of data to send
@@ -239,15 +510,206 @@ int recv_data( int sock, char *blk, int sz, int minsz )
 
 int send_data( int sock, char *blk, int len )
 {
+	IoRing *r = uring_thread();
+	char *buf;
+	int idx;
+
+	/* On the ring, copy into a registered buffer and queue it behind
+	   the earlier sends; the batch goes out when the buffers run out
+	   or on the next receive/flush */
+	if ( r != NULL )
+	{
+		if ( (net_nsends > 0) && (net_send_sock != sock) && 
+		     (uring_flush(r, NULL, 0) == -1) )
+			return( -1 );
+		if ( len <= URING_BUFSIZE )
+		{
+			if ( (buf = uring_buffer(r, &idx)) == NULL )
+			{
+				if ( uring_flush(r, NULL, 0) == -1 )
+					return( -1 );
+				buf = uring_buffer( r, &idx );
+			}
+			if ( (buf != NULL) && (uring_send_queue(r, sock, buf, idx, blk, len) == 0) )
+			{
+				/* Out of buffers, push the batch */
+				if ( (net_nsends == URING_NBUFS) && (uring_flush(r, NULL, 0) == -1) )
+					return( -1 );
+				return( 0 );
+			}
+			if ( buf != NULL )
+				uring_release( r, idx );
+		}
+		if ( (net_nsends > 0) && (uring_flush(r, NULL, 0) == -1) )
+			return( -1 );
+	}
+
 	/* Send data using the socket */
-	if ( send(sock, blk, len, 0) != len )
+	if ( send_all(sock, blk, len) != 0 )
 	{
 		/* Complain, explain, and return */
-		errorMessage( "failed socket send [short send]\n" );
-		exit( -1 );
+		char msg[128];
+		sprintf( msg, "failed socket send [%.64s]\n", strerror(errno) );
+		errorMessage( msg );
+		return( -1 );
 	}
 
 	/* printBuffer( "sent data : ", blk, len ); */
 
 	return( 0 );
 }
+
+/**********************************************************************
+
+    Function    : net_flush
+    Description : push out any sends still queued for the socket
+    Inputs      : sock - the socket
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int net_flush( int sock )
+{
+	IoRing *r = uring_thread();
+
+	if ( (r != NULL) && (net_nsends > 0) && (uring_flush(r, NULL, 0) == -1) )
+		return( -1 );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : net_conn_init
+    Description : set up a buffered connection on a connected socket
+    Inputs      : conn - the connection
+                  sock - the socket
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int net_conn_init( NetConn *conn, int sock )
+{
+	int on = 1;
+
+	/* Frames are gathered here, so Nagle only adds delay */
+	memset( conn, 0, sizeof(NetConn) );
+	conn->sock = sock;
+	if ( setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0 )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "failed setting TCP_NODELAY [%.64s]\n", strerror(errno) );
+		errorMessage( msg );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : net_queue
+    Description : queue a frame on the connection; the data is not
+                  copied and must stay put until net_send
+    Inputs      : conn - the connection
+                  blk - the frame
+                  len - its length
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int net_queue( NetConn *conn, char *blk, int len )
+{
+	if ( (conn->niov == NET_IOV_MAX) && (net_send(conn) != 0) )
+		return( -1 );
+	conn->iov[conn->niov].iov_base = blk;
+	conn->iov[conn->niov].iov_len = len;
+	conn->niov++;
+	conn->queued += len;
+	conn->frames++;
+
+	/* Enough to be worth a system call */
+	if ( conn->queued >= NET_COALESCE )
+		return( net_send(conn) );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : net_send
+    Description : send all the queued frames, together
+    Inputs      : conn - the connection
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int net_send( NetConn *conn )
+{
+	struct iovec *iov = conn->iov;
+	struct msghdr msg;
+	int i, n = conn->niov;
+	ssize_t ret;
+
+	/* The ring batches its own sends */
+	if ( uring_thread() != NULL )
+	{
+		for ( i=0; i<n; i++ )
+			if ( send_data(conn->sock, iov[i].iov_base, iov[i].iov_len) != 0 )
+				return( -1 );
+		n = 0;
+	}
+
+	/* One sendmsg for all of them, picking up after a short send */
+	memset( &msg, 0, sizeof(msg) );
+	while ( n > 0 )
+	{
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		if ( (ret = sendmsg(conn->sock, &msg, MSG_NOSIGNAL)) == -1 )
+		{
+			if ( errno == EINTR )
+				continue;
+
+			/* Complain, explain, and return */
+			char emsg[128];
+			sprintf( emsg, "failed socket send [%.64s]\n", strerror(errno) );
+			errorMessage( emsg );
+			return( -1 );
+		}
+		conn->sends++;
+		while ( (n > 0) && ((size_t)ret >= iov->iov_len) )
+		{
+			ret -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if ( n > 0 )
+		{
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	conn->niov = 0;
+	conn->queued = 0;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : net_recv
+    Description : send anything queued, then receive as much as the
+                  socket has (at least one byte)
+    Inputs      : conn - the connection
+                  blk - block to put data in
+                  sz - maximum size of buffer
+    Outputs     : bytes read if successful, -1 if failure
+
+***********************************************************************/
+
+int net_recv( NetConn *conn, char *blk, int sz )
+{
+	/* The peer may be waiting on what we queued */
+	if ( net_send(conn) != 0 )
+		return( -1 );
+	conn->recvs++;
+	return( recv_data(conn->sock, blk, sz, 1) );
+}
@@ -31,14 +31,32 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***********************************************************************/
 
 /* Include Files */
+#include <sys/uio.h>
 
 /* Defines */
 #define PROTOCOL_PORT 9165
+#define DEFAULT_BACKLOG SOMAXCONN
+#define NET_IOV_MAX 64              /* frames gathered into one send */
+#define NET_COALESCE (1024*1024)    /* bytes gathered before a send */
 
 #if defined(sun)
 #define	INADDR_NONE		((in_addr_t) 0xffffffff)
 #endif
 
+/* Data Structures */
+
+/* This is a buffered connection: frames queued on it go out together
+   in one writev, and reads take whatever the socket has */
+typedef struct {
+	int            sock;                /* the socket */
+	struct iovec   iov[NET_IOV_MAX];    /* frames waiting to go */
+	int            niov;
+	unsigned long  queued;              /* bytes in iov */
+	unsigned long  frames;              /* frames queued, ever */
+	unsigned long  sends;               /* send system calls made */
+	unsigned long  recvs;               /* receive system calls made */
+} NetConn;
+
 /*  Functional Prototypes */
 
 /**********************************************************************
@@ -55,11 +73,14 @@ int connect_client( char *addr );
 
     Function    : server_connect
     Description : connnect a server socket to listen for
-    Inputs      : none
+    Inputs      : backlog - length of the pending connection queue
+                  reuseport - share the port with other listeners
+                              (SO_REUSEPORT), so the kernel spreads
+                              connections across them
     Outputs     : file handle if successful, -1 if failure
 
 ***********************************************************************/
-int server_connect( void );
+int server_connect( int backlog, int reuseport );
 
 /**********************************************************************
 
@@ -71,6 +92,41 @@ int server_connect( void );
 ***********************************************************************/
 int server_accept( int sock );
 
+/**********************************************************************
+
+    Function    : set_nonblocking
+    Description : put the socket into non-blocking mode
+    Inputs      : sock - the socket
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+int set_nonblocking( int sock );
+
+/**********************************************************************
+
+    Function    : recv_avail
+    Description : receive whatever data a non-blocking socket has ready
+    Inputs      : sock - the socket
+                  blk - block to put data in
+                  sz - maxmimum size of buffer
+    Outputs     : bytes read (0 if the read would block), -1 on error
+                  or when the peer closed the connection
+
+***********************************************************************/
+int recv_avail( int sock, char *blk, int sz );
+
+/**********************************************************************
+
+    Function    : send_avail
+    Description : send as much data as a non-blocking socket will take
+    Inputs      : sock - the socket
+                  blk - block to send
+                  len - length of data to send
+    Outputs     : bytes sent (0 if the send would block), -1 on error
+
+***********************************************************************/
+int send_avail( int sock, char *blk, int len );
+
 /**********************************************************************
 
     Function    : recv_data
@@ -87,7 +143,8 @@ int recv_data( int sock, char *blk, int sz, int minsz );
 /**********************************************************************
 
     Function    : send_data
-    Description : send  data to the socket
+    Description : send  data to the socket (with io_uring enabled the
+                  send may be queued until the next recv_data/net_flush)
     Inputs      : sock - server socket
                   blk - block to put data in
                   len - length of data to send
@@ -96,5 +153,62 @@ int recv_data( int sock, char *blk, int sz, int minsz );
 ***********************************************************************/
 int send_data( int sock, char *blk, int len );
 
+/**********************************************************************
+
+    Function    : net_flush
+    Description : push out any sends still queued for the socket
+    Inputs      : sock - the socket
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+int net_flush( int sock );
+
+/**********************************************************************
+
+    Function    : net_conn_init
+    Description : set up a buffered connection on a connected socket
+    Inputs      : conn - the connection
+                  sock - the socket
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+int net_conn_init( NetConn *conn, int sock );
+
+/**********************************************************************
+
+    Function    : net_queue
+    Description : queue a frame on the connection; the data is not
+                  copied and must stay put until net_send
+    Inputs      : conn - the connection
+                  blk - the frame
+                  len - its length
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+int net_queue( NetConn *conn, char *blk, int len );
+
+/**********************************************************************
+
+    Function    : net_send
+    Description : send all the queued frames, together
+    Inputs      : conn - the connection
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+int net_send( NetConn *conn );
+
+/**********************************************************************
+
+    Function    : net_recv
+    Description : send anything queued, then receive as much as the
+                  socket has (at least one byte)
+    Inputs      : conn - the connection
+                  blk - block to put data in
+                  sz - maximum size of buffer
+    Outputs     : bytes read if successful, -1 if failure
+
+***********************************************************************/
+int net_recv( NetConn *conn, char *blk, int sz );
+
 #define CSE543_NETWORK_INCLUDED
 #endif
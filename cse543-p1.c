@@ -46,12 +46,46 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "cse543-util.h"
 #include "cse543-proto.h"
 #include "cse543-network.h"
+#include "cse543-core.h"
+#include "cse543-source.h"
+#include "cse543-sink.h"
+#include "cse543-queue.h"
+#include "cse543-pipeline.h"
 
 
 /* Definitions */
-#define ARGUMENTS "dr"
-#define USAGE "USAGE: cse543-p1 <filename> <server  IP address> \n"
-#define SERVER_USAGE "USAGE: cse543-p1-server <private_key_file> <public_key_file>\n"
+#define ARGUMENTS "us:f:j:k:t:x"
+#define USAGE "USAGE: cse543-p1 [-u] [-s bytes] [-f source] [-j threads] [-k keyfile] [-t ticketfile] [-x] <filename> <server  IP address> \n" \
+	"  -u        - batch socket I/O through io_uring (falls back if unavailable)\n" \
+	"  -s bytes  - file bytes per block to propose to the server\n" \
+	"  -f source - how to read the file (read, mmap, fadvise, direct)\n" \
+	"  -j threads - encryptor threads (0 = one per core)\n" \
+	"  -k keyfile - server public key saved by the first full exchange; the next\n" \
+	"               transfers send the key with the command (one round trip)\n" \
+	"               and refuse a server that presents a different key\n" \
+	"  -t ticketfile - resumption ticket kept from the last transfer; the next\n" \
+	"               one resumes with it and skips the RSA exchange\n" \
+	"  -x        - offer the X25519 exchange, agreeing the key with the server's\n" \
+	"               signed share instead of sealing it with RSA\n"
+#define SERVER_ARGUMENTS "w:b:t:r:um:d:i:l:ce:a:x:q:o:T:n:"
+#define SERVER_USAGE "USAGE: cse543-p1-server [-w workers] [-b backlog] [-t threads] [-r threads] [-u] [-m bytes] [-d secs] [-i secs] [-l secs] [-c] [-e secs] [-a count] [-x count] [-q bytes] [-o sink] [-T test [-n count]] <private_key_file> <public_key_file>\n" \
+	"  -w workers - SO_REUSEPORT listener processes, one pinned per core (0 = all cores)\n" \
+	"  -b backlog - pending connection queue length\n" \
+	"  -t threads - decrypt/write pool threads per worker (0 = one per core)\n" \
+	"  -r threads - handshake (RSA unseal) pool threads per worker (0 = one per core)\n" \
+	"  -u         - batch file writes through io_uring (falls back if unavailable)\n" \
+	"  -m bytes   - buffer budget per session before reading stops\n" \
+	"  -d secs    - handshake deadline (0 = none)\n" \
+	"  -i secs    - idle deadline once authenticated (0 = none)\n" \
+	"  -l secs    - total session deadline (0 = none)\n" \
+	"  -c         - require a stateless address cookie before any key work\n" \
+	"  -e secs    - resumption ticket key rotation and ticket lifetime (0 = no tickets)\n" \
+	"  -a count   - key exchanges at once before clients are told to retry (0 = no limit)\n" \
+	"  -x count   - authenticated sessions at once before clients are told to retry (0 = no limit)\n" \
+	"  -q bytes   - block bytes awaiting the disk before clients are told to retry (0 = no limit)\n" \
+	"  -o sink    - how received files are written (write, aggregate, fallocate, mmap)\n" \
+	"  -T test    - run a self-test and exit (sessions, blocks, aead, suites, copies, wire, sources, sinks, pipeline, ingest, allocs, resume, kex)\n" \
+	"  -n count   - self-test size (default depends on the test)\n"
 
 /**********************************************************************
 
@@ -68,10 +102,56 @@ int main( int argc, char **argv )
 {
 #ifndef CSE543_PROTOCOL_SERVER
 	struct rm_cmd *r;
-	int err;     
+	ClientConfig cfg;
+	int err, ch;
+	char *fname, *address;
+
+	/* Process the options */
+	client_config_init( &cfg );
+	while ( (ch = getopt(argc, argv, ARGUMENTS)) != -1 )
+	{
+		switch ( ch )
+		{
+		case 'u':
+			cfg.uring = 1;
+			break;
+
+		case 's':
+			cfg.blocksize = strtoul( optarg, NULL, 0 );
+			break;
+
+		case 'f':
+			cfg.source = source_kind( optarg );
+			break;
+
+		case 'j':
+			cfg.workers = atoi( optarg );
+			break;
+
+		case 'k':
+			cfg.keyfile = optarg;
+			break;
+
+		case 't':
+			cfg.ticketfile = optarg;
+			break;
+
+		case 'x':
+			cfg.kex |= KEX_X25519;
+			break;
+
+		default:
+			/* Complain, explain, and exit */
+			errorMessage( "bad command line option\n" );
+			printf( USAGE );
+			exit( -1 );
+		}
+	}
 
 	/* Check for arguments */
-	if ( argc < 3 ) 
+	if ( (argc-optind < 2) || (cfg.blocksize < BLOCKSIZE) || 
+	     (cfg.blocksize > XFER_BLOCK_MAX) || (cfg.source < 0) ||
+	     (cfg.workers < 0) || (cfg.workers > PIPE_WORKERS_MAX) ) 
 	{
 		/* Complain, explain, and exit */
 		errorMessage( "missing or bad command line arguments\n" );
@@ -83,7 +163,9 @@ int main( int argc, char **argv )
 	/* with file, command, file_type */
         char * cmd = "1";
         char * type = "1";
-	err = make_req_struct( &r, argv[1], cmd, type );
+	fname = argv[optind];
+	address = argv[optind+1];
+	err = make_req_struct( &r, fname, cmd, type );
 	if (err) {
 		errorMessage( "cannot process request line into command\n" );
 		printf( USAGE );
@@ -92,25 +174,25 @@ int main( int argc, char **argv )
 
 	/* Check it exists and is readable */
 	struct stat st;
-	int status = stat( argv[1], &st ), 
+	int status = stat( fname, &st ), 
 		readable = ( ((st.st_uid == getuid()) && (st.st_mode&S_IRUSR)) || 
 			     (st.st_mode&S_IROTH) );
 	if  ( (status == -1) || (!readable) )
 	{
 		/* Complain, explain, and exit */
 		char msg[128];
-		sprintf( msg, "non-existant or unreable file [%.64s]\n", argv[1] );
+		sprintf( msg, "non-existant or unreable file [%.64s]\n", fname );
 		errorMessage( msg );
 		printf( USAGE );
 		exit( -1 );
 	}
 
 	/* Check the address */
-	if  ( inet_addr(argv[2]) == INADDR_NONE )
+	if  ( inet_addr(address) == INADDR_NONE )
 	{
 		/* Complain, explain, and exit */
 		char msg[128];
-		sprintf( msg, "Bad server IP address [%.64s]\n", argv[2] );
+		sprintf( msg, "Bad server IP address [%.64s]\n", address );
 		errorMessage( msg );
 		printf( USAGE );
 		exit( -1 );
@@ -118,13 +200,102 @@ int main( int argc, char **argv )
 
 
 	/* Now print some preamble and get into the protocol, exit */
-	printf( "Transfer beginning, file [%s]\n", argv[1] );
-	return ( client_secure_transfer( r, argv[1], argv[2]) );
+	printf( "Transfer beginning, file [%s]\n", fname );
+	return ( client_secure_transfer( r, fname, address, &cfg ) );
 
 #else
+	ServerConfig cfg;
+	int ch;
+
+	/* Process the options */
+	server_config_init( &cfg );
+	while ( (ch = getopt(argc, argv, SERVER_ARGUMENTS)) != -1 )
+	{
+		switch ( ch )
+		{
+		case 'w':
+			cfg.workers = atoi( optarg );
+			break;
+
+		case 'b':
+			cfg.backlog = atoi( optarg );
+			break;
+
+		case 't':
+			cfg.threads = atoi( optarg );
+			break;
+
+		case 'r':
+			cfg.rsa_threads = atoi( optarg );
+			break;
+
+		case 'u':
+			cfg.uring = 1;
+			break;
+
+		case 'm':
+			cfg.session_budget = strtoul( optarg, NULL, 0 );
+			break;
+
+		case 'd':
+			cfg.handshake_timeout = atoi( optarg );
+			break;
+
+		case 'i':
+			cfg.idle_timeout = atoi( optarg );
+			break;
+
+		case 'l':
+			cfg.session_timeout = atoi( optarg );
+			break;
+
+		case 'c':
+			cfg.cookies = 1;
+			break;
+
+		case 'e':
+			cfg.ticket_lifetime = atoi( optarg );
+			break;
+
+		case 'a':
+			cfg.max_handshakes = atoi( optarg );
+			break;
+
+		case 'x':
+			cfg.max_transfers = atoi( optarg );
+			break;
+
+		case 'q':
+			cfg.max_queued = strtoul( optarg, NULL, 0 );
+			break;
+
+		case 'o':
+			cfg.sink = sink_kind( optarg );
+			break;
+
+		case 'T':
+			cfg.test = optarg;
+			break;
+
+		case 'n':
+			cfg.count = atoi( optarg );
+			break;
+
+		default:
+			/* Complain, explain, and exit */
+			errorMessage( "bad command line option\n" );
+			printf( SERVER_USAGE );
+			exit( -1 );
+		}
+	}
 
 	/* Check for arguments */
-	if ( argc < 3 ) 
+	if ( (argc-optind < 2) || (cfg.workers < 0) || (cfg.backlog < 1) ||
+	     (cfg.threads < 0) || (cfg.rsa_threads < 0) || (cfg.count < 0) ||
+	     (cfg.handshake_timeout < 0) || (cfg.idle_timeout < 0) || 
+	     (cfg.session_timeout < 0) || (cfg.max_handshakes < 0) || 
+	     (cfg.max_transfers < 0) || (cfg.sink < 0) || (cfg.ticket_lifetime < 0) ||
+	     (cfg.session_budget < 2*(sizeof(ProtoMessageHdr)+MAX_BLOCK_SIZE)) ) 
 	{
 		/* Complain, explain, and exit */
 		errorMessage( "missing or bad command line arguments\n" );
@@ -133,8 +304,8 @@ int main( int argc, char **argv )
 	}
 
 	/* Just run the server */
-	/* argv1 - private key file, argv2 - public key file */
-	server_secure_transfer( argv[1], argv[2] );
+	/* private key file, public key file */
+	server_secure_transfer( argv[optind], argv[optind+1], &cfg );
 	return( 0 );
 
 #endif
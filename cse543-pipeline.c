@@ -0,0 +1,512 @@
+/**********************************************************************
+
+   File          : cse543-pipeline.c
+
+   Description   : This is the client's transfer pipeline.  Block n
+                   always lives in frame n % depth, so the reader and
+                   the sender meet in order around the ring while the
+                   encryptors take read frames from a lock-free queue
+                   and seal them under their own sequence numbers, each
+                   with its own keyed cipher.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-proto.h"
+#include "cse543-core.h"
+#include "cse543-aead.h"
+#include "cse543-source.h"
+#include "cse543-queue.h"
+#include "cse543-pipeline.h"
+
+/* Defines */
+#define PIPE_TEST_FILE "cse543-pipeline-test.XXXXXX"
+#define PIPE_TEST_HOLD 64    /* ring sized for a sender holding this many, so
+                                the reader runs well ahead of the encryptors */
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : pipe_stopped
+    Description : check whether the stages should finish
+    Inputs      : p - the pipeline
+    Outputs     : non-zero if stopped or failed
+
+***********************************************************************/
+
+static int pipe_stopped( Pipeline *p )
+{
+	return( __atomic_load_n(&p->stop, __ATOMIC_ACQUIRE) || 
+		__atomic_load_n(&p->failed, __ATOMIC_ACQUIRE) );
+}
+
+/**********************************************************************
+
+    Function    : pipe_reader
+    Description : reader thread; fills free frames from the file in
+                  order and queues them for the encryptors
+    Inputs      : arg - the pipeline
+    Outputs     : NULL
+
+***********************************************************************/
+
+static void *pipe_reader( void *arg )
+{
+	Pipeline *p = (Pipeline *)arg;
+	unsigned int tries;
+	PipeSlot *slot;
+	uint64_t seq;
+	int i, len;
+
+	for ( seq=0; !pipe_stopped(p); seq++ )
+	{
+		/* Wait for the sender to be done with this frame */
+		slot = &p->slots[seq % p->depth];
+		for ( tries=0; (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != PIPE_FREE) && 
+			      !pipe_stopped(p); )
+			queue_backoff( &tries );
+		if ( pipe_stopped(p) )
+			break;
+
+		if ( (len = source_next(p->src, CORE_FRAME_PAYLOAD(&slot->frame), 
+					p->blocksize, &slot->data)) == -1 )
+		{
+			__atomic_store_n( &p->failed, 1, __ATOMIC_RELEASE );
+			break;
+		}
+		slot->len = len;
+		slot->seq = seq;
+
+		/* The end of the file needs no sealing, the sender stops there */
+		if ( len == 0 )
+		{
+			__atomic_store_n( &slot->state, PIPE_SEALED, __ATOMIC_RELEASE );
+			break;
+		}
+		__atomic_store_n( &slot->state, PIPE_READ, __ATOMIC_RELEASE );
+		for ( tries=0; (queue_push(&p->work, slot) != 0) && !pipe_stopped(p); )
+			queue_backoff( &tries );
+	}
+
+	/* Tell each encryptor there is no more */
+	for ( i=0; i<p->nworkers; i++ )
+		for ( tries=0; (queue_push(&p->work, NULL) != 0) && !pipe_stopped(p); )
+			queue_backoff( &tries );
+	return( NULL );
+}
+
+/**********************************************************************
+
+    Function    : pipe_encryptor
+    Description : encryptor thread; seals read frames in place (or from
+                  the source's buffer) under the block's sequence number
+    Inputs      : arg - the pipeline
+    Outputs     : NULL
+
+***********************************************************************/
+
+static void *pipe_encryptor( void *arg )
+{
+	Pipeline *p = (Pipeline *)arg;
+	unsigned int tries = 0, outlen;
+	AeadSession aead;
+	PipeSlot *slot;
+
+	if ( aead_init(&aead, p->key, p->suite, AEAD_CLIENT) != 0 )
+	{
+		__atomic_store_n( &p->failed, 1, __ATOMIC_RELEASE );
+		return( NULL );
+	}
+	while ( !pipe_stopped(p) )
+	{
+		if ( queue_pop(&p->work, (void **)&slot) != 0 )
+		{
+			queue_backoff( &tries );
+			continue;
+		}
+		tries = 0;
+		if ( slot == NULL )
+			break;
+		if ( aead_seal_at(&aead, slot->seq, (unsigned char *)slot->data, slot->len, 
+				  (unsigned char *)CORE_FRAME_BODY(&slot->frame), &outlen) != 0 )
+		{
+			__atomic_store_n( &p->failed, 1, __ATOMIC_RELEASE );
+			break;
+		}
+		slot->frame.len = outlen;
+		__atomic_store_n( &slot->state, PIPE_SEALED, __ATOMIC_RELEASE );
+	}
+	aead_free( &aead );
+	return( NULL );
+}
+
+/**********************************************************************
+
+    Function    : pipe_start
+    Description : allocate the ring and start the reader and encryptors
+    Inputs      : p - the pipeline
+                  src - the open file source
+                  key - the session key
+                  suite - the cipher suite (SUITE_*)
+                  blocksize - file bytes per block
+                  workers - encryptor threads, 0 for one per core
+                  hold - most frames the sender keeps before releasing
+                   them; the ring is sized to keep everyone busy
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int pipe_start( Pipeline *p, FileSource *src, unsigned char *key, int suite, 
+		unsigned int blocksize, int workers, unsigned int hold )
+{
+	unsigned int i;
+
+	/* Enough frames for what the sender holds, what is being sealed,
+	   and as much again read ahead; never fewer than the sender holds
+	   plus one, or the reader could wait on the sender forever */
+	memset( p, 0, sizeof(Pipeline) );
+	if ( workers == 0 )
+		workers = sysconf( _SC_NPROCESSORS_ONLN );
+	workers = (workers < 1) ? 1 : (workers > PIPE_WORKERS_MAX) ? PIPE_WORKERS_MAX : workers;
+	p->depth = 2 * (hold + workers);
+	if ( p->depth > PIPE_DEPTH_MAX )
+		p->depth = (hold+1 > PIPE_DEPTH_MAX) ? hold+1 : PIPE_DEPTH_MAX;
+	p->src = src;
+	p->blocksize = blocksize;
+	memcpy( p->key, key, KEYSIZE );
+	p->suite = suite;
+	if ( ((p->slots = (PipeSlot *)calloc(p->depth, sizeof(PipeSlot))) == NULL) ||
+	     ((p->workers = (pthread_t *)calloc(workers, sizeof(pthread_t))) == NULL) ||
+	     (queue_init(&p->work, p->depth+workers) != 0) )
+	{
+		errorMessage( "failed to allocate the transfer pipeline\n" );
+		pipe_stop( p );
+		return( -1 );
+	}
+	for ( i=0; i<p->depth; i++ )
+		if ( core_frame_init(&p->slots[i].frame, AEAD_OVERHEAD, blocksize) != 0 )
+		{
+			errorMessage( "failed to allocate transfer blocks\n" );
+			pipe_stop( p );
+			return( -1 );
+		}
+
+	/* Encryptors first, the reader tells however many started to stop */
+	for ( ; p->nworkers<workers; p->nworkers++ )
+		if ( pthread_create(&p->workers[p->nworkers], NULL, pipe_encryptor, p) != 0 )
+			break;
+	if ( (p->nworkers == 0) || 
+	     (pthread_create(&p->reader, NULL, pipe_reader, p) != 0) )
+	{
+		errorMessage( "failed to start the transfer pipeline\n" );
+		pipe_stop( p );
+		return( -1 );
+	}
+	p->reading = 1;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : pipe_next
+    Description : wait for the next sealed block, in order
+    Inputs      : p - the pipeline
+    Outputs     : the slot holding it, NULL at the end of the file or
+                  if a stage failed (p->failed says which)
+
+***********************************************************************/
+
+PipeSlot *pipe_next( Pipeline *p )
+{
+	PipeSlot *slot = &p->slots[p->next % p->depth];
+	unsigned int tries = 0;
+
+	while ( __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != PIPE_SEALED )
+	{
+		if ( pipe_stopped(p) )
+			return( NULL );
+		queue_backoff( &tries );
+	}
+	if ( slot->len == 0 )
+		return( NULL );
+	p->next++;
+	return( slot );
+}
+
+/**********************************************************************
+
+    Function    : pipe_release
+    Description : hand a slot back to the reader once its frame is sent
+    Inputs      : p - the pipeline
+                  slot - the slot
+    Outputs     : none
+
+***********************************************************************/
+
+void pipe_release( Pipeline *p, PipeSlot *slot )
+{
+	__atomic_store_n( &slot->state, PIPE_FREE, __ATOMIC_RELEASE );
+}
+
+/**********************************************************************
+
+    Function    : pipe_stop
+    Description : stop and join the stages and free the ring
+    Inputs      : p - the pipeline
+    Outputs     : 0 if every stage succeeded, -1 if failure
+
+***********************************************************************/
+
+int pipe_stop( Pipeline *p )
+{
+	unsigned int i;
+	int n;
+
+	__atomic_store_n( &p->stop, 1, __ATOMIC_RELEASE );
+	if ( p->reading )
+		pthread_join( p->reader, NULL );
+	for ( n=0; n<p->nworkers; n++ )
+		pthread_join( p->workers[n], NULL );
+	for ( i=0; (p->slots != NULL) && (i<p->depth); i++ )
+		core_frame_free( &p->slots[i].frame );
+	free( p->slots );
+	free( p->workers );
+	queue_free( &p->work );
+	OPENSSL_cleanse( p->key, KEYSIZE );
+	p->slots = NULL;
+	p->workers = NULL;
+	p->reading = p->nworkers = 0;
+	return( p->failed ? -1 : 0 );
+}
+
+/**********************************************************************
+
+    Function    : test_elapsed
+    Description : get the seconds since a start time
+    Inputs      : start - the start time
+    Outputs     : seconds
+
+***********************************************************************/
+
+static double test_elapsed( struct timespec *start )
+{
+	struct timespec end;
+
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	return( (end.tv_sec-start->tv_sec) + (end.tv_nsec-start->tv_nsec)/1e9 );
+}
+
+/**********************************************************************
+
+    Function    : test_pipeline_check
+    Description : send a file through the pipeline from one source and
+                  open every block, checking it against the file's bytes
+                  at that block's offset
+    Inputs      : kind - the source
+                  fname - the file
+                  key - the session key
+                  blocksize - file bytes per block
+                  workers - encryptor threads
+                  total - bytes in the file
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int test_pipeline_check( SourceKind kind, const char *fname, unsigned char *key, 
+				unsigned int blocksize, int workers, unsigned long total )
+{
+	unsigned long blocks = 0, bad = 0, bytes = 0;
+	unsigned char *plain, *expect;
+	unsigned int outlen;
+	AeadSession aead;
+	FileSource src;
+	Pipeline pipe;
+	PipeSlot *slot;
+	int fd, ret = 0;
+
+	memset( &aead, 0, sizeof(aead) );
+	plain = (unsigned char *)malloc( blocksize );
+	expect = (unsigned char *)malloc( blocksize );
+	if ( (plain == NULL) || (expect == NULL) || ((fd = open(fname, O_RDONLY)) == -1) )
+	{
+		errorMessage( "pipeline check unable to set up\n" );
+		free( plain );
+		free( expect );
+		return( -1 );
+	}
+	if ( (aead_init(&aead, key, SUITE_DEFAULT, AEAD_SERVER) != 0) ||
+	     (source_open(&src, kind, fname) != 0) )
+		ret = -1;
+	else if ( pipe_start(&pipe, &src, key, SUITE_DEFAULT, blocksize, workers, PIPE_TEST_HOLD) != 0 )
+	{
+		source_close( &src );
+		ret = -1;
+	}
+	else
+	{
+		for ( ; (slot = pipe_next(&pipe)) != NULL; blocks++ )
+		{
+			if ( (aead_open(&aead, (unsigned char *)CORE_FRAME_BODY(&slot->frame), 
+					slot->frame.len, plain, &outlen) != 0) ||
+			     (pread(fd, expect, blocksize, (off_t)slot->seq*blocksize) != (ssize_t)outlen) ||
+			     (memcmp(plain, expect, outlen) != 0) )
+				bad++;
+			else
+				bytes += outlen;
+			pipe_release( &pipe, slot );
+		}
+		if ( (pipe_stop(&pipe) != 0) || (bad != 0) || (bytes != total) )
+			ret = -1;
+		printf( "Pipeline %-7s: %lu of %lu blocks opened to the file's bytes, %d encryptors\n", 
+			source_name(src.kind), blocks-bad, blocks, workers );
+		source_close( &src );
+	}
+	if ( ret != 0 )
+		errorMessage( "pipeline sealed blocks that do not match the file\n" );
+
+	close( fd );
+	aead_free( &aead );
+	free( plain );
+	free( expect );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_pipeline
+    Description : read and seal a file through the pipeline with more
+                  and more encryptors (up to the cores, and at least
+                  two so blocks finish out of order), against the same
+                  work done on one thread, then check what every source
+                  seals opens to the file
+    Inputs      : count - MiB in the file, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_pipeline( int count )
+{
+	unsigned int blocksize = XFER_BLOCK_DEFAULT, outlen;
+	unsigned long total, bytes;
+	unsigned char key[KEYSIZE], *chunk;
+	char fname[] = PIPE_TEST_FILE, *data;
+	ProtoFrame frame;
+	FileSource src;
+	AeadSession aead;
+	Pipeline pipe;
+	PipeSlot *slot;
+	struct timespec start;
+	double serial, secs;
+	int fd, i, n, kind, workers, cores = sysconf( _SC_NPROCESSORS_ONLN ), ret = 0;
+
+	count = (count > 0) ? count : PIPE_TEST_COUNT;
+	total = (unsigned long)count * 1024 * 1024;
+	printf( "*** Test transfer pipeline, %d MiB in %u byte blocks, %d cores. ***\n", 
+		count, blocksize, cores );
+
+	/* A file in the page cache, so sealing is the work */
+	memset( &aead, 0, sizeof(aead) );
+	memset( &frame, 0, sizeof(frame) );
+	if ( ((chunk = (unsigned char *)malloc(1024*1024)) == NULL) ||
+	     (generate_pseudorandom_bytes(key, KEYSIZE) != 0) ||
+	     (core_frame_init(&frame, AEAD_OVERHEAD, blocksize) != 0) ||
+	     (aead_init(&aead, key, SUITE_DEFAULT, AEAD_CLIENT) != 0) ||
+	     ((fd = mkstemp(fname)) == -1) )
+	{
+		errorMessage( "pipeline test unable to set up\n" );
+		free( chunk );
+		core_frame_free( &frame );
+		aead_free( &aead );
+		return( -1 );
+	}
+	/* Every MiB different, so a block sealed from the wrong one shows */
+	for ( i=0; (i<count) && (ret == 0); i++ )
+		if ( (generate_pseudorandom_bytes(chunk, 1024*1024) != 0) ||
+		     (write(fd, chunk, 1024*1024) != 1024*1024) )
+			ret = -1;
+	close( fd );
+
+	/* One thread: read, then seal, then the next */
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	if ( (ret == 0) && (source_open(&src, SOURCE_READ, fname) == 0) )
+	{
+		while ( (n = source_next(&src, CORE_FRAME_PAYLOAD(&frame), blocksize, &data)) > 0 )
+			if ( aead_seal(&aead, (unsigned char *)data, n, 
+				       (unsigned char *)CORE_FRAME_BODY(&frame), &outlen) != 0 )
+				ret = -1;
+		source_close( &src );
+	}
+	else
+		ret = -1;
+	serial = test_elapsed( &start );
+	if ( ret == 0 )
+		printf( "Serial          : %8.1f MiB/s\n", total/serial/(1024*1024) );
+
+	/* The pipeline, with the sender handing each block straight back */
+	for ( workers=1; (workers<=PIPE_WORKERS_MAX) && (ret == 0); workers*=2 )
+	{
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		if ( (source_open(&src, SOURCE_READ, fname) != 0) ||
+		     (pipe_start(&pipe, &src, key, SUITE_DEFAULT, blocksize, workers, 1) != 0) )
+		{
+			ret = -1;
+			break;
+		}
+		for ( bytes=0; (slot = pipe_next(&pipe)) != NULL; bytes+=slot->len )
+			pipe_release( &pipe, slot );
+		if ( (pipe_stop(&pipe) != 0) || (bytes != total) )
+			ret = -1;
+		source_close( &src );
+		secs = test_elapsed( &start );
+		printf( "Pipeline %2d enc : %8.1f MiB/s (%.2fx serial)\n", 
+			workers, total/secs/(1024*1024), serial/secs );
+		if ( (workers >= cores) && (workers >= 2) )
+			break;
+	}
+
+	/* Every source, with blocks sealed out of order */
+	workers = (cores < 2) ? 2 : (cores > PIPE_WORKERS_MAX) ? PIPE_WORKERS_MAX : cores;
+	for ( kind=0; (kind<SOURCE_KINDS) && (ret == 0); kind++ )
+		ret = test_pipeline_check( kind, fname, key, blocksize, workers, total );
+
+	unlink( fname );
+	free( chunk );
+	core_frame_free( &frame );
+	aead_free( &aead );
+	return( ret );
+}
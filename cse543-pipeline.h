@@ -0,0 +1,147 @@
+#ifndef CSE543_PIPELINE_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-pipeline.h
+
+   Description   : This is the client's transfer pipeline: a reader
+                   thread fills a ring of frames from the file source,
+                   encryptor threads seal them in any order, and the
+                   sender takes them back in order to put on the wire.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdint.h>
+#include <pthread.h>
+
+/* Defines */
+#define PIPE_WORKERS_MAX 16     /* most encryptor threads */
+#define PIPE_DEPTH_MAX 256      /* most frames in the ring */
+#define PIPE_TEST_COUNT 256     /* MiB sealed per run by test_pipeline */
+
+/* Data Structures */
+
+/* Where a frame is in the pipeline */
+typedef enum {
+	PIPE_FREE,           /* the reader may fill it */
+	PIPE_READ,           /* waiting for an encryptor */
+	PIPE_SEALED,         /* waiting for the sender */
+} PipeState;
+
+/* This is one frame of the ring */
+typedef struct {
+	ProtoFrame        frame;     /* the sealed block, sent from here */
+	char             *data;      /* the plaintext (in the frame, or the source's) */
+	int               len;       /* plaintext bytes, 0 for the end of the file */
+	uint64_t          seq;       /* block sequence number */
+	PipeState         state;     /* whose it is */
+} PipeSlot;
+
+/* This is the pipeline */
+typedef struct {
+	FileSource       *src;       /* the file */
+	unsigned char     key[KEYSIZE];  /* session key, for each encryptor */
+	int               suite;     /* and its cipher suite */
+	unsigned int      blocksize; /* file bytes per block */
+	PipeSlot         *slots;     /* ring of frames, block seq in slot seq % depth */
+	unsigned int      depth;
+	BoundedQueue      work;      /* read frames for the encryptors */
+	pthread_t         reader;
+	int               reading;   /* the reader was started */
+	pthread_t        *workers;
+	int               nworkers;  /* encryptors running */
+	uint64_t          next;      /* next block for the sender */
+	int               stop;      /* tell every stage to finish */
+	int               failed;    /* a stage failed */
+} Pipeline;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : pipe_start
+    Description : allocate the ring and start the reader and encryptors
+    Inputs      : p - the pipeline
+                  src - the open file source
+                  key - the session key
+                  suite - the cipher suite (SUITE_*)
+                  blocksize - file bytes per block
+                  workers - encryptor threads, 0 for one per core
+                  hold - most frames the sender keeps before releasing
+                   them; the ring is sized to keep everyone busy
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int pipe_start( Pipeline *p, FileSource *src, unsigned char *key, int suite, 
+		       unsigned int blocksize, int workers, unsigned int hold );
+
+/**********************************************************************
+
+    Function    : pipe_next
+    Description : wait for the next sealed block, in order
+    Inputs      : p - the pipeline
+    Outputs     : the slot holding it, NULL at the end of the file or
+                  if a stage failed (p->failed says which)
+
+***********************************************************************/
+extern PipeSlot *pipe_next( Pipeline *p );
+
+/**********************************************************************
+
+    Function    : pipe_release
+    Description : hand a slot back to the reader once its frame is sent
+    Inputs      : p - the pipeline
+                  slot - the slot
+    Outputs     : none
+
+***********************************************************************/
+extern void pipe_release( Pipeline *p, PipeSlot *slot );
+
+/**********************************************************************
+
+    Function    : pipe_stop
+    Description : stop and join the stages and free the ring
+    Inputs      : p - the pipeline
+    Outputs     : 0 if every stage succeeded, -1 if failure
+
+***********************************************************************/
+extern int pipe_stop( Pipeline *p );
+
+/**********************************************************************
+
+    Function    : test_pipeline
+    Description : read and seal a file through the pipeline with more
+                  and more encryptors, against the same work done on
+                  one thread, then check what every source seals
+                  opens to the file
+    Inputs      : count - MiB in the file, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_pipeline( int count );
+
+#define CSE543_PIPELINE_INCLUDED
+#endif
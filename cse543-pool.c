@@ -0,0 +1,344 @@
+/**********************************************************************
+
+   File          : cse543-pool.c
+
+   Description   : This is a work-stealing thread pool.  Each worker
+                   has its own deque of tasks; it runs its newest task
+                   first, and when its deque is empty it steals the
+                   oldest task from another worker before going idle.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-pool.h"
+
+/* The worker running on this thread (NULL outside the pool) */
+static __thread PoolWorker *current_worker = NULL;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : deque_push
+    Description : add a task at the bottom of a deque, growing it
+    Inputs      : d - the deque
+                  task - the task
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int deque_push( PoolDeque *d, PoolTask *task )
+{
+	PoolTask *ntasks;
+	unsigned int i, n;
+
+	pthread_mutex_lock( &d->lock );
+
+	/* Full, so double the ring keeping the order */
+	if ( d->bottom-d->top == d->size )
+	{
+		n = d->size * 2;
+		if ( (ntasks = (PoolTask *)malloc(n * sizeof(PoolTask))) == NULL )
+		{
+			pthread_mutex_unlock( &d->lock );
+			return( -1 );
+		}
+		for ( i=0; i<d->size; i++ )
+			ntasks[i] = d->tasks[(d->top+i) & (d->size-1)];
+		free( d->tasks );
+		d->tasks = ntasks;
+		d->top = 0;
+		d->bottom = d->size;
+		d->size = n;
+	}
+
+	d->tasks[d->bottom & (d->size-1)] = *task;
+	d->bottom++;
+	pthread_mutex_unlock( &d->lock );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : deque_pop
+    Description : take the newest task from a deque (owner side)
+    Inputs      : d - the deque
+                  task - where to put the task
+    Outputs     : 0 if a task was taken, -1 if empty
+
+***********************************************************************/
+
+static int deque_pop( PoolDeque *d, PoolTask *task )
+{
+	int ret = -1;
+
+	pthread_mutex_lock( &d->lock );
+	if ( d->bottom != d->top )
+	{
+		d->bottom--;
+		*task = d->tasks[d->bottom & (d->size-1)];
+		ret = 0;
+	}
+	pthread_mutex_unlock( &d->lock );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : deque_steal
+    Description : take the oldest task from a deque (thief side)
+    Inputs      : d - the deque
+                  task - where to put the task
+    Outputs     : 0 if a task was taken, -1 if empty
+
+***********************************************************************/
+
+static int deque_steal( PoolDeque *d, PoolTask *task )
+{
+	int ret = -1;
+
+	/* Don't queue up behind a busy owner, try someone else */
+	if ( pthread_mutex_trylock(&d->lock) != 0 )
+		return( -1 );
+	if ( d->bottom != d->top )
+	{
+		*task = d->tasks[d->top & (d->size-1)];
+		d->top++;
+		ret = 0;
+	}
+	pthread_mutex_unlock( &d->lock );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : pool_take
+    Description : find the next task for a worker, its own first, then
+                  stolen from the others starting at a random victim
+    Inputs      : w - the worker
+                  seed - the worker's random state
+                  task - where to put the task
+    Outputs     : 0 if a task was taken, -1 if none was found
+
+***********************************************************************/
+
+static int pool_take( PoolWorker *w, unsigned int *seed, PoolTask *task )
+{
+	ThreadPool *pool = w->pool;
+	int i, victim;
+
+	if ( deque_pop(&w->deque, task) == 0 )
+		return( 0 );
+	victim = rand_r( seed ) % pool->nworkers;
+	for ( i=0; i<pool->nworkers; i++ )
+	{
+		PoolWorker *v = &pool->workers[(victim+i) % pool->nworkers];
+		if ( (v != w) && (deque_steal(&v->deque, task) == 0) )
+			return( 0 );
+	}
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : pool_worker
+    Description : run tasks until the pool shuts down and is drained
+    Inputs      : arg - the worker
+    Outputs     : NULL
+
+***********************************************************************/
+
+static void *pool_worker( void *arg )
+{
+	PoolWorker *w = (PoolWorker *)arg;
+	ThreadPool *pool = w->pool;
+	unsigned int seed = (unsigned int)w->id * 2654435761u;
+	PoolTask task;
+
+	current_worker = w;
+	while ( 1 )
+	{
+		/* Run whatever we can find */
+		if ( pool_take(w, &seed, &task) == 0 )
+		{
+			__atomic_sub_fetch( &pool->pending, 1, __ATOMIC_SEQ_CST );
+			task.fn( task.arg );
+			continue;
+		}
+
+		/* Nothing anywhere, sleep until something is submitted */
+		pthread_mutex_lock( &pool->idle_lock );
+		while ( (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) && 
+			!pool->shutdown )
+		{
+			pool->sleeping++;
+			pthread_cond_wait( &pool->idle_cond, &pool->idle_lock );
+			pool->sleeping--;
+		}
+		if ( (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) && 
+		     pool->shutdown )
+		{
+			pthread_mutex_unlock( &pool->idle_lock );
+			break;
+		}
+		pthread_mutex_unlock( &pool->idle_lock );
+	}
+
+	return( NULL );
+}
+
+/**********************************************************************
+
+    Function    : pool_create
+    Description : start a pool of worker threads
+    Inputs      : nworkers - number of threads, 0 for one per core
+    Outputs     : the pool if successful, NULL if failure
+
+***********************************************************************/
+
+ThreadPool *pool_create( int nworkers )
+{
+	ThreadPool *pool;
+	int i;
+
+	/* One worker per core unless told otherwise */
+	if ( nworkers <= 0 )
+		nworkers = sysconf( _SC_NPROCESSORS_ONLN );
+	if ( nworkers <= 0 )
+		nworkers = 1;
+
+	if ( (pool = (ThreadPool *)calloc(1, sizeof(ThreadPool))) == NULL )
+		return( NULL );
+	pool->nworkers = nworkers;
+	pool->workers = (PoolWorker *)calloc( nworkers, sizeof(PoolWorker) );
+	pool->nthreads = nworkers;
+	pthread_mutex_init( &pool->idle_lock, NULL );
+	pthread_cond_init( &pool->idle_cond, NULL );
+
+	/* Set up every deque before any thread can steal from it */
+	for ( i=0; i<nworkers; i++ )
+	{
+		PoolWorker *w = &pool->workers[i];
+		w->id = i;
+		w->pool = pool;
+		pthread_mutex_init( &w->deque.lock, NULL );
+		w->deque.size = POOL_DEQUE_SIZE;
+		w->deque.tasks = (PoolTask *)malloc( POOL_DEQUE_SIZE * sizeof(PoolTask) );
+	}
+	for ( i=0; i<nworkers; i++ )
+	{
+		if ( pthread_create(&pool->workers[i].thread, NULL, pool_worker, 
+				    &pool->workers[i]) != 0 )
+		{
+			/* Complain, explain, and run with what we have */
+			errorMessage( "failed to start pool worker thread\n" );
+			break;
+		}
+	}
+	pool->nworkers = i;
+	if ( i == 0 )
+	{
+		pool_destroy( pool );
+		return( NULL );
+	}
+
+	return( pool );
+}
+
+/**********************************************************************
+
+    Function    : pool_submit
+    Description : queue a task; from a worker thread it goes on that
+                  worker's own deque, otherwise round robin
+    Inputs      : pool - the pool
+                  fn - the task function
+                  arg - its argument
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int pool_submit( ThreadPool *pool, PoolTaskFn fn, void *arg )
+{
+	PoolTask task;
+	PoolWorker *w = current_worker;
+
+	/* Pick the deque, keep work local to the submitting worker */
+	task.fn = fn;
+	task.arg = arg;
+	if ( (w == NULL) || (w->pool != pool) )
+		w = &pool->workers[__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % 
+				   pool->nworkers];
+	if ( deque_push(&w->deque, &task) != 0 )
+		return( -1 );
+
+	/* Count it, then wake a sleeper to go find it */
+	__atomic_add_fetch( &pool->pending, 1, __ATOMIC_SEQ_CST );
+	pthread_mutex_lock( &pool->idle_lock );
+	if ( pool->sleeping > 0 )
+		pthread_cond_signal( &pool->idle_cond );
+	pthread_mutex_unlock( &pool->idle_lock );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : pool_destroy
+    Description : run the remaining tasks, stop the workers, free the pool
+    Inputs      : pool - the pool
+    Outputs     : none
+
+***********************************************************************/
+
+void pool_destroy( ThreadPool *pool )
+{
+	int i;
+
+	/* Tell everyone to finish up, wait for them */
+	pthread_mutex_lock( &pool->idle_lock );
+	pool->shutdown = 1;
+	pthread_cond_broadcast( &pool->idle_cond );
+	pthread_mutex_unlock( &pool->idle_lock );
+	for ( i=0; i<pool->nworkers; i++ )
+		pthread_join( pool->workers[i].thread, NULL );
+
+	/* Now release everything */
+	for ( i=0; i<pool->nthreads; i++ )
+	{
+		pthread_mutex_destroy( &pool->workers[i].deque.lock );
+		free( pool->workers[i].deque.tasks );
+	}
+	pthread_mutex_destroy( &pool->idle_lock );
+	pthread_cond_destroy( &pool->idle_cond );
+	free( pool->workers );
+	free( pool );
+}
@@ -0,0 +1,118 @@
+#ifndef CSE543_POOL_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-pool.h
+
+   Description   : This is a work-stealing thread pool for the server's
+                   crypto and disk work.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <pthread.h>
+
+/* Defines */
+#define POOL_DEQUE_SIZE 1024   /* initial tasks per worker deque */
+
+/* Data Structures */
+
+/* This is a unit of work */
+typedef void (*PoolTaskFn)( void *arg );
+typedef struct {
+	PoolTaskFn  fn;     /* the function to run */
+	void       *arg;    /* its argument */
+} PoolTask;
+
+/* This is a worker's deque; the owner takes from the bottom (newest),
+   thieves take from the top (oldest) */
+typedef struct {
+	pthread_mutex_t  lock;
+	PoolTask        *tasks;   /* ring of tasks */
+	unsigned int     size;    /* ring size (power of 2) */
+	unsigned int     top;     /* oldest task */
+	unsigned int     bottom;  /* one past the newest task */
+} PoolDeque;
+
+struct thread_pool;
+
+/* This is one worker thread */
+typedef struct {
+	pthread_t            thread;
+	int                  id;
+	PoolDeque            deque;
+	struct thread_pool  *pool;
+} PoolWorker;
+
+/* This is the pool */
+typedef struct thread_pool {
+	int              nworkers;    /* workers running */
+	int              nthreads;    /* workers allocated */
+	PoolWorker      *workers;
+	pthread_mutex_t  idle_lock;   /* guards pending/sleeping/shutdown */
+	pthread_cond_t   idle_cond;
+	unsigned int     pending;     /* tasks queued and not yet taken */
+	int              sleeping;    /* workers waiting for work */
+	int              shutdown;
+	unsigned int     next;        /* round robin for outside submits */
+} ThreadPool;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : pool_create
+    Description : start a pool of worker threads
+    Inputs      : nworkers - number of threads, 0 for one per core
+    Outputs     : the pool if successful, NULL if failure
+
+***********************************************************************/
+extern ThreadPool *pool_create( int nworkers );
+
+/**********************************************************************
+
+    Function    : pool_submit
+    Description : queue a task; from a worker thread it goes on that
+                  worker's own deque, otherwise round robin
+    Inputs      : pool - the pool
+                  fn - the task function
+                  arg - its argument
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int pool_submit( ThreadPool *pool, PoolTaskFn fn, void *arg );
+
+/**********************************************************************
+
+    Function    : pool_destroy
+    Description : run the remaining tasks, stop the workers, free the pool
+    Inputs      : pool - the pool
+    Outputs     : none
+
+***********************************************************************/
+extern void pool_destroy( ThreadPool *pool );
+
+#define CSE543_POOL_INCLUDED
+#endif
@@ -15,16 +15,18 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/select.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <time.h>
 
 /* OpenSSL Include Files */
 #include <openssl/conf.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/decoder.h>
 #include <openssl/rand.h>
 #include <openssl/err.h>
 #include <openssl/bn.h>
@@ -34,9 +36,20 @@
 #include "cse543-util.h"
 #include "cse543-network.h"
 #include "cse543-proto.h"
+#include "cse543-core.h"
 #include "cse543-ssl.h"
-
-#define IVSIZE 16
+#include "cse543-aead.h"
+#include "cse543-wire.h"
+#include "cse543-source.h"
+#include "cse543-sink.h"
+#include "cse543-queue.h"
+#include "cse543-pipeline.h"
+#include "cse543-slab.h"
+#include "cse543-uring.h"
+#include "cse543-timer.h"
+#include "cse543-kex.h"
+#include "cse543-keys.h"
+#include "cse543-server.h"
 
 /* Functional Prototypes */
 
@@ -78,32 +91,46 @@ int make_req_struct( struct rm_cmd **rptr, char *filename, char *cmd, char *type
 /**********************************************************************
 
     Function    : get_message
-    Description : receive data from the socket
-    Inputs      : sock - server socket
+    Description : receive the next message from the socket
+    Inputs      : conn - the server connection
+                  core - the connection's protocol state
                   hdr - the header structure
                   block - the block to read
     Outputs     : bytes read if successful, -1 if failure
 
 ***********************************************************************/
 
-int get_message( int sock, ProtoMessageHdr *hdr, char *block )
+int get_message( NetConn *conn, ProtoCore *core, ProtoMessageHdr *hdr, char *block )
 {
-	/* Read the message header */
-	recv_data( sock, (char *)hdr, sizeof(ProtoMessageHdr), 
-		   sizeof(ProtoMessageHdr) );
-	hdr->length = ntohs(hdr->length);
-	assert( hdr->length<MAX_BLOCK_SIZE );
-	hdr->msgtype = ntohs( hdr->msgtype );
-	if ( hdr->length > 0 )
-		return( recv_data( sock, block, hdr->length, hdr->length ) );
-	return( 0 );
+	ProtoEvent ev;
+	unsigned int avail;
+	char *space;
+	int ret;
+
+	/* Feed the core until it has a whole message */
+	while ( (ret = core_next_event(core, &ev)) == 0 )
+	{
+		space = core_recv_space( core, &avail );
+		if ( (ret = net_recv(conn, space, avail)) == -1 )
+			return( -1 );
+		core_received( core, ret );
+	}
+	if ( ret == -1 )
+		return( -1 );
+
+	hdr->msgtype = ev.msgtype;
+	hdr->length = ev.length;
+	if ( ev.length > 0 )
+		memcpy( block, ev.block, ev.length );
+	return( ev.length );
 }
 
 /**********************************************************************
 
     Function    : wait_message
     Description : wait for specific message type from the socket
-    Inputs      : sock - server socket
+    Inputs      : conn - the server connection
+                  core - the connection's protocol state
                   hdr - the header structure
                   block - the block to read
                   my - the message to wait for
@@ -111,49 +138,94 @@ int get_message( int sock, ProtoMessageHdr *hdr, char *block )
 
 ***********************************************************************/
 
-int wait_message( int sock, ProtoMessageHdr *hdr, 
+int wait_message( NetConn *conn, ProtoCore *core, ProtoMessageHdr *hdr, 
                  char *block, ProtoMessageType mt )
 {
 	/* Wait for init message */
-	int ret = get_message( sock, hdr, block );
+	int ret = get_message( conn, core, hdr, block );
+	if ( ret == -1 )
+		return( -1 );
 	if ( hdr->msgtype != mt )
 	{
-		/* Complain, explain, and exit */
+		/* Complain, explain, and return */
 		char msg[128];
-		sprintf( msg, "Server unable to process message type [%d != %d]\n", 
+		sprintf( msg, "Unable to process message type [%d != %d]\n", 
 			 hdr->msgtype, mt );
 		errorMessage( msg );
-		exit( -1 );
+		return( -1 );
 	}
 
 	/* Return succesfully */
 	return( ret );
 }
 
+/**********************************************************************
+
+    Function    : send_pending
+    Description : hand everything the core has framed to the connection
+    Inputs      : conn - the server connection
+                  core - the connection's protocol state
+                  defer - leave it queued on the connection (only for
+                   frames the caller keeps in place until net_send)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int send_pending( NetConn *conn, ProtoCore *core, int defer )
+{
+	unsigned int len;
+	char *out;
+
+	while ( (out = core_pending(core, &len)), len > 0 )
+	{
+		if ( net_queue(conn, out, len) != 0 )
+			return( -1 );
+		core_sent( core, len );
+	}
+
+	/* The core reuses its own buffer, so that goes out now */
+	return( defer ? 0 : net_send(conn) );
+}
+
 /**********************************************************************
 
     Function    : send_message
-    Description : send data over the socket
-    Inputs      : sock - server socket
+    Description : send a message over the socket
+    Inputs      : conn - the server connection
+                  core - the connection's protocol state
                   hdr - the header structure
                   block - the block to send
-    Outputs     : bytes read if successful, -1 if failure
+    Outputs     : 0 if successful, -1 if failure
 
 ***********************************************************************/
 
-int send_message( int sock, ProtoMessageHdr *hdr, char *block )
+int send_message( NetConn *conn, ProtoCore *core, ProtoMessageHdr *hdr, char *block )
 {
-     int real_len = 0;
-
-     /* Convert to the network format */
-     real_len = hdr->length;
-     hdr->msgtype = htons( hdr->msgtype );
-     hdr->length = htons( hdr->length );
-     if ( block == NULL )
-          return( send_data( sock, (char *)hdr, sizeof(hdr) ) );
-     else 
-          return( send_data(sock, (char *)hdr, sizeof(hdr)) ||
-                  send_data(sock, block, real_len) );
+	/* Frame it, then hand the frame to the socket */
+	if ( core_queue(core, hdr->msgtype, block, hdr->length) != 0 )
+		return( -1 );
+	return( send_pending(conn, core, 0) );
+}
+
+/**********************************************************************
+
+    Function    : send_frame
+    Description : queue a message built in a frame buffer, to go out
+                  straight from the buffer with the next net_send; the
+                  frame stays put until then
+    Inputs      : conn - the server connection
+                  core - the connection's protocol state
+                  msgtype - the message type
+                  f - the frame
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int send_frame( NetConn *conn, ProtoCore *core, ProtoMessageType msgtype, ProtoFrame *f )
+{
+	if ( core_queue_frame(core, msgtype, f) != 0 )
+		return( -1 );
+	return( send_pending(conn, core, core->frame == f->buf) );
 }
 
 
@@ -191,11 +263,8 @@ int generate_pseudorandom_bytes( unsigned char *buffer, unsigned int size)
 int encrypt_message( unsigned char *plaintext, unsigned int plaintext_len, unsigned char *key, 
 		     unsigned char *buffer, unsigned int *len )
 {
-	unsigned char *ciphertext, *tag;
-	ciphertext=(unsigned char *)malloc(plaintext_len);ciphertext[0]='\0';
-	tag=(unsigned char *)malloc((size_t)TAGSIZE);tag[0]='\0';
+	unsigned char *ciphertext=buffer+IVSIZE+TAGSIZE, tag[TAGSIZE]={'\0'}, iv[IVSIZE];
 	int clen=0;
-	unsigned char *iv=(unsigned char *)malloc((size_t)IVSIZE);
 	if(generate_pseudorandom_bytes(iv,IVSIZE)==-1) return -1;
 
 	/*
@@ -205,13 +274,14 @@ int encrypt_message( unsigned char *plaintext, unsigned int plaintext_len, unsig
 	clen=encrypt(plaintext,plaintext_len,(unsigned char *)NULL,0,key,iv,ciphertext,tag);
 	if(!((clen>0) && (clen<=plaintext_len))) return -1;
 	/*
-	* Encrypted Buffer :- a Tag + an IV + Cipher Text
+	* Encrypted Buffer :- a Tag + an IV + Cipher Text (encrypted in place, no copy)
 	*/
 	memcpy(buffer,iv,IVSIZE);
 	memcpy(buffer+IVSIZE,tag,TAGSIZE);
-	memcpy(buffer+IVSIZE+TAGSIZE,ciphertext,clen);
 	*len=IVSIZE+TAGSIZE+clen;
+#if 0
 	BIO_dump_fp(stdout,(const char *)buffer,*len);
+#endif
 	/*
 	* Take inspiration from Test AES function - We are trying to employ Symmetric Key Cryptography here
 	*/
@@ -237,18 +307,21 @@ int decrypt_message( unsigned char *buffer, unsigned int len, unsigned char *key
 		     unsigned char *plaintext, unsigned int *plaintext_len )
 {
 	int clen=0;
-	unsigned char iv[IVSIZE]={'\0'}, tag[TAGSIZE]={'\0'}, ciphertext[BLOCKSIZE]={'\0'};
+	unsigned char iv[IVSIZE]={'\0'}, tag[TAGSIZE]={'\0'}, *ciphertext;
 
+	/* The ciphertext is decrypted where it lies, blocks may be large */
+	if(len<IVSIZE+TAGSIZE) return -1;
 	memcpy(iv,buffer,IVSIZE);
 	memcpy(tag,buffer+IVSIZE,TAGSIZE);
-	memcpy(ciphertext,buffer+IVSIZE+TAGSIZE,len-IVSIZE-TAGSIZE);
+	ciphertext=buffer+IVSIZE+TAGSIZE;
 	clen=len-IVSIZE-TAGSIZE;
 	/*
 	* Given buffer, its length len and key
 	* Decrypt it using the key and copy the resulting data into plaintext, its length into plaintext_len
 	*/
-	*plaintext_len=decrypt(ciphertext,clen,(unsigned char *)NULL,0,tag,key,iv,plaintext);
-	if((*plaintext_len)<0) return -1;
+	int plen=decrypt(ciphertext,clen,(unsigned char *)NULL,0,tag,key,iv,plaintext);
+	if(plen<0) return -1;
+	*plaintext_len=plen;
 	/*
 	* Take inspiration from Test AES function - We are trying to employ Symmetric Key Cryptography here
 	*/
@@ -270,37 +343,31 @@ int decrypt_message( unsigned char *buffer, unsigned int len, unsigned char *key
 
 int extract_public_key( char *buffer, unsigned int size, EVP_PKEY **pubkey )
 {
-	RSA *rsa_pubkey = NULL;
-	FILE *fptr;
+	OSSL_DECODER_CTX *dctx;
+	BIO *bio;
+	int ok;
 
-	*pubkey = EVP_PKEY_new();
+	*pubkey = NULL;
 
-	/* Extract server's public key */
-	/* Make a function */
-	fptr = fopen( PUBKEY_FILE, "w+" );
-
-	if ( fptr == NULL ) {
-		errorMessage("Failed to open file to write public key data");
+	/* Extract server's public key, parsed where it lies (a PEM "RSA
+	   PUBLIC KEY", decoded straight into an EVP_PKEY) */
+	if ( (bio = BIO_new_mem_buf(buffer, size)) == NULL ) {
+		errorMessage("Failed to read public key data");
 		return -1;
 	}
-
-	fwrite( buffer, size, 1, fptr );
-	rewind(fptr);
-
-	/* open public key file */
-	if (!PEM_read_RSAPublicKey( fptr, &rsa_pubkey, NULL, NULL))
+	dctx = OSSL_DECODER_CTX_new_for_pkey( pubkey, "PEM", "type-specific", "RSA", 
+					      EVP_PKEY_PUBLIC_KEY, NULL, NULL );
+	ok = (dctx != NULL) && OSSL_DECODER_from_bio( dctx, bio );
+	OSSL_DECODER_CTX_free( dctx );
+	BIO_free( bio );
+	if ( !ok || (*pubkey == NULL) )
 	{
 		errorMessage("Cliet: Error loading RSA Public Key File.\n");
+		EVP_PKEY_free( *pubkey );
+		*pubkey = NULL;
 		return -1;
 	}
 
-	if (!EVP_PKEY_assign_RSA(*pubkey, rsa_pubkey))
-	{
-		errorMessage("Client: EVP_PKEY_assign_RSA: failed.\n");
-		return -1;
-	}
-
-	fclose( fptr );
 	return 0;
 }
 
@@ -319,14 +386,13 @@ int extract_public_key( char *buffer, unsigned int size, EVP_PKEY **pubkey )
 /*** YOUR CODE ***/
 int seal_symmetric_key( unsigned char *key, unsigned int keylen, EVP_PKEY *pubkey, char *buffer)
 {
-	unsigned int len=0;
+	int len=0,offset;
 	unsigned char *encryptedkey;
 	unsigned char *ek;
 	unsigned int ekl;
 	unsigned char *iv;
 	unsigned int ivl;
-	unsigned int offset=0;
-	unsigned char *lenbuffer=(unsigned char *)malloc(MAX_BLOCK_SIZE);memset(lenbuffer,'\0',(size_t)MAX_BLOCK_SIZE);
+	WireSealed sealed;
 	/*
 	* Given symmetric key "key", its length keylen and a known public key "pubkey"
 	* Encrypt the key using the RSA pubkey and copy the resulting encrypted data into buffer
@@ -335,64 +401,30 @@ int seal_symmetric_key( unsigned char *key, unsigned int keylen, EVP_PKEY *pubke
 	if(len<0) return -1;
 	/*
 	* The Encrypted Buffer needs the following - Encrypted RSA pubkey, its length, an IV, its length, Ciphertext of Symmetric Key, its length
-	* One Such implementation is :- encypted rsa pubkey length + iv length + ciphertext length + encrypted rsa pubkey + IV + Ciphertext
+	* Each goes in a tagged field with a fixed-width length, so no length can run into the binary that follows
 	*/
-	sprintf(lenbuffer,"%d",ekl);memcpy(buffer+offset,lenbuffer,strlen(lenbuffer));offset+=(strlen(lenbuffer));memcpy(buffer+offset,ek,ekl);offset+=(ekl);lenbuffer[0]='\0';
-	sprintf(lenbuffer,"%d",ivl);memcpy(buffer+offset,lenbuffer,strlen(lenbuffer));offset+=(strlen(lenbuffer));memcpy(buffer+offset,iv,ivl);offset+=(ivl);lenbuffer[0]='\0';
-	sprintf(lenbuffer,"%d",len);memcpy(buffer+offset,lenbuffer,strlen(lenbuffer));offset+=(strlen(lenbuffer));memcpy(buffer+offset,encryptedkey,len);offset+=(len);
-	BIO_dump_fp(stdout,(const char*)buffer,offset);
-	printf("%d\n",offset);
+	sealed.ek=ek;sealed.ek_len=ekl;sealed.iv=iv;sealed.iv_len=ivl;sealed.key=encryptedkey;sealed.key_len=len;
+	offset=wire_encode_sealed(&sealed,buffer,MAX_BLOCK_SIZE);
+	free(encryptedkey);free(ek);free(iv);
 	/*
 	* Take inspiration from Test RSA function - We are trying to employ Asymmetric Key Cryptography here
 	*/
 	return offset;
 }
 
-/* 
- * Helper function to get len and the data
- */
-unsigned int get_len_text(char *buffer,unsigned int pos,unsigned int *len,unsigned char *data)
-{
-	*len=atoi(buffer+pos);
-	char *lenbuf[100]={'\0'};
-	sprintf(lenbuf,"%d",*len);
-	memcpy(data,buffer+pos+strlen(lenbuf),*len);
-	return (*len)+strlen(lenbuf)+pos;
-}
-
-/**********************************************************************
-
-    Function    : unseal_symmetric_key
-    Description : Perform SSL unseal (open) operation to obtain the symmetric key
-    Inputs      : buffer - buffer of crypto data for decryption (ek, iv, ciphertext)
-                  len - length of buffer
-                  pubkey - public key 
-                  key - symmetric key (plaintext from unseal)
-    Outputs     : 0 if successful, -1 if failure
-
-***********************************************************************/
-/*** YOUR CODE ***/
 int unseal_symmetric_key( char *buffer, unsigned int len, EVP_PKEY *privkey, unsigned char **key )
 {
 	int declen=0;
-	unsigned char *ek=(unsigned char *)malloc(MAX_BLOCK_SIZE);
-	unsigned int ekl; 
-	unsigned char *iv=(unsigned char *)malloc(IVSIZE);
-	unsigned int ivl;
-	unsigned int ciphertextl;
-	unsigned char *ciphertext=(unsigned char *)malloc(MAX_BLOCK_SIZE);
+	WireSealed sealed;
 
 	/*
 	* Given buffer, its length len and a known private key "privkey"
 	* Decrypt it using the private key and copy the resulting data into key
+	* The fields are decoded in place: ek, iv and ciphertext point into buffer
 	*/
-	int pos = get_len_text(buffer,0,&ekl,ek);
-	pos = get_len_text(buffer,pos,&ivl,iv);
-	pos = get_len_text(buffer,pos,&ciphertextl,ciphertext);
-	/*
-	* Remember : The buffer could be something like this ("encypted rsa pubkey length + iv length + ciphertext length + encrypted rsa pubkey + IV + Ciphertext")
-	*/
-	declen = rsa_decrypt(ciphertext,ciphertextl,ek,ekl,iv,ivl,key,privkey);
+	if(wire_decode_sealed(buffer,len,&sealed)<0) return -1;
+	declen = rsa_decrypt((unsigned char *)sealed.key,sealed.key_len,(unsigned char *)sealed.ek,sealed.ek_len,
+			     (unsigned char *)sealed.iv,sealed.iv_len,key,privkey);
 	if(declen<0) return -1;
 	/*
 	* Take inspiration from Test RSA function - We are trying to employ Asymmetric Key Cryptography here
@@ -401,6 +433,41 @@ int unseal_symmetric_key( char *buffer, unsigned int len, EVP_PKEY *privkey, uns
 }
 
 
+/**********************************************************************
+
+    Function    : derive_resumed_key
+    Description : make a resumed session's key from a ticket secret and
+                  both sides' nonces, HMAC-SHA256(secret, RESUME_LABEL |
+                  client nonce | server nonce)
+    Inputs      : secret - the ticket secret (KEYSIZE bytes)
+                  cnonce - the client's nonce (RESUME_NONCE_SIZE bytes)
+                  snonce - the server's nonce (RESUME_NONCE_SIZE bytes)
+                  key - (out) the session key (KEYSIZE bytes)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int derive_resumed_key( const unsigned char *secret, const unsigned char *cnonce, 
+			const unsigned char *snonce, unsigned char *key )
+{
+	unsigned char msg[sizeof(RESUME_LABEL)-1+2*RESUME_NONCE_SIZE];
+	unsigned char mac[EVP_MAX_MD_SIZE], *val = mac;
+	size_t len = 0;
+
+	/* Both nonces are fresh, so each resumption gets its own key even
+	   from the same ticket */
+	memcpy( msg, RESUME_LABEL, sizeof(RESUME_LABEL)-1 );
+	memcpy( msg+sizeof(RESUME_LABEL)-1, cnonce, RESUME_NONCE_SIZE );
+	memcpy( msg+sizeof(RESUME_LABEL)-1+RESUME_NONCE_SIZE, snonce, RESUME_NONCE_SIZE );
+	hmac_message( msg, sizeof(msg), &val, &len, (unsigned char *)secret, KEYSIZE );
+	if ( len < KEYSIZE )
+		return( -1 );
+	memcpy( key, mac, KEYSIZE );
+	OPENSSL_cleanse( mac, sizeof(mac) );
+	return( 0 );
+}
+
+
 /* 
 
   CLIENT FUNCTIONS 
@@ -413,43 +480,147 @@ int unseal_symmetric_key( char *buffer, unsigned int len, EVP_PKEY *privkey, uns
 
     Function    : client_authenticate
     Description : this is the client side of the exchange
-    Inputs      : sock - server socket
+    Inputs      : conn - the server connection
+                  core - the connection's protocol state
+                  cookie - the server's cookie to present (in/out)
+                  cookielen - its length, 0 if none (in/out)
+                  retry - (out) milliseconds to wait when the server is busy
+                  blocksize - file bytes per block to propose, then the
+                   size the server agreed to (in/out)
                   session_key - the key resulting from the exchange
-    Outputs     : bytes read if successful, -1 if failure
+                  keyfile - the server's public key, saved by the first
+                   full exchange (for the one round trip exchange) and
+                   required of every later one; NULL to not keep it
+                  ticket - a ticket to resume with, NULL for the full
+                   exchange (which the server may answer with anyway)
+                  kex - the key exchanges to offer (KEX_*); the server
+                   picks X25519 when offered and it has a signed share
+                  suite - (out) the cipher suite the server chose from
+                   ours, fastest first
+    Outputs     : bytes read if successful, -1 if failure, AUTH_COOKIE
+                  if the server sent a cookie to reconnect with,
+                  AUTH_BUSY if the server asked us to come back later
 
 ***********************************************************************/
 /*** YOUR CODE ***/
-int client_authenticate( int sock, unsigned char **session_key )
+int client_authenticate( NetConn *conn, ProtoCore *core, char *cookie, unsigned int *cookielen, 
+			 unsigned int *retry, unsigned int *blocksize, unsigned char **session_key, 
+			 char *keyfile, WireTicket *ticket, int kex, int *suite )
 {
 	ProtoMessageHdr initClientRequest,initServerResponse,initClientAck,initServerAck;
-	initClientRequest.msgtype=CLIENT_INIT_EXCHANGE;initClientRequest.length=0;
+	char hello[WIRE_SIZE(5,sizeof(uint32_t)+COOKIE_SIZE+TICKET_SIZE+RESUME_NONCE_SIZE+SUITE_MAX)];
+	WireHello request;WireResponse response;WireCookie reconnect;WireBusy busy;
+	WireResume resume;WireResumed resumed;
+	unsigned char cnonce[RESUME_NONCE_SIZE],cshare[KEX_SHARE_SIZE],suites[SUITE_MAX];
+	struct timespec start,end;
+	const char *kind="full";
+	request.blocksize=*blocksize;request.cookie=(unsigned char *)cookie;request.cookie_len=*cookielen;
+	request.kex=0;request.share=NULL;request.share_len=0;
+	request.suites=resume.suites=suites;request.suites_len=resume.suites_len=aead_rank(suites);
+	resume.blocksize=*blocksize;resume.cookie=(unsigned char *)cookie;resume.cookie_len=*cookielen;
+	resume.nonce=cnonce;resume.nonce_len=RESUME_NONCE_SIZE;
+	initClientRequest.msgtype=CLIENT_INIT_EXCHANGE;
 	initClientAck.msgtype=CLIENT_INIT_ACK;initClientAck.length=0;
-	char *pubkeybuffer=malloc(MAX_BLOCK_SIZE);
+	/* Scratch for this exchange comes from an arena, given back in one step */
+	Arena scratch;arena_init(&scratch);
+	char *pubkeybuffer=arena_alloc(&scratch,MAX_BLOCK_SIZE);
 	unsigned char *symkey=(unsigned char *)malloc(KEYSIZE);
+	unsigned char *plaintext=(unsigned char *)arena_alloc(&scratch,MAX_BLOCK_SIZE);
 	char buffer[MAX_BLOCK_SIZE]={'\0'};
-	unsigned int encrsymmkeyl=0;
-	EVP_PKEY *pubkey;
+	int encrsymmkeyl=0,ret=-1;
+	unsigned int plaintext_len=0;
+	EVP_PKEY *pubkey=NULL,*eph=NULL,*trusted=NULL;
+	unsigned char *saved=NULL;unsigned int savedlen=0;
 	/*
 	* Send Message to server with header CLIENT_INIT_EXCHANGE
+	* The block size we propose goes first, then any cookie, then the exchanges we offer with our X25519 share, then our cipher suites fastest first
+	* With a ticket, CLIENT_RESUME carries it and our nonce for the resumed key instead
 	*/
 	printf("send client init req\n");
-	send_message(sock,&initClientRequest,NULL);
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	if(pubkeybuffer==NULL||symkey==NULL||plaintext==NULL) goto done;
+	if(ticket!=NULL) {
+		resume.ticket=ticket->ticket;resume.ticket_len=ticket->ticket_len;
+		initClientRequest.msgtype=CLIENT_RESUME;
+		if(generate_pseudorandom_bytes(cnonce,RESUME_NONCE_SIZE)<0) goto done;
+		if((int)(initClientRequest.length=wire_encode_resume(&resume,hello,sizeof(hello)))<0) goto done;
+	}
+	else {
+		if(kex&KEX_X25519) {
+			if(kex_keypair(&eph,cshare)<0) goto done;
+			request.kex=kex;request.share=cshare;request.share_len=KEX_SHARE_SIZE;
+		}
+		if((int)(initClientRequest.length=wire_encode_hello(&request,hello,sizeof(hello)))<0) goto done;
+	}
+	if(send_message(conn,core,&initClientRequest,hello)<0) goto done;
 	/*
 	* Wait for Message from server with header SERVER_INIT_RESPONSE
 	* Extract Pub Key out of the message -> Create a new Symmetric Key -> Encrypt it using the Pub Key of server
 	*/
 	printf("wait for server init response. Seal symm key using pub key\n");
-	wait_message(sock,&initServerResponse,pubkeybuffer,SERVER_INIT_RESPONSE);
-	if(extract_public_key(pubkeybuffer,initServerResponse.length,&pubkey)<0) return -1;
-	if(generate_pseudorandom_bytes(symkey,KEYSIZE)<0) return -1;
-	encrsymmkeyl=seal_symmetric_key(symkey,KEYSIZE,pubkey,buffer);
-	if(encrsymmkeyl<0) return -1;
-	/*
-	* Send message to server with header CLIENT_INIT_ACK
-	* The encrypted symmetric key from previous phase should be sent here
-	*/
-	initClientAck.length=encrsymmkeyl;
-	send_message(sock,&initClientAck,buffer);
+	if(get_message(conn,core,&initServerResponse,pubkeybuffer)<0) goto done;
+	if(initServerResponse.msgtype==SERVER_COOKIE&&wire_decode_cookie(pubkeybuffer,initServerResponse.length,&reconnect)==0) {
+		/* Prove we can receive at our address, then come back */
+		memcpy(cookie,reconnect.cookie,COOKIE_SIZE);
+		*cookielen=COOKIE_SIZE;
+		ret=AUTH_COOKIE;
+		goto done;
+	}
+	if(initServerResponse.msgtype==SERVER_BUSY&&wire_decode_busy(pubkeybuffer,initServerResponse.length,&busy)==0) {
+		/* Overloaded, the caller backs off and tries again */
+		*retry=busy.retry;
+		ret=AUTH_BUSY;
+		goto done;
+	}
+	if(ticket!=NULL&&initServerResponse.msgtype==SERVER_INIT_ACK) {
+		/* Resumed: the key comes from the ticket secret and both nonces, no RSA */
+		if(wire_decode_resumed(pubkeybuffer,initServerResponse.length,&resumed)<0) goto done;
+		if(resumed.blocksize<BLOCKSIZE||resumed.blocksize>*blocksize) goto done;
+		*blocksize=resumed.blocksize;
+		*suite=resumed.suite?(int)resumed.suite:SUITE_DEFAULT;
+		if(derive_resumed_key(ticket->secret,cnonce,resumed.nonce,symkey)<0) goto done;
+		if(decrypt_message((unsigned char *)resumed.proof,resumed.proof_len,symkey,plaintext,&plaintext_len)<0) goto done;
+		initServerAck.length=initServerResponse.length;
+		kind="resumed";
+		goto keyed;
+	}
+	/* No ticket, or the server would not take it: the full exchange */
+	if(initServerResponse.msgtype!=SERVER_INIT_RESPONSE||wire_decode_response(pubkeybuffer,initServerResponse.length,&response)<0) goto done;
+	/* The server's block size is never more than ours */
+	if(response.blocksize<BLOCKSIZE||response.blocksize>*blocksize) goto done;
+	*blocksize=response.blocksize;
+	/* A server that names no suite seals with the one everyone had before */
+	*suite=response.suite?(int)response.suite:SUITE_DEFAULT;
+	if(extract_public_key((char *)response.pubkey,response.pubkey_len,&pubkey)<0) goto done;
+	/* A key saved by an earlier exchange is the server's; the response is unauthenticated, so a different key is refused rather than trusted and saved */
+	if(keyfile!=NULL&&(savedlen=buffer_from_file(keyfile,&saved))>0) {
+		if(extract_public_key((char *)saved,savedlen,&trusted)<0||EVP_PKEY_eq(trusted,pubkey)!=1) {
+			errorMessage("server public key does not match the saved key\n");
+			goto done;
+		}
+		EVP_PKEY_free(pubkey);pubkey=trusted;trusted=NULL;
+	}
+	if(response.kex==KEX_X25519) {
+		/* The server's share must be signed by its key (the saved one, if any); the session key comes from both shares, no CLIENT_INIT_ACK */
+		if(eph==NULL||response.share_len!=KEX_SHARE_SIZE) goto done;
+		if(kex_verify(pubkey,response.share,response.expiry,response.sig,response.sig_len,(uint32_t)time(NULL))<0) {
+			errorMessage("server key share signature invalid\n");
+			goto done;
+		}
+		if(kex_derive(eph,response.share,cshare,response.share,symkey)<0) goto done;
+		kind="x25519";
+	}
+	else {
+		if(generate_pseudorandom_bytes(symkey,KEYSIZE)<0) goto done;
+		encrsymmkeyl=seal_symmetric_key(symkey,KEYSIZE,pubkey,buffer);
+		if(encrsymmkeyl<0) goto done;
+		/*
+		* Send message to server with header CLIENT_INIT_ACK
+		* The encrypted symmetric key from previous phase should be sent here
+		*/
+		initClientAck.length=encrsymmkeyl;
+		if(send_message(conn,core,&initClientAck,buffer)<0) goto done;
+	}
 	/*
 	* Wait message from server with header SERVER_INIT_ACK
 	* Decrypt the message using the symmetric key and make sure the code doesn't break. 
@@ -457,17 +628,100 @@ int client_authenticate( int sock, unsigned char **session_key )
 	*/
 	printf("wait for server init ack. decrypt server message.\n");
 	buffer[0]='\0';
-	unsigned int plaintext_len=0;
-	wait_message(sock,&initServerAck,buffer,SERVER_INIT_ACK);
-	unsigned char *plaintext=(unsigned char *)malloc(BLOCKSIZE);plaintext[0]='\0';
-	if(decrypt_message(buffer,initServerAck.length,symkey,plaintext,&plaintext_len)<0) return -1;
+	if(wait_message(conn,core,&initServerAck,buffer,SERVER_INIT_ACK)<0) goto done;
+	plaintext[0]='\0';
+	if(decrypt_message((unsigned char *)buffer,initServerAck.length,symkey,plaintext,&plaintext_len)<0) goto done;
 	BIO_dump_fp(stdout,(const char*)plaintext,plaintext_len);
+	/* Keep the server key the first time, next time the key goes in the first flight */
+	if(keyfile!=NULL&&savedlen==0&&buffer_to_file(keyfile,response.pubkey,response.pubkey_len)!=0) errorMessage("unable to save the server public key\n");
+keyed:
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	if(aead_suite_name(*suite)==NULL) goto done;
+	printf("Handshake %s in %.3f ms, %s\n",kind,
+	       (end.tv_sec-start.tv_sec)*1e3+(end.tv_nsec-start.tv_nsec)/1e6,aead_suite_name(*suite));
 	/*
 	* Store the Symmetric key in session_key for later use. 
+	* Frames may be file blocks of the agreed size from here on
 	*/
-	*session_key=(unsigned char *)malloc(KEYSIZE);
-	memcpy(*session_key,symkey,KEYSIZE);
-	return initServerAck.length;
+	core_set_limit(core,*blocksize+AEAD_OVERHEAD);
+	*session_key=symkey;
+	symkey=NULL;
+	ret=initServerAck.length;
+done:
+	free(symkey);arena_free(&scratch);
+	EVP_PKEY_free(pubkey);EVP_PKEY_free(eph);EVP_PKEY_free(trusted);free(saved);
+	return ret;
+}
+
+/**********************************************************************
+
+    Function    : client_seal_cached
+    Description : make a session key and seal it to a server public key
+                  saved by an earlier exchange, for the one round trip
+                  exchange
+    Inputs      : keyfile - the saved server public key
+                  sealed - buffer for the sealed key (MAX_BLOCK_SIZE)
+                  session_key - (out) the new session key
+    Outputs     : length of the sealed key if successful, -1 if failure
+                  (or no key saved)
+
+***********************************************************************/
+
+static int client_seal_cached( char *keyfile, char *sealed, unsigned char **session_key )
+{
+	unsigned char *pubkeyc = NULL, *symkey = NULL;
+	EVP_PKEY *pubkey = NULL;
+	unsigned int len;
+	int ret = -1;
+
+	/* No key yet is not an error, the full exchange saves one */
+	if ( (len = buffer_from_file(keyfile, &pubkeyc)) == 0 )
+		return( -1 );
+	if ( (extract_public_key((char *)pubkeyc, len, &pubkey) < 0) ||
+	     ((symkey = (unsigned char *)malloc(KEYSIZE)) == NULL) ||
+	     (generate_pseudorandom_bytes(symkey, KEYSIZE) < 0) ||
+	     ((ret = seal_symmetric_key(symkey, KEYSIZE, pubkey, sealed)) < 0) )
+	{
+		free( symkey );
+		symkey = NULL;
+		ret = -1;
+	}
+	*session_key = symkey;
+	EVP_PKEY_free( pubkey );
+	free( pubkeyc );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : client_keep_ticket
+    Description : decrypt a SERVER_TICKET and save it to resume the
+                  next transfer with
+    Inputs      : ticketfile - where to keep it, NULL to drop it
+                  block - the ticket message
+                  len - its length
+                  key - the session key it is encrypted under
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int client_keep_ticket( char *ticketfile, char *block, unsigned int len, 
+			       unsigned char *key )
+{
+	unsigned char plain[WIRE_SIZE(3, sizeof(uint32_t)+TICKET_SIZE+KEYSIZE)];
+	unsigned int plainlen = 0;
+	WireTicket ticket;
+	int ret = -1;
+
+	if ( ticketfile == NULL )
+		return( 0 );
+	if ( (len <= IVSIZE+TAGSIZE+sizeof(plain)) &&
+	     (decrypt_message((unsigned char *)block, len, key, plain, &plainlen) == 0) &&
+	     (wire_decode_ticket((char *)plain, plainlen, &ticket) == 0) &&
+	     (buffer_to_file(ticketfile, plain, plainlen) == 0) )
+		ret = 0;
+	OPENSSL_cleanse( plain, sizeof(plain) );
+	return( ret );
 }
 
 /**********************************************************************
@@ -476,79 +730,196 @@ int client_authenticate( int sock, unsigned char **session_key )
     Description : transfer the entire file over the wire
     Inputs      : r - rm_cmd describing what to transfer and do
                   fname - the name of the file
-                  sz - this is the size of the file to be read
+                  conn - the server connection
+                  core - the connection's protocol state
                   key - the cipher to encrypt the data with
+                  suite - its cipher suite, as agreed
+                  blocksize - file bytes per block, as agreed
+                  source - how to read the file
+                  workers - encryptor threads, 0 for one per core
+                  fast - the hello and sealed key to send the command
+                   with (the one round trip exchange), NULL when the
+                   exchange is already done
+                  ticketfile - where to keep a resumption ticket the
+                   server sends, NULL for none
     Outputs     : 0 if successful, -1 if failure
 
 ***********************************************************************/
 
-int transfer_file( struct rm_cmd *r, char *fname, int sock, 
-		   unsigned char *key )
+int transfer_file( struct rm_cmd *r, char *fname, NetConn *conn, ProtoCore *core, 
+		   unsigned char *key, int suite, unsigned int blocksize, SourceKind source, 
+		   int workers, WireFast *fast, char *ticketfile )
 {
 	/* Local variables */
-	int readBytes = 1, totalBytes = 0, fh;
-	unsigned int outbytes;
+	unsigned long totalBytes = 0;
+	int len, nframes, held = 0, ret = -1;
+	FileSource src;
 	ProtoMessageHdr hdr;
-	char block[MAX_BLOCK_SIZE];
-	char outblock[MAX_BLOCK_SIZE];
+	Pipeline pipe;
+	PipeSlot *slot, *batch[NET_IOV_MAX];
+	WireCommand cmd;
+	char command[MAX_BLOCK_SIZE], flight[MAX_BLOCK_SIZE], *reply = command;
+	unsigned int acklen;
+	struct timespec start, end;
+	double secs;
 
 	/* Read the next block */
 	printf ("\n\nfile name: %s\n\n", fname);
-	if ( (fh=open(fname, O_RDONLY, 0)) == -1 )
-	{
-		/* Complain, explain, and exit */
-		char msg[128];
-		sprintf( msg, "failure opening file [%.64s]\n", fname );
-		errorMessage( msg );
+	if ( source_open(&src, source, fname) != 0 )
 		exit( -1 );
+	/* The pipeline reads each block into the frame it is sent from,
+	   behind room for the header, sequence number and tag, and seals
+	   it there on another thread; enough frames to fill one send go
+	   out together before they are handed back */
+	memset( &pipe, 0, sizeof(pipe) );
+	nframes = NET_COALESCE / (sizeof(ProtoMessageHdr) + AEAD_OVERHEAD + blocksize);
+	nframes = (nframes < 1) ? 1 : (nframes > NET_IOV_MAX) ? NET_IOV_MAX : nframes;
+	if ( r->cmd == CMD_CREATE ) 
+	{
+		if ( pipe_start(&pipe, &src, key, suite, blocksize, workers, nframes) != 0 )
+			goto done;
+		reply = CORE_FRAME_BODY( &pipe.slots[0].frame );
 	}
 
 	/* Send the command */
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	cmd.cmd = r->cmd;
+	cmd.type = r->type;
+	cmd.fname = (unsigned char *)r->fname;
+	cmd.fname_len = r->len;
+	cmd.size = src.size;
+	if ( (len = wire_encode_command(&cmd, command, sizeof(command))) < 0 )
+	{
+		/* Complain, explain, and return */
+		errorMessage( "file name too long for the transfer command\n" );
+		goto done;
+	}
 	hdr.msgtype = FILE_XFER_INIT;
-	hdr.length = sizeof(struct rm_cmd) + r->len;
-	send_message( sock, &hdr, (char *)r );
+	hdr.length = len;
+	if ( fast != NULL )
+	{
+		/* The command goes with the sealed key, and the blocks right
+		   behind them at our block size while the server unseals */
+		fast->command = (unsigned char *)command;
+		fast->command_len = len;
+		if ( (len = wire_encode_fast(fast, flight, sizeof(flight))) < 0 )
+			goto done;
+		hdr.msgtype = CLIENT_FAST_INIT;
+		hdr.length = len;
+		if ( send_message(conn, core, &hdr, flight) != 0 )
+			goto done;
+		core_set_limit( core, blocksize+AEAD_OVERHEAD );
+	}
+	else if ( send_message(conn, core, &hdr, command) != 0 )
+		goto done;
 
-	/* Start transferring data */
-	while ( (r->cmd == CMD_CREATE) && (readBytes != 0) )
+	/* Start transferring data, sealed blocks come back in order */
+	while ( (r->cmd == CMD_CREATE) && ((slot = pipe_next(&pipe)) != NULL) )
 	{
-		/* Read the next block */
-		if ( (readBytes=read( fh, block, BLOCKSIZE )) == -1 )
-		{
-			/* Complain, explain, and exit */
-			errorMessage( "failed read on data file.\n" );
-			exit( -1 );
-		}
-		
 		/* A little bookkeeping */
-		totalBytes += readBytes;
-		printf( "Reading %10d bytes ...\r", totalBytes );
+		totalBytes += slot->len;
+		printf( "Reading %10lu bytes ...\r", totalBytes );
 
-		/* Send data if needed */
-		if ( readBytes > 0 ) 
-		{
-#if 1
-			printf("Block is:\n");
-			BIO_dump_fp (stdout, (const char *)block, readBytes);
+#if 0
+		printf("Block is:\n");
+		BIO_dump_fp (stdout, slot->data, slot->len);
 #endif
 
-			/* Encrypt and send */
-			encrypt_message( (unsigned char *)block, readBytes, key, 
-					 (unsigned char *)outblock, &outbytes );
-			hdr.msgtype = FILE_XFER_BLOCK;
-			hdr.length = outbytes;
-			send_message( sock, &hdr, outblock );
+		/* Queue the frame; once a send's worth are queued, send
+		   them and hand the frames back to the reader */
+		if ( send_frame(conn, core, FILE_XFER_BLOCK, &slot->frame) != 0 )
+			goto done;
+		batch[held++] = slot;
+		if ( held == nframes )
+		{
+			if ( net_send(conn) != 0 )
+				goto done;
+			for ( ; held > 0; held-- )
+				pipe_release( &pipe, batch[held-1] );
 		}
 	}
+	if ( pipe.failed )
+	{
+		/* Complain, explain, and return */
+		errorMessage( "failed to read or seal the file\n" );
+		goto done;
+	}
 
-	/* Send the ack, wait for server ack */
+	/* Send the ack (with any frames still queued), wait for server ack */
 	hdr.msgtype = EXIT;
 	hdr.length = 0;
-	send_message( sock, &hdr, NULL );
-	wait_message( sock, &hdr, block, EXIT );
+	if ( send_message(conn, core, &hdr, NULL) != 0 )
+		goto done;
+	for ( ; held > 0; held-- )
+		pipe_release( &pipe, batch[held-1] );
+	if ( (fast != NULL) && 
+	     ((wait_message(conn, core, &hdr, reply, SERVER_INIT_ACK) == -1) ||
+	      (decrypt_message((unsigned char *)reply, hdr.length, key, 
+			       (unsigned char *)flight, &acklen) < 0)) )
+	{
+		/* Complain, explain, and return */
+		errorMessage( "server did not take the key in one round trip\n" );
+		goto done;
+	}
 
-	/* Clean up the file, return successfully */
-	close( fh );
-	return( 0 );
+	/* A ticket may come before the EXIT, for the next transfer */
+	if ( get_message(conn, core, &hdr, reply) == -1 )
+		goto done;
+	if ( hdr.msgtype == SERVER_TICKET )
+	{
+		if ( client_keep_ticket(ticketfile, reply, hdr.length, key) != 0 )
+			errorMessage( "unable to keep the resumption ticket\n" );
+		if ( wait_message(conn, core, &hdr, reply, EXIT) == -1 )
+			goto done;
+	}
+	else if ( hdr.msgtype != EXIT )
+	{
+		/* Complain, explain, and return */
+		errorMessage( "server did not ack the transfer\n" );
+		goto done;
+	}
+
+	/* Report the rate, the acked EXIT means the server has it all */
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	secs = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+	printf( "\nSent %lu bytes in %u byte blocks from %s, %d encryptors, %.3f s (%.1f MiB/s)\n", 
+		totalBytes, blocksize, source_name(src.kind), pipe.nworkers, secs, 
+		(secs > 0) ? totalBytes/secs/(1024*1024) : 0.0 );
+	printf( "%lu frames, %lu sends, %lu receives (%.3f system calls per frame)\n", 
+		conn->frames, conn->sends, conn->recvs, 
+		(conn->frames > 0) ? (double)(conn->sends+conn->recvs)/conn->frames : 0.0 );
+	ret = 0;
+
+	/* Clean up the file, no frame may still be queued on the
+	   connection once the pipeline frees them */
+done:
+	if ( held > 0 )
+	{
+		conn->niov = 0;
+		conn->queued = 0;
+	}
+	if ( pipe_stop(&pipe) != 0 )
+		ret = -1;
+	source_close( &src );
+	return( ret );
+}
+
+
+/**********************************************************************
+
+    Function    : client_config_init
+    Description : fill in the default client options
+    Inputs      : cfg - the options to set
+    Outputs     : none
+
+***********************************************************************/
+
+void client_config_init( ClientConfig *cfg )
+{
+	/* Plain system calls, large blocks */
+	memset( cfg, 0, sizeof(ClientConfig) );
+	cfg->blocksize = XFER_BLOCK_DEFAULT;
+	cfg->kex = KEX_RSA;
 }
 
 
@@ -559,26 +930,132 @@ int transfer_file( struct rm_cmd *r, char *fname, int sock,
     Inputs      : r - cmd describing what to transfer and do
                   fname - filename of the file to transfer
                   address - address of the server
+                  cfg - client options
     Outputs     : 0 if successful, -1 if failure
 
 ***********************************************************************/
 
-int client_secure_transfer( struct rm_cmd *r, char *fname, char *address ) 
+int client_secure_transfer( struct rm_cmd *r, char *fname, char *address, 
+			    ClientConfig *cfg ) 
 {
 	/* Local variables */
-	unsigned char *key;
-	int sock;
+	unsigned char *key = NULL;
+	char cookie[COOKIE_SIZE], sealed[MAX_BLOCK_SIZE];
+	unsigned int cookielen = 0, retry = 0, backoff, blocksize;
+	ProtoCore core;
+	NetConn conn;
+	WireFast fast;
+	int sock, auth, tries = 0, busy = 0, again, ret = -1;
+	int onertt = (cfg->keyfile != NULL), sealedlen;
+	unsigned char *ticketc = NULL;
+	unsigned int ticketlen = 0;
+	WireTicket ticket, *resume = NULL;
+	unsigned char suites[SUITE_MAX];
+	int suite;
+
+	if ( cfg->uring )
+		uring_enable();
+	srand( getpid() ^ time(NULL) );
+	if ( crypto_init() != 0 )
+	{
+		errorMessage( "unable to initialize the crypto library\n" );
+		return( -1 );
+	}
 
-	sock = connect_client( address );
-	// crypto setup, authentication
-	client_authenticate( sock, &key );
-	// symmetric key crypto for file transfer
-	transfer_file( r, fname, sock, key );
-	// Done
-	close( sock );
+	/* A ticket from the last transfer skips the RSA exchange (and
+	   the one round trip flight, which still needs it) */
+	if ( (cfg->ticketfile != NULL) && 
+	     ((ticketlen = buffer_from_file(cfg->ticketfile, &ticketc)) > 0) &&
+	     (wire_decode_ticket((char *)ticketc, ticketlen, &ticket) == 0) )
+	{
+		resume = &ticket;
+		onertt = 0;
+	}
+	do
+	{
+		if ( core_init(&core, CORE_CLIENT) != 0 )
+			return( -1 );
+		sock = connect_client( address );
+		net_conn_init( &conn, sock );
+		// crypto setup, authentication (reconnecting with the
+		// server's cookie if it asks), then symmetric key crypto
+		// for file transfer
+		blocksize = cfg->blocksize;
+		auth = -1;
+		sealedlen = onertt ? client_seal_cached( cfg->keyfile, sealed, &key ) : -1;
+		onertt = 0;
+		if ( sealedlen > 0 )
+		{
+			// one round trip: the key sealed to the server key
+			// saved last time goes with the command and blocks
+			fast.blocksize = blocksize;
+			fast.cookie = (unsigned char *)cookie;
+			fast.cookie_len = cookielen;
+			fast.sealed = (unsigned char *)sealed;
+			fast.sealed_len = sealedlen;
+			// the blocks go before the server answers, so the
+			// suite is our fastest
+			aead_rank( suites );
+			fast.suite = suite = suites[0];
+			if ( transfer_file(r, fname, &conn, &core, key, suite, blocksize, 
+					   cfg->source, cfg->workers, &fast, cfg->ticketfile) == 0 )
+				ret = 0;
+		}
+		else if ( ((auth = client_authenticate(&conn, &core, cookie, &cookielen, &retry, 
+						       &blocksize, &key, cfg->keyfile, resume, 
+						       cfg->kex, &suite)) >= 0) &&
+			  (transfer_file(r, fname, &conn, &core, key, suite, blocksize, 
+					 cfg->source, cfg->workers, NULL, cfg->ticketfile) == 0) )
+			ret = 0;
+		// Done
+		net_send( &conn );
+		net_flush( sock );
+		close( sock );
+		core_free( &core );
+
+		// Present the cookie on a new connection; or, when busy,
+		// wait the server's retry-after doubled for each refusal,
+		// jittered over its upper half so refused clients do not
+		// all come back at once
+		again = 0;
+		if ( sealedlen > 0 )
+		{
+			// Any failure in one round trip (a stale server
+			// key, a cookie or busy reply, a block size the server
+			// will not take) falls back to the full exchange, which
+			// saves the key again; the server truncates the file
+			if ( ret != 0 )
+			{
+				printf( "Falling back to the full key exchange\n" );
+				free( key );
+				key = NULL;
+				again = 1;
+			}
+		}
+		else if ( (auth == AUTH_COOKIE) && (tries++ < COOKIE_RETRIES) )
+			again = 1;
+		else if ( (auth == AUTH_BUSY) && (busy < BUSY_RETRIES) )
+		{
+			backoff = retry << busy++;
+			if ( (backoff > BUSY_BACKOFF_MAX) || (backoff < retry) )
+				backoff = BUSY_BACKOFF_MAX;
+			backoff = backoff/2 + rand() % (backoff/2 + 1);
+			printf( "Server busy, retrying in %u ms\n", backoff );
+			usleep( backoff * 1000 );
+			again = 1;
+		}
+	}
+	while ( again );
+	free( key );
+	if ( ticketc != NULL )
+	{
+		OPENSSL_cleanse( ticketc, ticketlen );
+		free( ticketc );
+	}
 
-	/* Return successfully */
-	return( 0 );
+	if ( ret != 0 )
+		errorMessage( "secure transfer failed\n" );
+	return( ret );
 }
 
 /* 
@@ -685,275 +1162,124 @@ int test_aes( )
 
 /**********************************************************************
 
-    Function    : server_protocol
-    Description : server processing of crypto protocol
-    Inputs      : sock - server socket
-                  key - the key resulting from the protocol
-    Outputs     : bytes read if successful, -1 if failure
+    Function    : server_self_test
+    Description : run one of the named server self-tests
+    Inputs      : cfg - server options (test is the name)
+                  keys - the server keys
+    Outputs     : 0 if the test passed, -1 if failure
 
 ***********************************************************************/
-/*** YOUR_CODE ***/
-int server_protocol( int sock, char *pubfile, EVP_PKEY *privkey, unsigned char **enckey )
-{
-/*
-	* Couterparts of client actions that the server needs to take.
-	*/
-	/*
-	* Wait for Message to server with header CLIENT_INIT_EXCHANGE
-	*/
-	printf("wait for init exchange\n");
-	ProtoMessageHdr initExchange;
-	wait_message(sock,&initExchange,NULL,CLIENT_INIT_EXCHANGE);
-	/*
-	* Send Message from server with header SERVER_INIT_RESPONSE
-	*/
-	ProtoMessageHdr initResponse;
-	initResponse.msgtype=SERVER_INIT_RESPONSE;
-	unsigned char* pubkeyc = malloc(MAX_BLOCK_SIZE);
-	initResponse.length=buffer_from_file(pubfile,&pubkeyc);
-	/* Extract server's public key */
-	/* Make a function */
-	printf("send init response with pub key\n");
-	send_message(sock,&initResponse,(char *)pubkeyc);
-	/*
-	* Wait for message to server with header CLIENT_INIT_ACK
-	*/
 
-	fflush(stdout);
-	ProtoMessageHdr initAck;
-	char* symKeyBuffer=(char *)malloc(MAX_BLOCK_SIZE);
-	unsigned char* symKey;
-	printf("wait for sealed symmetric key\n");
-	wait_message(sock,&initAck,symKeyBuffer,CLIENT_INIT_ACK);
-	if (symKeyBuffer == NULL){
-		errorMessage("init ack recieve error");
-		return -1;
-	}
-	printBuffer("Sym Key Buffer",symKeyBuffer, initAck.length);
-	fflush(stdout);
-	unseal_symmetric_key(symKeyBuffer,initAck.length, privkey, &symKey);
-	/*
-	* Send message from server with header SERVER_INIT_ACK
-	*/
-	initAck.msgtype=SERVER_INIT_ACK;
-	unsigned char* buffer=malloc(MAX_BLOCK_SIZE);
-	unsigned int len;
-	unsigned char message[] = "Complete";
-	int messageLen = strlen((char *)message);
-	printf("encrypt \"complete\"\n");
-	encrypt_message(message, messageLen,symKey,buffer,&len);
-	if (messageLen < 1){
-		errorMessage("init ack encryption error");
-		return -1;
-	}
-	initAck.length= len;
-	char* bufferc = (char*) buffer;
-	printf("send encrypted \"complete\"\n");
-	send_message(sock, &initAck, bufferc);
-	/*
-	* Store the Symmetric key in session_key for later use. 
-	*/
-	printf("store sym key"\n);
-	*enckey = symKey;
-	return 0;
+int server_self_test( ServerConfig *cfg, KeySet *keys )
+{
+	EVP_PKEY *privkey = keys->privkey, *pubkey = keys->pubkey;
+
+	if ( strcmp(cfg->test, "sessions") == 0 )
+		return( test_sessions(cfg, keys) );
+	if ( strcmp(cfg->test, "blocks") == 0 )
+		return( test_blocks(cfg) );
+	if ( strcmp(cfg->test, "aead") == 0 )
+		return( test_aead(cfg->count) );
+	if ( strcmp(cfg->test, "suites") == 0 )
+		return( test_suites(cfg->count) );
+	if ( strcmp(cfg->test, "copies") == 0 )
+		return( test_copies(cfg) );
+	if ( strcmp(cfg->test, "ingest") == 0 )
+		return( test_ingest(cfg) );
+	if ( strcmp(cfg->test, "allocs") == 0 )
+		return( test_allocs(cfg) );
+	if ( strcmp(cfg->test, "resume") == 0 )
+		return( test_resume(cfg, keys) );
+	if ( strcmp(cfg->test, "sinks") == 0 )
+		return( test_sinks(cfg->count) );
+	if ( strcmp(cfg->test, "pipeline") == 0 )
+		return( test_pipeline(cfg->count) );
+	if ( strcmp(cfg->test, "sources") == 0 )
+		return( test_sources(cfg->count) );
+	if ( strcmp(cfg->test, "wire") == 0 )
+		return( test_wire(cfg->count, privkey, pubkey) );
+	if ( strcmp(cfg->test, "kex") == 0 )
+		return( test_kex(cfg->count, privkey, pubkey) );
+
+	/* Complain, explain, and return */
+	char msg[128];
+	sprintf( msg, "unknown self-test [%.64s]\n", cfg->test );
+	errorMessage( msg );
+	return( -1 );
 }
 
-
 /**********************************************************************
 
-    Function    : receive_file
-    Description : receive a file over the wire
-    Inputs      : sock - the socket to receive the file over
-                  key - the cicpher used to encrypt the traffic
-    Outputs     : 0 if successful, -1 if failure
+    Function    : server_config_init
+    Description : fill in the default server options
+    Inputs      : cfg - the options to set
+    Outputs     : none
 
 ***********************************************************************/
 
-#define FILE_PREFIX "./shared/"
-
-int receive_file( int sock, unsigned char *key ) 
+void server_config_init( ServerConfig *cfg )
 {
-	/* Local variables */
-	unsigned long totalBytes = 0;
-	int done = 0, fh = 0;
-	unsigned int outbytes;
-	ProtoMessageHdr hdr;
-	struct rm_cmd *r = NULL;
-	char block[MAX_BLOCK_SIZE];
-	unsigned char plaintext[MAX_BLOCK_SIZE];
-	char *fname = NULL;
-	int rc = 0;
-
-	/* clear */
-	bzero(block, MAX_BLOCK_SIZE);
-
-	/* Receive the init message */
-	wait_message( sock, &hdr, block, FILE_XFER_INIT );
-
-	/* set command structure */
-	struct rm_cmd *tmp = (struct rm_cmd *)block;
-	unsigned int len = tmp->len;
-	r = (struct rm_cmd *)malloc( sizeof(struct rm_cmd) + len );
-	r->cmd = tmp->cmd, r->type = tmp->type, r->len = len;
-	memcpy( r->fname, tmp->fname, len );
-
-	/* open file */
-	if ( r->type == TYP_DATA_SHARED ) {
-		unsigned int size = r->len + strlen(FILE_PREFIX) + 1;
-		char *fname = (char *)malloc( size );
-		snprintf( fname, size, "%s%.*s", FILE_PREFIX, (int) r->len, r->fname );
-		if ( (fh=open( fname, O_WRONLY|O_CREAT|O_TRUNC, 0700)) > 0 );  // TJ: need to change this for students
-		else assert( 0 );
-	}
-	else assert( 0 );
-
-	/* read the file data, if it's a create */ 
-	if ( r->cmd == CMD_CREATE ) {
-		/* Repeat until the file is transferred */
-		printf( "Receiving file [%s] ..\n", fname );
-		while (!done)
-		{
-			/* Wait message, then check length */
-			get_message( sock, &hdr, block );
-			if ( hdr.msgtype == EXIT ) {
-				done = 1;
-				break;
-			}
-			else
-			{
-				/* Write the data file information */
-				rc = decrypt_message( (unsigned char *)block, hdr.length, key, 
-						      plaintext, &outbytes );
-				assert( rc  == 0 );
-				write( fh, plaintext, outbytes );
-
-#if 1
-				printf("Decrypted Block is:\n");
-				BIO_dump_fp (stdout, (const char *)plaintext, outbytes);
-#endif
-
-				totalBytes += outbytes;
-				printf( "Received/written %ld bytes ...\n", totalBytes );
-			}
-		}
-		printf( "Total bytes [%ld].\n", totalBytes );
-		/* Clean up the file, return successfully */
-		close( fh );
-	}
-	else {
-		printf( "Server: illegal command %d\n", r->cmd );
-		//	     exit( -1 );
-	}
-
-	/* Server ack */
-	hdr.msgtype = EXIT;
-	hdr.length = 0;
-	send_message( sock, &hdr, NULL );
-
-	return( 0 );
+	/* A single process on the default backlog */
+	memset( cfg, 0, sizeof(ServerConfig) );
+	cfg->workers = 1;
+	cfg->backlog = DEFAULT_BACKLOG;
+	cfg->session_budget = SESSION_BUDGET;
+	cfg->handshake_timeout = SESSION_HANDSHAKE_TIMEOUT;
+	cfg->idle_timeout = SESSION_IDLE_TIMEOUT;
+	cfg->session_timeout = SESSION_LIFETIME;
+	cfg->ticket_lifetime = TICKET_LIFETIME;
 }
 
+
 /**********************************************************************
 
     Function    : server_secure_transfer
     Description : this is the main function to execute the protocol
-    Inputs      : pubkey - public key of the server
+    Inputs      : privfile - private key file of the server
+                  pubfile - public key file of the server
+                  cfg - server options
     Outputs     : 0 if successful, -1 if failure
 
 ***********************************************************************/
 
-int server_secure_transfer( char *privfile, char *pubfile )
+int server_secure_transfer( char *privfile, char *pubfile, ServerConfig *cfg )
 {
 	/* Local variables */
-	int server, errored, newsock;
-	RSA *rsa_privkey = NULL, *rsa_pubkey = NULL;
-	RSA *pRSA = NULL;
-	EVP_PKEY *privkey = EVP_PKEY_new(), *pubkey = EVP_PKEY_new();
-	fd_set readfds;
-	unsigned char *key;
-	FILE *fptr;
+	int server, i, n;
+	unsigned char suites[SUITE_MAX];
+	KeySet keys;
 
 	/* initialize */
-	OpenSSL_add_all_algorithms();
-	OpenSSL_add_all_ciphers();
-	ERR_load_crypto_strings();
-
-	/* Connect the server/setup */
-	server = server_connect();
-	errored = 0;
-
-	/* open private key file */
-	fptr = fopen( privfile, "r" );
-	assert( fptr != NULL);
-	if (!(pRSA = PEM_read_RSAPrivateKey( fptr, &rsa_privkey, NULL, NULL)))
+	if ( crypto_init() != 0 )
 	{
-		fprintf(stderr, "Error loading RSA Private Key File.\n");
-
-		return 2;
+		errorMessage( "unable to initialize the crypto library\n" );
+		return( -1 );
 	}
+	printf( "Cipher suites:" );
+	for ( i=0, n=aead_rank(suites); i<n; i++ )
+		printf( " %s", aead_suite_name(suites[i]) );
+	printf( "\n" );
 
-	if (!EVP_PKEY_assign_RSA(privkey, rsa_privkey))
-	{
-		fprintf(stderr, "EVP_PKEY_assign_RSA: failed.\n");
-		return 3;
-	}
-	fclose( fptr ); 
-
-	/* open public key file */
-	fptr = fopen( pubfile, "r" );
-	assert( fptr != NULL);
-	if (!PEM_read_RSAPublicKey( fptr , &rsa_pubkey, NULL, NULL))
-	{
-		fprintf(stderr, "Error loading RSA Public Key File.\n");
-		return 2;
-	}
-
-	if (!EVP_PKEY_assign_RSA( pubkey, rsa_pubkey))
-	{
-		fprintf(stderr, "EVP_PKEY_assign_RSA: failed.\n");
-		return 3;
-	}
-	fclose( fptr );
+	/* Parse the key files once; handshakes use the parsed keys and
+	   the public key as read, and SIGHUP loads them again */
+	if ( keys_load(&keys, privfile, pubfile) != 0 )
+		return( 2 );
 
 	// Test the RSA encryption and symmetric key encryption
-	test_rsa( privkey, pubkey );
+	test_rsa( keys.privkey, keys.pubkey );
 	test_aes();
-
-	/* Repeat until the socket is closed */
-	while ( !errored )
-	{
-		FD_ZERO( &readfds );
-		FD_SET( server, &readfds );
-		if ( select(server+1, &readfds, NULL, NULL, NULL) < 1 )
-		{
-			/* Complain, explain, and exit */
-			char msg[128];
-			sprintf( msg, "failure selecting server connection [%.64s]\n",
-				 strerror(errno) );
-			errorMessage( msg );
-			errored = 1;
-		}
-		else
-		{
-			/* Accept the connect, receive the file, and return */
-			if ( (newsock = server_accept(server)) != -1 )
-			{
-				/* Do the protocol, receive file, shutdown */
-				server_protocol( newsock, pubfile, privkey, &key );
-				receive_file( newsock, key );
-				close( newsock );
-			}
-			else
-			{
-				/* Complain, explain, and exit */
-				char msg[128];
-				sprintf( msg, "failure accepting connection [%.64s]\n", 
-					 strerror(errno) );
-				errorMessage( msg );
-				errored = 1;
-			}
-		}
-	}
+	if ( cfg->test != NULL )
+		return( server_self_test(cfg, &keys) );
+
+	/* Several workers each get their own listener */
+	signal( SIGPIPE, SIG_IGN );
+	if ( cfg->workers != 1 )
+		return( server_spawn_workers(cfg, &keys) );
+
+	/* Connect the server/setup, serve sessions until the listener fails */
+	server = server_connect( cfg->backlog, 0 );
+	if ( server_event_loop(server, cfg, &keys) != 0 )
+		return( -1 );
 
 	/* Return successfully */
 	return( 0 );
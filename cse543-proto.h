@@ -32,13 +32,34 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***********************************************************************/
 
 /* Include Files */
+#include <openssl/evp.h>
 
 /* Defines */
 #define MAX_BLOCK_SIZE 8096
 #define BLOCKSIZE 128
 #define KEYSIZE 32
 #define TAGSIZE 16
-#define PUBKEY_FILE "./pubkey.tmp" 
+#define IVSIZE 16
+#define XFER_BLOCK_DEFAULT (64*1024)    /* file bytes per block a client proposes */
+#define XFER_BLOCK_MAX (4*1024*1024)    /* largest block a server agrees to */
+#define COOKIE_SIZE (4+32)   /* timestamp, HMAC-SHA256 */
+#define COOKIE_RETRIES 2     /* reconnects a client makes to present a cookie */
+#define TICKET_SIZE (4+IVSIZE+TAGSIZE+4+KEYSIZE)  /* key epoch, sealed issue time and secret */
+#define RESUME_NONCE_SIZE 16 /* each side's part of a resumed session key */
+#define RESUME_LABEL "cse543 resume"  /* HMAC input prefix for a resumed session key */
+#define KEX_RSA 0x1          /* key exchanges a client offers: RSA-sealed key */
+#define KEX_X25519 0x2       /* ... or X25519 against a signed server share */
+#define KEX_SHARE_SIZE 32    /* an X25519 public value */
+#define KEX_SIG_MAX 1024     /* largest share signature (RSA-8192) */
+#define SUITE_AES_256_GCM 1  /* block cipher suites, as numbered on the wire */
+#define SUITE_AES_128_GCM 2
+#define SUITE_CHACHA20_POLY1305 3
+#define SUITE_MAX 3
+#define SUITE_DEFAULT SUITE_AES_256_GCM  /* when the peer names none */
+#define AUTH_COOKIE -2       /* client_authenticate: reconnect with the cookie */
+#define AUTH_BUSY -3         /* client_authenticate: server busy, back off */
+#define BUSY_RETRIES 5       /* times a client backs off before giving up */
+#define BUSY_BACKOFF_MAX 5000  /* longest backoff, milliseconds */
 
 /* command and type */
 #define CMD_CREATE 1
@@ -57,6 +78,11 @@ typedef enum {
      FILE_XFER_INIT,         /* message 7 - initialize transfer */
      FILE_XFER_BLOCK,        /* message 8 - transfer file block */
      EXIT,                   /* message 9 - exit the protocol */
+     SERVER_COOKIE,          /* message 10 - reconnect with this cookie */
+     SERVER_BUSY,            /* message 11 - overloaded, retry after a delay */
+     CLIENT_FAST_INIT,       /* message 12 - sealed key and command in one flight */
+     CLIENT_RESUME,          /* message 13 - resume with a ticket, no RSA */
+     SERVER_TICKET,          /* message 14 - ticket to resume the next session */
 } ProtoMessageType;
 
 /* This is the message header */
@@ -73,6 +99,38 @@ struct rm_cmd {
 	char fname[0];
 };
 
+/* Server run-time options */
+typedef struct {
+	int workers;     /* listener processes, 0 for one per core */
+	int backlog;     /* pending connection queue length */
+	int threads;     /* crypto/disk pool threads, 0 for one per core */
+	int uring;       /* batch file writes through io_uring */
+	int sink;        /* how received files are written (SinkKind) */
+	int rsa_threads; /* handshake private key threads, 0 for one per core */
+	unsigned int session_budget;  /* buffer bytes one session may hold */
+	int handshake_timeout;  /* seconds to finish the key exchange, 0 for none */
+	int idle_timeout;       /* seconds a session may send nothing, 0 for none */
+	int session_timeout;    /* seconds a session may last, 0 for none */
+	int cookies;     /* require a stateless cookie before any key work */
+	int ticket_lifetime;  /* seconds a ticket key is used, 0 for no tickets */
+	int max_handshakes;          /* key exchanges at once, 0 for no limit */
+	int max_transfers;           /* authenticated sessions at once, 0 for no limit */
+	unsigned long max_queued;    /* block bytes awaiting the disk, 0 for no limit */
+	char *test;      /* run this self-test instead of serving */
+	int count;       /* self-test size, 0 for its default */
+} ServerConfig;
+
+/* Client run-time options */
+typedef struct {
+	int uring;       /* batch socket I/O through io_uring */
+	unsigned int blocksize;  /* file bytes per block to propose */
+	int source;      /* how the file is read (SourceKind) */
+	int workers;     /* encryptor threads, 0 for one per core */
+	char *keyfile;   /* saved server public key for one round trip, NULL for none */
+	char *ticketfile;  /* resumption ticket kept between runs, NULL for none */
+	int kex;         /* key exchanges to offer (KEX_*) */
+} ClientConfig;
+
 
 /* Functional Prototypes */
 
@@ -83,20 +141,143 @@ struct rm_cmd {
     Inputs      : r - cmd describing what to transfer and do
                   fname - filename of the file to transfer
                   address - address of the server
+                  cfg - client options
     Outputs     : 0 if successful, -1 if failure
 
 ***********************************************************************/
-extern int client_secure_transfer( struct rm_cmd *r, char *fname, char *address );
+extern int client_secure_transfer( struct rm_cmd *r, char *fname, char *address, 
+				   ClientConfig *cfg );
+
+/**********************************************************************
+
+    Function    : client_config_init
+    Description : fill in the default client options
+    Inputs      : cfg - the options to set
+    Outputs     : none
+
+***********************************************************************/
+extern void client_config_init( ClientConfig *cfg );
 
 /**********************************************************************
 
     Function    : server_secure_transfer
     Description : this is the main function to execute the protocol
-    Inputs      : pubkey - public key of the server
+    Inputs      : privfile - private key file of the server
+                  pubfile - public key file of the server
+                  cfg - server options
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int server_secure_transfer( char *privfile, char *pubfile, ServerConfig *cfg );
+
+/**********************************************************************
+
+    Function    : server_config_init
+    Description : fill in the default server options
+    Inputs      : cfg - the options to set
+    Outputs     : none
+
+***********************************************************************/
+extern void server_config_init( ServerConfig *cfg );
+
+/**********************************************************************
+
+    Function    : encrypt_message
+    Description : Get message encrypted (by encrypt) and put ciphertext 
+                   and metadata for decryption into buffer
+    Inputs      : plaintext - message
+                : plaintext_len - size of message
+                : key - symmetric key
+                : buffer - place to put ciphertext and metadata for 
+                   decryption on other end
+                : len - length of the buffer after message is set 
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int encrypt_message( unsigned char *plaintext, unsigned int plaintext_len, 
+			    unsigned char *key, unsigned char *buffer, unsigned int *len );
+
+/**********************************************************************
+
+    Function    : decrypt_message
+    Description : Produce plaintext for given ciphertext buffer (ciphertext+tag) using key 
+    Inputs      : buffer - encrypted message - includes tag
+                : len - length of encrypted message and tag
+                : key - symmetric key
+                : plaintext - message
+                : plaintext_len - size of message
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int decrypt_message( unsigned char *buffer, unsigned int len, unsigned char *key, 
+			    unsigned char *plaintext, unsigned int *plaintext_len );
+
+/**********************************************************************
+
+    Function    : generate_pseudorandom_bytes
+    Description : Generate pseudirandom bytes using OpenSSL PRNG 
+    Inputs      : buffer - buffer to fill
+                  size - number of bytes to get
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int generate_pseudorandom_bytes( unsigned char *buffer, unsigned int size );
+
+/**********************************************************************
+
+    Function    : extract_public_key
+    Description : Create public key data structure from network message
+    Inputs      : buffer - network message  buffer
+                : size - size of buffer
+                : pubkey - public key pointer
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int extract_public_key( char *buffer, unsigned int size, EVP_PKEY **pubkey );
+
+/**********************************************************************
+
+    Function    : seal_symmetric_key
+    Description : Encrypt symmetric key using public key
+    Inputs      : key - symmetric key
+                  keylen - symmetric key length in bytes
+                  pubkey - public key
+                  buffer - output buffer to store the encrypted seal key and ciphertext (iv?)
+    Outputs     : len if successful, -1 if failure
+
+***********************************************************************/
+extern int seal_symmetric_key( unsigned char *key, unsigned int keylen, EVP_PKEY *pubkey, 
+			       char *buffer );
+
+/**********************************************************************
+
+    Function    : unseal_symmetric_key
+    Description : Perform SSL unseal (open) operation to obtain the symmetric key
+    Inputs      : buffer - buffer of crypto data for decryption (ek, iv, ciphertext)
+                  len - length of buffer
+                  pubkey - public key 
+                  key - symmetric key (plaintext from unseal)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int unseal_symmetric_key( char *buffer, unsigned int len, EVP_PKEY *privkey, 
+				 unsigned char **key );
+
+/**********************************************************************
+
+    Function    : derive_resumed_key
+    Description : make a resumed session's key from a ticket secret and
+                  both sides' nonces, HMAC-SHA256(secret, RESUME_LABEL |
+                  client nonce | server nonce)
+    Inputs      : secret - the ticket secret (KEYSIZE bytes)
+                  cnonce - the client's nonce (RESUME_NONCE_SIZE bytes)
+                  snonce - the server's nonce (RESUME_NONCE_SIZE bytes)
+                  key - (out) the session key (KEYSIZE bytes)
     Outputs     : 0 if successful, -1 if failure
 
 ***********************************************************************/
-extern int server_secure_transfer( char *privfile, char *pubfile );
+extern int derive_resumed_key( const unsigned char *secret, const unsigned char *cnonce, 
+			       const unsigned char *snonce, unsigned char *key );
 
 /**********************************************************************
 
@@ -0,0 +1,187 @@
+/**********************************************************************
+
+   File          : cse543-queue.c
+
+   Description   : This is the bounded lock-free queue.  Each cell
+                   carries a sequence number: a producer may fill it
+                   when the number equals its ticket, a consumer may
+                   empty it when the number is one past its ticket, so
+                   a compare-and-swap on head or tail is the only
+                   contention.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* Project Include Files */
+#include "cse543-queue.h"
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : queue_init
+    Description : set up an empty queue
+    Inputs      : q - the queue
+                  size - least number of items it holds
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int queue_init( BoundedQueue *q, unsigned int size )
+{
+	unsigned long i, n = 2;
+
+	while ( n < size )
+		n <<= 1;
+	if ( (q->cells = (QueueCell *)malloc(n * sizeof(QueueCell))) == NULL )
+		return( -1 );
+	for ( i=0; i<n; i++ )
+		q->cells[i].seq = i;
+	q->mask = n - 1;
+	q->head = q->tail = 0;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : queue_free
+    Description : release the queue's cells
+    Inputs      : q - the queue
+    Outputs     : none
+
+***********************************************************************/
+
+void queue_free( BoundedQueue *q )
+{
+	free( q->cells );
+	q->cells = NULL;
+}
+
+/**********************************************************************
+
+    Function    : queue_push
+    Description : add an item, without waiting
+    Inputs      : q - the queue
+                  item - the item
+    Outputs     : 0 if successful, -1 if the queue is full
+
+***********************************************************************/
+
+int queue_push( BoundedQueue *q, void *item )
+{
+	unsigned long pos = __atomic_load_n( &q->tail, __ATOMIC_RELAXED ), seq;
+	QueueCell *cell;
+	long diff;
+
+	while ( 1 )
+	{
+		cell = &q->cells[pos & q->mask];
+		seq = __atomic_load_n( &cell->seq, __ATOMIC_ACQUIRE );
+		diff = (long)seq - (long)pos;
+
+		/* Our turn at this cell, if no other producer takes it */
+		if ( diff == 0 )
+		{
+			if ( __atomic_compare_exchange_n(&q->tail, &pos, pos+1, 1, 
+							 __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+				break;
+		}
+		/* Still holds an item from a lap ago */
+		else if ( diff < 0 )
+			return( -1 );
+		else
+			pos = __atomic_load_n( &q->tail, __ATOMIC_RELAXED );
+	}
+	cell->item = item;
+	__atomic_store_n( &cell->seq, pos+1, __ATOMIC_RELEASE );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : queue_pop
+    Description : take the oldest item, without waiting
+    Inputs      : q - the queue
+                  item - (out) the item
+    Outputs     : 0 if successful, -1 if the queue is empty
+
+***********************************************************************/
+
+int queue_pop( BoundedQueue *q, void **item )
+{
+	unsigned long pos = __atomic_load_n( &q->head, __ATOMIC_RELAXED ), seq;
+	QueueCell *cell;
+	long diff;
+
+	while ( 1 )
+	{
+		cell = &q->cells[pos & q->mask];
+		seq = __atomic_load_n( &cell->seq, __ATOMIC_ACQUIRE );
+		diff = (long)seq - (long)(pos+1);
+
+		/* Filled for this ticket, if no other consumer takes it */
+		if ( diff == 0 )
+		{
+			if ( __atomic_compare_exchange_n(&q->head, &pos, pos+1, 1, 
+							 __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+				break;
+		}
+		/* Not filled yet */
+		else if ( diff < 0 )
+			return( -1 );
+		else
+			pos = __atomic_load_n( &q->head, __ATOMIC_RELAXED );
+	}
+	*item = cell->item;
+
+	/* Free for the producer one lap on */
+	__atomic_store_n( &cell->seq, pos+q->mask+1, __ATOMIC_RELEASE );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : queue_backoff
+    Description : wait a little before trying again: spin, then yield,
+                  then sleep, the longer nothing changes
+    Inputs      : tries - (in/out) retries so far, 0 after progress
+    Outputs     : none
+
+***********************************************************************/
+
+void queue_backoff( unsigned int *tries )
+{
+	if ( *tries < QUEUE_SPINS )
+		__asm__ __volatile__( "" ::: "memory" );
+	else if ( *tries < QUEUE_SPINS+QUEUE_YIELDS )
+		sched_yield();
+	else
+		usleep( QUEUE_SLEEP_US );
+	(*tries)++;
+}
@@ -0,0 +1,115 @@
+#ifndef CSE543_QUEUE_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-queue.h
+
+   Description   : This is a bounded lock-free queue of pointers for
+                   handing work between threads (any number of
+                   producers and consumers), with a backoff for the
+                   side that finds it full or empty.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Defines */
+#define QUEUE_CACHELINE 64     /* keeps the two ends from sharing a line */
+#define QUEUE_SPINS 64         /* busy retries before yielding */
+#define QUEUE_YIELDS 1024      /* yields before sleeping */
+#define QUEUE_SLEEP_US 50      /* sleep between retries after that */
+
+/* Data Structures */
+
+/* This is one slot; its sequence number says whose turn it is */
+typedef struct {
+	unsigned long    seq;
+	void            *item;
+} QueueCell;
+
+/* This is the queue */
+typedef struct {
+	QueueCell       *cells;    /* ring of cells (power of 2) */
+	unsigned long    mask;     /* cells - 1 */
+	unsigned long    head __attribute__((aligned(QUEUE_CACHELINE)));  /* next pop */
+	unsigned long    tail __attribute__((aligned(QUEUE_CACHELINE)));  /* next push */
+} BoundedQueue;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : queue_init
+    Description : set up an empty queue
+    Inputs      : q - the queue
+                  size - least number of items it holds
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int queue_init( BoundedQueue *q, unsigned int size );
+
+/**********************************************************************
+
+    Function    : queue_free
+    Description : release the queue's cells
+    Inputs      : q - the queue
+    Outputs     : none
+
+***********************************************************************/
+extern void queue_free( BoundedQueue *q );
+
+/**********************************************************************
+
+    Function    : queue_push
+    Description : add an item, without waiting
+    Inputs      : q - the queue
+                  item - the item
+    Outputs     : 0 if successful, -1 if the queue is full
+
+***********************************************************************/
+extern int queue_push( BoundedQueue *q, void *item );
+
+/**********************************************************************
+
+    Function    : queue_pop
+    Description : take the oldest item, without waiting
+    Inputs      : q - the queue
+                  item - (out) the item
+    Outputs     : 0 if successful, -1 if the queue is empty
+
+***********************************************************************/
+extern int queue_pop( BoundedQueue *q, void **item );
+
+/**********************************************************************
+
+    Function    : queue_backoff
+    Description : wait a little before trying again: spin, then yield,
+                  then sleep, the longer nothing changes
+    Inputs      : tries - (in/out) retries so far, 0 after progress
+    Outputs     : none
+
+***********************************************************************/
+extern void queue_backoff( unsigned int *tries );
+
+#define CSE543_QUEUE_INCLUDED
+#endif
@@ -0,0 +1,2965 @@
+/**********************************************************************
+
+   File          : cse543-server.c
+
+   Description   : This is the event-driven server loop.  The listen
+                   socket and every session socket are registered
+                   edge-triggered with one epoll instance, and each
+                   session advances through the exchange as its frames
+                   arrive, so no client ever blocks another.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <time.h>
+
+/* OpenSSL Include Files */
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-network.h"
+#include "cse543-proto.h"
+#include "cse543-core.h"
+#include "cse543-pool.h"
+#include "cse543-uring.h"
+#include "cse543-timer.h"
+#include "cse543-ssl.h"
+#include "cse543-aead.h"
+#include "cse543-wire.h"
+#include "cse543-sink.h"
+#include "cse543-slab.h"
+#include "cse543-kex.h"
+#include "cse543-keys.h"
+#include "cse543-server.h"
+
+/* Defines */
+#define FILE_PREFIX "./shared/"
+
+/* The reactor state shared by every session */
+static int epfd = -1;
+static KeySet *server_keys = NULL;
+static volatile sig_atomic_t reload_keys = 0;
+static unsigned int active_sessions = 0;
+static unsigned int session_budget = SESSION_BUDGET;
+static SinkKind file_sink = SINK_WRITE;
+
+/* Session deadlines (0 for none), kept on the reactor's timer wheel */
+static TimerWheel wheel;
+static unsigned long handshake_ms = 0, idle_ms = 0, lifetime_ms = 0;
+
+/* Admission limits (0 for none) and what is admitted now; queued_bytes
+   is shared with the pool threads */
+static int max_handshakes = 0, max_transfers = 0;
+static unsigned long max_queued = 0;
+static int handshakes = 0, transfers = 0;
+static unsigned long queued_bytes = 0;
+
+/* Handshake cookies, keyed by a secret every worker shares */
+static int cookies = 0, cookie_ready = 0;
+static unsigned char cookie_secret[KEYSIZE];
+
+/* Resumption tickets; the ticket key for each period comes from one
+   secret, so forked workers agree on it without sharing anything */
+static int ticket_lifetime = 0, ticket_ready = 0;
+static unsigned char ticket_secret[KEYSIZE];
+
+/* X25519 share, made and signed on the reactor thread as it expires */
+static KexShare kex_share;
+
+/* The pool doing block decrypts and file writes, the pool doing the
+   handshake's RSA private key work, and the list of sessions whose
+   pool task finished (signalled through done_fd) */
+static ThreadPool *pool = NULL;
+static ThreadPool *handshake_pool = NULL;
+static int done_fd = -1;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static ProtoSession *done_list = NULL;
+
+/* epoll tags for the non-session descriptors */
+static char listener_tag, completion_tag;
+
+/* Functional Prototypes */
+static int session_readable( ProtoSession *s );
+static int session_xfer_init( ProtoSession *s, char *block, unsigned int len );
+static void session_expired( Timer *t );
+
+/**********************************************************************
+
+    Function    : server_deadlines
+    Description : set up the timer wheel and the session deadlines
+    Inputs      : cfg - server options
+    Outputs     : none
+
+***********************************************************************/
+
+static void server_deadlines( ServerConfig *cfg )
+{
+	timer_wheel_init( &wheel );
+	handshake_ms = (unsigned long)cfg->handshake_timeout * 1000;
+	idle_ms = (unsigned long)cfg->idle_timeout * 1000;
+	lifetime_ms = (unsigned long)cfg->session_timeout * 1000;
+}
+
+/**********************************************************************
+
+    Function    : session_deadline
+    Description : (re)arm one of a session's deadlines
+    Inputs      : t - the session timer
+                  ms - milliseconds from now (0 for no deadline)
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_deadline( Timer *t, unsigned long ms )
+{
+	if ( ms > 0 )
+		timer_add( &wheel, t, ms );
+	else
+		timer_del( &wheel, t );
+}
+
+/**********************************************************************
+
+    Function    : session_admit
+    Description : move a session to another admission count
+    Inputs      : s - the session
+                  admit - what it counts against now
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_admit( ProtoSession *s, SessionAdmit admit )
+{
+	if ( s->admitted == SESSION_ADMIT_HANDSHAKE )
+		handshakes--;
+	else if ( s->admitted == SESSION_ADMIT_TRANSFER )
+		transfers--;
+	if ( admit == SESSION_ADMIT_HANDSHAKE )
+		handshakes++;
+	else if ( admit == SESSION_ADMIT_TRANSFER )
+		transfers++;
+	s->admitted = admit;
+}
+
+/**********************************************************************
+
+    Function    : server_overloaded
+    Description : check whether a new session would go over a limit
+    Inputs      : none
+    Outputs     : 1 if the session should be refused, 0 if not
+
+***********************************************************************/
+
+static int server_overloaded( void )
+{
+	return( ((max_handshakes > 0) && (handshakes >= max_handshakes)) ||
+		((max_transfers > 0) && (transfers >= max_transfers)) ||
+		((max_queued > 0) && 
+		 (__atomic_load_n(&queued_bytes, __ATOMIC_RELAXED) >= max_queued)) );
+}
+
+/**********************************************************************
+
+    Function    : server_block_max
+    Description : get the largest file block a session may use, so a
+                  few whole frames fit in its buffer budget
+    Inputs      : none
+    Outputs     : the block size in bytes
+
+***********************************************************************/
+
+static unsigned int server_block_max( void )
+{
+	unsigned int max = session_budget/SESSION_BLOCKS - 
+		sizeof(ProtoMessageHdr) - AEAD_OVERHEAD;
+
+	return( (max < XFER_BLOCK_MAX) ? max : XFER_BLOCK_MAX );
+}
+
+/**********************************************************************
+
+    Function    : session_new
+    Description : create the session state for a new connection
+    Inputs      : sock - the accepted client socket
+    Outputs     : the session if successful, NULL if failure
+
+***********************************************************************/
+
+static ProtoSession *session_new( int sock )
+{
+	ProtoSession *s;
+
+	/* Allocate the session and its protocol state */
+	if ( (s = (ProtoSession *)calloc(1, sizeof(ProtoSession))) == NULL )
+		return( NULL );
+	if ( core_init(&s->core, CORE_SERVER) != 0 )
+	{
+		core_free( &s->core );
+		free( s );
+		return( NULL );
+	}
+	s->sock = sock;
+	s->sink.fd = -1;
+	arena_init( &s->scratch );
+	s->state = SESSION_WAIT_INIT_EXCHANGE;
+	pthread_mutex_init( &s->lock, NULL );
+	timer_init( &s->deadline, session_expired, s );
+	timer_init( &s->lifetime, session_expired, s );
+	session_deadline( &s->deadline, handshake_ms );
+	session_deadline( &s->lifetime, lifetime_ms );
+	active_sessions++;
+	return( s );
+}
+
+/**********************************************************************
+
+    Function    : session_close
+    Description : tear down a session and release everything it holds
+    Inputs      : s - the session
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_close( ProtoSession *s )
+{
+	XferJob *job;
+	int i;
+
+	/* Closing the socket also drops it from the epoll set */
+	if ( s->sock != -1 )
+		close( s->sock );
+	s->sock = -1;
+	timer_del( &wheel, &s->deadline );
+	timer_del( &wheel, &s->lifetime );
+	session_admit( s, SESSION_ADMIT_NONE );
+
+	/* The pool still has the file and key, finish when it is done */
+	if ( s->inflight )
+	{
+		s->dead = 1;
+		return;
+	}
+
+	while ( (job = s->jobs) != NULL )
+	{
+		s->jobs = job->next;
+		__atomic_sub_fetch( &queued_bytes, job->len, __ATOMIC_RELAXED );
+		slab_free( job->buf );
+		slab_free( job );
+	}
+	sink_close( &s->sink, 0 );
+	for ( i=0; i<s->lanes; i++ )
+		aead_free( &s->ciphers[i] );
+	pthread_mutex_destroy( &s->lock );
+	core_free( &s->core );
+	aead_free( &s->aead );
+	free( s->key );
+	EVP_PKEY_free( s->privkey );
+	arena_free( &s->scratch );
+	free( s );
+	active_sessions--;
+}
+
+/**********************************************************************
+
+    Function    : session_flush
+    Description : send as much of the queued output as the socket takes
+    Inputs      : s - the session
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_flush( ProtoSession *s )
+{
+	unsigned int len;
+	char *out;
+	int ret;
+
+	/* Keep sending until drained or the socket is full */
+	while ( (out = core_pending(&s->core, &len)), len > 0 )
+	{
+		if ( (ret = send_avail(s->sock, out, len)) == -1 )
+			return( -1 );
+		if ( ret == 0 )
+			return( 0 );
+		core_sent( &s->core, ret );
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : session_send
+    Description : queue a frame for the client and try to send it
+    Inputs      : s - the session
+                  msgtype - the message type
+                  block - the message body (or NULL)
+                  len - the length of the body
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_send( ProtoSession *s, ProtoMessageType msgtype, 
+			 char *block, unsigned int len )
+{
+	/* The core frames it and checks it is our turn */
+	if ( core_queue(&s->core, msgtype, block, len) != 0 )
+		return( -1 );
+	return( session_flush(s) );
+}
+
+/**********************************************************************
+
+    Function    : server_cookies
+    Description : turn handshake cookies on, choosing the secret once so
+                  that forked workers share it
+    Inputs      : cfg - server options
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int server_cookies( ServerConfig *cfg )
+{
+	cookies = cfg->cookies;
+	if ( !cookies || cookie_ready )
+		return( 0 );
+	if ( generate_pseudorandom_bytes(cookie_secret, KEYSIZE) != 0 )
+		return( -1 );
+	cookie_ready = 1;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : cookie_make
+    Description : compute the cookie for a client address and time,
+                  the time followed by HMAC(secret, address | time)
+    Inputs      : sock - the client socket
+                  stamp - the time the cookie was issued
+                  cookie - (out) COOKIE_SIZE bytes
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int cookie_make( int sock, uint32_t stamp, unsigned char *cookie )
+{
+	struct sockaddr_storage peer;
+	socklen_t plen = sizeof(peer);
+	unsigned char msg[sizeof(struct in6_addr)+sizeof(stamp)], *mac = cookie+sizeof(stamp);
+	size_t mlen = 0, maclen;
+
+	/* Only the address, the client reconnects from another port */
+	if ( getpeername(sock, (struct sockaddr *)&peer, &plen) != 0 )
+		return( -1 );
+	if ( peer.ss_family == AF_INET6 )
+	{
+		memcpy( msg, &((struct sockaddr_in6 *)&peer)->sin6_addr, sizeof(struct in6_addr) );
+		mlen = sizeof(struct in6_addr);
+	}
+	else
+	{
+		memcpy( msg, &((struct sockaddr_in *)&peer)->sin_addr, sizeof(struct in_addr) );
+		mlen = sizeof(struct in_addr);
+	}
+	stamp = htonl( stamp );
+	memcpy( msg+mlen, &stamp, sizeof(stamp) );
+	mlen += sizeof(stamp);
+
+	memcpy( cookie, &stamp, sizeof(stamp) );
+	hmac_message( msg, mlen, &mac, &maclen, cookie_secret, KEYSIZE );
+	return( (maclen == COOKIE_SIZE-sizeof(stamp)) ? 0 : -1 );
+}
+
+/**********************************************************************
+
+    Function    : session_cookie_valid
+    Description : check the cookie a client presented is one we issued
+                  to its address, and recently
+    Inputs      : s - the session
+                  block - the cookie
+                  len - length of the cookie
+    Outputs     : 1 if valid, 0 if not
+
+***********************************************************************/
+
+static int session_cookie_valid( ProtoSession *s, char *block, unsigned int len )
+{
+	unsigned char expect[COOKIE_SIZE];
+	uint32_t stamp, now = (uint32_t)time( NULL );
+
+	if ( len != COOKIE_SIZE )
+		return( 0 );
+	memcpy( &stamp, block, sizeof(stamp) );
+	stamp = ntohl( stamp );
+	if ( (stamp > now) || (now-stamp > COOKIE_LIFETIME) ||
+	     (cookie_make(s->sock, stamp, expect) != 0) )
+		return( 0 );
+	return( CRYPTO_memcmp(expect, block, COOKIE_SIZE) == 0 );
+}
+
+/**********************************************************************
+
+    Function    : server_tickets
+    Description : turn resumption tickets on, choosing the secret the
+                  ticket keys come from once so that forked workers
+                  share it
+    Inputs      : cfg - server options
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int server_tickets( ServerConfig *cfg )
+{
+	ticket_lifetime = cfg->ticket_lifetime;
+	if ( !ticket_lifetime || ticket_ready )
+		return( 0 );
+	if ( generate_pseudorandom_bytes(ticket_secret, KEYSIZE) != 0 )
+		return( -1 );
+	ticket_ready = 1;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : ticket_key
+    Description : compute the ticket key for a period, the key rotates
+                  each ticket lifetime: HMAC(secret, label | period)
+    Inputs      : epoch - the period (time / ticket lifetime)
+                  key - (out) KEYSIZE bytes
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int ticket_key( uint32_t epoch, unsigned char *key )
+{
+	unsigned char msg[sizeof("ticket key")-1+sizeof(epoch)];
+	unsigned char mac[EVP_MAX_MD_SIZE], *val = mac;
+	size_t maclen = 0;
+
+	epoch = htonl( epoch );
+	memcpy( msg, "ticket key", sizeof("ticket key")-1 );
+	memcpy( msg+sizeof("ticket key")-1, &epoch, sizeof(epoch) );
+	hmac_message( msg, sizeof(msg), &val, &maclen, ticket_secret, KEYSIZE );
+	if ( maclen < KEYSIZE )
+		return( -1 );
+	memcpy( key, mac, KEYSIZE );
+	OPENSSL_cleanse( mac, sizeof(mac) );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : ticket_make
+    Description : seal a resumption secret into a ticket only this
+                  server can open: the period, then the issue time and
+                  secret encrypted under that period's ticket key
+    Inputs      : secret - the secret (KEYSIZE bytes)
+                  ticket - (out) TICKET_SIZE bytes
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int ticket_make( unsigned char *secret, unsigned char *ticket )
+{
+	unsigned char key[KEYSIZE], plain[sizeof(uint32_t)+KEYSIZE];
+	uint32_t now = (uint32_t)time( NULL ), epoch = now / ticket_lifetime;
+	unsigned int len = 0;
+	int ret = -1;
+
+	now = htonl( now );
+	memcpy( plain, &now, sizeof(now) );
+	memcpy( plain+sizeof(now), secret, KEYSIZE );
+	if ( (ticket_key(epoch, key) == 0) &&
+	     (encrypt_message(plain, sizeof(plain), key, ticket+sizeof(epoch), &len) == 0) &&
+	     (len == TICKET_SIZE-sizeof(epoch)) )
+		ret = 0;
+	epoch = htonl( epoch );
+	memcpy( ticket, &epoch, sizeof(epoch) );
+	OPENSSL_cleanse( key, KEYSIZE );
+	OPENSSL_cleanse( plain, sizeof(plain) );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : ticket_open
+    Description : get the secret out of a ticket, if it is one of ours
+                  under the current or previous ticket key and has not
+                  outlived the ticket lifetime
+    Inputs      : ticket - the ticket (TICKET_SIZE bytes)
+                  secret - (out) KEYSIZE bytes
+    Outputs     : 0 if successful, -1 if not
+
+***********************************************************************/
+
+static int ticket_open( const unsigned char *ticket, unsigned char *secret )
+{
+	unsigned char key[KEYSIZE], sealed[TICKET_SIZE], plain[TICKET_SIZE];
+	uint32_t now = (uint32_t)time( NULL ), epoch, issued;
+	unsigned int len = 0;
+	int ret = -1;
+
+	memcpy( &epoch, ticket, sizeof(epoch) );
+	epoch = ntohl( epoch );
+	if ( (epoch != now/ticket_lifetime) && (epoch+1 != now/ticket_lifetime) )
+		return( -1 );
+
+	/* Decrypted from a copy, the ticket is in the receive buffer */
+	memcpy( sealed, ticket, TICKET_SIZE );
+	if ( (ticket_key(epoch, key) == 0) &&
+	     (decrypt_message(sealed+sizeof(epoch), TICKET_SIZE-sizeof(epoch), key, 
+			      plain, &len) == 0) &&
+	     (len == sizeof(issued)+KEYSIZE) )
+	{
+		memcpy( &issued, plain, sizeof(issued) );
+		issued = ntohl( issued );
+		if ( (issued <= now) && (now-issued <= (uint32_t)ticket_lifetime) )
+		{
+			memcpy( secret, plain+sizeof(issued), KEYSIZE );
+			ret = 0;
+		}
+	}
+	OPENSSL_cleanse( key, KEYSIZE );
+	OPENSSL_cleanse( plain, sizeof(plain) );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : session_hello
+    Description : check a client's hello before any key work: send a
+                  cookie to come back with when it has not presented a
+                  valid one, or turn it away when over a limit
+    Inputs      : s - the session
+                  hello - the hello (block size, any cookie)
+    Outputs     : 0 to go on, 1 if it was answered, -1 if failure
+
+***********************************************************************/
+
+static int session_hello( ProtoSession *s, WireHello *hello )
+{
+	char reply[WIRE_SIZE(1, COOKIE_SIZE)];
+	unsigned char cookie[COOKIE_SIZE];
+	WireCookie reconnect;
+	WireBusy busy;
+
+	/* No file or key work until the client shows it can receive at
+	   its address; the cookie carries all the state */
+	if ( cookies && !session_cookie_valid(s, (char *)hello->cookie, hello->cookie_len) )
+	{
+		if ( cookie_make(s->sock, (uint32_t)time(NULL), cookie) != 0 )
+			return( -1 );
+		reconnect.cookie = cookie;
+		reconnect.cookie_len = COOKIE_SIZE;
+		s->state = SESSION_CLOSING;
+		return( (session_send(s, SERVER_COOKIE, reply, 
+				      wire_encode_cookie(&reconnect, reply, sizeof(reply))) == 0) ? 1 : -1 );
+	}
+
+	/* Over a limit, turn it away before it costs anything */
+	if ( server_overloaded() )
+	{
+		busy.retry = BUSY_RETRY_MS;
+		s->state = SESSION_CLOSING;
+		return( (session_send(s, SERVER_BUSY, reply, 
+				      wire_encode_busy(&busy, reply, sizeof(reply))) == 0) ? 1 : -1 );
+	}
+	session_admit( s, SESSION_ADMIT_HANDSHAKE );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : session_hold_key
+    Description : take a reference to the current private key for a
+                  session to unseal with, if it has none
+    Inputs      : s - the session
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_hold_key( ProtoSession *s )
+{
+	if ( (s->privkey == NULL) && (EVP_PKEY_up_ref(server_keys->privkey) == 1) )
+		s->privkey = server_keys->privkey;
+}
+
+/**********************************************************************
+
+    Function    : session_keyed
+    Description : move a session that has its key on to the command,
+                  under the transfer limits
+    Inputs      : s - the session
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_keyed( ProtoSession *s )
+{
+	s->state = SESSION_WAIT_XFER_INIT;
+	core_set_limit( &s->core, s->blocksize+AEAD_OVERHEAD );
+	session_admit( s, SESSION_ADMIT_TRANSFER );
+	session_deadline( &s->deadline, idle_ms );
+}
+
+/**********************************************************************
+
+    Function    : session_offer_key
+    Description : agree the block size, taking the client's up to what
+                  the budget holds, and send it with the public key as
+                  SERVER_INIT_RESPONSE; given the client's X25519 share,
+                  send the signed server share too, agree the key from
+                  the two and ack at once
+    Inputs      : s - the session
+                  blocksize - the client's proposed block size
+                  share - the client's X25519 share, NULL for RSA
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_offer_key( ProtoSession *s, unsigned int blocksize, 
+			      const unsigned char *share )
+{
+	unsigned char message[] = "Complete", proof[IVSIZE+TAGSIZE+sizeof(message)];
+	char *response;
+	WireResponse answer;
+	unsigned int len, prooflen;
+	int ret;
+
+	s->blocksize = blocksize;
+	if ( s->blocksize > server_block_max() )
+		s->blocksize = server_block_max();
+	if ( s->blocksize < BLOCKSIZE )
+	{
+		errorMessage( "Server received too small a block size\n" );
+		return( -1 );
+	}
+
+	/* The key as loaded; the client's sealed key is opened with its
+	   private half even if the keys are reloaded meanwhile */
+	session_hold_key( s );
+	memset( &answer, 0, sizeof(answer) );
+	answer.blocksize = s->blocksize;
+	answer.pubkey = server_keys->pem;
+	answer.pubkey_len = len = server_keys->pemlen;
+	answer.suite = s->suite;
+	len = WIRE_SIZE( 3, 2*sizeof(uint32_t)+len );
+
+	/* Without a share we can sign the client has the RSA exchange */
+	if ( (share != NULL) && 
+	     (kex_share_refresh(&kex_share, server_keys->privkey, (uint32_t)time(NULL)) == 0) )
+	{
+		answer.kex = KEX_X25519;
+		answer.share = kex_share.pub;
+		answer.share_len = KEX_SHARE_SIZE;
+		answer.expiry = kex_share.expiry;
+		answer.sig = kex_share.sig;
+		answer.sig_len = kex_share.siglen;
+		len += WIRE_SIZE( 4, 2*sizeof(uint32_t)+KEX_SHARE_SIZE+kex_share.siglen ) - WIRE_PREAMBLE;
+	}
+	if ( (response = (char *)arena_alloc(&s->scratch, len)) == NULL )
+		return( -1 );
+	ret = session_send( s, SERVER_INIT_RESPONSE, response, 
+			    wire_encode_response(&answer, response, len) );
+	if ( (ret != 0) || (answer.kex != KEX_X25519) )
+	{
+		s->state = SESSION_WAIT_INIT_ACK;
+		return( ret );
+	}
+
+	/* The key from the two shares, and the proof we have it */
+	if ( ((s->key = (unsigned char *)malloc(KEYSIZE)) == NULL) ||
+	     (kex_derive(kex_share.key, share, share, kex_share.pub, s->key) != 0) ||
+	     (encrypt_message(message, strlen((char *)message), s->key, 
+			      proof, &prooflen) != 0) )
+	{
+		errorMessage( "Server unable to establish session key\n" );
+		return( -1 );
+	}
+	session_keyed( s );
+	return( session_send(s, SERVER_INIT_ACK, (char *)proof, prooflen) );
+}
+
+/**********************************************************************
+
+    Function    : session_init_exchange
+    Description : answer CLIENT_INIT_EXCHANGE with the public key, or
+                  with a cookie to come back with when the client has
+                  not presented a valid one
+    Inputs      : s - the session
+                  block - the client's hello (block size, any cookie)
+                  len - length of the hello
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_init_exchange( ProtoSession *s, char *block, unsigned int len )
+{
+	WireHello hello;
+	int ret;
+
+	if ( wire_decode_hello(block, len, &hello) != 0 )
+	{
+		errorMessage( "Server received malformed init exchange\n" );
+		return( -1 );
+	}
+	if ( (ret = session_hello(s, &hello)) != 0 )
+		return( (ret > 0) ? 0 : -1 );
+	if ( (s->suite = aead_choose(hello.suites, hello.suites_len)) == 0 )
+	{
+		errorMessage( "Server has no cipher suite in common with the client\n" );
+		return( -1 );
+	}
+	return( session_offer_key(s, hello.blocksize, 
+				  ((hello.kex & KEX_X25519) && hello.share_len) ? hello.share : NULL) );
+}
+
+/**********************************************************************
+
+    Function    : session_resume
+    Description : answer CLIENT_RESUME: with a ticket we can open, make
+                  the session key from its secret and both nonces and
+                  ack at once, no RSA; otherwise go on with the full
+                  exchange as if it were CLIENT_INIT_EXCHANGE
+    Inputs      : s - the session
+                  block - the hello, ticket and client nonce
+                  len - its length
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_resume( ProtoSession *s, char *block, unsigned int len )
+{
+	unsigned char message[] = "Complete", secret[KEYSIZE], nonce[RESUME_NONCE_SIZE];
+	unsigned char proof[IVSIZE+TAGSIZE+sizeof(message)];
+	char reply[WIRE_SIZE(4, 2*sizeof(uint32_t)+RESUME_NONCE_SIZE+sizeof(proof))];
+	WireResume resume;
+	WireResumed answer;
+	WireHello hello;
+	unsigned int prooflen;
+	int ret;
+
+	if ( wire_decode_resume(block, len, &resume) != 0 )
+	{
+		errorMessage( "Server received malformed resume\n" );
+		return( -1 );
+	}
+	hello.blocksize = resume.blocksize;
+	hello.cookie = resume.cookie;
+	hello.cookie_len = resume.cookie_len;
+	if ( (ret = session_hello(s, &hello)) != 0 )
+		return( (ret > 0) ? 0 : -1 );
+	if ( (s->suite = aead_choose(resume.suites, resume.suites_len)) == 0 )
+	{
+		errorMessage( "Server has no cipher suite in common with the client\n" );
+		return( -1 );
+	}
+
+	/* Another server's ticket or an old one costs the client only
+	   the full exchange */
+	if ( !ticket_lifetime || (ticket_open(resume.ticket, secret) != 0) )
+		return( session_offer_key(s, resume.blocksize, NULL) );
+
+	s->blocksize = resume.blocksize;
+	if ( s->blocksize > server_block_max() )
+		s->blocksize = server_block_max();
+	ret = -1;
+	if ( (s->blocksize >= BLOCKSIZE) &&
+	     ((s->key = (unsigned char *)malloc(KEYSIZE)) != NULL) &&
+	     (generate_pseudorandom_bytes(nonce, RESUME_NONCE_SIZE) == 0) &&
+	     (derive_resumed_key(secret, resume.nonce, nonce, s->key) == 0) &&
+	     (encrypt_message(message, strlen((char *)message), s->key, 
+			      proof, &prooflen) == 0) )
+		ret = 0;
+	OPENSSL_cleanse( secret, KEYSIZE );
+	if ( ret != 0 )
+	{
+		errorMessage( "Server unable to resume session\n" );
+		return( -1 );
+	}
+
+	session_keyed( s );
+	answer.blocksize = s->blocksize;
+	answer.nonce = nonce;
+	answer.nonce_len = RESUME_NONCE_SIZE;
+	answer.proof = proof;
+	answer.proof_len = prooflen;
+	answer.suite = s->suite;
+	return( session_send(s, SERVER_INIT_ACK, reply, 
+			     wire_encode_resumed(&answer, reply, sizeof(reply))) );
+}
+
+/**********************************************************************
+
+    Function    : session_done
+    Description : hand a session back to the reactor when its pool
+                  task finishes
+    Inputs      : s - the session
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_done( ProtoSession *s )
+{
+	uint64_t one = 1;
+
+	/* On the list once, however many of its tasks finish */
+	pthread_mutex_lock( &done_lock );
+	if ( s->finished++ == 0 )
+	{
+		s->next_done = done_list;
+		done_list = s;
+	}
+	pthread_mutex_unlock( &done_lock );
+	if ( write(done_fd, &one, sizeof(one)) != sizeof(one) )
+		errorMessage( "Server failed to signal pool completion\n" );
+}
+
+/**********************************************************************
+
+    Function    : session_unseal
+    Description : handshake pool task that does the RSA private key
+                  operation to recover the session key
+    Inputs      : arg - the session
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_unseal( void *arg )
+{
+	ProtoSession *s = (ProtoSession *)arg;
+
+	if ( unseal_symmetric_key(s->sealed, s->sealed_len, s->privkey, &s->key) != 0 )
+	{
+		pthread_mutex_lock( &s->lock );
+		s->failed = 1;
+		pthread_mutex_unlock( &s->lock );
+	}
+	session_done( s );
+}
+
+/**********************************************************************
+
+    Function    : session_init_ack
+    Description : hand the sealed key from CLIENT_INIT_ACK to the
+                  handshake pool; the session waits (SESSION_UNSEALING)
+                  while the reactor keeps serving everyone else
+    Inputs      : s - the session
+                  block - the sealed key
+                  len - length of the sealed key
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_init_ack( ProtoSession *s, char *block, unsigned int len )
+{
+	WireSealed sealed;
+
+	/* Turn away malformed keys before they take a pool thread */
+	if ( wire_decode_sealed(block, len, &sealed) != 0 )
+	{
+		errorMessage( "Server received malformed sealed key\n" );
+		return( -1 );
+	}
+
+	/* Keep a copy, the receive buffer moves on; the one round trip
+	   flight was sealed to whichever key the client saved */
+	session_hold_key( s );
+	if ( (s->privkey == NULL) || 
+	     ((s->sealed = (char *)arena_alloc(&s->scratch, len)) == NULL) )
+		return( -1 );
+	memcpy( s->sealed, block, len );
+	s->sealed_len = len;
+
+	if ( pool_submit(handshake_pool, session_unseal, s) != 0 )
+		return( -1 );
+	s->inflight = 1;
+	s->state = SESSION_UNSEALING;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : session_fast_init
+    Description : take a CLIENT_FAST_INIT: check the hello, keep the
+                  command until the key is unsealed and hand the sealed
+                  key to the handshake pool; the blocks that follow wait
+                  in the socket until then
+    Inputs      : s - the session
+                  block - the hello, sealed key and command
+                  len - its length
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_fast_init( ProtoSession *s, char *block, unsigned int len )
+{
+	WireFast fast;
+	WireHello hello;
+	int ret;
+
+	if ( wire_decode_fast(block, len, &fast) != 0 )
+	{
+		errorMessage( "Server received malformed fast init\n" );
+		return( -1 );
+	}
+	hello.blocksize = fast.blocksize;
+	hello.cookie = fast.cookie;
+	hello.cookie_len = fast.cookie_len;
+	if ( (ret = session_hello(s, &hello)) != 0 )
+		return( (ret > 0) ? 0 : -1 );
+
+	/* The blocks are already coming at the client's size, so there is
+	   no agreeing on a smaller one; the client falls back to the full
+	   exchange */
+	if ( (fast.blocksize < BLOCKSIZE) || (fast.blocksize > server_block_max()) )
+	{
+		errorMessage( "Server cannot take the block size in one round trip\n" );
+		return( -1 );
+	}
+	s->blocksize = fast.blocksize;
+	core_set_limit( &s->core, s->blocksize+AEAD_OVERHEAD );
+	s->suite = (fast.suite != 0) ? (int)fast.suite : SUITE_DEFAULT;
+	if ( aead_suite_name(s->suite) == NULL )
+	{
+		errorMessage( "Server received an unknown cipher suite\n" );
+		return( -1 );
+	}
+
+	/* Keep a copy of the command, the receive buffer moves on */
+	if ( (s->command = (char *)arena_alloc(&s->scratch, fast.command_len)) == NULL )
+		return( -1 );
+	memcpy( s->command, fast.command, fast.command_len );
+	s->command_len = fast.command_len;
+	return( session_init_ack(s, (char *)fast.sealed, fast.sealed_len) );
+}
+
+/**********************************************************************
+
+    Function    : session_unsealed
+    Description : finish the handshake once the pool has the key,
+                  confirming it with an encrypted SERVER_INIT_ACK
+    Inputs      : s - the session
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_unsealed( ProtoSession *s )
+{
+	unsigned char message[] = "Complete";
+	unsigned char buffer[MAX_BLOCK_SIZE];
+	unsigned int outlen;
+
+	/* Prove we have the key */
+	s->sealed = NULL;
+	if ( s->failed || 
+	     (encrypt_message(message, strlen((char *)message), s->key, 
+			      buffer, &outlen) != 0) )
+	{
+		errorMessage( "Server unable to establish session key\n" );
+		return( -1 );
+	}
+
+	session_keyed( s );
+	if ( session_send(s, SERVER_INIT_ACK, (char *)buffer, outlen) != 0 )
+		return( -1 );
+
+	/* In one round trip the command came with the key */
+	if ( s->command != NULL )
+	{
+		if ( session_xfer_init(s, s->command, s->command_len) != 0 )
+			return( -1 );
+		s->command = NULL;
+	}
+
+	/* Pick up anything that arrived meanwhile */
+	return( session_readable(s) );
+}
+
+/**********************************************************************
+
+    Function    : session_xfer_init
+    Description : set up the file named by the FILE_XFER_INIT command
+    Inputs      : s - the session
+                  block - the command
+                  len - length of the command
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_xfer_init( ProtoSession *s, char *block, unsigned int len )
+{
+	WireCommand cmd;
+	unsigned int size;
+	char *fname;
+
+	/* Build the command structure from the fields */
+	if ( wire_decode_command(block, len, &cmd) != 0 )
+	{
+		errorMessage( "Server received malformed transfer command\n" );
+		return( -1 );
+	}
+	if ( (s->cmd = (struct rm_cmd *)arena_alloc(&s->scratch, 
+						    sizeof(struct rm_cmd) + cmd.fname_len)) == NULL )
+		return( -1 );
+	s->cmd->cmd = cmd.cmd;
+	s->cmd->type = cmd.type;
+	s->cmd->len = cmd.fname_len;
+	memcpy( s->cmd->fname, cmd.fname, cmd.fname_len );
+	s->state = SESSION_XFER;
+
+	/* Only a create carries file data */
+	if ( s->cmd->cmd != CMD_CREATE )
+	{
+		printf( "Server: illegal command %d\n", s->cmd->cmd );
+		return( 0 );
+	}
+	if ( s->cmd->type != TYP_DATA_SHARED )
+	{
+		printf( "Server: illegal command type %d\n", s->cmd->type );
+		return( -1 );
+	}
+
+	/* Key the block cipher; an open file means it is ready */
+	if ( aead_init(&s->aead, s->key, s->suite, AEAD_SERVER) != 0 )
+		return( -1 );
+
+	/* open file */
+	size = s->cmd->len + strlen(FILE_PREFIX) + 1;
+	if ( (fname = (char *)arena_alloc(&s->scratch, size)) == NULL )
+		return( -1 );
+	snprintf( fname, size, "%s%.*s", FILE_PREFIX, (int)s->cmd->len, s->cmd->fname );
+	if ( sink_open(&s->sink, file_sink, fname, cmd.size, s->blocksize) != 0 )
+		return( -1 );
+	printf( "Receiving file [%s] ..\n", fname );
+
+	/* Blocks that go at their own offsets can be opened and written
+	   by every pool thread at once, each lane with its own cipher */
+	s->lanes = sink_positional( &s->sink ) ? pool->nworkers : 1;
+	s->ciphers = (AeadSession *)arena_alloc( &s->scratch, s->lanes*sizeof(AeadSession) );
+	s->idle_ciphers = (int *)arena_alloc( &s->scratch, s->lanes*sizeof(int) );
+	if ( (s->ciphers == NULL) || (s->idle_ciphers == NULL) )
+	{
+		s->lanes = 0;
+		return( -1 );
+	}
+	memset( s->ciphers, 0, s->lanes*sizeof(AeadSession) );
+	for ( s->nidle_ciphers=0; s->nidle_ciphers<s->lanes; s->nidle_ciphers++ )
+		s->idle_ciphers[s->nidle_ciphers] = s->nidle_ciphers;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : session_write_plain
+    Description : decrypt blocks into the gathering sink's buffer, or
+                  in place and then, once authenticated, into the sink
+    Inputs      : s - the session
+                  a - this lane's copy of the session cipher
+                  jobs - the blocks
+                  n - number of blocks
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_write_plain( ProtoSession *s, AeadSession *a, XferJob **jobs, int n )
+{
+	unsigned char *plaintext, *space;
+	unsigned int outbytes;
+	int i, ret = 0;
+
+	for ( i=0; (i<n) && (ret == 0); i++ )
+	{
+		/* A gathering sink's space only counts once committed, so it
+		   is opened into; any other space (a mapping) is the file, so
+		   open in place after the tag and copy it there once the tag
+		   checks out */
+		space = NULL;
+		if ( jobs[i]->len > AEAD_OVERHEAD )
+			space = (unsigned char *)sink_space_at( &s->sink, jobs[i]->offset, 
+								jobs[i]->len-AEAD_OVERHEAD );
+		plaintext = (unsigned char *)jobs[i]->block + AEAD_OVERHEAD;
+		if ( (space != NULL) && !sink_positional(&s->sink) )
+			plaintext = space;
+		if ( aead_open_at(a, jobs[i]->seq, (unsigned char *)jobs[i]->block, 
+				  jobs[i]->len, plaintext, &outbytes) != 0 )
+		{
+			errorMessage( "Server failed to decrypt file block\n" );
+			ret = -1;
+			break;
+		}
+		if ( (space != NULL) && (plaintext != space) )
+		{
+			memcpy( space, plaintext, outbytes );
+			plaintext = space;
+		}
+		ret = sink_write_at( &s->sink, (char *)plaintext, outbytes, jobs[i]->offset );
+	}
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : session_write_uring
+    Description : decrypt blocks into the thread's registered buffers
+                  and write them all with one io_uring submit
+    Inputs      : r - the thread's ring
+                  s - the session
+                  a - this lane's copy of the session cipher
+                  jobs - the blocks (at most URING_NBUFS)
+                  n - number of blocks
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_write_uring( IoRing *r, ProtoSession *s, AeadSession *a, 
+				XferJob **jobs, int n )
+{
+	int idx[URING_NBUFS], res[URING_NBUFS];
+	unsigned long off[URING_NBUFS];
+	AeadBlock blocks[URING_NBUFS];
+	unsigned long long tag;
+	int i, slot, opened, queued = 0, ret = 0, rv;
+	char *buf;
+
+	/* Blocks larger than a registered buffer are written as they come;
+	   so is a descriptor number that may be a different file than
+	   last time, and anything for a sink that gathers or maps */
+	if ( (s->blocksize > URING_BUFSIZE) || 
+	     ((s->sink.kind != SINK_WRITE) && (s->sink.kind != SINK_FALLOCATE)) ||
+	     ((slot = uring_file(r, s->sink.fd, 1)) == -1) )
+		return( session_write_plain(s, a, jobs, n) );
+
+	/* Decrypt the batch straight into registered buffers */
+	for ( i=0; i<n; i++ )
+	{
+		blocks[i].in = (unsigned char *)jobs[i]->block;
+		blocks[i].inlen = jobs[i]->len;
+		blocks[i].out = (unsigned char *)uring_buffer( r, &idx[i] );
+	}
+	for ( opened=0; opened<n; opened++ )
+		if ( aead_open_at(a, jobs[opened]->seq, blocks[opened].in, blocks[opened].inlen, 
+				  blocks[opened].out, &blocks[opened].outlen) != 0 )
+			break;
+	if ( opened < n )
+	{
+		errorMessage( "Server failed to decrypt file block\n" );
+		for ( i=opened; i<n; i++ )
+			uring_release( r, idx[i] );
+		ret = -1;
+	}
+	n = opened;
+
+	/* Queue a write of each, where it goes */
+	for ( i=0; i<n; i++ )
+	{
+		off[i] = jobs[i]->offset;
+		res[i] = -ECANCELED;
+		if ( uring_queue(r, IORING_OP_WRITE_FIXED, slot, (char *)blocks[i].out, 
+				 blocks[i].outlen, off[i], idx[i], 0, i) != 0 )
+			res[i] = 0;
+		else
+			queued++;
+	}
+
+	/* One call to write them all, then mop up anything short */
+	sink_written( &s->sink, 0, (queued > 0), 0.0 );
+	if ( (queued > 0) && (uring_submit(r, queued) == 0) )
+		while ( (queued > 0) && uring_reap(r, &tag, &rv) )
+		{
+			res[tag] = rv;
+			queued--;
+		}
+	for ( i=0; i<n; i++ )
+	{
+		buf = (char *)blocks[i].out;
+		if ( res[i] < 0 )
+			res[i] = 0;
+		if ( (res[i] < blocks[i].outlen) && 
+		     (pwrite(s->sink.fd, buf+res[i], blocks[i].outlen-res[i], off[i]+res[i]) != 
+		      blocks[i].outlen-res[i]) )
+		{
+			/* Complain, explain, and stop */
+			char msg[128];
+			sprintf( msg, "failure writing file [%.64s]\n", strerror(errno) );
+			errorMessage( msg );
+			ret = -1;
+		}
+		else
+			sink_written( &s->sink, off[i]+blocks[i].outlen, 0, 0.0 );
+		uring_release( r, idx[i] );
+	}
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : session_drain
+    Description : pool task that decrypts and writes a session's queued
+                  blocks, then reports back to the reactor; several may
+                  run at once for a sink that writes at offsets
+    Inputs      : arg - the session
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_drain( void *arg )
+{
+	ProtoSession *s = (ProtoSession *)arg;
+	XferJob *jobs[URING_NBUFS];
+	IoRing *r = uring_thread();
+	int i, n, max = (r != NULL) ? URING_NBUFS : 1;
+	AeadSession *aead;
+	int lane, failed;
+
+	/* Each task opens blocks with its lane's copy of the keyed cipher,
+	   copied the first time the lane runs; there is always one idle,
+	   since no more tasks run than there are lanes */
+	pthread_mutex_lock( &s->lock );
+	lane = s->idle_ciphers[--s->nidle_ciphers];
+	pthread_mutex_unlock( &s->lock );
+	aead = &s->ciphers[lane];
+	failed = (aead->open == NULL) && (aead_clone(aead, &s->aead) != 0);
+
+	/* Work through the queue; the reactor only appends to it */
+	while ( 1 )
+	{
+		pthread_mutex_lock( &s->lock );
+		for ( n=0; (n<max) && (s->jobs != NULL); n++ )
+		{
+			jobs[n] = s->jobs;
+			if ( (s->jobs = jobs[n]->next) == NULL )
+				s->jobs_tail = NULL;
+			s->queued -= jobs[n]->len;
+			__atomic_sub_fetch( &queued_bytes, jobs[n]->len, __ATOMIC_RELAXED );
+		}
+		s->failed |= failed;
+		failed = s->failed;
+		pthread_mutex_unlock( &s->lock );
+		if ( n == 0 )
+			break;
+
+		/* Write the batch (skip once broken) */
+		if ( !failed )
+			failed = (r != NULL) ? (session_write_uring(r, s, aead, jobs, n) != 0) :
+				(session_write_plain(s, aead, jobs, n) != 0);
+		for ( i=0; i<n; i++ )
+		{
+			slab_free( jobs[i]->buf );
+			slab_free( jobs[i] );
+		}
+	}
+
+	/* Hand the lane and the session back */
+	pthread_mutex_lock( &s->lock );
+	s->idle_ciphers[s->nidle_ciphers++] = lane;
+	pthread_mutex_unlock( &s->lock );
+	session_done( s );
+}
+
+/**********************************************************************
+
+    Function    : session_xfer_block
+    Description : number a FILE_XFER_BLOCK and place it in the file as
+                  it arrives, and queue it for the pool to decrypt and
+                  write there
+    Inputs      : s - the session
+                  ev - the message
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_xfer_block( ProtoSession *s, ProtoEvent *ev )
+{
+	unsigned int len = ev->length;
+	XferJob *job;
+	char *buf;
+
+	/* Blocks only make sense for a create */
+	if ( s->sink.fd == -1 )
+	{
+		errorMessage( "Server received file block without open file\n" );
+		return( -1 );
+	}
+
+	/* Take the receive buffer it is in, or copy a small block out */
+	if ( (buf = core_detach(&s->core, ev)) != NULL )
+	{
+		if ( (job = (XferJob *)slab_alloc(sizeof(XferJob))) == NULL )
+		{
+			slab_free( buf );
+			return( -1 );
+		}
+		job->block = ev->block;
+	}
+	else
+	{
+		if ( (job = (XferJob *)slab_alloc(sizeof(XferJob) + len)) == NULL )
+			return( -1 );
+		job->block = job->data;
+		memcpy( job->block, ev->block, len );
+	}
+	job->next = NULL;
+	job->buf = buf;
+	job->len = len;
+	job->seq = s->next_seq++;
+	job->offset = s->next_offset;
+	s->next_offset += (len > AEAD_OVERHEAD) ? len-AEAD_OVERHEAD : 0;
+	pthread_mutex_lock( &s->lock );
+	if ( s->jobs_tail != NULL )
+		s->jobs_tail->next = job;
+	else
+		s->jobs = job;
+	s->jobs_tail = job;
+	s->queued += len;
+	__atomic_add_fetch( &queued_bytes, len, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &s->lock );
+
+	/* Another drain task, up to the lanes the sink allows; with one,
+	   the blocks are written in order */
+	if ( s->inflight < s->lanes )
+	{
+		if ( pool_submit(pool, session_drain, s) != 0 )
+			return( -1 );
+		s->inflight++;
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : ticket_issue
+    Description : make a new resumption secret and the SERVER_TICKET
+                  carrying it, encrypted under the session key
+    Inputs      : key - the session key
+                  sealed - (out) the message, WIRE_TICKET_SEALED bytes
+                  len - (out) its length
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int ticket_issue( unsigned char *key, unsigned char *sealed, unsigned int *len )
+{
+	unsigned char secret[KEYSIZE], ticket[TICKET_SIZE];
+	unsigned char plain[WIRE_SIZE(3, sizeof(uint32_t)+TICKET_SIZE+KEYSIZE)];
+	WireTicket issue;
+	int n, ret = -1;
+
+	issue.lifetime = ticket_lifetime;
+	issue.ticket = ticket;
+	issue.ticket_len = TICKET_SIZE;
+	issue.secret = secret;
+	issue.secret_len = KEYSIZE;
+	if ( (generate_pseudorandom_bytes(secret, KEYSIZE) == 0) &&
+	     (ticket_make(secret, ticket) == 0) &&
+	     ((n = wire_encode_ticket(&issue, (char *)plain, sizeof(plain))) > 0) &&
+	     (encrypt_message(plain, n, key, sealed, len) == 0) )
+		ret = 0;
+	OPENSSL_cleanse( secret, KEYSIZE );
+	OPENSSL_cleanse( plain, sizeof(plain) );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : session_ticket
+    Description : send the client a ticket to resume its next session
+                  with
+    Inputs      : s - the session
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_ticket( ProtoSession *s )
+{
+	unsigned char sealed[WIRE_TICKET_SEALED];
+	unsigned int len = 0;
+
+	if ( ticket_issue(s->key, sealed, &len) != 0 )
+		return( -1 );
+	return( session_send(s, SERVER_TICKET, (char *)sealed, len) );
+}
+
+/**********************************************************************
+
+    Function    : session_finish
+    Description : ack the client's EXIT once every block is written
+    Inputs      : s - the session
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_finish( ProtoSession *s )
+{
+	/* Still writing, the last completion will call us again */
+	if ( s->inflight )
+	{
+		s->state = SESSION_DRAINING;
+		return( 0 );
+	}
+	if ( s->failed )
+		return( -1 );
+
+	/* Done, the file is complete once the sink lets go of it; ack the
+	   client and close once it is sent */
+	if ( s->sink.fd != -1 )
+	{
+		printf( "Total bytes [%ld].\n", s->sink.offset );
+		if ( sink_close(&s->sink, 1) != 0 )
+			return( -1 );
+	}
+	if ( ticket_lifetime && (s->key != NULL) && (session_ticket(s) != 0) )
+		warningMessage( "unable to issue a resumption ticket" );
+	s->state = SESSION_CLOSING;
+	return( session_send(s, EXIT, NULL, 0) );
+}
+
+/**********************************************************************
+
+    Function    : session_message
+    Description : advance the session by one received message
+    Inputs      : s - the session
+                  ev - the message
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int session_message( ProtoSession *s, ProtoEvent *ev )
+{
+	/* The core has already checked the message is in order */
+	switch ( ev->msgtype )
+	{
+	case CLIENT_INIT_EXCHANGE:
+		return( session_init_exchange(s, ev->block, ev->length) );
+
+	case CLIENT_INIT_ACK:
+		return( session_init_ack(s, ev->block, ev->length) );
+
+	case CLIENT_RESUME:
+		return( session_resume(s, ev->block, ev->length) );
+
+	case CLIENT_FAST_INIT:
+		return( session_fast_init(s, ev->block, ev->length) );
+
+	case FILE_XFER_INIT:
+		return( session_xfer_init(s, ev->block, ev->length) );
+
+	case FILE_XFER_BLOCK:
+		return( session_xfer_block(s, ev) );
+
+	case EXIT:
+		return( session_finish(s) );
+
+	default:
+		break;
+	}
+
+	/* Complain, explain, and return */
+	char msg[128];
+	sprintf( msg, "Server unable to process message type [%d]\n", ev->msgtype );
+	errorMessage( msg );
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : session_readable
+    Description : drain the socket and process every complete frame
+    Inputs      : s - the session
+    Outputs     : 0 if successful, -1 if the session should be closed
+
+***********************************************************************/
+
+static int session_readable( ProtoSession *s )
+{
+	ProtoEvent ev;
+	unsigned int avail;
+	char *space;
+	int got, ret;
+
+	/* Edge-triggered, so read until the socket is empty (or the pool
+	   is too far behind, the completion resumes reading) */
+	do
+	{
+		/* Leave the rest in the socket until the key is ready (in
+		   one round trip the blocks are already coming) */
+		if ( s->state == SESSION_UNSEALING )
+			break;
+		pthread_mutex_lock( &s->lock );
+		s->throttled = (s->queued+core_held(&s->core) >= session_budget);
+		pthread_mutex_unlock( &s->lock );
+		if ( s->throttled )
+			return( 0 );
+		if ( ((space = core_recv_space(&s->core, &avail)) == NULL) ||
+		     ((got = recv_avail(s->sock, space, avail)) == -1) )
+			return( -1 );
+		core_received( &s->core, got );
+
+		/* Past the handshake, any traffic pushes the idle deadline */
+		if ( (got > 0) && (s->state >= SESSION_WAIT_XFER_INIT) )
+			session_deadline( &s->deadline, idle_ms );
+
+		/* Process each complete message */
+		while ( s->state != SESSION_UNSEALING )
+		{
+			if ( (ret = core_next_event(&s->core, &ev)) == -1 )
+				return( -1 );
+			if ( ret == 0 )
+				break;
+			if ( session_message(s, &ev) != 0 )
+				return( -1 );
+		}
+	}
+	while ( got > 0 );
+
+	/* Nothing in flight, hand the buffers back until more arrives */
+	core_idle( &s->core );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : session_expired
+    Description : a session deadline passed, drop the session unless it
+                  is only waiting on the server's own pools
+    Inputs      : t - the session timer that fired
+    Outputs     : none
+
+***********************************************************************/
+
+static void session_expired( Timer *t )
+{
+	ProtoSession *s = (ProtoSession *)t->arg;
+
+	/* Not the client's fault, give it another idle period */
+	if ( (t == &s->deadline) && (s->state >= SESSION_WAIT_XFER_INIT) &&
+	     (s->throttled || (s->state == SESSION_DRAINING)) )
+	{
+		session_deadline( &s->deadline, idle_ms );
+		return;
+	}
+
+	/* Complain, explain, and drop it */
+	char msg[128];
+	sprintf( msg, "session timed out (%s) in state [%d]", 
+		 (t == &s->lifetime) ? "lifetime" : 
+		 (s->state < SESSION_WAIT_XFER_INIT) ? "handshake" : "idle", s->state );
+	warningMessage( msg );
+	session_close( s );
+}
+
+/**********************************************************************
+
+    Function    : server_accept_all
+    Description : accept every pending connection on the listen socket
+    Inputs      : server - the listening socket
+    Outputs     : none
+
+***********************************************************************/
+
+static void server_accept_all( int server )
+{
+	struct epoll_event ev;
+	ProtoSession *s;
+	int newsock;
+
+	/* Edge-triggered, so accept until the backlog is empty */
+	while ( (newsock = server_accept(server)) != -1 )
+	{
+		if ( (set_nonblocking(newsock) != 0) || 
+		     ((s = session_new(newsock)) == NULL) )
+		{
+			errorMessage( "Server unable to set up session\n" );
+			close( newsock );
+			continue;
+		}
+
+		/* Watch for input and for room to send */
+		ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+		ev.data.ptr = s;
+		if ( epoll_ctl(epfd, EPOLL_CTL_ADD, newsock, &ev) != 0 )
+		{
+			errorMessage( "Server unable to watch session socket\n" );
+			session_close( s );
+		}
+	}
+}
+
+/**********************************************************************
+
+    Function    : server_completions
+    Description : pick up sessions whose drain task finished, start the
+                  next one, resume throttled reads and ack finished
+                  transfers
+    Inputs      : none
+    Outputs     : none
+
+***********************************************************************/
+
+static void server_completions( void )
+{
+	ProtoSession *s, *next;
+	uint64_t count;
+	int more, finished;
+
+	/* Take the whole list at once */
+	if ( read(done_fd, &count, sizeof(count)) != sizeof(count) )
+		return;
+	pthread_mutex_lock( &done_lock );
+	s = done_list;
+	done_list = NULL;
+	pthread_mutex_unlock( &done_lock );
+
+	for ( ; s != NULL; s = next )
+	{
+		pthread_mutex_lock( &done_lock );
+		next = s->next_done;
+		finished = s->finished;
+		s->finished = 0;
+		pthread_mutex_unlock( &done_lock );
+		s->inflight -= finished;
+		if ( s->dead )
+		{
+			if ( !s->inflight )
+				session_close( s );
+			continue;
+		}
+
+		/* The key is unsealed, or not */
+		if ( s->state == SESSION_UNSEALING )
+		{
+			if ( session_unsealed(s) != 0 )
+			{
+				warningMessage( "session dropped during handshake" );
+				session_close( s );
+			}
+			continue;
+		}
+
+		/* Blocks may have arrived after the task looked */
+		pthread_mutex_lock( &s->lock );
+		more = (s->jobs != NULL) && !s->failed;
+		pthread_mutex_unlock( &s->lock );
+		if ( more && (s->inflight < s->lanes) && (pool_submit(pool, session_drain, s) == 0) )
+			s->inflight++;
+
+		/* Broken, resumed or finished */
+		if ( s->failed ||
+		     (s->throttled && (session_readable(s) != 0)) ||
+		     ((s->state == SESSION_DRAINING) && (session_finish(s) != 0)) )
+		{
+			warningMessage( "session dropped before transfer completed" );
+			session_close( s );
+		}
+	}
+}
+
+/**********************************************************************
+
+    Function    : server_hangup
+    Description : SIGHUP handler: note the keys are to be reloaded and
+                  wake the reactor through the pool's completion fd
+    Inputs      : sig - the signal
+    Outputs     : none
+
+***********************************************************************/
+
+static void server_hangup( int sig )
+{
+	uint64_t one = 1;
+	ssize_t wrote = 0;
+	int saved = errno;
+
+	/* Should the write fail the reactor sees the flag when it next wakes */
+	reload_keys = 1;
+	if ( done_fd != -1 )
+		wrote = write( done_fd, &one, sizeof(one) );
+	(void)wrote;
+	errno = saved;
+}
+
+/**********************************************************************
+
+    Function    : server_reload
+    Description : reload the key files; sessions keep the key they
+                  were offered, new ones get the new keys, and a bad
+                  file leaves the old keys in place
+    Inputs      : none
+    Outputs     : 0 if reloaded, -1 if failure
+
+***********************************************************************/
+
+static int server_reload( void )
+{
+	reload_keys = 0;
+	if ( keys_reload(server_keys) != 0 )
+	{
+		warningMessage( "unable to reload the server keys, keeping the old ones" );
+		return( -1 );
+	}
+
+	/* The share was signed with the old key */
+	kex_share_free( &kex_share );
+	printf( "Server keys reloaded from [%s] and [%s]\n", 
+		server_keys->privfile, server_keys->pubfile );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : server_watch_hangup
+    Description : reload the keys on SIGHUP; without SA_RESTART so a
+                  wait in progress returns to look
+    Inputs      : none
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int server_watch_hangup( void )
+{
+	struct sigaction sa;
+
+	memset( &sa, 0, sizeof(sa) );
+	sa.sa_handler = server_hangup;
+	sigemptyset( &sa.sa_mask );
+	return( sigaction(SIGHUP, &sa, NULL) );
+}
+
+/**********************************************************************
+
+    Function    : server_event_loop
+    Description : accept and serve client sessions until the listen
+                  socket fails
+    Inputs      : server - the listening socket
+                  cfg - server options
+                  keys - the server keys, reloaded on SIGHUP
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int server_event_loop( int server, ServerConfig *cfg, KeySet *keys )
+{
+	struct epoll_event ev, events[MAX_EPOLL_EVENTS];
+	ProtoSession *s;
+	unsigned int pending;
+	int i, nev, completed;
+
+	/* Setup the reactor and the pool, which reports through done_fd */
+	server_keys = keys;
+	if ( cfg->session_budget > 0 )
+		session_budget = cfg->session_budget;
+	file_sink = cfg->sink;
+	server_deadlines( cfg );
+	max_handshakes = cfg->max_handshakes;
+	max_transfers = cfg->max_transfers;
+	max_queued = cfg->max_queued;
+	if ( server_cookies(cfg) != 0 )
+	{
+		errorMessage( "failure choosing the cookie secret\n" );
+		return( -1 );
+	}
+	if ( server_tickets(cfg) != 0 )
+	{
+		errorMessage( "failure choosing the ticket secret\n" );
+		return( -1 );
+	}
+	if ( cfg->uring )
+		uring_enable();
+	if ( ((epfd = epoll_create1(0)) == -1) || (set_nonblocking(server) != 0) ||
+	     ((done_fd = eventfd(0, EFD_NONBLOCK)) == -1) ||
+	     ((pool = pool_create(cfg->threads)) == NULL) ||
+	     ((handshake_pool = pool_create(cfg->rsa_threads)) == NULL) )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "failure creating server reactor [%.64s]\n", 
+			 strerror(errno) );
+		errorMessage( msg );
+		return( -1 );
+	}
+	ev.events = EPOLLIN|EPOLLET;
+	ev.data.ptr = &listener_tag;
+	if ( epoll_ctl(epfd, EPOLL_CTL_ADD, server, &ev) != 0 )
+	{
+		errorMessage( "failure watching server connection\n" );
+		return( -1 );
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &completion_tag;
+	if ( (epoll_ctl(epfd, EPOLL_CTL_ADD, done_fd, &ev) != 0) ||
+	     (server_watch_hangup() != 0) )
+	{
+		errorMessage( "failure watching server connection\n" );
+		return( -1 );
+	}
+
+	/* Repeat until the reactor fails */
+	while ( 1 )
+	{
+		if ( (nev = epoll_wait(epfd, events, MAX_EPOLL_EVENTS, timer_next(&wheel))) == -1 )
+		{
+			if ( errno == EINTR )
+				continue;
+
+			/* Complain, explain, and return */
+			char msg[128];
+			sprintf( msg, "failure waiting on server connections [%.64s]\n", 
+				 strerror(errno) );
+			errorMessage( msg );
+			return( -1 );
+		}
+
+		for ( i=0, completed=0; i<nev; i++ )
+		{
+			/* New connections */
+			if ( events[i].data.ptr == &listener_tag )
+			{
+				server_accept_all( server );
+				continue;
+			}
+
+			/* Pool completions, handled after this batch since they
+			   may free sessions that still have events in it */
+			if ( events[i].data.ptr == &completion_tag )
+			{
+				completed = 1;
+				continue;
+			}
+			s = (ProtoSession *)events[i].data.ptr;
+
+			/* Session traffic: send what we can, take what came in */
+			if ( (events[i].events & (EPOLLERR|EPOLLHUP)) ||
+			     ((events[i].events & EPOLLOUT) && (session_flush(s) != 0)) ||
+			     ((events[i].events & (EPOLLIN|EPOLLRDHUP)) && 
+			      (session_readable(s) != 0)) )
+			{
+				if ( s->state != SESSION_CLOSING )
+					warningMessage( "session dropped before transfer completed" );
+				session_close( s );
+				continue;
+			}
+
+			/* The final ack has been sent, we are done */
+			if ( (s->state == SESSION_CLOSING) && 
+			     (core_pending(&s->core, &pending), pending == 0) )
+				session_close( s );
+		}
+		if ( completed )
+			server_completions();
+
+		/* Between batches, so no session is part way through a send */
+		if ( reload_keys )
+			server_reload();
+
+		/* Reap the sessions whose deadline passed */
+		timer_advance( &wheel );
+	}
+
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : server_start_worker
+    Description : fork a listener process pinned to one core
+    Inputs      : cpu - the core to run on (-1 for no pinning)
+                  cfg - server options
+                  keys - the server keys
+    Outputs     : the worker pid in the parent, -1 if failure
+
+***********************************************************************/
+
+static pid_t server_start_worker( int cpu, ServerConfig *cfg, KeySet *keys )
+{
+	cpu_set_t set;
+	pid_t pid;
+	int server;
+
+	/* The parent just tracks the worker */
+	if ( (pid = fork()) != 0 )
+		return( pid );
+
+	/* Go down with the parent, pin, then bind our own listener */
+	prctl( PR_SET_PDEATHSIG, SIGTERM );
+	if ( cpu >= 0 )
+	{
+		CPU_ZERO( &set );
+		CPU_SET( cpu, &set );
+		if ( sched_setaffinity(0, sizeof(set), &set) != 0 )
+			warningMessage( "unable to pin server worker to its core" );
+	}
+	server = server_connect( cfg->backlog, 1 );
+	exit( server_event_loop(server, cfg, keys) == 0 ? 0 : -1 );
+}
+
+/**********************************************************************
+
+    Function    : server_spawn_workers
+    Description : run the server as several SO_REUSEPORT listener
+                  processes, one pinned to each core, restarting any
+                  that crash
+    Inputs      : cfg - server options
+                  keys - the server keys; SIGHUP reloads them here and
+                   in every worker
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int server_spawn_workers( ServerConfig *cfg, KeySet *keys )
+{
+	cpu_set_t allowed;
+	int *cpus, *wcpu, ncpus = 0, nworkers, running = 0, i, status;
+	pid_t *pids, pid;
+
+	/* Find the cores we are allowed to run on */
+	CPU_ZERO( &allowed );
+	if ( sched_getaffinity(0, sizeof(allowed), &allowed) != 0 )
+	{
+		errorMessage( "unable to get server cpu affinity\n" );
+		return( -1 );
+	}
+	cpus = (int *)malloc( CPU_SETSIZE * sizeof(int) );
+	for ( i=0; i<CPU_SETSIZE; i++ )
+		if ( CPU_ISSET(i, &allowed) )
+			cpus[ncpus++] = i;
+
+	/* Workers share one cookie secret and one ticket secret */
+	if ( server_cookies(cfg) != 0 )
+	{
+		errorMessage( "failure choosing the cookie secret\n" );
+		free( cpus );
+		return( -1 );
+	}
+	if ( server_tickets(cfg) != 0 )
+	{
+		errorMessage( "failure choosing the ticket secret\n" );
+		free( cpus );
+		return( -1 );
+	}
+
+	/* One worker per core unless told otherwise */
+	nworkers = (cfg->workers > 0) ? cfg->workers : ncpus;
+	pids = (pid_t *)malloc( nworkers * sizeof(pid_t) );
+	wcpu = (int *)malloc( nworkers * sizeof(int) );
+	printf( "Server starting [%d] workers on [%d] cores ...\n", nworkers, ncpus );
+	for ( i=0; i<nworkers; i++ )
+	{
+		wcpu[i] = cpus[i % ncpus];
+		if ( (pids[i] = server_start_worker(wcpu[i], cfg, keys)) == -1 )
+			errorMessage( "unable to fork server worker\n" );
+		else
+			running++;
+	}
+
+	/* Restart workers that crash, stop when they all exit; on
+	   SIGHUP reload our keys, for the workers we restart, and pass
+	   it on */
+	server_keys = keys;
+	if ( server_watch_hangup() != 0 )
+		warningMessage( "unable to watch for SIGHUP, keys will not reload" );
+	while ( running > 0 )
+	{
+		if ( (pid = wait(&status)) == -1 )
+		{
+			if ( errno != EINTR )
+				break;
+			if ( reload_keys )
+			{
+				server_reload();
+				for ( i=0; i<nworkers; i++ )
+					if ( pids[i] != -1 )
+						kill( pids[i], SIGHUP );
+			}
+			continue;
+		}
+		for ( i=0; (i<nworkers) && (pids[i]!=pid); i++ );
+		if ( i == nworkers )
+			continue;
+		if ( WIFSIGNALED(status) )
+		{
+			char msg[128];
+			sprintf( msg, "server worker on core [%d] died (signal %d), restarting", 
+				 wcpu[i], WTERMSIG(status) );
+			warningMessage( msg );
+			if ( (pids[i] = server_start_worker(wcpu[i], cfg, keys)) != -1 )
+				continue;
+		}
+		pids[i] = -1;
+		running--;
+	}
+
+	free( cpus );
+	free( pids );
+	free( wcpu );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : test_transport
+    Description : move what one core has queued to another in memory,
+                  returning the message as the receiver sees it
+    Inputs      : from - the sending core
+                  to - the receiving core
+                  msgtype - the message type expected
+                  ev - (out) the message received
+    Outputs     : 0 if the message arrived, -1 if failure
+
+***********************************************************************/
+
+static int test_transport( ProtoCore *from, ProtoCore *to, ProtoMessageType msgtype, 
+			   ProtoEvent *ev )
+{
+	unsigned int n, taken;
+	char *out;
+
+	while ( (out = core_pending(from, &n)), n > 0 )
+	{
+		/* A full core learns the frame size from its header and
+		   makes room on the next push */
+		if ( ((taken = core_push(to, out, n)) == 0) &&
+		     ((core_next_event(to, ev) != 0) || 
+		      ((taken = core_push(to, out, n)) == 0)) )
+			return( -1 );
+		core_sent( from, taken );
+	}
+	if ( (core_next_event(to, ev) != 1) || (ev->msgtype != msgtype) )
+		return( -1 );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : test_deliver
+    Description : pass one message between two cores in memory,
+                  returning it as the receiver sees it
+    Inputs      : from - the sending core
+                  to - the receiving core
+                  msgtype - the message type
+                  block - the message body (or NULL)
+                  len - the length of the body
+                  ev - (out) the message received
+    Outputs     : 0 if the message arrived, -1 if failure
+
+***********************************************************************/
+
+static int test_deliver( ProtoCore *from, ProtoCore *to, ProtoMessageType msgtype, 
+			 char *block, unsigned int len, ProtoEvent *ev )
+{
+	if ( core_queue(from, msgtype, block, len) != 0 )
+		return( -1 );
+	return( test_transport(from, to, msgtype, ev) );
+}
+
+/**********************************************************************
+
+    Function    : test_exchange
+    Description : pass one message between two cores in memory
+    Inputs      : from - the sending core
+                  to - the receiving core
+                  msgtype - the message type
+                  block - the message body (or NULL)
+                  len - the length of the body
+    Outputs     : 0 if the message arrived intact, -1 if failure
+
+***********************************************************************/
+
+static int test_exchange( ProtoCore *from, ProtoCore *to, ProtoMessageType msgtype, 
+			  char *block, unsigned int len )
+{
+	ProtoEvent ev;
+
+	if ( (test_deliver(from, to, msgtype, block, len, &ev) != 0) ||
+	     (ev.length != len) )
+		return( -1 );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : test_rss
+    Description : get the resident memory of this process
+    Inputs      : none
+    Outputs     : resident bytes, 0 if unknown
+
+***********************************************************************/
+
+static unsigned long test_rss( void )
+{
+	unsigned long size = 0, resident = 0;
+	FILE *fptr;
+
+	if ( (fptr = fopen("/proc/self/statm", "r")) == NULL )
+		return( 0 );
+	if ( fscanf(fptr, "%lu %lu", &size, &resident) != 2 )
+		resident = 0;
+	fclose( fptr );
+	return( resident * sysconf(_SC_PAGESIZE) );
+}
+
+/**********************************************************************
+
+    Function    : test_sessions
+    Description : hold many idle authenticated sessions and report
+                  the memory each one costs; the exchange runs through
+                  each session's core in memory, with one sealed key
+                  and server ack reused so the RSA work is done once
+    Inputs      : cfg - server options (count is the number of sessions)
+                  keys - the server keys
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_sessions( ServerConfig *cfg, KeySet *keys )
+{
+	int count = (cfg->count > 0) ? cfg->count : SESSION_TEST_COUNT;
+	unsigned char symkey[KEYSIZE], ack[MAX_BLOCK_SIZE];
+	unsigned char *key = NULL;
+	char sealed[MAX_BLOCK_SIZE];
+	unsigned int acklen, held = 0;
+	unsigned long before, after;
+	ProtoSession **sessions;
+	ProtoCore client;
+	int sealedlen = -1, i, n, failed = 0, ret = -1;
+
+	printf( "*** Test %d idle authenticated sessions. ***\n", count );
+
+	/* One real exchange, its messages replayed for every session */
+	server_deadlines( cfg );
+	if ( (sessions = (ProtoSession **)calloc(count, sizeof(ProtoSession *))) == NULL )
+		return( -1 );
+	if ( (generate_pseudorandom_bytes(symkey, KEYSIZE) != 0) ||
+	     ((sealedlen = seal_symmetric_key(symkey, KEYSIZE, keys->pubkey, sealed)) <= 0) ||
+	     (unseal_symmetric_key(sealed, sealedlen, keys->privkey, &key) != 0) ||
+	     (memcmp(key, symkey, KEYSIZE) != 0) ||
+	     (encrypt_message((unsigned char *)"Complete", 8, key, ack, &acklen) != 0) )
+	{
+		errorMessage( "session test unable to set up the exchange\n" );
+		free( sessions );
+		free( key );
+		return( -1 );
+	}
+
+	/* Authenticate each session and leave it idle */
+	before = test_rss();
+	for ( n=0; n<count; n++ )
+	{
+		if ( (sessions[n] = session_new(-1)) == NULL )
+			break;
+		core_init( &client, CORE_CLIENT );
+		if ( (test_exchange(&client, &sessions[n]->core, CLIENT_INIT_EXCHANGE, NULL, 0) != 0) ||
+		     (test_exchange(&sessions[n]->core, &client, SERVER_INIT_RESPONSE, 
+				    (char *)keys->pem, keys->pemlen) != 0) ||
+		     (test_exchange(&client, &sessions[n]->core, CLIENT_INIT_ACK, 
+				    sealed, sealedlen) != 0) ||
+		     ((sessions[n]->key = (unsigned char *)malloc(KEYSIZE)) == NULL) ||
+		     (test_exchange(&sessions[n]->core, &client, SERVER_INIT_ACK, 
+				    (char *)ack, acklen) != 0) )
+		{
+			core_free( &client );
+			failed = 1;
+			n++;
+			break;
+		}
+		memcpy( sessions[n]->key, key, KEYSIZE );
+		sessions[n]->state = SESSION_WAIT_XFER_INIT;
+		core_idle( &sessions[n]->core );
+		core_free( &client );
+	}
+	after = test_rss();
+
+	/* Report, then check an idle session holds no buffers */
+	for ( i=0; i<n; i++ )
+		held += core_held( &sessions[i]->core );
+	printf( "Sessions: %d of %d, session size %lu bytes, buffers held %u bytes\n", 
+		n, count, (unsigned long)sizeof(ProtoSession), held );
+	printf( "RSS: %lu -> %lu bytes, %lu bytes per idle session\n", 
+		before, after, (n > 0) ? (after-before)/n : 0 );
+	if ( !failed && (n == count) && (held == 0) )
+		ret = 0;
+	else
+		errorMessage( "session test failed\n" );
+
+	for ( i=0; i<n; i++ )
+		session_close( sessions[i] );
+	free( sessions );
+	free( key );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_connect
+    Description : set up two cores and session ciphers in memory as 
+                  they are once the handshake is done and a transfer
+                  has started
+    Inputs      : client - the client core
+                  server - the server core
+                  seal - the client cipher
+                  open - the server cipher
+                  key - the session key
+                  blocksize - file bytes per block
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int test_connect( ProtoCore *client, ProtoCore *server, AeadSession *seal, 
+			 AeadSession *open, unsigned char *key, unsigned int blocksize )
+{
+	int ret = 0;
+
+	core_init( client, CORE_CLIENT );
+	core_init( server, CORE_SERVER );
+	if ( (test_exchange(client, server, CLIENT_INIT_EXCHANGE, NULL, 0) != 0) ||
+	     (test_exchange(server, client, SERVER_INIT_RESPONSE, NULL, 0) != 0) ||
+	     (test_exchange(client, server, CLIENT_INIT_ACK, NULL, 0) != 0) ||
+	     (test_exchange(server, client, SERVER_INIT_ACK, NULL, 0) != 0) ||
+	     (test_exchange(client, server, FILE_XFER_INIT, NULL, 0) != 0) )
+		ret = -1;
+	core_set_limit( client, blocksize+AEAD_OVERHEAD );
+	core_set_limit( server, blocksize+AEAD_OVERHEAD );
+	client->copied = server->copied = 0;
+	if ( (aead_init(seal, key, SUITE_DEFAULT, AEAD_CLIENT) | 
+	      aead_init(open, key, SUITE_DEFAULT, AEAD_SERVER)) != 0 )
+		ret = -1;
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_blocks
+    Description : measure file data throughput at each block size, 
+                  through the client's encrypt and framing and the
+                  server's parse and decrypt, in memory so the network
+                  and disk do not hide the per-block cost
+    Inputs      : cfg - server options (count is MiB per block size)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_blocks( ServerConfig *cfg )
+{
+	static const unsigned int sizes[] = { BLOCKSIZE, 4*1024, 64*1024, 
+					      1024*1024, XFER_BLOCK_MAX };
+	unsigned long total = (unsigned long)((cfg->count > 0) ? cfg->count : BLOCK_TEST_COUNT) 
+		* 1024 * 1024;
+	unsigned char key[KEYSIZE], *data, *outblock, *plaintext;
+	unsigned int i, outbytes, plainbytes;
+	unsigned long off, frames;
+	struct timespec start, end;
+	ProtoCore client, server;
+	AeadSession seal, open;
+	ProtoEvent ev;
+	double secs;
+	int ret = 0;
+
+	printf( "*** Test block size throughput, %lu MiB each. ***\n", total/(1024*1024) );
+	data = (unsigned char *)malloc( total );
+	outblock = (unsigned char *)malloc( XFER_BLOCK_MAX+AEAD_OVERHEAD );
+	plaintext = (unsigned char *)malloc( XFER_BLOCK_MAX+AEAD_OVERHEAD );
+	if ( (data == NULL) || (outblock == NULL) || (plaintext == NULL) ||
+	     (generate_pseudorandom_bytes(key, KEYSIZE) != 0) ||
+	     (generate_pseudorandom_bytes(data, total) != 0) )
+	{
+		errorMessage( "block test unable to set up\n" );
+		free( data );
+		free( outblock );
+		free( plaintext );
+		return( -1 );
+	}
+
+	for ( i=0; (i<sizeof(sizes)/sizeof(sizes[0])) && (ret == 0); i++ )
+	{
+		/* Walk both cores to the transfer, as after the handshake */
+		ret = test_connect( &client, &server, &seal, &open, key, sizes[i] );
+
+		/* Move the data one block at a time, checking each arrives */
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		for ( off=0, frames=0; (off<total) && (ret == 0); off+=plainbytes, frames++ )
+		{
+			outbytes = (total-off < sizes[i]) ? total-off : sizes[i];
+			if ( (aead_seal(&seal, data+off, outbytes, outblock, &outbytes) != 0) ||
+			     (test_deliver(&client, &server, FILE_XFER_BLOCK, (char *)outblock, 
+					   outbytes, &ev) != 0) ||
+			     (aead_open(&open, (unsigned char *)ev.block, ev.length, 
+					plaintext, &plainbytes) != 0) ||
+			     (memcmp(plaintext, data+off, plainbytes) != 0) )
+				ret = -1;
+		}
+		clock_gettime( CLOCK_MONOTONIC, &end );
+		core_free( &client );
+		core_free( &server );
+		aead_free( &seal );
+		aead_free( &open );
+
+		secs = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+		printf( "Block %8u bytes: %8lu frames, %5.1f%% overhead, %.3f s, %8.1f MiB/s\n", 
+			sizes[i], frames, 
+			100.0*frames*(sizeof(ProtoMessageHdr)+AEAD_OVERHEAD)/total, secs, 
+			(secs > 0) ? total/secs/(1024*1024) : 0.0 );
+	}
+	if ( ret != 0 )
+		errorMessage( "block test failed\n" );
+
+	free( data );
+	free( outblock );
+	free( plaintext );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_copies
+    Description : count the bytes each file block path copies between
+                  the file read and the file write (the read, write 
+                  and socket copies are the same for both and left 
+                  out): the copying path seals into a second buffer, 
+                  frames a copy and queues a copy for the pool; the 
+                  in-place path seals in a frame buffer, sends from it,
+                  and opens the block in the receive buffer it arrived in
+    Inputs      : cfg - server options (count is MiB per block size)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_copies( ServerConfig *cfg )
+{
+	static const unsigned int sizes[] = { 4*1024, 64*1024, 1024*1024 };
+	unsigned long total = (unsigned long)((cfg->count > 0) ? cfg->count : BLOCK_TEST_COUNT) 
+		* 1024 * 1024;
+	unsigned char key[KEYSIZE], *data, *block = NULL, *outblock = NULL, *job = NULL;
+	unsigned char *plaintext = NULL, *in;
+	unsigned int i, len, outbytes, plainbytes;
+	unsigned long off, copied;
+	struct timespec start, end;
+	ProtoCore client, server;
+	AeadSession seal, open;
+	ProtoFrame frame;
+	ProtoEvent ev;
+	double secs;
+	char *buf;
+	int inplace, ret = 0;
+
+	printf( "*** Test bytes copied per file block, %lu MiB each. ***\n", total/(1024*1024) );
+	frame.buf = NULL;
+	if ( ((data = (unsigned char *)malloc(total)) == NULL) ||
+	     ((block = (unsigned char *)malloc(XFER_BLOCK_MAX)) == NULL) ||
+	     ((outblock = (unsigned char *)malloc(XFER_BLOCK_MAX+AEAD_OVERHEAD)) == NULL) ||
+	     ((job = (unsigned char *)malloc(XFER_BLOCK_MAX+AEAD_OVERHEAD)) == NULL) ||
+	     ((plaintext = (unsigned char *)malloc(XFER_BLOCK_MAX)) == NULL) ||
+	     (core_frame_init(&frame, AEAD_OVERHEAD, XFER_BLOCK_MAX) != 0) ||
+	     (generate_pseudorandom_bytes(key, KEYSIZE) != 0) ||
+	     (generate_pseudorandom_bytes(data, total) != 0) )
+	{
+		errorMessage( "copy test unable to set up\n" );
+		ret = -1;
+	}
+
+	for ( i=0; (i<sizeof(sizes)/sizeof(sizes[0])) && (ret == 0); i++ )
+		for ( inplace=0; (inplace<2) && (ret == 0); inplace++ )
+		{
+			ret = test_connect( &client, &server, &seal, &open, key, sizes[i] );
+			copied = 0;
+			clock_gettime( CLOCK_MONOTONIC, &start );
+			for ( off=0; (off<total) && (ret == 0); off+=plainbytes )
+			{
+				len = (total-off < sizes[i]) ? total-off : sizes[i];
+				buf = NULL;
+				if ( !inplace )
+				{
+					/* Read, seal into the send buffer, frame a copy */
+					memcpy( block, data+off, len );
+					if ( (aead_seal(&seal, block, len, outblock, &outbytes) != 0) ||
+					     (test_deliver(&client, &server, FILE_XFER_BLOCK, 
+							   (char *)outblock, outbytes, &ev) != 0) )
+						ret = -1;
+
+					/* Queue a copy, open it into a plaintext buffer */
+					memcpy( job, ev.block, ev.length );
+					copied += ev.length;
+					in = job;
+				}
+				else
+				{
+					/* Read into the frame, seal in place, send from it */
+					memcpy( CORE_FRAME_PAYLOAD(&frame), data+off, len );
+					if ( (aead_seal(&seal, (unsigned char *)CORE_FRAME_PAYLOAD(&frame), len, 
+							(unsigned char *)CORE_FRAME_BODY(&frame), 
+							&outbytes) != 0) ||
+					     ((frame.len = outbytes), 
+					      core_queue_frame(&client, FILE_XFER_BLOCK, &frame) != 0) ||
+					     (test_transport(&client, &server, FILE_XFER_BLOCK, &ev) != 0) )
+						ret = -1;
+
+					/* Keep the receive buffer, as the server does */
+					if ( (buf = core_detach(&server, &ev)) != NULL )
+						in = (unsigned char *)ev.block;
+					else
+					{
+						memcpy( job, ev.block, ev.length );
+						copied += ev.length;
+						in = job;
+					}
+				}
+				if ( (ret != 0) ||
+				     (aead_open(&open, in, ev.length, 
+						inplace ? in+AEAD_OVERHEAD : plaintext, 
+						&plainbytes) != 0) ||
+				     (memcmp(inplace ? in+AEAD_OVERHEAD : plaintext, 
+					     data+off, plainbytes) != 0) )
+					ret = -1;
+				slab_free( buf );
+			}
+			clock_gettime( CLOCK_MONOTONIC, &end );
+			copied += client.copied + server.copied;
+			core_free( &client );
+			core_free( &server );
+			aead_free( &seal );
+			aead_free( &open );
+
+			secs = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+			printf( "Block %8u bytes, %-8s: %10lu bytes copied (%.2f per byte), %8.1f MiB/s\n", 
+				sizes[i], inplace ? "in place" : "copying", copied, 
+				(double)copied/total, (secs > 0) ? total/secs/(1024*1024) : 0.0 );
+		}
+	if ( ret != 0 )
+		errorMessage( "copy test failed\n" );
+
+	core_frame_free( &frame );
+	free( data );
+	free( block );
+	free( outblock );
+	free( job );
+	free( plaintext );
+	return( ret );
+}
+
+/* One run of test_ingest, shared by its lanes */
+typedef struct {
+	ProtoSession   *s;        /* the file and session cipher */
+	XferJob       **jobs;     /* sealed blocks, numbered and placed */
+	int             njobs;
+	int             next;     /* next block a lane takes */
+	int             failed;
+} IngestTest;
+
+/**********************************************************************
+
+    Function    : test_ingest_lane
+    Description : one test_ingest thread, taking blocks as a drain task
+                  would and writing each through session_write_plain
+    Inputs      : arg - the run
+    Outputs     : NULL
+
+***********************************************************************/
+
+static void *test_ingest_lane( void *arg )
+{
+	IngestTest *t = (IngestTest *)arg;
+	AeadSession aead;
+	int i;
+
+	if ( aead_clone(&aead, &t->s->aead) != 0 )
+	{
+		__atomic_store_n( &t->failed, 1, __ATOMIC_RELAXED );
+		return( NULL );
+	}
+	while ( (i = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED)) < t->njobs )
+		if ( session_write_plain(t->s, &aead, &t->jobs[i], 1) != 0 )
+			__atomic_store_n( &t->failed, 1, __ATOMIC_RELAXED );
+	aead_free( &aead );
+	return( NULL );
+}
+
+/**********************************************************************
+
+    Function    : test_ingest
+    Description : open and write one file's blocks, numbered as they
+                  would arrive, with more and more lanes taking them in
+                  whatever order they finish, and check the file that
+                  comes out; the disk is left out with an unsynced
+                  write, so this is the decrypt and placement cost
+    Inputs      : cfg - server options (count is MiB, sink the sink)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_ingest( ServerConfig *cfg )
+{
+	unsigned int blocksize = XFER_BLOCK_DEFAULT, outbytes;
+	unsigned long total = (unsigned long)((cfg->count > 0) ? cfg->count : INGEST_TEST_COUNT) 
+		* 1024 * 1024;
+	int i, n, lanes, njobs = (total+blocksize-1)/blocksize, fd = -1, ret = 0;
+	int cores = sysconf( _SC_NPROCESSORS_ONLN );
+	char fname[] = "cse543-ingest-test.XXXXXX";
+	unsigned char key[KEYSIZE], *data, *check;
+	pthread_t threads[INGEST_LANES_MAX];
+	XferJob **jobs;
+	AeadSession seal;
+	ProtoSession s;
+	IngestTest t;
+	struct timespec start, end;
+	double secs, one = 0;
+
+	printf( "*** Test parallel block ingest, %lu MiB in %u byte blocks to the %s sink, %d cores. ***\n", 
+		total/(1024*1024), blocksize, sink_name(cfg->sink), cores );
+	memset( &s, 0, sizeof(s) );
+	memset( &seal, 0, sizeof(seal) );
+	s.sink.fd = -1;
+	data = (unsigned char *)malloc( total );
+	check = (unsigned char *)malloc( total );
+	jobs = (XferJob **)calloc( njobs, sizeof(XferJob *) );
+	for ( i=0; (jobs != NULL) && (i<njobs); i++ )
+		if ( (jobs[i] = (XferJob *)malloc(sizeof(XferJob)+blocksize+AEAD_OVERHEAD)) == NULL )
+			ret = -1;
+	if ( (ret != 0) || (data == NULL) || (check == NULL) || (jobs == NULL) ||
+	     (generate_pseudorandom_bytes(key, KEYSIZE) != 0) ||
+	     (generate_pseudorandom_bytes(data, total) != 0) ||
+	     (aead_init(&seal, key, SUITE_DEFAULT, AEAD_CLIENT) != 0) ||
+	     (aead_init(&s.aead, key, SUITE_DEFAULT, AEAD_SERVER) != 0) ||
+	     ((fd = mkstemp(fname)) == -1) )
+	{
+		errorMessage( "ingest test unable to set up\n" );
+		ret = -1;
+	}
+	if ( fd != -1 )
+		close( fd );
+
+	/* One lane is the old in-order drain; then up to the cores, and at
+	   least two so blocks finish out of order */
+	for ( lanes=1; (lanes<=INGEST_LANES_MAX) && (ret == 0); lanes*=2 )
+	{
+		/* Seal and number the blocks as the reactor would, every run,
+		   since they are opened in place */
+		for ( i=0; i<njobs; i++ )
+		{
+			jobs[i]->block = jobs[i]->data;
+			jobs[i]->buf = NULL;
+			jobs[i]->seq = i;
+			jobs[i]->offset = (unsigned long)i * blocksize;
+			outbytes = (total-jobs[i]->offset < blocksize) ? total-jobs[i]->offset : blocksize;
+			if ( aead_seal_at(&seal, i, data+jobs[i]->offset, outbytes, 
+					  (unsigned char *)jobs[i]->block, &jobs[i]->len) != 0 )
+				ret = -1;
+		}
+		if ( (ret != 0) || (sink_open(&s.sink, cfg->sink, fname, total, blocksize) != 0) )
+		{
+			ret = -1;
+			break;
+		}
+
+		/* A gathering sink can only take its blocks in order */
+		memset( &t, 0, sizeof(t) );
+		t.s = &s;
+		t.jobs = jobs;
+		t.njobs = njobs;
+		if ( !sink_positional(&s.sink) )
+			lanes = 1;
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		for ( n=0; n<lanes; n++ )
+			if ( pthread_create(&threads[n], NULL, test_ingest_lane, &t) != 0 )
+				break;
+		for ( i=0; i<n; i++ )
+			pthread_join( threads[i], NULL );
+		if ( (n < lanes) || t.failed || (sink_close(&s.sink, 0) != 0) )
+			ret = -1;
+		clock_gettime( CLOCK_MONOTONIC, &end );
+
+		/* Every byte where it belongs */
+		if ( (ret == 0) && 
+		     (((fd = open(fname, O_RDONLY)) == -1) || 
+		      (read(fd, check, total) != (ssize_t)total) || 
+		      (read(fd, check, 1) != 0) || (memcmp(check, data, total) != 0)) )
+		{
+			errorMessage( "ingest test file does not match\n" );
+			ret = -1;
+		}
+		if ( fd != -1 )
+			close( fd );
+		fd = -1;
+
+		secs = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+		one = (lanes == 1) ? secs : one;
+		if ( ret == 0 )
+			printf( "Lanes %2d: %.3f s, %8.1f MiB/s (%.2fx one lane)\n", lanes, secs, 
+				(secs > 0) ? total/secs/(1024*1024) : 0.0, (secs > 0) ? one/secs : 0.0 );
+		if ( !sink_positional(&s.sink) || ((lanes >= cores) && (lanes >= 2)) )
+			break;
+	}
+	if ( ret != 0 )
+		errorMessage( "ingest test failed\n" );
+
+	unlink( fname );
+	for ( i=0; (jobs != NULL) && (i<njobs); i++ )
+		free( jobs[i] );
+	free( jobs );
+	free( data );
+	free( check );
+	aead_free( &seal );
+	aead_free( &s.aead );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_allocs
+    Description : count the heap allocations on the steady-state block
+                  path (seal in a frame, send, parse, keep the receive
+                  buffer in a job, open, give both back) once the pools
+                  have warmed up; any at all is a failure
+    Inputs      : cfg - server options (count is blocks per size)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_allocs( ServerConfig *cfg )
+{
+	static const unsigned int sizes[] = { 4*1024, 64*1024, 1024*1024 };
+	int count = (cfg->count > 0) ? cfg->count : SLAB_TEST_COUNT, n, warm, ret = 0;
+	unsigned char key[KEYSIZE];
+	unsigned int i, outbytes, plainbytes;
+	unsigned long before, heap;
+	ProtoCore client, server;
+	AeadSession seal, open;
+	ProtoFrame frame;
+	ProtoEvent ev;
+	XferJob *job;
+	char *buf;
+
+	printf( "*** Test heap allocations per block, %d blocks each. ***\n", count );
+	if ( generate_pseudorandom_bytes(key, KEYSIZE) != 0 )
+		return( -1 );
+	for ( i=0; (i<sizeof(sizes)/sizeof(sizes[0])) && (ret == 0); i++ )
+	{
+		ret = test_connect( &client, &server, &seal, &open, key, sizes[i] );
+		if ( core_frame_init(&frame, AEAD_OVERHEAD, sizes[i]) != 0 )
+			ret = -1;
+		memset( CORE_FRAME_PAYLOAD(&frame), 0x5a, sizes[i] );
+
+		/* The first blocks fill the pools, the rest must not touch
+		   the heap */
+		for ( warm=1; (warm>=0) && (ret == 0); warm-- )
+		{
+			before = slab_allocs();
+			for ( n=0; (n<count) && (ret == 0); n++ )
+			{
+				buf = NULL;
+				job = NULL;
+				if ( (aead_seal(&seal, (unsigned char *)CORE_FRAME_PAYLOAD(&frame), sizes[i], 
+						(unsigned char *)CORE_FRAME_BODY(&frame), &outbytes) != 0) ||
+				     ((frame.len = outbytes), 
+				      core_queue_frame(&client, FILE_XFER_BLOCK, &frame) != 0) ||
+				     (test_transport(&client, &server, FILE_XFER_BLOCK, &ev) != 0) ||
+				     ((buf = core_detach(&server, &ev)) == NULL) ||
+				     ((job = (XferJob *)slab_alloc(sizeof(XferJob))) == NULL) ||
+				     ((job->block = ev.block), 
+				      aead_open(&open, (unsigned char *)job->block, ev.length, 
+						(unsigned char *)job->block+AEAD_OVERHEAD, &plainbytes) != 0) ||
+				     (plainbytes != sizes[i]) )
+					ret = -1;
+				slab_free( buf );
+				slab_free( job );
+			}
+			heap = slab_allocs() - before;
+			if ( !warm )
+			{
+				printf( "Block %8u bytes: %lu heap allocations in %d blocks\n", 
+					sizes[i], heap, count );
+				if ( heap > 0 )
+					ret = -1;
+			}
+		}
+		core_frame_free( &frame );
+		core_free( &client );
+		core_free( &server );
+		aead_free( &seal );
+		aead_free( &open );
+	}
+	if ( ret != 0 )
+		errorMessage( "allocation test failed\n" );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_cpu
+    Description : get the CPU time this thread has used
+    Inputs      : none
+    Outputs     : seconds
+
+***********************************************************************/
+
+static double test_cpu( void )
+{
+	struct timespec t;
+
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &t );
+	return( t.tv_sec + t.tv_nsec/1e9 );
+}
+
+/**********************************************************************
+
+    Function    : test_handshake
+    Description : run one handshake through two cores in memory with
+                  the work each side does on the wire, full (RSA) or
+                  resumed (ticket), ending with the server's next
+                  ticket as the client keeps it
+    Inputs      : keys - the server keys
+                  held - the client's ticket, resumed with unless its
+                   length is 0, then replaced with the new one
+                  heldlen - (in/out) the ticket length
+                  cpu - (in/out) CPU seconds added, [0] client, [1] server
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int test_handshake( KeySet *keys, unsigned char *held, 
+			   unsigned int *heldlen, double *cpu )
+{
+	unsigned char message[] = "Complete", cnonce[RESUME_NONCE_SIZE], snonce[RESUME_NONCE_SIZE];
+	unsigned char ckey[KEYSIZE], skey[KEYSIZE], secret[KEYSIZE], *key = NULL;
+	unsigned char sealed[MAX_BLOCK_SIZE], plain[MAX_BLOCK_SIZE];
+	char out[MAX_BLOCK_SIZE];
+	unsigned int len, plainlen;
+	ProtoCore client, server;
+	ProtoEvent ev;
+	WireHello hello;
+	WireResponse response;
+	WireResume resume;
+	WireResumed resumed;
+	WireTicket ticket;
+	EVP_PKEY *pubkey = NULL;
+	double t;
+	int n, ret = -1;
+
+	core_init( &client, CORE_CLIENT );
+	core_init( &server, CORE_SERVER );
+	memset( &hello, 0, sizeof(hello) );
+	memset( &response, 0, sizeof(response) );
+	memset( &resumed, 0, sizeof(resumed) );
+	hello.blocksize = BLOCKSIZE;
+	if ( *heldlen == 0 )
+	{
+		/* Full: hello, public key, sealed key, ack */
+		t = test_cpu();
+		if ( ((n = wire_encode_hello(&hello, out, sizeof(out))) <= 0) ||
+		     (core_queue(&client, CLIENT_INIT_EXCHANGE, out, n) != 0) )
+			goto done;
+		cpu[0] += test_cpu()-t;
+		if ( test_transport(&client, &server, CLIENT_INIT_EXCHANGE, &ev) != 0 )
+			goto done;
+
+		t = test_cpu();
+		if ( wire_decode_hello(ev.block, ev.length, &hello) != 0 )
+			goto done;
+		response.blocksize = hello.blocksize;
+		response.suite = SUITE_DEFAULT;
+		response.pubkey = keys->pem;
+		response.pubkey_len = keys->pemlen;
+		if ( ((n = wire_encode_response(&response, out, sizeof(out))) <= 0) ||
+		     (core_queue(&server, SERVER_INIT_RESPONSE, out, n) != 0) )
+			goto done;
+		cpu[1] += test_cpu()-t;
+		if ( test_transport(&server, &client, SERVER_INIT_RESPONSE, &ev) != 0 )
+			goto done;
+
+		t = test_cpu();
+		if ( (wire_decode_response(ev.block, ev.length, &response) != 0) ||
+		     (extract_public_key((char *)response.pubkey, response.pubkey_len, &pubkey) < 0) ||
+		     (generate_pseudorandom_bytes(ckey, KEYSIZE) != 0) ||
+		     ((n = seal_symmetric_key(ckey, KEYSIZE, pubkey, out)) <= 0) ||
+		     (core_queue(&client, CLIENT_INIT_ACK, out, n) != 0) )
+			goto done;
+		cpu[0] += test_cpu()-t;
+		if ( test_transport(&client, &server, CLIENT_INIT_ACK, &ev) != 0 )
+			goto done;
+
+		t = test_cpu();
+		if ( (unseal_symmetric_key(ev.block, ev.length, keys->privkey, &key) != 0) ||
+		     (encrypt_message(message, strlen((char *)message), key, sealed, &len) != 0) ||
+		     (core_queue(&server, SERVER_INIT_ACK, (char *)sealed, len) != 0) )
+			goto done;
+		memcpy( skey, key, KEYSIZE );
+		cpu[1] += test_cpu()-t;
+		if ( test_transport(&server, &client, SERVER_INIT_ACK, &ev) != 0 )
+			goto done;
+
+		t = test_cpu();
+		if ( decrypt_message((unsigned char *)ev.block, ev.length, ckey, plain, &plainlen) != 0 )
+			goto done;
+		cpu[0] += test_cpu()-t;
+	}
+	else
+	{
+		/* Resumed: ticket and nonce, nonce and ack */
+		t = test_cpu();
+		if ( (wire_decode_ticket((char *)held, *heldlen, &ticket) != 0) ||
+		     (generate_pseudorandom_bytes(cnonce, RESUME_NONCE_SIZE) != 0) )
+			goto done;
+		memset( &resume, 0, sizeof(resume) );
+		resume.blocksize = BLOCKSIZE;
+		resume.ticket = ticket.ticket;
+		resume.ticket_len = ticket.ticket_len;
+		resume.nonce = cnonce;
+		resume.nonce_len = RESUME_NONCE_SIZE;
+		if ( ((n = wire_encode_resume(&resume, out, sizeof(out))) <= 0) ||
+		     (core_queue(&client, CLIENT_RESUME, out, n) != 0) )
+			goto done;
+		cpu[0] += test_cpu()-t;
+		if ( test_transport(&client, &server, CLIENT_RESUME, &ev) != 0 )
+			goto done;
+
+		t = test_cpu();
+		if ( (wire_decode_resume(ev.block, ev.length, &resume) != 0) ||
+		     (ticket_open(resume.ticket, secret) != 0) ||
+		     (generate_pseudorandom_bytes(snonce, RESUME_NONCE_SIZE) != 0) ||
+		     (derive_resumed_key(secret, resume.nonce, snonce, skey) != 0) ||
+		     (encrypt_message(message, strlen((char *)message), skey, sealed, &len) != 0) )
+			goto done;
+		resumed.blocksize = resume.blocksize;
+		resumed.suite = SUITE_DEFAULT;
+		resumed.nonce = snonce;
+		resumed.nonce_len = RESUME_NONCE_SIZE;
+		resumed.proof = sealed;
+		resumed.proof_len = len;
+		if ( ((n = wire_encode_resumed(&resumed, out, sizeof(out))) <= 0) ||
+		     (core_queue(&server, SERVER_INIT_ACK, out, n) != 0) )
+			goto done;
+		cpu[1] += test_cpu()-t;
+		if ( test_transport(&server, &client, SERVER_INIT_ACK, &ev) != 0 )
+			goto done;
+
+		t = test_cpu();
+		if ( (wire_decode_resumed(ev.block, ev.length, &resumed) != 0) ||
+		     (derive_resumed_key(ticket.secret, cnonce, resumed.nonce, ckey) != 0) ||
+		     (decrypt_message((unsigned char *)resumed.proof, resumed.proof_len, ckey, 
+				      plain, &plainlen) != 0) )
+			goto done;
+		cpu[0] += test_cpu()-t;
+	}
+
+	/* Both end with a ticket for the next time */
+	t = test_cpu();
+	if ( ticket_issue(skey, sealed, &len) != 0 )
+		goto done;
+	cpu[1] += test_cpu()-t;
+	t = test_cpu();
+	if ( (len > WIRE_TICKET_SEALED) ||
+	     (decrypt_message(sealed, len, ckey, plain, &plainlen) != 0) ||
+	     (wire_decode_ticket((char *)plain, plainlen, &ticket) != 0) )
+		goto done;
+	memcpy( held, plain, plainlen );
+	*heldlen = plainlen;
+	cpu[0] += test_cpu()-t;
+	if ( memcmp(ckey, skey, KEYSIZE) == 0 )
+		ret = 0;
+
+done:
+	core_free( &client );
+	core_free( &server );
+	EVP_PKEY_free( pubkey );
+	free( key );
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_resume
+    Description : time full and resumed handshakes side by side, the
+                  CPU each side spends and the latency of the exchange
+                  (in memory, so without the network round trips)
+    Inputs      : cfg - server options (count is handshakes of each kind)
+                  keys - the server keys
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_resume( ServerConfig *cfg, KeySet *keys )
+{
+	static const char *kinds[] = { "Full", "Resumed" };
+	int count = (cfg->count > 0) ? cfg->count : RESUME_TEST_COUNT;
+	unsigned char held[WIRE_TICKET_SEALED], scratch[WIRE_TICKET_SEALED];
+	unsigned int heldlen = 0, none;
+	double cpu[2][2], warm[2] = { 0, 0 }, secs[2];
+	struct timespec start, end;
+	int i, k, ret = 0;
+
+	printf( "*** Test %d full and %d resumed handshakes. ***\n", count, count );
+	if ( (server_tickets(cfg) != 0) || !ticket_lifetime )
+	{
+		errorMessage( "resume test needs tickets (-e secs)\n" );
+		return( -1 );
+	}
+
+	/* One full handshake warms up and gets the first ticket */
+	if ( test_handshake(keys, held, &heldlen, warm) != 0 )
+	{
+		errorMessage( "resume test handshake failed\n" );
+		return( -1 );
+	}
+	for ( k=0; k<2; k++ )
+	{
+		cpu[k][0] = cpu[k][1] = 0;
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		for ( i=0; (i<count) && (ret == 0); i++ )
+		{
+			none = 0;
+			ret = (k == 0) ? test_handshake(keys, scratch, &none, cpu[k]) :
+				test_handshake(keys, held, &heldlen, cpu[k]);
+		}
+		clock_gettime( CLOCK_MONOTONIC, &end );
+		secs[k] = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+		if ( ret != 0 )
+		{
+			errorMessage( "resume test handshake failed\n" );
+			return( -1 );
+		}
+		printf( "%-8s %8.3f ms per handshake, client CPU %8.1f us, server CPU %8.1f us\n", 
+			kinds[k], secs[k]*1e3/count, cpu[k][0]*1e6/count, cpu[k][1]*1e6/count );
+	}
+	printf( "Resumed: %.1fx less server CPU, %.1fx lower latency\n", 
+		(cpu[1][1] > 0) ? cpu[0][1]/cpu[1][1] : 0.0, 
+		(secs[1] > 0) ? secs[0]/secs[1] : 0.0 );
+	return( 0 );
+}
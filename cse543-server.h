@@ -0,0 +1,224 @@
+#ifndef CSE543_SERVER_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-server.h
+
+   Description   : This is the event-driven server loop, which runs
+                   every client session from a single epoll reactor.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <pthread.h>
+
+/* Defines */
+#define MAX_EPOLL_EVENTS 256
+#define SESSION_BUDGET (1024*1024)  /* default buffer bytes per session before we stop reading */
+#define SESSION_TEST_COUNT 100000   /* idle sessions held by test_sessions */
+#define BLOCK_TEST_COUNT 64         /* MiB moved per block size by test_blocks */
+#define INGEST_TEST_COUNT 256       /* MiB written per lane count by test_ingest */
+#define INGEST_LANES_MAX 16         /* most lanes test_ingest tries */
+#define RESUME_TEST_COUNT 200       /* handshakes of each kind timed by test_resume */
+#define SESSION_HANDSHAKE_TIMEOUT 10  /* seconds to finish the key exchange */
+#define SESSION_IDLE_TIMEOUT 30       /* seconds a session may send nothing */
+#define SESSION_LIFETIME 3600         /* seconds a session may last in all */
+#define COOKIE_LIFETIME 30            /* seconds a handshake cookie is good for */
+#define TICKET_LIFETIME 3600          /* seconds a ticket key is used, and a ticket good for */
+#define BUSY_RETRY_MS 250             /* retry-after sent with SERVER_BUSY */
+#define SESSION_BLOCKS 4              /* file blocks that fit in a session budget */
+
+/* Data Structures */
+
+/* This is where a session is in the exchange */
+typedef enum {
+     SESSION_WAIT_INIT_EXCHANGE,  /* waiting for CLIENT_INIT_EXCHANGE */
+     SESSION_WAIT_INIT_ACK,       /* waiting for the sealed key */
+     SESSION_UNSEALING,           /* handshake pool is unsealing the key */
+     SESSION_WAIT_XFER_INIT,      /* waiting for the transfer command */
+     SESSION_XFER,                /* receiving FILE_XFER_BLOCKs until EXIT */
+     SESSION_DRAINING,            /* EXIT received, pool still writing blocks */
+     SESSION_CLOSING,             /* flushing the final ack, then close */
+} SessionState;
+
+/* This is what a session counts against in admission control */
+typedef enum {
+     SESSION_ADMIT_NONE,          /* refused, or not yet started */
+     SESSION_ADMIT_HANDSHAKE,     /* in the key exchange */
+     SESSION_ADMIT_TRANSFER,      /* authenticated */
+} SessionAdmit;
+
+/* This is a received file block waiting for the pool, decrypted where
+   it was received and written at its own offset */
+typedef struct xfer_job {
+     struct xfer_job *next;
+     uint64_t         seq;         /* sequence number it must carry */
+     unsigned long    offset;      /* where its bytes go in the file */
+     unsigned int     len;         /* length of the encrypted block */
+     char            *block;       /* the encrypted block */
+     char            *buf;         /* receive buffer taken from the core, 
+                                      NULL if the block was copied below */
+     char             data[0];
+} XferJob;
+
+/* This is one client connection being served */
+typedef struct proto_session {
+     int             sock;        /* client socket */
+     SessionState    state;       /* where the server side is */
+     SessionAdmit    admitted;    /* which admission limit it counts against */
+     ProtoCore       core;        /* framing and message order */
+     unsigned char  *key;         /* session key, once unsealed */
+     EVP_PKEY       *privkey;     /* private key to unseal with, the one offered */
+     AeadSession     aead;        /* block cipher, keyed for the transfer */
+     char           *sealed;      /* sealed key waiting for the handshake pool */
+     unsigned int    sealed_len;
+     struct rm_cmd  *cmd;         /* the transfer command */
+     char           *command;     /* FILE_XFER_INIT sent with the key, until it is unsealed */
+     unsigned int    command_len;
+     FileSink        sink;        /* file being received, and bytes written */
+     unsigned int    blocksize;   /* file bytes per block, as agreed */
+     int             suite;       /* block cipher suite, as agreed */
+     Timer           deadline;    /* handshake, then idle, deadline */
+     Timer           lifetime;    /* total session deadline */
+     Arena           scratch;     /* handshake and command memory, freed with the session */
+
+     /* Blocks handed to the pool, numbered and placed as they arrive,
+        then decrypted and written by up to lanes tasks at once */
+     pthread_mutex_t  lock;       /* guards jobs, queued and failed */
+     XferJob         *jobs;       /* blocks not yet written */
+     XferJob         *jobs_tail;
+     unsigned long    queued;     /* bytes in jobs */
+     uint64_t         next_seq;   /* sequence number of the next block */
+     unsigned long    next_offset;  /* file offset of the next block */
+     int              lanes;      /* pool tasks the file may have at once */
+     AeadSession     *ciphers;    /* a keyed copy of aead per lane, made on first use */
+     int             *idle_ciphers;  /* lanes' ciphers not in use (lock) */
+     int              nidle_ciphers;
+     int              failed;     /* a block failed to decrypt or write */
+     int              inflight;   /* pool tasks queued (reactor only) */
+     int              finished;   /* of those, done but not yet seen (done_lock) */
+     int              throttled;  /* stopped reading until jobs drain */
+     int              dead;       /* closed, free once the pool is done */
+     struct proto_session *next_done;  /* completed pool task list */
+} ProtoSession;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : server_event_loop
+    Description : accept and serve client sessions until the listen
+                  socket fails
+    Inputs      : server - the listening socket
+                  cfg - server options
+                  keys - the server keys, reloaded on SIGHUP
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int server_event_loop( int server, ServerConfig *cfg, KeySet *keys );
+
+/**********************************************************************
+
+    Function    : server_spawn_workers
+    Description : run the server as several SO_REUSEPORT listener
+                  processes, one pinned to each core, restarting any
+                  that crash
+    Inputs      : cfg - server options
+                  keys - the server keys; SIGHUP reloads them here and
+                   in every worker
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int server_spawn_workers( ServerConfig *cfg, KeySet *keys );
+
+/**********************************************************************
+
+    Function    : test_sessions
+    Description : hold many idle authenticated sessions and report
+                  the memory each one costs
+    Inputs      : cfg - server options (count is the number of sessions)
+                  keys - the server keys
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_sessions( ServerConfig *cfg, KeySet *keys );
+
+/**********************************************************************
+
+    Function    : test_blocks
+    Description : measure file data throughput at each block size
+    Inputs      : cfg - server options (count is MiB per block size)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_blocks( ServerConfig *cfg );
+
+/**********************************************************************
+
+    Function    : test_copies
+    Description : count the bytes the copying and in-place file block
+                  paths copy
+    Inputs      : cfg - server options (count is MiB per block size)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_copies( ServerConfig *cfg );
+
+/**********************************************************************
+
+    Function    : test_ingest
+    Description : decrypt and write one file's blocks with more and
+                  more lanes, out of order, and check the file
+    Inputs      : cfg - server options (count is MiB, sink the sink)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_ingest( ServerConfig *cfg );
+
+/**********************************************************************
+
+    Function    : test_allocs
+    Description : count the heap allocations on the steady-state block
+                  path once the pools have warmed up
+    Inputs      : cfg - server options (count is blocks per size)
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_allocs( ServerConfig *cfg );
+
+/**********************************************************************
+
+    Function    : test_resume
+    Description : time full and resumed handshakes side by side, the
+                  CPU each side spends and the latency of the exchange
+    Inputs      : cfg - server options (count is handshakes of each kind)
+                  keys - the server keys
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_resume( ServerConfig *cfg, KeySet *keys );
+
+#define CSE543_SERVER_INCLUDED
+#endif
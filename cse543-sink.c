@@ -0,0 +1,616 @@
+/**********************************************************************
+
+   File          : cse543-sink.c
+
+   Description   : This is where the server writes a received file.
+                   The gathering and mapped sinks hand out the place
+                   the next bytes go, so blocks are decrypted straight
+                   into the staging buffer, or copied into the file's
+                   pages once authenticated.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-proto.h"
+#include "cse543-sink.h"
+
+/* Defines */
+#define SINK_TEST_FILE "cse543-sink-test.XXXXXX"
+
+/* Sink names, by SinkKind */
+static const char *sink_names[SINK_KINDS] = { "write", "aggregate", "fallocate", "mmap" };
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : sink_kind
+    Description : look up a sink by name
+    Inputs      : name - write, aggregate, fallocate or mmap
+    Outputs     : the SinkKind, -1 if there is no such sink
+
+***********************************************************************/
+
+int sink_kind( const char *name )
+{
+	int i;
+
+	for ( i=0; i<SINK_KINDS; i++ )
+		if ( strcmp(name, sink_names[i]) == 0 )
+			return( i );
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : sink_name
+    Description : get the name of a sink
+    Inputs      : kind - the sink
+    Outputs     : its name
+
+***********************************************************************/
+
+const char *sink_name( SinkKind kind )
+{
+	return( sink_names[kind] );
+}
+
+/**********************************************************************
+
+    Function    : sink_now
+    Description : get the time, for the write rate
+    Inputs      : none
+    Outputs     : seconds
+
+***********************************************************************/
+
+static double sink_now( void )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return( now.tv_sec + now.tv_nsec/1e9 );
+}
+
+/**********************************************************************
+
+    Function    : sink_map
+    Description : allocate the file's blocks and map (or remap) all of
+                  it; stores into a sparse mapping would raise SIGBUS
+                  when the disk fills, taking every session with them
+    Inputs      : k - the sink
+                  size - the new size
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int sink_map( FileSink *k, unsigned long size )
+{
+	char *map;
+
+	if ( fallocate(k->fd, 0, 0, size) != 0 )
+		return( -1 );
+	if ( k->map == NULL )
+		map = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, k->fd, 0 );
+	else
+		map = mremap( k->map, k->size, size, MREMAP_MAYMOVE );
+	if ( map == MAP_FAILED )
+		return( -1 );
+	k->map = map;
+	k->size = size;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : sink_flush
+    Description : write the first bytes of the staging buffer and keep
+                  the rest
+    Inputs      : k - the sink
+                  len - how many bytes to write
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int sink_flush( FileSink *k, unsigned int len )
+{
+	unsigned long at = k->offset - k->buflen;
+	unsigned int done = 0;
+	ssize_t n;
+
+	while ( done < len )
+	{
+		k->writes++;
+		if ( (n = pwrite(k->fd, k->buf+done, len-done, at+done)) <= 0 )
+		{
+			if ( (n == -1) && (errno == EINTR) )
+				continue;
+
+			/* Complain, explain, and return */
+			char msg[128];
+			sprintf( msg, "failure writing file [%.64s]\n", strerror(errno) );
+			errorMessage( msg );
+			return( -1 );
+		}
+		done += n;
+	}
+	k->buflen -= len;
+	memmove( k->buf, k->buf+len, k->buflen );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : sink_extents
+    Description : count the extents the file is stored in
+    Inputs      : fd - the file
+    Outputs     : the extents, -1 if the file system will not say
+
+***********************************************************************/
+
+static long sink_extents( int fd )
+{
+	struct fiemap fm;
+
+	/* No room for extents, so only the count comes back */
+	memset( &fm, 0, sizeof(fm) );
+	fm.fm_length = FIEMAP_MAX_OFFSET;
+	if ( ioctl(fd, FS_IOC_FIEMAP, &fm) != 0 )
+		return( -1 );
+	return( fm.fm_mapped_extents );
+}
+
+/**********************************************************************
+
+    Function    : sink_open
+    Description : create (or truncate) a file to receive; a sink the
+                  file system cannot do falls back to a write per block
+    Inputs      : k - the sink
+                  kind - how to write it
+                  fname - the file
+                  size - the size the client announced, 0 if unknown
+                  blocksize - most bytes committed at once
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int sink_open( FileSink *k, SinkKind kind, const char *fname, 
+	       unsigned long size, unsigned int blocksize )
+{
+	int flags = O_CREAT|O_TRUNC|((kind == SINK_MMAP) ? O_RDWR : O_WRONLY);
+
+	memset( k, 0, sizeof(FileSink) );
+	k->kind = kind;
+	if ( (k->fd = open(fname, flags, 0700)) == -1 )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "failure opening file [%.64s]\n", fname );
+		errorMessage( msg );
+		return( -1 );
+	}
+
+	/* The client says how big; do not take its word beyond reason */
+	if ( size > SINK_PREALLOC_MAX )
+		size = SINK_PREALLOC_MAX;
+	switch ( kind )
+	{
+	case SINK_AGGREGATE:
+		/* Room for a chunk and the block that overflows it */
+		k->bufsize = SINK_CHUNK + blocksize;
+		if ( posix_memalign((void **)&k->buf, SINK_ALIGN, k->bufsize) != 0 )
+		{
+			k->buf = NULL;
+			close( k->fd );
+			k->fd = -1;
+			return( -1 );
+		}
+		break;
+
+	case SINK_FALLOCATE:
+		if ( (size > 0) && (fallocate(k->fd, 0, 0, size) != 0) )
+		{
+			printf( "Unable to preallocate %s [%s], writing normally\n", 
+				fname, strerror(errno) );
+			k->kind = SINK_WRITE;
+			break;
+		}
+		k->size = size;
+		break;
+
+	case SINK_MMAP:
+		if ( sink_map(k, (size > 0) ? size : SINK_MAP_GROW) != 0 )
+		{
+			printf( "Unable to preallocate and map %s [%s], writing normally\n", 
+				fname, strerror(errno) );
+			k->kind = SINK_WRITE;
+			if ( ftruncate(k->fd, 0) != 0 )
+				return( -1 );
+		}
+		break;
+
+	default:
+		break;
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : sink_space
+    Description : get where the next bytes of the file can be put
+                  directly, if the sink has such a place
+    Inputs      : k - the sink
+                  len - how many bytes
+    Outputs     : where to put them, NULL to commit from elsewhere
+
+***********************************************************************/
+
+char *sink_space( FileSink *k, unsigned int len )
+{
+	unsigned long size;
+
+	switch ( k->kind )
+	{
+	case SINK_AGGREGATE:
+		return( (k->buflen+len <= k->bufsize) ? k->buf+k->buflen : NULL );
+
+	case SINK_MMAP:
+		/* Past the announced size (or none), double the mapping; with
+		   no room for that, what is mapped stays and the rest is
+		   written normally */
+		if ( (k->map != NULL) && (k->offset+len > k->size) )
+		{
+			size = (k->offset+len > 2*k->size) ? k->offset+len : 2*k->size;
+			if ( sink_map(k, size) != 0 )
+			{
+				printf( "Unable to grow the file mapping [%s], writing normally\n", 
+					strerror(errno) );
+				k->kind = SINK_WRITE;
+				return( NULL );
+			}
+		}
+		return( (k->map != NULL) ? k->map+k->offset : NULL );
+
+	default:
+		return( NULL );
+	}
+}
+
+/**********************************************************************
+
+    Function    : sink_commit
+    Description : append the next bytes of the file, from sink_space or
+                  any other buffer
+    Inputs      : k - the sink
+                  data - the bytes
+                  len - how many
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int sink_commit( FileSink *k, char *data, unsigned int len )
+{
+	double start = sink_now();
+	unsigned int done = 0;
+	ssize_t n;
+	int ret = 0;
+
+	if ( (k->buf != NULL) && (data == k->buf+k->buflen) )
+	{
+		/* Gathered; write whole chunks, at chunk offsets */
+		k->buflen += len;
+		k->offset += len;
+		if ( k->buflen >= SINK_CHUNK )
+			ret = sink_flush( k, SINK_CHUNK );
+	}
+	else if ( (k->map != NULL) && (data == k->map+k->offset) )
+		k->offset += len;
+	else
+	{
+		/* From elsewhere, after anything gathered before it */
+		if ( (k->buflen > 0) && (sink_flush(k, k->buflen) != 0) )
+			return( -1 );
+		while ( (done < len) && (ret == 0) )
+		{
+			k->writes++;
+			if ( (n = pwrite(k->fd, data+done, len-done, k->offset+done)) > 0 )
+				done += n;
+			else if ( (n == -1) && (errno == EINTR) )
+				continue;
+			else
+			{
+				/* Complain, explain, and stop */
+				char msg[128];
+				sprintf( msg, "failure writing file [%.64s]\n", strerror(errno) );
+				errorMessage( msg );
+				ret = -1;
+			}
+		}
+		k->offset += done;
+	}
+	k->seconds += sink_now() - start;
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : sink_positional
+    Description : check whether blocks may be put at their own offsets,
+                  in any order and from several threads at once
+    Inputs      : k - the sink
+    Outputs     : non-zero if so; gathered writes must be appended
+
+***********************************************************************/
+
+int sink_positional( FileSink *k )
+{
+	return( k->kind != SINK_AGGREGATE );
+}
+
+/**********************************************************************
+
+    Function    : sink_written
+    Description : account for file bytes put in place by a positional
+                  writer; safe from several threads at once
+    Inputs      : k - the sink
+                  end - offset just past the bytes
+                  writes - system calls it took
+                  seconds - time it took
+    Outputs     : none
+
+***********************************************************************/
+
+void sink_written( FileSink *k, unsigned long end, unsigned long writes, double seconds )
+{
+	unsigned long at = __atomic_load_n( &k->offset, __ATOMIC_RELAXED );
+	double was, now;
+
+	/* The file is as long as the furthest block, once all are in */
+	while ( (end > at) && 
+		!__atomic_compare_exchange_n(&k->offset, &at, end, 0, 
+					     __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+		;
+	__atomic_add_fetch( &k->writes, writes, __ATOMIC_RELAXED );
+	__atomic_load( &k->seconds, &was, __ATOMIC_RELAXED );
+	do
+		now = was + seconds;
+	while ( !__atomic_compare_exchange(&k->seconds, &was, &now, 0, 
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+}
+
+/**********************************************************************
+
+    Function    : sink_space_at
+    Description : get where the bytes at an offset of the file can be
+                  put directly, if the sink has such a place
+    Inputs      : k - the sink
+                  offset - where in the file
+                  len - how many bytes
+    Outputs     : where to put them, NULL to write from elsewhere
+
+***********************************************************************/
+
+char *sink_space_at( FileSink *k, unsigned long offset, unsigned int len )
+{
+	/* Appending is the only way into a gathering sink; a mapping is
+	   never grown under other writers, past it they pwrite */
+	if ( !sink_positional(k) )
+		return( (offset == k->offset) ? sink_space(k, len) : NULL );
+	if ( (k->map != NULL) && (offset+len <= k->size) )
+		return( k->map+offset );
+	return( NULL );
+}
+
+/**********************************************************************
+
+    Function    : sink_write_at
+    Description : put bytes of the file at their offset, from
+                  sink_space_at or any other buffer; positional sinks
+                  take blocks in any order from several threads at once
+    Inputs      : k - the sink
+                  data - the bytes
+                  len - how many
+                  offset - where in the file
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int sink_write_at( FileSink *k, char *data, unsigned int len, unsigned long offset )
+{
+	double start = sink_now();
+	unsigned long writes = 0;
+	unsigned int done = 0;
+	ssize_t n;
+
+	/* A gathering sink only appends */
+	if ( !sink_positional(k) )
+	{
+		if ( offset != k->offset )
+		{
+			errorMessage( "file block out of order for the sink\n" );
+			return( -1 );
+		}
+		return( sink_commit(k, data, len) );
+	}
+
+	/* Already in the mapping, or written where it goes */
+	if ( (k->map == NULL) || (data != k->map+offset) )
+		while ( done < len )
+		{
+			writes++;
+			if ( (n = pwrite(k->fd, data+done, len-done, offset+done)) > 0 )
+				done += n;
+			else if ( (n == -1) && (errno == EINTR) )
+				continue;
+			else
+			{
+				/* Complain, explain, and return */
+				char msg[128];
+				sprintf( msg, "failure writing file [%.64s]\n", strerror(errno) );
+				errorMessage( msg );
+				return( -1 );
+			}
+		}
+	sink_written( k, offset+len, writes, sink_now()-start );
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : sink_close
+    Description : write out anything held, trim the file to what was
+                  written, and close it; does nothing once closed
+    Inputs      : k - the sink
+                  report - print the bytes, writes, rate and extents
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int sink_close( FileSink *k, int report )
+{
+	double start = sink_now();
+	int ret = 0;
+
+	if ( k->fd == -1 )
+		return( 0 );
+	if ( (k->buflen > 0) && (sink_flush(k, k->buflen) != 0) )
+		ret = -1;
+	if ( k->map != NULL )
+		munmap( k->map, k->size );
+
+	/* Preallocated or mapped past the end, give back the rest */
+	if ( (k->size > k->offset) && (ftruncate(k->fd, k->offset) != 0) )
+		ret = -1;
+	k->seconds += sink_now() - start;
+
+	if ( report )
+		printf( "Wrote %lu bytes with the %s sink: %lu writes, %.1f MiB/s, %ld extents\n", 
+			k->offset, sink_name(k->kind), k->writes, 
+			(k->seconds > 0) ? k->offset/k->seconds/(1024*1024) : 0.0, 
+			sink_extents(k->fd) );
+	close( k->fd );
+	free( k->buf );
+	k->fd = -1;
+	k->buf = NULL;
+	k->map = NULL;
+	return( ret );
+}
+
+/**********************************************************************
+
+    Function    : test_sinks
+    Description : write several files at once, block by block, through
+                  each sink and report the rates and fragmentation
+    Inputs      : count - MiB per file, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_sinks( int count )
+{
+	unsigned int blocksize = XFER_BLOCK_DEFAULT;
+	unsigned long total, off, writes;
+	char names[SINK_TEST_FILES][sizeof(SINK_TEST_FILE)], *block, *space;
+	FileSink sinks[SINK_TEST_FILES];
+	long extents;
+	double start, secs;
+	int i, j, fd, ret = 0;
+
+	count = (count > 0) ? count : SINK_TEST_COUNT;
+	total = (unsigned long)count * 1024 * 1024;
+	printf( "*** Test file sinks, %d files of %d MiB at once in %u byte blocks. ***\n", 
+		SINK_TEST_FILES, count, blocksize );
+	if ( ((block = (char *)malloc(blocksize)) == NULL) ||
+	     (generate_pseudorandom_bytes((unsigned char *)block, blocksize) != 0) )
+	{
+		errorMessage( "sink test unable to set up\n" );
+		free( block );
+		return( -1 );
+	}
+	for ( j=0; j<SINK_TEST_FILES; j++ )
+	{
+		strcpy( names[j], SINK_TEST_FILE );
+		if ( (fd = mkstemp(names[j])) != -1 )
+			close( fd );
+	}
+
+	/* The files take turns a block at a time, as concurrent uploads
+	   would, and each is on disk before the clock stops */
+	for ( i=0; (i<SINK_KINDS) && (ret == 0); i++ )
+	{
+		start = sink_now();
+		for ( j=0; j<SINK_TEST_FILES; j++ )
+			if ( sink_open(&sinks[j], i, names[j], total, blocksize) != 0 )
+				ret = -1;
+		for ( off=0; (off<total) && (ret == 0); off+=blocksize )
+			for ( j=0; (j<SINK_TEST_FILES) && (ret == 0); j++ )
+			{
+				if ( (space = sink_space(&sinks[j], blocksize)) != NULL )
+					memcpy( space, block, blocksize );
+				ret = sink_commit( &sinks[j], (space != NULL) ? space : block, blocksize );
+			}
+		for ( j=0, writes=0, extents=0; j<SINK_TEST_FILES; j++ )
+		{
+			if ( sinks[j].fd == -1 )
+				continue;
+			if ( (sinks[j].buflen > 0) && (sink_flush(&sinks[j], sinks[j].buflen) != 0) )
+				ret = -1;
+			if ( (sinks[j].map != NULL) && (msync(sinks[j].map, sinks[j].size, MS_SYNC) != 0) )
+				ret = -1;
+			if ( fdatasync(sinks[j].fd) != 0 )
+				ret = -1;
+			writes += sinks[j].writes;
+			extents += sink_extents( sinks[j].fd );
+			if ( sink_close(&sinks[j], 0) != 0 )
+				ret = -1;
+		}
+		secs = sink_now() - start;
+		if ( ret == 0 )
+			printf( "Sink %-10s: %8.1f MiB/s, %8lu writes, %6.1f extents per file\n", 
+				sink_name(i), SINK_TEST_FILES*(total/secs)/(1024*1024), writes, 
+				(double)extents/SINK_TEST_FILES );
+	}
+
+	for ( j=0; j<SINK_TEST_FILES; j++ )
+		unlink( names[j] );
+	free( block );
+	return( ret );
+}
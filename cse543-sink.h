@@ -0,0 +1,215 @@
+#ifndef CSE543_SINK_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-sink.h
+
+   Description   : This is where the server writes a received file:
+                   a write per block, blocks gathered into large
+                   aligned writes, a file preallocated to the size the
+                   client announced, or a mapping of the file the
+                   blocks are decrypted into.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <sys/types.h>
+
+/* Defines */
+#define SINK_ALIGN 4096                 /* staging buffer alignment */
+#define SINK_CHUNK (1024*1024)          /* bytes per aggregated write */
+#define SINK_MAP_GROW (64*1024*1024)    /* mapping growth when no size was announced */
+#define SINK_PREALLOC_MAX (1UL << 34)   /* most bytes preallocated for one file */
+#define SINK_TEST_COUNT 64              /* MiB written per sink by test_sinks */
+#define SINK_TEST_FILES 4               /* files written at once by test_sinks */
+
+/* Data Structures */
+
+/* The ways of writing the file */
+typedef enum {
+	SINK_WRITE,          /* a pwrite per block */
+	SINK_AGGREGATE,      /* blocks gathered into SINK_CHUNK pwrites */
+	SINK_FALLOCATE,      /* preallocated to the announced size, a pwrite per block */
+	SINK_MMAP,           /* authenticated blocks copied into a mapping of the file */
+	SINK_KINDS
+} SinkKind;
+
+/* This is a file being received */
+typedef struct {
+	SinkKind          kind;      /* how it is written */
+	int               fd;        /* the file, -1 once closed */
+	unsigned long     offset;    /* bytes of the file written so far */
+	unsigned long     size;      /* bytes preallocated or mapped */
+	char             *buf;       /* aggregate: aligned staging buffer */
+	unsigned int      buflen;    /* aggregate: bytes in buf */
+	unsigned int      bufsize;   /* aggregate: its size */
+	char             *map;       /* mmap: the file */
+	unsigned long     writes;    /* write system calls made */
+	double            seconds;   /* time spent writing */
+} FileSink;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : sink_kind
+    Description : look up a sink by name
+    Inputs      : name - write, aggregate, fallocate or mmap
+    Outputs     : the SinkKind, -1 if there is no such sink
+
+***********************************************************************/
+extern int sink_kind( const char *name );
+
+/**********************************************************************
+
+    Function    : sink_name
+    Description : get the name of a sink
+    Inputs      : kind - the sink
+    Outputs     : its name
+
+***********************************************************************/
+extern const char *sink_name( SinkKind kind );
+
+/**********************************************************************
+
+    Function    : sink_open
+    Description : create (or truncate) a file to receive; a sink the
+                  file system cannot do falls back to a write per block
+    Inputs      : k - the sink
+                  kind - how to write it
+                  fname - the file
+                  size - the size the client announced, 0 if unknown
+                  blocksize - most bytes committed at once
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int sink_open( FileSink *k, SinkKind kind, const char *fname, 
+		      unsigned long size, unsigned int blocksize );
+
+/**********************************************************************
+
+    Function    : sink_space
+    Description : get where the next bytes of the file can be put
+                  directly, if the sink has such a place
+    Inputs      : k - the sink
+                  len - how many bytes
+    Outputs     : where to put them, NULL to commit from elsewhere
+
+***********************************************************************/
+extern char *sink_space( FileSink *k, unsigned int len );
+
+/**********************************************************************
+
+    Function    : sink_commit
+    Description : append the next bytes of the file, from sink_space or
+                  any other buffer
+    Inputs      : k - the sink
+                  data - the bytes
+                  len - how many
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int sink_commit( FileSink *k, char *data, unsigned int len );
+
+/**********************************************************************
+
+    Function    : sink_positional
+    Description : check whether blocks may be put at their own offsets,
+                  in any order and from several threads at once
+    Inputs      : k - the sink
+    Outputs     : non-zero if so; gathered writes must be appended
+
+***********************************************************************/
+extern int sink_positional( FileSink *k );
+
+/**********************************************************************
+
+    Function    : sink_written
+    Description : account for file bytes put in place by a positional
+                  writer; safe from several threads at once
+    Inputs      : k - the sink
+                  end - offset just past the bytes
+                  writes - system calls it took
+                  seconds - time it took
+    Outputs     : none
+
+***********************************************************************/
+extern void sink_written( FileSink *k, unsigned long end, unsigned long writes, 
+			  double seconds );
+
+/**********************************************************************
+
+    Function    : sink_space_at
+    Description : get where the bytes at an offset of the file can be
+                  put directly, if the sink has such a place
+    Inputs      : k - the sink
+                  offset - where in the file
+                  len - how many bytes
+    Outputs     : where to put them, NULL to write from elsewhere
+
+***********************************************************************/
+extern char *sink_space_at( FileSink *k, unsigned long offset, unsigned int len );
+
+/**********************************************************************
+
+    Function    : sink_write_at
+    Description : put bytes of the file at their offset, from
+                  sink_space_at or any other buffer; positional sinks
+                  take blocks in any order from several threads at once
+    Inputs      : k - the sink
+                  data - the bytes
+                  len - how many
+                  offset - where in the file
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int sink_write_at( FileSink *k, char *data, unsigned int len, 
+			  unsigned long offset );
+
+/**********************************************************************
+
+    Function    : sink_close
+    Description : write out anything held, trim the file to what was
+                  written, and close it; does nothing once closed
+    Inputs      : k - the sink
+                  report - print the bytes, writes, rate and extents
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int sink_close( FileSink *k, int report );
+
+/**********************************************************************
+
+    Function    : test_sinks
+    Description : write several files at once, block by block, through
+                  each sink and report the rates and fragmentation
+    Inputs      : count - MiB per file, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_sinks( int count );
+
+#define CSE543_SINK_INCLUDED
+#endif
@@ -0,0 +1,293 @@
+/**********************************************************************
+
+   File          : cse543-slab.c
+
+   Description   : This is where buffers are pooled.  Each class keeps
+                   its idle buffers on a lock-free queue, so the
+                   transfer path allocates from the heap only until
+                   enough buffers are in circulation.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-queue.h"
+#include "cse543-slab.h"
+
+/* Defines */
+#define SLAB_HUGE SLAB_CLASSES          /* class of a buffer too big for any */
+
+/* This is what precedes each buffer */
+typedef struct {
+	uint32_t          cls;       /* its class, SLAB_HUGE for none */
+	uint32_t          pad[3];
+} SlabHeader;
+
+/* Idle buffers of each class, set up on first use */
+static BoundedQueue slab_idle[SLAB_CLASSES];
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static int slab_ready = 0;
+static unsigned long slab_heap = 0;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : slab_setup
+    Description : size each class's idle queue
+    Inputs      : none
+    Outputs     : none
+
+***********************************************************************/
+
+static void slab_setup( void )
+{
+	unsigned long size, keep;
+	int i;
+
+	for ( i=0; i<SLAB_CLASSES; i++ )
+	{
+		size = (1UL << (SLAB_MIN_SHIFT+i)) + SLAB_SLACK;
+		keep = SLAB_CLASS_BYTES / size;
+		if ( queue_init(&slab_idle[i], (keep < SLAB_CLASS_MIN) ? SLAB_CLASS_MIN : keep) != 0 )
+		{
+			/* Complain, explain, and go without */
+			errorMessage( "unable to set up buffer pools, using the heap\n" );
+			while ( i-- > 0 )
+				queue_free( &slab_idle[i] );
+			return;
+		}
+	}
+	slab_ready = 1;
+}
+
+/**********************************************************************
+
+    Function    : slab_class
+    Description : find the smallest class that holds a size
+    Inputs      : size - bytes needed
+    Outputs     : the class, SLAB_HUGE if none does
+
+***********************************************************************/
+
+static int slab_class( size_t size )
+{
+	int cls = 0;
+
+	while ( (cls < SLAB_CLASSES) && 
+		(size > (1UL << (SLAB_MIN_SHIFT+cls)) + SLAB_SLACK) )
+		cls++;
+	return( cls );
+}
+
+/**********************************************************************
+
+    Function    : slab_capacity
+    Description : get the bytes a class holds
+    Inputs      : cls - the class
+    Outputs     : its size
+
+***********************************************************************/
+
+static size_t slab_capacity( int cls )
+{
+	return( (1UL << (SLAB_MIN_SHIFT+cls)) + SLAB_SLACK );
+}
+
+/**********************************************************************
+
+    Function    : slab_alloc
+    Description : get a buffer from the smallest class that holds it,
+                  idle if one is, else from the heap
+    Inputs      : size - bytes needed
+    Outputs     : the buffer, NULL if failure
+
+***********************************************************************/
+
+void *slab_alloc( size_t size )
+{
+	int cls = slab_class( size );
+	SlabHeader *h = NULL;
+
+	pthread_once( &slab_once, slab_setup );
+	if ( slab_ready && (cls != SLAB_HUGE) && 
+	     (queue_pop(&slab_idle[cls], (void **)&h) == 0) )
+		return( (char *)h + SLAB_HEADER );
+
+	/* None idle, or too big to pool */
+	__atomic_add_fetch( &slab_heap, 1, __ATOMIC_RELAXED );
+	if ( (h = (SlabHeader *)malloc(SLAB_HEADER + 
+				       ((cls == SLAB_HUGE) ? size : slab_capacity(cls)))) == NULL )
+		return( NULL );
+	h->cls = cls;
+	return( (char *)h + SLAB_HEADER );
+}
+
+/**********************************************************************
+
+    Function    : slab_free
+    Description : give a buffer back to its class, or to the heap if
+                  the class has enough idle; from any thread
+    Inputs      : ptr - the buffer (or NULL)
+    Outputs     : none
+
+***********************************************************************/
+
+void slab_free( void *ptr )
+{
+	SlabHeader *h;
+
+	if ( ptr == NULL )
+		return;
+	h = (SlabHeader *)((char *)ptr - SLAB_HEADER);
+	if ( !slab_ready || (h->cls == SLAB_HUGE) || 
+	     (queue_push(&slab_idle[h->cls], h) != 0) )
+		free( h );
+}
+
+/**********************************************************************
+
+    Function    : slab_realloc
+    Description : grow a buffer, keeping its contents; the same buffer
+                  if its class already holds the size
+    Inputs      : ptr - the buffer (or NULL)
+                  size - bytes needed
+    Outputs     : the buffer, NULL if failure (ptr is still good)
+
+***********************************************************************/
+
+void *slab_realloc( void *ptr, size_t size )
+{
+	SlabHeader *h;
+	void *nptr;
+
+	if ( ptr == NULL )
+		return( slab_alloc(size) );
+	h = (SlabHeader *)((char *)ptr - SLAB_HEADER);
+	if ( (h->cls != SLAB_HUGE) && (size <= slab_capacity(h->cls)) )
+		return( ptr );
+
+	/* A huge buffer does not know its size, so the heap moves it */
+	if ( h->cls == SLAB_HUGE )
+	{
+		__atomic_add_fetch( &slab_heap, 1, __ATOMIC_RELAXED );
+		if ( (h = (SlabHeader *)realloc(h, SLAB_HEADER + size)) == NULL )
+			return( NULL );
+		return( (char *)h + SLAB_HEADER );
+	}
+	if ( (nptr = slab_alloc(size)) == NULL )
+		return( NULL );
+	memcpy( nptr, ptr, slab_capacity(h->cls) );
+	slab_free( ptr );
+	return( nptr );
+}
+
+/**********************************************************************
+
+    Function    : slab_allocs
+    Description : count the heap allocations the slabs and arenas
+                  have made
+    Inputs      : none
+    Outputs     : allocations so far
+
+***********************************************************************/
+
+unsigned long slab_allocs( void )
+{
+	return( __atomic_load_n(&slab_heap, __ATOMIC_RELAXED) );
+}
+
+/**********************************************************************
+
+    Function    : arena_init
+    Description : start an empty arena
+    Inputs      : a - the arena
+    Outputs     : none
+
+***********************************************************************/
+
+void arena_init( Arena *a )
+{
+	a->chunks = NULL;
+}
+
+/**********************************************************************
+
+    Function    : arena_alloc
+    Description : get scratch memory that lasts until arena_free
+    Inputs      : a - the arena
+                  size - bytes needed
+    Outputs     : the memory, NULL if failure
+
+***********************************************************************/
+
+void *arena_alloc( Arena *a, size_t size )
+{
+	ArenaChunk *c = a->chunks;
+	size_t need = (size + 15) & ~(size_t)15, chunk;
+	char *ptr;
+
+	/* A new chunk (from the slabs) when this one is full; a large
+	   request gets one of its own */
+	if ( (c == NULL) || (c->used+need > c->size) )
+	{
+		chunk = (sizeof(ArenaChunk)+need > ARENA_CHUNK) ? sizeof(ArenaChunk)+need : ARENA_CHUNK;
+		if ( (c = (ArenaChunk *)slab_alloc(chunk)) == NULL )
+			return( NULL );
+		c->size = chunk - sizeof(ArenaChunk);
+		c->used = 0;
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+	ptr = c->data + c->used;
+	c->used += need;
+	return( ptr );
+}
+
+/**********************************************************************
+
+    Function    : arena_free
+    Description : give back everything in the arena at once
+    Inputs      : a - the arena
+    Outputs     : none
+
+***********************************************************************/
+
+void arena_free( Arena *a )
+{
+	ArenaChunk *c;
+
+	while ( (c = a->chunks) != NULL )
+	{
+		a->chunks = c->next;
+		slab_free( c );
+	}
+}
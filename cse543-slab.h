@@ -0,0 +1,145 @@
+#ifndef CSE543_SLAB_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-slab.h
+
+   Description   : These are the buffer pools: size-classed slabs for
+                   frame, block and job buffers, shared by every thread
+                   so a buffer freed on a pool thread is reused by the
+                   reactor, and arenas for scratch memory that is all
+                   released in one step.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stddef.h>
+
+/* Defines */
+#define SLAB_MIN_SHIFT 8                /* smallest class, 256 bytes */
+#define SLAB_MAX_SHIFT 22               /* largest class, 4 MiB (a block at XFER_BLOCK_MAX) */
+#define SLAB_CLASSES (SLAB_MAX_SHIFT-SLAB_MIN_SHIFT+1)
+#define SLAB_SLACK 256                  /* above each power of two, for headers, sequence and tag */
+#define SLAB_HEADER 16                  /* before each buffer, keeps malloc's alignment */
+#define SLAB_CLASS_BYTES (32*1024*1024) /* most idle bytes kept per class */
+#define SLAB_CLASS_MIN 8                /* least idle buffers kept per class */
+#define ARENA_CHUNK (16*1024)           /* arena bytes taken at a time */
+#define SLAB_TEST_COUNT 10000           /* blocks moved by test_allocs */
+
+/* Data Structures */
+
+/* This is one piece of an arena */
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t              size;      /* bytes in data */
+	size_t              used;
+	char                data[0] __attribute__((aligned(16)));
+} ArenaChunk;
+
+/* This is an arena; everything in it goes back at once */
+typedef struct {
+	ArenaChunk         *chunks;    /* newest first */
+} Arena;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : slab_alloc
+    Description : get a buffer from the smallest class that holds it,
+                  idle if one is, else from the heap
+    Inputs      : size - bytes needed
+    Outputs     : the buffer, NULL if failure
+
+***********************************************************************/
+extern void *slab_alloc( size_t size );
+
+/**********************************************************************
+
+    Function    : slab_free
+    Description : give a buffer back to its class, or to the heap if
+                  the class has enough idle; from any thread
+    Inputs      : ptr - the buffer (or NULL)
+    Outputs     : none
+
+***********************************************************************/
+extern void slab_free( void *ptr );
+
+/**********************************************************************
+
+    Function    : slab_realloc
+    Description : grow a buffer, keeping its contents; the same buffer
+                  if its class already holds the size
+    Inputs      : ptr - the buffer (or NULL)
+                  size - bytes needed
+    Outputs     : the buffer, NULL if failure (ptr is still good)
+
+***********************************************************************/
+extern void *slab_realloc( void *ptr, size_t size );
+
+/**********************************************************************
+
+    Function    : slab_allocs
+    Description : count the heap allocations the slabs and arenas
+                  have made
+    Inputs      : none
+    Outputs     : allocations so far
+
+***********************************************************************/
+extern unsigned long slab_allocs( void );
+
+/**********************************************************************
+
+    Function    : arena_init
+    Description : start an empty arena
+    Inputs      : a - the arena
+    Outputs     : none
+
+***********************************************************************/
+extern void arena_init( Arena *a );
+
+/**********************************************************************
+
+    Function    : arena_alloc
+    Description : get scratch memory that lasts until arena_free
+    Inputs      : a - the arena
+                  size - bytes needed
+    Outputs     : the memory, NULL if failure
+
+***********************************************************************/
+extern void *arena_alloc( Arena *a, size_t size );
+
+/**********************************************************************
+
+    Function    : arena_free
+    Description : give back everything in the arena at once
+    Inputs      : a - the arena
+    Outputs     : none
+
+***********************************************************************/
+extern void arena_free( Arena *a );
+
+#define CSE543_SLAB_INCLUDED
+#endif
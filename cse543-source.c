@@ -0,0 +1,369 @@
+/**********************************************************************
+
+   File          : cse543-source.c
+
+   Description   : This is where the client reads the file it sends.
+                   Each source hands back where the next bytes are, so
+                   the mapped source is sealed from without a copy into
+                   the frame.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-proto.h"
+#include "cse543-aead.h"
+#include "cse543-source.h"
+
+/* Defines */
+#define SOURCE_TEST_FILE "cse543-source-test.XXXXXX"
+
+/* Source names, by SourceKind */
+static const char *source_names[SOURCE_KINDS] = { "read", "mmap", "fadvise", "direct" };
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : source_kind
+    Description : look up a source by name
+    Inputs      : name - read, mmap, fadvise or direct
+    Outputs     : the SourceKind, -1 if there is no such source
+
+***********************************************************************/
+
+int source_kind( const char *name )
+{
+	int i;
+
+	for ( i=0; i<SOURCE_KINDS; i++ )
+		if ( strcmp(name, source_names[i]) == 0 )
+			return( i );
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : source_name
+    Description : get the name of a source
+    Inputs      : kind - the source
+    Outputs     : its name
+
+***********************************************************************/
+
+const char *source_name( SourceKind kind )
+{
+	return( source_names[kind] );
+}
+
+/**********************************************************************
+
+    Function    : source_open
+    Description : open a file to read; a source the file system cannot
+                  do (a mapping or O_DIRECT) falls back to plain reads
+    Inputs      : src - the source
+                  kind - how to read it
+                  fname - the file
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int source_open( FileSource *src, SourceKind kind, const char *fname )
+{
+	struct stat st;
+
+	memset( src, 0, sizeof(FileSource) );
+	src->kind = kind;
+	src->fd = open( fname, O_RDONLY | ((kind == SOURCE_DIRECT) ? O_DIRECT : 0) );
+	if ( (src->fd == -1) && (kind == SOURCE_DIRECT) && (errno == EINVAL) )
+	{
+		/* Some file systems (tmpfs) have no O_DIRECT */
+		printf( "O_DIRECT not supported for %s, reading normally\n", fname );
+		src->kind = SOURCE_READ;
+		src->fd = open( fname, O_RDONLY );
+	}
+	if ( (src->fd == -1) || (fstat(src->fd, &st) != 0) )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "failure opening file [%.64s]\n", fname );
+		errorMessage( msg );
+		source_close( src );
+		return( -1 );
+	}
+	src->size = st.st_size;
+
+	switch ( src->kind )
+	{
+	case SOURCE_MMAP:
+		/* Nothing to map in an empty file */
+		if ( src->size == 0 )
+			break;
+		src->map = mmap( NULL, src->size, PROT_READ, MAP_PRIVATE, src->fd, 0 );
+		if ( src->map == MAP_FAILED )
+		{
+			printf( "Unable to map %s, reading normally\n", fname );
+			src->map = NULL;
+			src->kind = SOURCE_READ;
+			break;
+		}
+		madvise( src->map, src->size, MADV_SEQUENTIAL );
+		break;
+
+	case SOURCE_FADVISE:
+		posix_fadvise( src->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+		break;
+
+	case SOURCE_DIRECT:
+		if ( posix_memalign((void **)&src->buf, SOURCE_DIRECT_ALIGN, SOURCE_DIRECT_CHUNK) != 0 )
+		{
+			src->buf = NULL;
+			source_close( src );
+			return( -1 );
+		}
+		break;
+
+	default:
+		break;
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : source_next
+    Description : get the next bytes of the file, read into buf or left
+                  where they are; they stay valid until the next call
+    Inputs      : src - the source
+                  buf - where plain reads go (len bytes)
+                  len - most bytes wanted
+                  data - (out) where the bytes are: buf, or inside the
+                   mapping
+    Outputs     : bytes available (0 at the end), -1 if failure
+
+***********************************************************************/
+
+int source_next( FileSource *src, char *buf, unsigned int len, char **data )
+{
+	ssize_t n;
+
+	switch ( src->kind )
+	{
+	case SOURCE_MMAP:
+		/* Already there, just hand out the next piece */
+		n = ((off_t)len < src->size-src->offset) ? (off_t)len : src->size-src->offset;
+		*data = src->map + src->offset;
+		break;
+
+	case SOURCE_DIRECT:
+		/* Refill the aligned buffer a whole chunk at a time, which
+		   keeps every read offset aligned; the slice is copied out,
+		   as blocks still being sealed would see the next refill */
+		if ( src->bufoff == src->buflen )
+		{
+			src->calls++;
+			if ( (n = read(src->fd, src->buf, SOURCE_DIRECT_CHUNK)) <= 0 )
+				break;
+			src->buflen = n;
+			src->bufoff = 0;
+		}
+		n = (len < src->buflen-src->bufoff) ? len : src->buflen-src->bufoff;
+		memcpy( buf, src->buf+src->bufoff, n );
+		*data = buf;
+		src->bufoff += n;
+		break;
+
+	case SOURCE_FADVISE:
+		/* Keep the kernel reading a window ahead of us */
+		if ( (src->offset+SOURCE_READAHEAD/2 >= src->ahead) && (src->ahead < src->size) )
+		{
+			posix_fadvise( src->fd, src->ahead, SOURCE_READAHEAD, POSIX_FADV_WILLNEED );
+			src->ahead += SOURCE_READAHEAD;
+		}
+		/* Fall through */
+
+	default:
+		src->calls++;
+		n = read( src->fd, buf, len );
+		*data = buf;
+		break;
+	}
+
+	if ( n == -1 )
+	{
+		/* Complain, explain, and return */
+		char msg[128];
+		sprintf( msg, "failed read on data file [%.64s]\n", strerror(errno) );
+		errorMessage( msg );
+		return( -1 );
+	}
+	src->offset += n;
+	return( (int)n );
+}
+
+/**********************************************************************
+
+    Function    : source_close
+    Description : unmap, free and close
+    Inputs      : src - the source
+    Outputs     : none
+
+***********************************************************************/
+
+void source_close( FileSource *src )
+{
+	if ( src->map != NULL )
+		munmap( src->map, src->size );
+	free( src->buf );
+	if ( src->fd != -1 )
+		close( src->fd );
+	src->map = NULL;
+	src->buf = NULL;
+	src->fd = -1;
+}
+
+/**********************************************************************
+
+    Function    : test_source_pass
+    Description : read and seal the whole test file through a source
+    Inputs      : kind - the source
+                  fname - the test file
+                  aead - the session cipher
+                  frame - a sealed block (blocksize+AEAD_OVERHEAD bytes)
+                  blocksize - file bytes per block
+                  calls - (out) read system calls made
+    Outputs     : seconds taken, -1 if failure
+
+***********************************************************************/
+
+static double test_source_pass( SourceKind kind, const char *fname, AeadSession *aead, 
+				unsigned char *frame, unsigned int blocksize, 
+				unsigned long *calls )
+{
+	struct timespec start, end;
+	FileSource src;
+	unsigned int outlen;
+	char *data;
+	int n;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	if ( source_open(&src, kind, fname) != 0 )
+		return( -1 );
+	while ( (n = source_next(&src, (char *)frame+AEAD_OVERHEAD, blocksize, &data)) > 0 )
+		if ( aead_seal(aead, (unsigned char *)data, n, frame, &outlen) != 0 )
+		{
+			n = -1;
+			break;
+		}
+	*calls = src.calls;
+	source_close( &src );
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	return( (n < 0) ? -1 : (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9 );
+}
+
+/**********************************************************************
+
+    Function    : test_sources
+    Description : read and seal a file through each source, from the
+                  page cache and (as far as the kernel will drop it)
+                  from disk, and report the rates
+    Inputs      : count - MiB in the file, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_sources( int count )
+{
+	unsigned int blocksize = XFER_BLOCK_DEFAULT;
+	unsigned long total, calls;
+	unsigned char key[KEYSIZE], *chunk, *frame;
+	char fname[] = SOURCE_TEST_FILE;
+	AeadSession aead;
+	double secs;
+	int fd, i, cold, ret = 0;
+
+	count = (count > 0) ? count : SOURCE_TEST_COUNT;
+	total = (unsigned long)count * 1024 * 1024;
+	printf( "*** Test file sources, %d MiB in %u byte blocks. ***\n", count, blocksize );
+
+	/* One random MiB over and over is as good as any for reading */
+	memset( &aead, 0, sizeof(aead) );
+	chunk = (unsigned char *)malloc( 1024*1024 );
+	frame = (unsigned char *)malloc( blocksize+AEAD_OVERHEAD );
+	if ( (chunk == NULL) || (frame == NULL) || ((fd = mkstemp(fname)) == -1) )
+	{
+		errorMessage( "source test unable to create its file\n" );
+		free( chunk );
+		free( frame );
+		return( -1 );
+	}
+	if ( (generate_pseudorandom_bytes(chunk, 1024*1024) != 0) ||
+	     (generate_pseudorandom_bytes(key, KEYSIZE) != 0) ||
+	     (aead_init(&aead, key, SUITE_DEFAULT, AEAD_CLIENT) != 0) )
+		ret = -1;
+	for ( i=0; (i<count) && (ret == 0); i++ )
+		if ( write(fd, chunk, 1024*1024) != 1024*1024 )
+			ret = -1;
+	if ( (ret != 0) || (fsync(fd) != 0) )
+	{
+		errorMessage( "source test unable to write its file\n" );
+		ret = -1;
+	}
+
+	/* Each source from disk, then from the page cache */
+	for ( i=0; (i<SOURCE_KINDS) && (ret == 0); i++ )
+		for ( cold=1; (cold>=0) && (ret == 0); cold-- )
+		{
+			if ( cold )
+				posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+			if ( (secs = test_source_pass(i, fname, &aead, frame, blocksize, &calls)) < 0 )
+			{
+				ret = -1;
+				break;
+			}
+			printf( "Source %-8s %s: %8.1f MiB/s, %6lu read calls\n", source_name(i), 
+				cold ? "cold" : "warm", (secs > 0) ? total/secs/(1024*1024) : 0.0, calls );
+		}
+
+	aead_free( &aead );
+	close( fd );
+	unlink( fname );
+	free( chunk );
+	free( frame );
+	return( ret );
+}
@@ -0,0 +1,143 @@
+#ifndef CSE543_SOURCE_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-source.h
+
+   Description   : This is where the client reads the file it sends:
+                   plain reads, a mapping the blocks are sealed from,
+                   sequential reads with readahead hints, or O_DIRECT
+                   into aligned buffers for data not in the page cache.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <sys/types.h>
+
+/* Defines */
+#define SOURCE_READAHEAD (8*1024*1024)  /* bytes hinted ahead of the fadvise source */
+#define SOURCE_DIRECT_ALIGN 4096        /* O_DIRECT buffer, offset and size alignment */
+#define SOURCE_DIRECT_CHUNK (1024*1024) /* bytes per O_DIRECT read */
+#define SOURCE_TEST_COUNT 256           /* MiB read per source by test_sources */
+
+/* Data Structures */
+
+/* The ways of reading the file */
+typedef enum {
+	SOURCE_READ,         /* read() into each frame */
+	SOURCE_MMAP,         /* seal straight from a mapping of the file */
+	SOURCE_FADVISE,      /* read() with sequential and readahead hints */
+	SOURCE_DIRECT,       /* O_DIRECT reads into an aligned buffer */
+	SOURCE_KINDS
+} SourceKind;
+
+/* This is an open source file */
+typedef struct {
+	SourceKind        kind;      /* how it is read */
+	int               fd;        /* the file */
+	off_t             size;      /* its length when opened */
+	off_t             offset;    /* bytes handed out so far */
+	char             *map;       /* mmap: the whole file */
+	off_t             ahead;     /* fadvise: hinted up to here */
+	char             *buf;       /* direct: aligned staging buffer */
+	unsigned int      buflen;    /* direct: bytes in buf */
+	unsigned int      bufoff;    /* direct: bytes of buf handed out */
+	unsigned long     calls;     /* read system calls made */
+} FileSource;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : source_kind
+    Description : look up a source by name
+    Inputs      : name - read, mmap, fadvise or direct
+    Outputs     : the SourceKind, -1 if there is no such source
+
+***********************************************************************/
+extern int source_kind( const char *name );
+
+/**********************************************************************
+
+    Function    : source_name
+    Description : get the name of a source
+    Inputs      : kind - the source
+    Outputs     : its name
+
+***********************************************************************/
+extern const char *source_name( SourceKind kind );
+
+/**********************************************************************
+
+    Function    : source_open
+    Description : open a file to read; a source the file system cannot
+                  do (a mapping or O_DIRECT) falls back to plain reads
+    Inputs      : src - the source
+                  kind - how to read it
+                  fname - the file
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int source_open( FileSource *src, SourceKind kind, const char *fname );
+
+/**********************************************************************
+
+    Function    : source_next
+    Description : get the next bytes of the file, read into buf or left
+                  where they are; they stay valid until the next call
+    Inputs      : src - the source
+                  buf - where plain reads go (len bytes)
+                  len - most bytes wanted
+                  data - (out) where the bytes are: buf, or inside the
+                   mapping
+    Outputs     : bytes available (0 at the end), -1 if failure
+
+***********************************************************************/
+extern int source_next( FileSource *src, char *buf, unsigned int len, char **data );
+
+/**********************************************************************
+
+    Function    : source_close
+    Description : unmap, free and close
+    Inputs      : src - the source
+    Outputs     : none
+
+***********************************************************************/
+extern void source_close( FileSource *src );
+
+/**********************************************************************
+
+    Function    : test_sources
+    Description : read and seal a file through each source, from the
+                  page cache and (as far as the kernel will drop it)
+                  from disk, and report the rates
+    Inputs      : count - MiB in the file, 0 for the default
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_sources( int count );
+
+#define CSE543_SOURCE_INCLUDED
+#endif
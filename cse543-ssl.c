@@ -6,6 +6,7 @@
 #include <openssl/rsa.h>
 #include <openssl/err.h>
 #include <openssl/hmac.h>
+#include <openssl/engine.h>
 #include <sys/types.h>
 #include <assert.h>
 #include <unistd.h>
@@ -154,26 +155,16 @@ void digest_message(const unsigned char *message, size_t message_len, unsigned c
 
 
 
-int hmac_message(unsigned char* msg, size_t mlen, unsigned char** val, size_t* vlen, unsigned char *key)
+int hmac_message(unsigned char* msg, size_t mlen, unsigned char** val, size_t* vlen, 
+		 unsigned char *key, int klen)
 {
-	HMAC_CTX *ctx;
-	const EVP_MD* md = NULL;
+	unsigned int len = 0;
 
-	OpenSSL_add_all_digests();
-
-	md = EVP_get_digestbyname("SHA256");
-	HMAC_CTX_init( ctx );
-
-	if(!HMAC_Init_ex(ctx, key, sizeof(key), md, NULL))
+	/* *val must hold EVP_MAX_MD_SIZE bytes; the whole key is used, not
+	   just a pointer's worth of it */
+	if(!HMAC(EVP_sha256(), key, klen, msg, mlen, *val, &len))
 		handleErrors();
-
-	if(!HMAC_Update(ctx, msg, mlen))
-		handleErrors();
-
-	if(!HMAC_Final(ctx, *val, (unsigned int *)vlen))
-		handleErrors();
-  
-	HMAC_CTX_cleanup(ctx);
+	*vlen = len;
 
 #if 0
 	unsigned int i;
@@ -221,7 +212,7 @@ int rsa_encrypt(unsigned char *msg, unsigned int msgLen, unsigned char **encMsg,
 	}
 	encMsgLen += blockLen;
 
-	EVP_CIPHER_CTX_cleanup(rsaEncryptCtx);
+	EVP_CIPHER_CTX_free(rsaEncryptCtx);
 
 	return (int)encMsgLen;
 }
@@ -239,27 +230,68 @@ int rsa_decrypt(unsigned char *encMsg, unsigned int encMsgLen, unsigned char *ek
 
 	if(!(rsaDecryptCtx = EVP_CIPHER_CTX_new())) handleErrors();
 
-	if(!EVP_OpenInit(rsaDecryptCtx, EVP_aes_256_cbc(), ek, ekl, iv, privkey)) {
-		handleErrors();
-	}
-
-	if(!EVP_OpenUpdate(rsaDecryptCtx, (unsigned char*)*decMsg + decLen, (int*)&blockLen, encMsg, (int)encMsgLen)) {
-		handleErrors();
+	/* A bad sealed key is the peer's fault, report it rather than abort
+	 * (this runs on the server's crypto pool)
+	 */
+	if(!EVP_OpenInit(rsaDecryptCtx, EVP_aes_256_cbc(), ek, ekl, iv, privkey) ||
+	   !EVP_OpenUpdate(rsaDecryptCtx, (unsigned char*)*decMsg + decLen, (int*)&blockLen, encMsg, (int)encMsgLen)) {
+		ERR_print_errors_fp(stderr);
+		EVP_CIPHER_CTX_free(rsaDecryptCtx);
+		free(*decMsg);
+		*decMsg = NULL;
+		return -1;
 	}
 	decLen += blockLen;
 
 	if(!EVP_OpenFinal(rsaDecryptCtx, (unsigned char*)*decMsg + decLen, (int*)&blockLen)) {
-		handleErrors();
+		ERR_print_errors_fp(stderr);
+		EVP_CIPHER_CTX_free(rsaDecryptCtx);
+		free(*decMsg);
+		*decMsg = NULL;
+		return -1;
 	}
 	decLen += blockLen;
 
-	EVP_CIPHER_CTX_cleanup(rsaDecryptCtx);
+	EVP_CIPHER_CTX_free(rsaDecryptCtx);
 
 	return (int)decLen;
 }
 
 
 
+ENGINE *engine_init( void )
+{
+	/* No engine: the default provider's AES-GCM already uses the CPU's
+	   AES instructions, and the ENGINE API is deprecated */
+	return NULL;
+}
+
+
+int engine_cleanup( ENGINE *eng )
+{
+	return 0;
+}
+
+
+int crypto_init( void )
+{
+	/* Ciphers, digests and error strings, once per process */
+	if ( OPENSSL_init_crypto(OPENSSL_INIT_LOAD_CRYPTO_STRINGS | 
+				 OPENSSL_INIT_ADD_ALL_CIPHERS | 
+				 OPENSSL_INIT_ADD_ALL_DIGESTS, NULL) != 1 )
+		return -1;
+	return 0;
+}
+
+
+int crypto_cleanup( void )
+{
+	/* OpenSSL frees its own state at exit; drop this thread's errors */
+	ERR_clear_error();
+	return 0;
+}
+
+
 void handleErrors(void)
 {
 	ERR_print_errors_fp(stderr);
@@ -8,7 +8,7 @@ extern int decrypt(unsigned char *ciphertext, int ciphertext_len, unsigned char
 extern void digest_message(const unsigned char *message, size_t message_len, 
 		    unsigned char **digest, unsigned int *digest_len);
 extern int hmac_message(unsigned char* msg, size_t mlen, unsigned char** val, size_t* vlen, 
-			 unsigned char *key);
+			 unsigned char *key, int klen);
 extern int rsa_encrypt(unsigned char *msg, unsigned int msgLen, unsigned char **encMsg, unsigned char **ek,
 		       unsigned int *ekl, unsigned char **iv, unsigned int *ivl, EVP_PKEY *pubkey);
 extern int rsa_decrypt(unsigned char *encMsg, unsigned int encMsgLen, unsigned char *ek, unsigned int ekl,
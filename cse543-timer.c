@@ -0,0 +1,304 @@
+/**********************************************************************
+
+   File          : cse543-timer.c
+
+   Description   : This is a hierarchical timer wheel.  Each level
+                   has TIMER_SLOTS slots; level 0 slots are one tick
+                   wide and each level up is TIMER_SLOTS times wider.
+                   Arming and disarming a timer is a list insert or
+                   unlink, and a timer in an upper level moves down
+                   (cascades) when level 0 wraps, so firing never
+                   scans timers that are not due.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Project Include Files */
+#include "cse543-timer.h"
+
+/* Defines */
+#define TIMER_MASK (TIMER_SLOTS-1)
+#define TIMER_INDEX(t, l) (((t) >> ((l)*TIMER_BITS)) & TIMER_MASK)
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : timer_clock
+    Description : get the current monotonic time
+    Inputs      : none
+    Outputs     : milliseconds
+
+***********************************************************************/
+
+static unsigned long timer_clock( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return( (unsigned long)ts.tv_sec*1000 + ts.tv_nsec/1000000 );
+}
+
+/**********************************************************************
+
+    Function    : timer_link
+    Description : put an armed timer in the slot its expiry falls in
+    Inputs      : w - the wheel
+                  t - the timer
+    Outputs     : none
+
+***********************************************************************/
+
+static void timer_link( TimerWheel *w, Timer *t )
+{
+	long delta = (long)(t->expires - w->now);
+	Timer *head;
+	int l;
+
+	/* Already due runs on the next tick, too far out waits at the top */
+	if ( delta < 0 )
+		t->expires = w->now;
+	else if ( delta >= (1L << (TIMER_LEVELS*TIMER_BITS)) )
+		t->expires = w->now + (1L << (TIMER_LEVELS*TIMER_BITS)) - 1;
+	delta = (long)(t->expires - w->now);
+
+	for ( l=0; l<TIMER_LEVELS-1; l++ )
+		if ( delta < (1L << ((l+1)*TIMER_BITS)) )
+			break;
+	head = &w->slots[l][TIMER_INDEX(t->expires, l)];
+
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+/**********************************************************************
+
+    Function    : timer_unlink
+    Description : take a timer out of its slot
+    Inputs      : t - the timer
+    Outputs     : none
+
+***********************************************************************/
+
+static void timer_unlink( Timer *t )
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+}
+
+/**********************************************************************
+
+    Function    : timer_cascade
+    Description : move the timers in one upper level slot down to the
+                  levels they now fit in
+    Inputs      : w - the wheel
+                  l - the level
+                  index - the slot
+    Outputs     : the slot index (0 means the level above is due too)
+
+***********************************************************************/
+
+static int timer_cascade( TimerWheel *w, int l, int index )
+{
+	Timer *head = &w->slots[l][index], *t;
+
+	while ( (t = head->next) != head )
+	{
+		timer_unlink( t );
+		timer_link( w, t );
+	}
+	return( index );
+}
+
+/**********************************************************************
+
+    Function    : timer_wheel_init
+    Description : set up an empty wheel at the current time
+    Inputs      : w - the wheel
+    Outputs     : none
+
+***********************************************************************/
+
+void timer_wheel_init( TimerWheel *w )
+{
+	int l, i;
+
+	for ( l=0; l<TIMER_LEVELS; l++ )
+		for ( i=0; i<TIMER_SLOTS; i++ )
+			w->slots[l][i].next = w->slots[l][i].prev = &w->slots[l][i];
+	w->now = timer_clock() / TIMER_TICK_MS;
+	w->count = 0;
+}
+
+/**********************************************************************
+
+    Function    : timer_init
+    Description : set up a timer that is not armed
+    Inputs      : t - the timer
+                  fn - called when it fires
+                  arg - for the callback
+    Outputs     : none
+
+***********************************************************************/
+
+void timer_init( Timer *t, TimerFn fn, void *arg )
+{
+	memset( t, 0, sizeof(Timer) );
+	t->fn = fn;
+	t->arg = arg;
+}
+
+/**********************************************************************
+
+    Function    : timer_add
+    Description : arm (or re-arm) a timer, O(1)
+    Inputs      : w - the wheel
+                  t - the timer
+                  ms - milliseconds from now
+    Outputs     : none
+
+***********************************************************************/
+
+void timer_add( TimerWheel *w, Timer *t, unsigned long ms )
+{
+	timer_del( w, t );
+	t->expires = timer_clock()/TIMER_TICK_MS + (ms+TIMER_TICK_MS-1)/TIMER_TICK_MS;
+	timer_link( w, t );
+	w->count++;
+}
+
+/**********************************************************************
+
+    Function    : timer_del
+    Description : disarm a timer if it is armed, O(1)
+    Inputs      : w - the wheel
+                  t - the timer
+    Outputs     : none
+
+***********************************************************************/
+
+void timer_del( TimerWheel *w, Timer *t )
+{
+	if ( t->next == NULL )
+		return;
+	timer_unlink( t );
+	w->count--;
+}
+
+/**********************************************************************
+
+    Function    : timer_pending
+    Description : check whether a timer is armed
+    Inputs      : t - the timer
+    Outputs     : 1 if armed, 0 if not
+
+***********************************************************************/
+
+int timer_pending( Timer *t )
+{
+	return( t->next != NULL );
+}
+
+/**********************************************************************
+
+    Function    : timer_advance
+    Description : fire every timer that is due
+    Inputs      : w - the wheel
+    Outputs     : number of timers fired
+
+***********************************************************************/
+
+int timer_advance( TimerWheel *w )
+{
+	unsigned long cur = timer_clock() / TIMER_TICK_MS;
+	Timer *head, *t;
+	int index, l, fired = 0;
+
+	/* Nothing armed, nothing to catch up on */
+	if ( w->count == 0 )
+	{
+		w->now = cur + 1;
+		return( 0 );
+	}
+
+	while ( (long)(cur - w->now) >= 0 )
+	{
+		/* Level 0 wrapped, pull the next slot of each level down */
+		index = TIMER_INDEX( w->now, 0 );
+		for ( l=1; (index == 0) && (l<TIMER_LEVELS); l++ )
+			index = timer_cascade( w, l, TIMER_INDEX(w->now, l) );
+
+		/* Fire this tick's timers; a callback may arm or disarm
+		   others, so take them one at a time */
+		head = &w->slots[0][TIMER_INDEX(w->now, 0)];
+		w->now++;
+		while ( (t = head->next) != head )
+		{
+			timer_unlink( t );
+			w->count--;
+			t->fn( t );
+			fired++;
+		}
+	}
+	return( fired );
+}
+
+/**********************************************************************
+
+    Function    : timer_next
+    Description : get how long to sleep before the wheel needs to run
+    Inputs      : w - the wheel
+    Outputs     : milliseconds (-1 if no timer is armed)
+
+***********************************************************************/
+
+int timer_next( TimerWheel *w )
+{
+	unsigned long tick, clock = timer_clock();
+	Timer *head;
+
+	if ( w->count == 0 )
+		return( -1 );
+
+	/* The first busy level 0 slot, or else the wrap, when upper
+	   level timers cascade down */
+	for ( tick = w->now; ; tick++ )
+	{
+		head = &w->slots[0][TIMER_INDEX(tick, 0)];
+		if ( (head->next != head) || (TIMER_INDEX(tick, 0) == 0) )
+			break;
+	}
+	if ( tick*TIMER_TICK_MS <= clock )
+		return( 0 );
+	return( (int)(tick*TIMER_TICK_MS - clock) );
+}
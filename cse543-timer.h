@@ -0,0 +1,140 @@
+#ifndef CSE543_TIMER_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-timer.h
+
+   Description   : This is a hierarchical timer wheel for the server's
+                   per-session deadlines.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+
+/* Defines */
+#define TIMER_TICK_MS 100    /* wheel resolution */
+#define TIMER_BITS 6         /* slots per level is 1<<TIMER_BITS */
+#define TIMER_SLOTS (1<<TIMER_BITS)
+#define TIMER_LEVELS 4       /* 100ms, 6.4s, 7min, 7.6h per slot */
+
+/* Data Structures */
+
+/* This is one timer, kept in the slot list of the level it fits in */
+struct timer;
+typedef void (*TimerFn)( struct timer *t );
+typedef struct timer {
+	struct timer   *next;      /* slot list */
+	struct timer   *prev;
+	unsigned long   expires;   /* tick it fires on */
+	TimerFn         fn;        /* called when it fires */
+	void           *arg;       /* for the callback */
+} Timer;
+
+/* This is the wheel; each slot head is an empty timer in a ring */
+typedef struct {
+	Timer           slots[TIMER_LEVELS][TIMER_SLOTS];
+	unsigned long   now;       /* last tick processed */
+	unsigned int    count;     /* timers armed */
+} TimerWheel;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : timer_wheel_init
+    Description : set up an empty wheel at the current time
+    Inputs      : w - the wheel
+    Outputs     : none
+
+***********************************************************************/
+extern void timer_wheel_init( TimerWheel *w );
+
+/**********************************************************************
+
+    Function    : timer_init
+    Description : set up a timer that is not armed
+    Inputs      : t - the timer
+                  fn - called when it fires
+                  arg - for the callback
+    Outputs     : none
+
+***********************************************************************/
+extern void timer_init( Timer *t, TimerFn fn, void *arg );
+
+/**********************************************************************
+
+    Function    : timer_add
+    Description : arm (or re-arm) a timer, O(1)
+    Inputs      : w - the wheel
+                  t - the timer
+                  ms - milliseconds from now
+    Outputs     : none
+
+***********************************************************************/
+extern void timer_add( TimerWheel *w, Timer *t, unsigned long ms );
+
+/**********************************************************************
+
+    Function    : timer_del
+    Description : disarm a timer if it is armed, O(1)
+    Inputs      : w - the wheel
+                  t - the timer
+    Outputs     : none
+
+***********************************************************************/
+extern void timer_del( TimerWheel *w, Timer *t );
+
+/**********************************************************************
+
+    Function    : timer_pending
+    Description : check whether a timer is armed
+    Inputs      : t - the timer
+    Outputs     : 1 if armed, 0 if not
+
+***********************************************************************/
+extern int timer_pending( Timer *t );
+
+/**********************************************************************
+
+    Function    : timer_advance
+    Description : fire every timer that is due
+    Inputs      : w - the wheel
+    Outputs     : number of timers fired
+
+***********************************************************************/
+extern int timer_advance( TimerWheel *w );
+
+/**********************************************************************
+
+    Function    : timer_next
+    Description : get how long to sleep before the wheel needs to run
+    Inputs      : w - the wheel
+    Outputs     : milliseconds (-1 if no timer is armed)
+
+***********************************************************************/
+extern int timer_next( TimerWheel *w );
+
+#define CSE543_TIMER_INCLUDED
+#endif
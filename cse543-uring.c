@@ -0,0 +1,376 @@
+/**********************************************************************
+
+   File          : cse543-uring.c
+
+   Description   : This is a small io_uring wrapper.  Each thread gets
+                   its own ring with a set of registered buffers and a
+                   fixed file table, so batches of sends and writes go
+                   to the kernel in a single io_uring_enter call.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-uring.h"
+
+/* io_uring is off until enabled, and stays off after a failed setup */
+static int uring_enabled = 0;
+static __thread IoRing *thread_ring = NULL;
+static __thread int thread_ring_failed = 0;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : uring_setup
+    Description : create and map a ring, register its buffers and an
+                  empty fixed file table
+    Inputs      : r - the ring to set up
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+static int uring_setup( IoRing *r )
+{
+	struct io_uring_params p;
+	struct iovec iov[URING_NBUFS];
+	int i;
+
+	/* Create the ring */
+	memset( r, 0, sizeof(IoRing) );
+	memset( &p, 0, sizeof(p) );
+	if ( (r->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0 )
+		return( -1 );
+	r->entries = p.sq_entries;
+
+	/* Map the submission and completion rings and the entries */
+	r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ( p.features & IORING_FEAT_SINGLE_MMAP )
+		r->sq_sz = r->cq_sz = (r->sq_sz > r->cq_sz) ? r->sq_sz : r->cq_sz;
+	r->sq_ptr = mmap( NULL, r->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, 
+			  r->fd, IORING_OFF_SQ_RING );
+	if ( r->sq_ptr == MAP_FAILED )
+		goto fail;
+	if ( p.features & IORING_FEAT_SINGLE_MMAP )
+		r->cq_ptr = r->sq_ptr;
+	else if ( (r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ|PROT_WRITE, 
+				    MAP_SHARED|MAP_POPULATE, r->fd, 
+				    IORING_OFF_CQ_RING)) == MAP_FAILED )
+		goto fail;
+	r->sqes = mmap( NULL, p.sq_entries * sizeof(struct io_uring_sqe), 
+			PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, 
+			IORING_OFF_SQES );
+	if ( r->sqes == MAP_FAILED )
+		goto fail;
+	r->sq_head = (unsigned int *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned int *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+	/* Register the buffers so the kernel maps them once */
+	if ( (r->bufs = (char *)aligned_alloc(4096, (URING_NBUFS*URING_BUFSIZE + 4095) & ~4095)) == NULL )
+		goto fail;
+	for ( i=0; i<URING_NBUFS; i++ )
+	{
+		iov[i].iov_base = r->bufs + i * URING_BUFSIZE;
+		iov[i].iov_len = URING_BUFSIZE;
+	}
+	if ( syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, 
+		     iov, URING_NBUFS) != 0 )
+		goto fail;
+	r->freebufs = (URING_NBUFS == 32) ? 0xffffffffu : ((1u << URING_NBUFS) - 1);
+
+	/* And a sparse file table, filled in as descriptors are used */
+	for ( i=0; i<URING_NFILES; i++ )
+		r->files[i] = -1;
+	if ( syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES, 
+		     r->files, URING_NFILES) != 0 )
+		goto fail;
+	return( 0 );
+
+fail:
+	/* Undo whatever got set up */
+	if ( (r->sqes != NULL) && (r->sqes != MAP_FAILED) )
+		munmap( r->sqes, p.sq_entries * sizeof(struct io_uring_sqe) );
+	if ( (r->cq_ptr != NULL) && (r->cq_ptr != MAP_FAILED) && (r->cq_ptr != r->sq_ptr) )
+		munmap( r->cq_ptr, r->cq_sz );
+	if ( (r->sq_ptr != NULL) && (r->sq_ptr != MAP_FAILED) )
+		munmap( r->sq_ptr, r->sq_sz );
+	close( r->fd );
+	free( r->bufs );
+	return( -1 );
+}
+
+/**********************************************************************
+
+    Function    : uring_enable
+    Description : turn on io_uring for the calling process; each thread
+                  sets up its own ring on first use (call after any fork,
+                  registered buffers are not shared with a child)
+    Inputs      : none
+    Outputs     : 0 if the kernel supports io_uring, -1 if not
+
+***********************************************************************/
+
+int uring_enable( void )
+{
+	/* Try it out on this thread, fall back quietly if it's missing */
+	uring_enabled = 1;
+	if ( uring_thread() == NULL )
+	{
+		uring_enabled = 0;
+		warningMessage( "io_uring unavailable, using plain system calls" );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : uring_thread
+    Description : get the calling thread's ring
+    Inputs      : none
+    Outputs     : the ring, NULL if io_uring is off or unavailable
+
+***********************************************************************/
+
+IoRing *uring_thread( void )
+{
+	IoRing *r;
+
+	if ( !uring_enabled || thread_ring_failed )
+		return( NULL );
+	if ( thread_ring != NULL )
+		return( thread_ring );
+
+	/* First use on this thread */
+	if ( ((r = (IoRing *)malloc(sizeof(IoRing))) == NULL) || (uring_setup(r) != 0) )
+	{
+		free( r );
+		thread_ring_failed = 1;
+		return( NULL );
+	}
+	return( thread_ring = r );
+}
+
+/**********************************************************************
+
+    Function    : uring_buffer
+    Description : take a free registered buffer
+    Inputs      : r - the ring
+                  idx - set to the buffer index
+    Outputs     : the buffer, NULL if they are all in use
+
+***********************************************************************/
+
+char *uring_buffer( IoRing *r, int *idx )
+{
+	if ( r->freebufs == 0 )
+		return( NULL );
+	*idx = __builtin_ctz( r->freebufs );
+	r->freebufs &= ~(1u << *idx);
+	return( r->bufs + *idx * URING_BUFSIZE );
+}
+
+/**********************************************************************
+
+    Function    : uring_release
+    Description : give back a registered buffer
+    Inputs      : r - the ring
+                  idx - the buffer index
+    Outputs     : none
+
+***********************************************************************/
+
+void uring_release( IoRing *r, int idx )
+{
+	r->freebufs |= (1u << idx);
+}
+
+/**********************************************************************
+
+    Function    : uring_file
+    Description : get the fixed file slot for a descriptor, registering
+                  it if needed
+    Inputs      : r - the ring
+                  fd - the file descriptor
+                  refresh - register again even if the slot matches
+                            (the fd number may have been reused)
+    Outputs     : the slot, -1 if failure
+
+***********************************************************************/
+
+int uring_file( IoRing *r, int fd, int refresh )
+{
+	struct io_uring_files_update up;
+	int i;
+
+	/* Already registered? */
+	for ( i=0; i<URING_NFILES; i++ )
+		if ( r->files[i] == fd )
+			break;
+	if ( (i < URING_NFILES) && !refresh )
+		return( i );
+
+	/* Take over a slot (the oldest) and point it at this descriptor */
+	if ( i == URING_NFILES )
+	{
+		i = r->nextfile;
+		r->nextfile = (r->nextfile + 1) % URING_NFILES;
+	}
+	memset( &up, 0, sizeof(up) );
+	up.offset = i;
+	up.fds = (unsigned long)&fd;
+	if ( syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES_UPDATE, &up, 1) != 1 )
+		return( -1 );
+	r->files[i] = fd;
+	return( i );
+}
+
+/**********************************************************************
+
+    Function    : uring_queue
+    Description : add a request to the submission queue
+    Inputs      : r - the ring
+                  op - IORING_OP_*
+                  slot - fixed file slot
+                  addr - the data
+                  len - length of the data
+                  off - file offset
+                  bufidx - registered buffer index (fixed ops only)
+                  flags - IOSQE_* flags (IOSQE_FIXED_FILE is added)
+                  tag - returned with the completion
+    Outputs     : 0 if successful, -1 if the queue is full
+
+***********************************************************************/
+
+int uring_queue( IoRing *r, int op, int slot, void *addr, unsigned int len, 
+		 unsigned long long off, int bufidx, int flags, unsigned long long tag )
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *r->sq_tail, idx;
+
+	/* The kernel moves the head as it consumes entries */
+	if ( tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries )
+		return( -1 );
+
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset( sqe, 0, sizeof(*sqe) );
+	sqe->opcode = op;
+	sqe->flags = flags | IOSQE_FIXED_FILE;
+	sqe->fd = slot;
+	sqe->addr = (unsigned long)addr;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->buf_index = bufidx;
+	sqe->user_data = tag;
+	r->sq_array[idx] = idx;
+	__atomic_store_n( r->sq_tail, tail + 1, __ATOMIC_RELEASE );
+	r->queued++;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : uring_submit
+    Description : submit the queued requests in one system call
+    Inputs      : r - the ring
+                  wait - completions to wait for
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int uring_submit( IoRing *r, unsigned int wait )
+{
+	int ret;
+
+	do
+	{
+		ret = syscall( __NR_io_uring_enter, r->fd, r->queued, wait, 
+			       IORING_ENTER_GETEVENTS, NULL, 0 );
+	}
+	while ( (ret == -1) && (errno == EINTR) );
+	if ( ret < 0 )
+		return( -1 );
+	r->queued -= ret;
+	return( 0 );
+}
+
+/**********************************************************************
+
+    Function    : uring_discard
+    Description : drop the requests queued but not yet submitted, after
+                  a failed submit, so a later one does not send them
+    Inputs      : r - the ring
+    Outputs     : none
+
+***********************************************************************/
+
+void uring_discard( IoRing *r )
+{
+	/* A failed enter consumed none of them, the tail can go back */
+	__atomic_store_n( r->sq_tail, *r->sq_tail - r->queued, __ATOMIC_RELEASE );
+	r->queued = 0;
+}
+
+/**********************************************************************
+
+    Function    : uring_reap
+    Description : take one completion off the ring
+    Inputs      : r - the ring
+                  tag - set to the request tag
+                  res - set to the request result
+    Outputs     : 1 if a completion was taken, 0 if none is ready
+
+***********************************************************************/
+
+int uring_reap( IoRing *r, unsigned long long *tag, int *res )
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head = *r->cq_head;
+
+	if ( head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) )
+		return( 0 );
+	cqe = &r->cqes[head & *r->cq_mask];
+	*tag = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n( r->cq_head, head + 1, __ATOMIC_RELEASE );
+	return( 1 );
+}
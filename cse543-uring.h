@@ -0,0 +1,178 @@
+#ifndef CSE543_URING_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-uring.h
+
+   Description   : This is a small io_uring wrapper (raw system calls,
+                   no liburing) used to batch socket and file I/O.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Defines */
+#define URING_ENTRIES  64                  /* submission queue size */
+#define URING_NBUFS    32                  /* registered buffers per ring */
+#define URING_BUFSIZE  (8*1024+64)         /* size of each registered buffer */
+#define URING_NFILES   16                  /* fixed file table slots */
+
+/* Data Structures */
+
+/* This is one thread's ring */
+typedef struct {
+	int                   fd;           /* the ring */
+	unsigned int          entries;      /* submission queue entries */
+	unsigned int         *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int         *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe  *sqes;
+	struct io_uring_cqe  *cqes;
+	unsigned int          queued;       /* entries not yet submitted */
+	void                 *sq_ptr, *cq_ptr;
+	size_t                sq_sz, cq_sz;
+	char                 *bufs;         /* registered buffers, URING_NBUFS of them */
+	unsigned int          freebufs;     /* bitmap of free buffers */
+	int                   files[URING_NFILES];  /* fd in each fixed file slot */
+	unsigned int          nextfile;     /* next slot to recycle */
+} IoRing;
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : uring_enable
+    Description : turn on io_uring for the calling process; each thread
+                  sets up its own ring on first use (call after any fork,
+                  registered buffers are not shared with a child)
+    Inputs      : none
+    Outputs     : 0 if the kernel supports io_uring, -1 if not
+
+***********************************************************************/
+extern int uring_enable( void );
+
+/**********************************************************************
+
+    Function    : uring_thread
+    Description : get the calling thread's ring
+    Inputs      : none
+    Outputs     : the ring, NULL if io_uring is off or unavailable
+
+***********************************************************************/
+extern IoRing *uring_thread( void );
+
+/**********************************************************************
+
+    Function    : uring_buffer
+    Description : take a free registered buffer
+    Inputs      : r - the ring
+                  idx - set to the buffer index
+    Outputs     : the buffer, NULL if they are all in use
+
+***********************************************************************/
+extern char *uring_buffer( IoRing *r, int *idx );
+
+/**********************************************************************
+
+    Function    : uring_release
+    Description : give back a registered buffer
+    Inputs      : r - the ring
+                  idx - the buffer index
+    Outputs     : none
+
+***********************************************************************/
+extern void uring_release( IoRing *r, int idx );
+
+/**********************************************************************
+
+    Function    : uring_file
+    Description : get the fixed file slot for a descriptor, registering
+                  it if needed
+    Inputs      : r - the ring
+                  fd - the file descriptor
+                  refresh - register again even if the slot matches
+                            (the fd number may have been reused)
+    Outputs     : the slot, -1 if failure
+
+***********************************************************************/
+extern int uring_file( IoRing *r, int fd, int refresh );
+
+/**********************************************************************
+
+    Function    : uring_queue
+    Description : add a request to the submission queue
+    Inputs      : r - the ring
+                  op - IORING_OP_*
+                  slot - fixed file slot
+                  addr - the data
+                  len - length of the data
+                  off - file offset
+                  bufidx - registered buffer index (fixed ops only)
+                  flags - IOSQE_* flags (IOSQE_FIXED_FILE is added)
+                  tag - returned with the completion
+    Outputs     : 0 if successful, -1 if the queue is full
+
+***********************************************************************/
+extern int uring_queue( IoRing *r, int op, int slot, void *addr, unsigned int len, 
+			unsigned long long off, int bufidx, int flags, 
+			unsigned long long tag );
+
+/**********************************************************************
+
+    Function    : uring_submit
+    Description : submit the queued requests in one system call
+    Inputs      : r - the ring
+                  wait - completions to wait for
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int uring_submit( IoRing *r, unsigned int wait );
+
+/**********************************************************************
+
+    Function    : uring_discard
+    Description : drop the requests queued but not yet submitted, after
+                  a failed submit, so a later one does not send them
+    Inputs      : r - the ring
+    Outputs     : none
+
+***********************************************************************/
+extern void uring_discard( IoRing *r );
+
+/**********************************************************************
+
+    Function    : uring_reap
+    Description : take one completion off the ring
+    Inputs      : r - the ring
+                  tag - set to the request tag
+                  res - set to the request result
+    Outputs     : 1 if a completion was taken, 0 if none is ready
+
+***********************************************************************/
+extern int uring_reap( IoRing *r, unsigned long long *tag, int *res );
+
+#define CSE543_URING_INCLUDED
+#endif
@@ -38,6 +38,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
 #include <string.h>
 
 #include "cse543-util.h"
@@ -159,3 +161,40 @@ unsigned int buffer_from_file(char *filepath, unsigned char **buf)
   
 	return filesize;
 }
+
+/**********************************************************************
+
+    Function    : buffer_to_file
+    Description : writes a buffer to a file, replacing it whole so a
+                  reader never sees part of it
+    Inputs      : filepath - location of file
+                  buf - the data
+                  len - its length
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int buffer_to_file(char *filepath, const unsigned char *buf, unsigned int len)
+{
+	char tmppath[PATH_MAX];
+	FILE *fptr;
+	int fd, ok;
+
+	/* Write it beside the file, then move it over the file; only we
+	   may read it, it may hold a secret */
+	if ( snprintf(tmppath, sizeof(tmppath), "%s.tmp", filepath) >= (int)sizeof(tmppath) )
+		return -1;
+	if ( (fd = open(tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0600)) == -1 )
+		return -1;
+	if ( (fptr = fdopen(fd, "w")) == NULL ) {
+		close( fd );
+		unlink( tmppath );
+		return -1;
+	}
+	ok = (fwrite(buf, 1, len, fptr) == len);
+	if ( (fclose(fptr) != 0) || !ok || (rename(tmppath, filepath) != 0) ) {
+		unlink( tmppath );
+		return -1;
+	}
+	return 0;
+}
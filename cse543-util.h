@@ -76,3 +76,16 @@ extern void printBuffer( char *msg, char *buf, int len );
 
 ***********************************************************************/
 extern unsigned int buffer_from_file(char *filepath, unsigned char **buf);
+
+/**********************************************************************
+
+    Function    : buffer_to_file
+    Description : writes a buffer to a file, replacing it whole so a
+                  reader never sees part of it
+    Inputs      : filepath - location of file
+                  buf - the data
+                  len - its length
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int buffer_to_file(char *filepath, const unsigned char *buf, unsigned int len);
@@ -0,0 +1,368 @@
+/**********************************************************************
+
+   File          : cse543-wire.c
+
+   Description   : This is the wire codec.  The routines for each
+                   message are generated from its field table; decoding
+                   checks every length against the payload and the
+                   field's bound, and leaves byte fields in place, so
+                   it allocates nothing and never reads past the frame.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+
+/* Project Include Files */
+#include "cse543-util.h"
+#include "cse543-proto.h"
+#include "cse543-wire.h"
+
+/* Defines */
+#define WIRE_TEST_FUZZ 100000      /* corrupted payloads decoded by test_wire */
+#define WIRE_TEST_DECODES 1000000  /* decodes timed by test_wire */
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : wire_put32
+    Description : store a 32-bit value little-endian
+    Inputs      : p - where to put it
+                  v - the value
+    Outputs     : none
+
+***********************************************************************/
+
+static inline void wire_put32( unsigned char *p, uint32_t v )
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+/**********************************************************************
+
+    Function    : wire_get32
+    Description : load a little-endian 32-bit value
+    Inputs      : p - where it is
+    Outputs     : the value
+
+***********************************************************************/
+
+static inline uint32_t wire_get32( const unsigned char *p )
+{
+	return( (uint32_t)p[0] | ((uint32_t)p[1] << 8) | 
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24) );
+}
+
+/**********************************************************************
+
+    Function    : wire_put64
+    Description : store a 64-bit value little-endian
+    Inputs      : p - where to put it
+                  v - the value
+    Outputs     : none
+
+***********************************************************************/
+
+static inline void wire_put64( unsigned char *p, uint64_t v )
+{
+	wire_put32( p, (uint32_t)v );
+	wire_put32( p+4, (uint32_t)(v >> 32) );
+}
+
+/**********************************************************************
+
+    Function    : wire_get64
+    Description : load a little-endian 64-bit value
+    Inputs      : p - where it is
+    Outputs     : the value
+
+***********************************************************************/
+
+static inline uint64_t wire_get64( const unsigned char *p )
+{
+	return( (uint64_t)wire_get32(p) | ((uint64_t)wire_get32(p+4) << 32) );
+}
+
+/**********************************************************************
+
+    Function    : wire_put
+    Description : append one field
+    Inputs      : buf - the payload
+                  size - its size
+                  off - (in/out) where the field goes
+                  tag - the field tag
+                  val - the field bytes
+                  len - how many
+    Outputs     : 0 if successful, -1 if it does not fit
+
+***********************************************************************/
+
+static int wire_put( unsigned char *buf, unsigned int size, unsigned int *off, 
+		     unsigned char tag, const void *val, uint32_t len )
+{
+	if ( (size-*off < WIRE_TLV_HDR) || (len > size-*off-WIRE_TLV_HDR) )
+		return( -1 );
+	buf[*off] = tag;
+	wire_put32( buf+*off+1, len );
+	if ( len > 0 )
+		memcpy( buf+*off+WIRE_TLV_HDR, val, len );
+	*off += WIRE_TLV_HDR + len;
+	return( 0 );
+}
+
+/* Encode one field of m into b, by kind */
+#define WIRE_PUT_U32(tag, name, max, req) \
+	if ( (req) || (m->name != 0) ) \
+	{ \
+		unsigned char word[sizeof(uint32_t)]; \
+		wire_put32( word, m->name ); \
+		if ( wire_put(b, size, &off, tag, word, sizeof(word)) != 0 ) \
+			return( -1 ); \
+	}
+#define WIRE_PUT_U64(tag, name, max, req) \
+	if ( (req) || (m->name != 0) ) \
+	{ \
+		unsigned char word[sizeof(uint64_t)]; \
+		wire_put64( word, m->name ); \
+		if ( wire_put(b, size, &off, tag, word, sizeof(word)) != 0 ) \
+			return( -1 ); \
+	}
+#define WIRE_PUT_BYTES(tag, name, max, req) \
+	if ( (m->name##_len > (max)) || \
+	     (((req) || (m->name##_len > 0)) && \
+	      (wire_put(b, size, &off, tag, m->name, m->name##_len) != 0)) ) \
+		return( -1 );
+#define WIRE_PUT_FIXED(tag, name, max, req) \
+	if ( (m->name##_len != (max)) && ((req) || (m->name##_len > 0)) ) \
+		return( -1 ); \
+	WIRE_PUT_BYTES( tag, name, max, req )
+#define WIRE_PUT(tag, name, kind, max, req) WIRE_PUT_##kind( tag, name, max, req )
+
+/* Decode one field at p (flen bytes) into m, by kind */
+#define WIRE_GET_U32(name, max) \
+	if ( flen != sizeof(uint32_t) ) \
+		return( -1 ); \
+	m->name = wire_get32( p );
+#define WIRE_GET_U64(name, max) \
+	if ( flen != sizeof(uint64_t) ) \
+		return( -1 ); \
+	m->name = wire_get64( p );
+#define WIRE_GET_BYTES(name, max) \
+	if ( flen > (max) ) \
+		return( -1 ); \
+	m->name = p; \
+	m->name##_len = flen;
+#define WIRE_GET_FIXED(name, max) \
+	if ( flen != (max) ) \
+		return( -1 ); \
+	m->name = p; \
+	m->name##_len = flen;
+#define WIRE_GET(tag, name, kind, max, req) \
+	case tag: \
+		if ( seen & (1u << (tag)) ) \
+			return( -1 ); \
+		WIRE_GET_##kind( name, max ) \
+		seen |= 1u << (tag); \
+		break;
+#define WIRE_REQUIRED(tag, name, kind, max, req) | ((req) ? (1u << (tag)) : 0u)
+
+/* The encode and decode routines for one message */
+#define WIRE_ROUTINES(type, name, id, fields) \
+int wire_encode_##name( const type *m, char *buf, unsigned int size ) \
+{ \
+	unsigned char *b = (unsigned char *)buf; \
+	unsigned int off = WIRE_PREAMBLE; \
+	\
+	if ( size < WIRE_PREAMBLE ) \
+		return( -1 ); \
+	b[0] = WIRE_VERSION; \
+	b[1] = id; \
+	fields(WIRE_PUT) \
+	return( (int)off ); \
+} \
+\
+int wire_decode_##name( const char *buf, unsigned int len, type *m ) \
+{ \
+	const unsigned char *p = (const unsigned char *)buf, *end = p + len; \
+	uint32_t seen = 0, flen; \
+	\
+	memset( m, 0, sizeof(type) ); \
+	if ( (len < WIRE_PREAMBLE) || (p[0] != WIRE_VERSION) || (p[1] != id) ) \
+		return( -1 ); \
+	for ( p+=WIRE_PREAMBLE; p<end; p+=flen ) \
+	{ \
+		if ( end-p < WIRE_TLV_HDR ) \
+			return( -1 ); \
+		flen = wire_get32( p+1 ); \
+		p += WIRE_TLV_HDR; \
+		if ( flen > (uint32_t)(end-p) ) \
+			return( -1 ); \
+		switch ( p[-WIRE_TLV_HDR] ) \
+		{ \
+			fields(WIRE_GET) \
+		default: \
+			break; \
+		} \
+	} \
+	return( ((seen & (0u fields(WIRE_REQUIRED))) == (0u fields(WIRE_REQUIRED))) ? 0 : -1 ); \
+}
+
+WIRE_MESSAGES(WIRE_ROUTINES)
+
+/**********************************************************************
+
+    Function    : test_wire
+    Description : round trip and fuzz the codec, seal and unseal keys
+                  through it, and time decoding
+    Inputs      : count - key seals, 0 for the default
+                  privkey - the server private key
+                  pubkey - the server public key
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+
+int test_wire( int count, EVP_PKEY *privkey, EVP_PKEY *pubkey )
+{
+	char payload[MAX_BLOCK_SIZE], fuzzed[MAX_BLOCK_SIZE], flight[MAX_BLOCK_SIZE];
+	unsigned char symkey[KEYSIZE], *key;
+	WireCommand cmd, back;
+	WireHello hello;
+	WireFast fast, fback;
+	struct timespec start, end;
+	int i, n, len, sealed, accepted = 0, failed = 0, ret = 0;
+	double secs;
+
+	count = (count > 0) ? count : WIRE_TEST_COUNT;
+	printf( "*** Test wire codec, %d key seals. ***\n", count );
+
+	/* Round trip, and every truncation (but the one that leaves out just
+	   the optional size) or the wrong message rejected */
+	memset( &cmd, 0, sizeof(cmd) );
+	cmd.cmd = CMD_CREATE;
+	cmd.type = TYP_DATA_SHARED;
+	cmd.fname = (const unsigned char *)"wire-test.txt";
+	cmd.fname_len = strlen( (char *)cmd.fname );
+	cmd.size = 0x123456789aUL;
+	if ( ((len = wire_encode_command(&cmd, payload, sizeof(payload))) <= 0) ||
+	     (wire_decode_command(payload, len, &back) != 0) ||
+	     (back.cmd != cmd.cmd) || (back.type != cmd.type) || (back.size != cmd.size) || 
+	     (back.fname_len != cmd.fname_len) || 
+	     (memcmp(back.fname, cmd.fname, cmd.fname_len) != 0) ||
+	     (wire_decode_hello(payload, len, &hello) == 0) ||
+	     (wire_encode_command(&cmd, payload, len-1) != -1) )
+	{
+		errorMessage( "wire test round trip failed\n" );
+		return( -1 );
+	}
+	for ( i=0; i<len; i++ )
+		if ( (wire_decode_command(payload, i, &back) == 0) && 
+		     (i != len-WIRE_TLV_HDR-(int)sizeof(uint64_t)) )
+		{
+			errorMessage( "wire test accepted a truncated payload\n" );
+			return( -1 );
+		}
+
+	/* Corrupt a byte at a time; whatever decodes must lie inside */
+	srand( 543 );
+	for ( i=0; i<WIRE_TEST_FUZZ; i++ )
+	{
+		memcpy( fuzzed, payload, len );
+		fuzzed[rand() % len] ^= (char)(1 + rand() % 255);
+		if ( wire_decode_command(fuzzed, len, &back) != 0 )
+			continue;
+		accepted++;
+		if ( (back.fname < (unsigned char *)fuzzed) || 
+		     (back.fname+back.fname_len > (unsigned char *)fuzzed+len) )
+		{
+			errorMessage( "wire test decoded outside the payload\n" );
+			return( -1 );
+		}
+	}
+	printf( "Round trip ok, %d byte command, %d of %d corrupted payloads decoded (in bounds)\n", 
+		len, accepted, WIRE_TEST_FUZZ );
+
+	/* Every sealed key must come back whatever bytes the RSA output has */
+	for ( i=0; i<count; i++ )
+	{
+		key = NULL;
+		if ( (generate_pseudorandom_bytes(symkey, KEYSIZE) != 0) ||
+		     ((sealed = seal_symmetric_key(symkey, KEYSIZE, pubkey, payload)) <= 0) ||
+		     (unseal_symmetric_key(payload, sealed, privkey, &key) != 0) ||
+		     (memcmp(key, symkey, KEYSIZE) != 0) )
+			failed++;
+		free( key );
+	}
+	printf( "Sealed keys: %d of %d unsealed\n", count-failed, count );
+	if ( failed > 0 )
+		ret = -1;
+
+	/* The one round trip flight carries a sealed key and a command */
+	key = NULL;
+	memset( &fast, 0, sizeof(fast) );
+	fast.blocksize = BLOCKSIZE;
+	fast.sealed = (const unsigned char *)fuzzed;
+	fast.command = (const unsigned char *)payload;
+	n = -1;
+	if ( (generate_pseudorandom_bytes(symkey, KEYSIZE) == 0) &&
+	     ((sealed = seal_symmetric_key(symkey, KEYSIZE, pubkey, fuzzed)) > 0) &&
+	     ((len = wire_encode_command(&cmd, payload, sizeof(payload))) > 0) )
+	{
+		fast.sealed_len = sealed;
+		fast.command_len = len;
+		n = wire_encode_fast( &fast, flight, sizeof(flight) );
+	}
+	if ( (n <= 0) || (wire_decode_fast(flight, n, &fback) != 0) || (fback.cookie_len != 0) ||
+	     (unseal_symmetric_key((char *)fback.sealed, fback.sealed_len, privkey, &key) != 0) ||
+	     (memcmp(key, symkey, KEYSIZE) != 0) ||
+	     (wire_decode_command((char *)fback.command, fback.command_len, &back) != 0) ||
+	     (back.size != cmd.size) )
+	{
+		errorMessage( "wire test one round trip flight failed\n" );
+		ret = -1;
+	}
+	else
+		printf( "One round trip flight ok, %d bytes\n", n );
+	free( key );
+
+	/* Decoding cost on the server's path */
+	len = wire_encode_command( &cmd, payload, sizeof(payload) );
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	for ( i=0, n=0; i<WIRE_TEST_DECODES; i++ )
+		n += (wire_decode_command(payload, len, &back) == 0);
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	secs = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+	printf( "Decode: %.1f ns per command (%d decoded)\n", 
+		secs*1e9/WIRE_TEST_DECODES, n );
+
+	return( ret );
+}
@@ -0,0 +1,209 @@
+#ifndef CSE543_WIRE_INCLUDED
+
+/**********************************************************************
+
+   File          : cse543-wire.h
+
+   Description   : This is the wire codec for the handshake and command
+                   payloads: a version and message byte, then tagged
+                   fields with fixed-width little-endian lengths.  Each
+                   message is a field table below, from which the
+                   structures and the encode/decode routines are
+                   generated.  Include after cse543-proto.h.
+
+***********************************************************************/
+/**********************************************************************
+Copyright (c) 2006-2018 The Pennsylvania State University
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of The Pennsylvania State University nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+/* Include Files */
+#include <stdint.h>
+#include <openssl/evp.h>
+
+/* Defines */
+#define WIRE_VERSION 1       /* first byte of every payload */
+#define WIRE_PREAMBLE 2      /* version and message bytes */
+#define WIRE_TLV_HDR 5       /* one byte tag, four byte little-endian length */
+#define WIRE_SIZE(fields, bytes) (WIRE_PREAMBLE+(fields)*WIRE_TLV_HDR+(bytes))
+#define WIRE_NAME_MAX 0xffff /* longest file name (rm_cmd len) */
+#define WIRE_TEST_COUNT 256  /* key seals checked by test_wire */
+
+/* Field tables: X( tag, name, kind, max, required ).  A U32 is four
+   bytes, a U64 eight; BYTES are up to max bytes, FIXED exactly max, both decoded
+   as a pointer into the payload (name) and a length (name_len).
+   Optional fields that are zero or empty are left out.
+   Tags are below 32; a decoder skips tags it does not know, so a
+   later version may add fields without a new version byte. */
+
+/* CLIENT_INIT_EXCHANGE: proposed block size, any cookie, the key
+   exchanges offered (KEX_*, RSA if absent), an X25519 share and the
+   cipher suites offered fastest first (SUITE_DEFAULT if absent) */
+#define WIRE_HELLO_FIELDS(X) \
+	X( 1, blocksize, U32,   4,              1 ) \
+	X( 2, cookie,    FIXED, COOKIE_SIZE,    0 ) \
+	X( 3, kex,       U32,   4,              0 ) \
+	X( 4, share,     FIXED, KEX_SHARE_SIZE, 0 ) \
+	X( 5, suites,    BYTES, SUITE_MAX,      0 )
+
+/* SERVER_INIT_RESPONSE: agreed block size, public key (PEM); for
+   X25519 the exchange chosen, the server share, its expiry and the
+   signature over them; the cipher suite chosen */
+#define WIRE_RESPONSE_FIELDS(X) \
+	X( 1, blocksize, U32,   4,              1 ) \
+	X( 2, pubkey,    BYTES, MAX_BLOCK_SIZE, 1 ) \
+	X( 3, kex,       U32,   4,              0 ) \
+	X( 4, share,     FIXED, KEX_SHARE_SIZE, 0 ) \
+	X( 5, expiry,    U32,   4,              0 ) \
+	X( 6, sig,       BYTES, KEX_SIG_MAX,    0 ) \
+	X( 7, suite,     U32,   4,              0 )
+
+/* SERVER_COOKIE: the cookie to reconnect with */
+#define WIRE_COOKIE_FIELDS(X) \
+	X( 1, cookie,    FIXED, COOKIE_SIZE,    1 )
+
+/* SERVER_BUSY: milliseconds to wait */
+#define WIRE_BUSY_FIELDS(X) \
+	X( 1, retry,     U32,   4,              1 )
+
+/* CLIENT_INIT_ACK: the RSA-sealed session key */
+#define WIRE_SEALED_FIELDS(X) \
+	X( 1, ek,        BYTES, MAX_BLOCK_SIZE, 1 ) \
+	X( 2, iv,        FIXED, IVSIZE,         1 ) \
+	X( 3, key,       BYTES, MAX_BLOCK_SIZE, 1 )
+
+/* FILE_XFER_INIT: the command, file name and file size (0 if unknown) */
+#define WIRE_COMMAND_FIELDS(X) \
+	X( 1, cmd,       U32,   4,              1 ) \
+	X( 2, type,      U32,   4,              1 ) \
+	X( 3, fname,     BYTES, WIRE_NAME_MAX,  1 ) \
+	X( 4, size,      U64,   8,              0 )
+
+/* CLIENT_FAST_INIT: the hello, the sealed key (a CLIENT_INIT_ACK
+   payload), the command (a FILE_XFER_INIT payload) and the cipher
+   suite the blocks behind them are sealed with, the client's choice */
+#define WIRE_FAST_FIELDS(X) \
+	X( 1, blocksize, U32,   4,              1 ) \
+	X( 2, cookie,    FIXED, COOKIE_SIZE,    0 ) \
+	X( 3, sealed,    BYTES, MAX_BLOCK_SIZE, 1 ) \
+	X( 4, command,   BYTES, MAX_BLOCK_SIZE, 1 ) \
+	X( 5, suite,     U32,   4,              0 )
+
+/* CLIENT_RESUME: the hello, a ticket from an earlier session, the
+   client's nonce for the resumed key and the suites it offers */
+#define WIRE_RESUME_FIELDS(X) \
+	X( 1, blocksize, U32,   4,              1 ) \
+	X( 2, cookie,    FIXED, COOKIE_SIZE,    0 ) \
+	X( 3, ticket,    FIXED, TICKET_SIZE,    1 ) \
+	X( 4, nonce,     FIXED, RESUME_NONCE_SIZE, 1 ) \
+	X( 5, suites,    BYTES, SUITE_MAX,      0 )
+
+/* SERVER_INIT_ACK to a CLIENT_RESUME: agreed block size, the server's
+   nonce, the ack encrypted under the resumed key and the suite chosen */
+#define WIRE_RESUMED_FIELDS(X) \
+	X( 1, blocksize, U32,   4,              1 ) \
+	X( 2, nonce,     FIXED, RESUME_NONCE_SIZE, 1 ) \
+	X( 3, proof,     BYTES, MAX_BLOCK_SIZE, 1 ) \
+	X( 4, suite,     U32,   4,              0 )
+
+/* SERVER_TICKET (encrypted under the session key): seconds the ticket
+   is good for, the ticket and the secret sealed in it */
+#define WIRE_TICKET_FIELDS(X) \
+	X( 1, lifetime,  U32,   4,              1 ) \
+	X( 2, ticket,    FIXED, TICKET_SIZE,    1 ) \
+	X( 3, secret,    FIXED, KEYSIZE,        1 )
+
+/* A SERVER_TICKET, the payload above encrypted (IV, tag, ciphertext) */
+#define WIRE_TICKET_SEALED (IVSIZE+TAGSIZE+WIRE_SIZE(3, sizeof(uint32_t)+TICKET_SIZE+KEYSIZE))
+
+/* Messages: M( structure, routine suffix, message byte, field table ) */
+#define WIRE_MESSAGES(M) \
+	M( WireHello,    hello,    1, WIRE_HELLO_FIELDS ) \
+	M( WireResponse, response, 2, WIRE_RESPONSE_FIELDS ) \
+	M( WireCookie,   cookie,   3, WIRE_COOKIE_FIELDS ) \
+	M( WireBusy,     busy,     4, WIRE_BUSY_FIELDS ) \
+	M( WireSealed,   sealed,   5, WIRE_SEALED_FIELDS ) \
+	M( WireCommand,  command,  6, WIRE_COMMAND_FIELDS ) \
+	M( WireFast,     fast,     7, WIRE_FAST_FIELDS ) \
+	M( WireResume,   resume,   8, WIRE_RESUME_FIELDS ) \
+	M( WireResumed,  resumed,  9, WIRE_RESUMED_FIELDS ) \
+	M( WireTicket,   ticket,  10, WIRE_TICKET_FIELDS )
+
+/* Data Structures */
+
+/* One structure per message, a member (or pointer and length) per field */
+#define WIRE_MEMBER_U32(name)   uint32_t name;
+#define WIRE_MEMBER_U64(name)   uint64_t name;
+#define WIRE_MEMBER_BYTES(name) const unsigned char *name; uint32_t name##_len;
+#define WIRE_MEMBER_FIXED(name) WIRE_MEMBER_BYTES(name)
+#define WIRE_MEMBER(tag, name, kind, max, req) WIRE_MEMBER_##kind(name)
+#define WIRE_STRUCT(type, name, id, fields) \
+	typedef struct { fields(WIRE_MEMBER) } type;
+WIRE_MESSAGES(WIRE_STRUCT)
+
+/* Functional Prototypes */
+
+/**********************************************************************
+
+    Function    : wire_encode_<message>
+    Description : encode a message; optional fields with no bytes are
+                  left out
+    Inputs      : m - the message
+                  buf - buffer for the payload
+                  size - its size
+    Outputs     : payload length if successful, -1 if a field is too
+                  long or the buffer too small
+
+***********************************************************************/
+
+/**********************************************************************
+
+    Function    : wire_decode_<message>
+    Description : decode and bounds check a payload without copying;
+                  byte fields point into buf
+    Inputs      : buf - the payload
+                  len - its length
+                  m - (out) the message
+    Outputs     : 0 if successful, -1 if the version, message byte or
+                  any field is wrong, or a required field is missing
+
+***********************************************************************/
+
+#define WIRE_PROTOTYPES(type, name, id, fields) \
+	extern int wire_encode_##name( const type *m, char *buf, unsigned int size ); \
+	extern int wire_decode_##name( const char *buf, unsigned int len, type *m );
+WIRE_MESSAGES(WIRE_PROTOTYPES)
+
+/**********************************************************************
+
+    Function    : test_wire
+    Description : round trip and fuzz the codec, seal and unseal keys
+                  through it, and time decoding
+    Inputs      : count - key seals, 0 for the default
+                  privkey - the server private key
+                  pubkey - the server public key
+    Outputs     : 0 if successful, -1 if failure
+
+***********************************************************************/
+extern int test_wire( int count, EVP_PKEY *privkey, EVP_PKEY *pubkey );
+
+#define CSE543_WIRE_INCLUDED
+#endif